@@ -34,6 +34,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
  *
  *****************************************************************************/
 
+#include <atomic>
+#include <mutex>
+
 #include "qcommon/q_shared.h"
 #include "l_utils.h"
 #include "l_memory.h"
@@ -89,6 +92,115 @@ int numportalcacheupdates;
 int routingcachesize;
 int max_routingcachesize;
 
+/*
+
+  routing cache memory:
+  caches are carved out of large blocks instead of being allocated one by
+  one. all the area caches of a cluster have the same size and so do all
+  portal caches, so a freed cache goes on the free list of its cluster
+  (portal caches use the list of cluster 0) and the next cache of that
+  cluster reuses it. once the blocks add up to max_routingcachesize no new
+  blocks are allocated and the oldest cache of the same cluster is
+  recycled instead.
+
+  routing cache index:
+  every cache is also stored in an open addressing hash table keyed on
+  type, cluster, area and travel flags. lookups only read the table and
+  never lock, new caches are added with a compare and swap. caches are only
+  removed from the table outside of lookups.
+
+*/
+
+#define ROUTINGCACHE_ALIGN(x)		(((x) + 7) & ~7)
+#define ROUTINGCACHE_BLOCKSIZE		(256 * 1024)
+#define ROUTINGCACHE_MINHASHSIZE	1024
+
+typedef struct aas_routingcacheblock_s
+{
+	struct aas_routingcacheblock_s *next;
+	int size;									//bytes available after the header
+	int used;									//bytes handed out
+} aas_routingcacheblock_t;
+
+#define ROUTINGCACHE_BLOCKHEADER	ROUTINGCACHE_ALIGN((int) sizeof(aas_routingcacheblock_t))
+
+typedef struct aas_routingstats_s
+{
+	int lookups;								//area and portal cache lookups
+	int hits;									//lookups that found an existing cache
+	int probes;									//hash table slots looked at
+	int areacreated;							//area caches calculated
+	int portalcreated;							//portal caches calculated
+	int reused;									//caches allocated from a free list
+	int recycled;								//caches evicted to make room for a new one
+	int loaded;									//caches read from the route cache file
+	int blocks;									//number of blocks allocated
+	int warmups;								//frames routing cache was filled in on the worker pool
+	int warmed;									//routing targets filled in on the worker pool
+} aas_routingstats_t;
+
+static aas_routingcacheblock_t *routingcacheblocks;
+static aas_routingcache_t **freeroutingcache;	//free caches per cluster, portal caches in 0
+static int routingarenasize;					//bytes handed out from the blocks
+static int routingfreesize;						//bytes on the free lists
+static std::atomic<int> numroutingcache;
+static int routingblocksize;					//bytes in all the blocks
+static int routingcachechanged;					//caches were calculated since the route cache was read
+static int routingareadisabled;					//an area was disabled on this map, the caches may route around it
+static std::atomic<aas_routingcache_t *> *routingcachehash;
+static int routingcachehashsize;
+static aas_routingstats_t routingstats;
+
+/*
+
+  routing cache warmup:
+  the goal areas bots route to are remembered as routing targets. at the
+  start of a frame the targets without routing cache are handed to the
+  worker pool and their cache is calculated in parallel, so the routing
+  queries the bots make during the frame find it ready.
+
+  while the workers run every thread has its own routing update fields,
+  new caches only come from the free lists and the last block and nothing
+  is evicted. a new cache is only added to the hash table once it's
+  calculated and is linked into the lists and the time list afterwards on
+  the main thread. when there's no room for a new cache it is calculated
+  into scratch memory of the thread and not kept.
+
+  the cache contents only depend on the cluster, area and travel flags, so
+  routing results are the same whether the cache was warmed up or not.
+
+*/
+
+#define MAX_ROUTINGTHREADS			32
+#define MAX_ROUTINGTARGETS			1024
+
+typedef struct aas_routingthread_s
+{
+	aas_routingupdate_t *areaupdate;
+	aas_routingupdate_t *portalupdate;
+	aas_routingcache_t *areascratch;			//used when a new area cache can't be kept
+	aas_routingcache_t *portalscratch;			//used when a new portal cache can't be kept
+	aas_routingcache_t *newcache;				//caches to link in after the warmup
+	aas_routingstats_t stats;
+} aas_routingthread_t;
+
+typedef struct aas_routingtarget_s
+{
+	int areanum;
+	int travelflags;
+} aas_routingtarget_t;
+
+static aas_routingthread_t *routingthreads;
+static int numroutingthreads;
+static aas_routingtarget_t routingtargets[MAX_ROUTINGTARGETS];
+static int routingtargethash[MAX_ROUTINGTARGETS * 2];	//target index + 1, 0 if empty
+static int numroutingtargets;
+static int routingwarmup[MAX_ROUTINGTARGETS];	//targets to warm up this frame
+static int routingrecordtargets;				//remember the goal areas bots route to
+static int routingwarmuplimit;					//number of caches the hash table can take during the warmup
+static std::atomic<bool> routingwarmupfull;
+static std::mutex routingwarmuplock;			//guards the free lists and blocks during the warmup
+
 //===========================================================================
 //
 // Parameter:			-
@@ -104,6 +216,33 @@ void AAS_RoutingInfo(void)
 } //end of the function AAS_RoutingInfo
 #endif //ROUTING_DEBUG
 //===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_RoutingStats(void)
+{
+	if (!aasworld.loaded || !routingcachehash)
+	{
+		botimport.Print(PRT_MESSAGE, "no routing cache\n");
+		return;
+	} //end if
+	botimport.Print(PRT_MESSAGE, "%d routing cache lookups, %d hits (%.1f%%), %.2f probes per lookup\n",
+			routingstats.lookups, routingstats.hits,
+			routingstats.lookups ? routingstats.hits * 100.0f / routingstats.lookups : 0.0f,
+			routingstats.lookups ? (float) routingstats.probes / routingstats.lookups : 0.0f);
+	botimport.Print(PRT_MESSAGE, "%d area cache and %d portal cache calculated, %d read from maps/%s.rcd\n",
+			routingstats.areacreated, routingstats.portalcreated, routingstats.loaded, aasworld.mapname);
+	botimport.Print(PRT_MESSAGE, "%d reused from free lists, %d recycled to stay within %d bytes\n",
+			routingstats.reused, routingstats.recycled, max_routingcachesize);
+	botimport.Print(PRT_MESSAGE, "%d caches using %d bytes, %d bytes free, %d of %d bytes in %d blocks used\n",
+			numroutingcache.load(), routingcachesize, routingfreesize, routingarenasize, routingblocksize, routingstats.blocks);
+	botimport.Print(PRT_MESSAGE, "%d hash slots\n", routingcachehashsize);
+	botimport.Print(PRT_MESSAGE, "%d routing targets, %d warmed up on worker threads in %d frames\n",
+			numroutingtargets, routingstats.warmed, routingstats.warmups);
+} //end of the function AAS_RoutingStats
+//===========================================================================
 // returns the number of the area in the cluster
 // assumes the given area is in the given cluster or a portal of the cluster
 //
@@ -238,11 +377,224 @@ void AAS_LinkCache(aas_routingcache_t *cache)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
+static QINLINE int AAS_RoutingCacheClass(aas_routingcache_t *cache)
+{
+	if (cache->type == CACHETYPE_PORTAL) return 0;
+	return cache->cluster;
+} //end of the function AAS_RoutingCacheClass
+//===========================================================================
+// portal caches are found on area and travel flags only
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static QINLINE unsigned int AAS_RoutingCacheHash(int type, int cluster, int areanum, int travelflags)
+{
+	unsigned int hash;
+
+	hash = (unsigned int) areanum * 0x9E3779B1u;
+	hash ^= (unsigned int) travelflags * 0x85EBCA77u;
+	if (type == CACHETYPE_AREA) hash ^= (unsigned int) cluster * 0xC2B2AE3Du;
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	hash ^= hash >> 13;
+	return hash;
+} //end of the function AAS_RoutingCacheHash
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static QINLINE unsigned int AAS_RoutingCacheHashForCache(aas_routingcache_t *cache)
+{
+	return AAS_RoutingCacheHash(cache->type, cache->cluster, cache->areanum, cache->travelflags);
+} //end of the function AAS_RoutingCacheHashForCache
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static QINLINE int AAS_RoutingCacheMatches(aas_routingcache_t *cache, int type, int cluster, int areanum, int travelflags)
+{
+	if (cache->type != type) return qfalse;
+	if (cache->areanum != areanum) return qfalse;
+	if (cache->travelflags != travelflags) return qfalse;
+	if (type == CACHETYPE_AREA && cache->cluster != cluster) return qfalse;
+	return qtrue;
+} //end of the function AAS_RoutingCacheMatches
+//===========================================================================
+// returns the cache with the given key or NULL if not cached
+//
+// Parameter:			stats		: counts the probes, can be NULL
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_FindRoutingCache(aas_routingstats_t *stats, int type, int cluster, int areanum, int travelflags)
+{
+	int i, mask;
+	aas_routingcache_t *cache;
+
+	mask = routingcachehashsize - 1;
+	i = AAS_RoutingCacheHash(type, cluster, areanum, travelflags) & mask;
+	for (;; i = (i + 1) & mask)
+	{
+		if (stats) stats->probes++;
+		cache = routingcachehash[i].load(std::memory_order_acquire);
+		if (!cache) return NULL;
+		if (AAS_RoutingCacheMatches(cache, type, cluster, areanum, travelflags)) return cache;
+	} //end for
+} //end of the function AAS_FindRoutingCache
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_InsertRoutingCacheHash(aas_routingcache_t *cache)
+{
+	int i, mask;
+	aas_routingcache_t *empty;
+
+	mask = routingcachehashsize - 1;
+	i = AAS_RoutingCacheHashForCache(cache) & mask;
+	for (;; i = (i + 1) & mask)
+	{
+		empty = NULL;
+		if (routingcachehash[i].compare_exchange_strong(empty, cache, std::memory_order_release)) break;
+	} //end for
+} //end of the function AAS_InsertRoutingCacheHash
+//===========================================================================
+// adds a calculated cache during the warmup, if another thread already
+// added a cache with the same key that cache is returned instead
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_PublishRoutingCache(aas_routingcache_t *cache)
+{
+	int i, mask;
+	aas_routingcache_t *other;
+
+	mask = routingcachehashsize - 1;
+	i = AAS_RoutingCacheHashForCache(cache) & mask;
+	for (;; i = (i + 1) & mask)
+	{
+		other = routingcachehash[i].load(std::memory_order_acquire);
+		if (!other)
+		{
+			if (routingcachehash[i].compare_exchange_strong(other, cache,
+						std::memory_order_release, std::memory_order_acquire)) return cache;
+			//another thread took the slot, other is what it stored
+		} //end if
+		if (AAS_RoutingCacheMatches(other, cache->type, cache->cluster, cache->areanum, cache->travelflags)) return other;
+	} //end for
+} //end of the function AAS_PublishRoutingCache
+//===========================================================================
+// never called while other threads look up caches
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_ResizeRoutingCacheHash(int size)
+{
+	int i, oldsize;
+	std::atomic<aas_routingcache_t *> *oldhash;
+	aas_routingcache_t *cache;
+
+	oldhash = routingcachehash;
+	oldsize = routingcachehashsize;
+	routingcachehash = (std::atomic<aas_routingcache_t *> *) GetClearedMemory(size * sizeof(routingcachehash[0]));
+	routingcachehashsize = size;
+	for (i = 0; i < oldsize; i++)
+	{
+		cache = oldhash[i].load(std::memory_order_relaxed);
+		if (cache) AAS_InsertRoutingCacheHash(cache);
+	} //end for
+	if (oldhash) FreeMemory(oldhash);
+} //end of the function AAS_ResizeRoutingCacheHash
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_HashRoutingCache(aas_routingcache_t *cache)
+{
+	//keep the table at most half full
+	if ((numroutingcache + 1) * 2 > routingcachehashsize)
+	{
+		AAS_ResizeRoutingCacheHash(routingcachehashsize * 2);
+	} //end if
+	AAS_InsertRoutingCacheHash(cache);
+	numroutingcache++;
+} //end of the function AAS_HashRoutingCache
+//===========================================================================
+// removes the cache from the hash table by moving later entries of the
+// same probe sequence back into the hole, so no tombstones are needed
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_UnhashRoutingCache(aas_routingcache_t *cache)
+{
+	int i, j, k, mask;
+	aas_routingcache_t *other;
+
+	mask = routingcachehashsize - 1;
+	i = AAS_RoutingCacheHashForCache(cache) & mask;
+	for (;; i = (i + 1) & mask)
+	{
+		other = routingcachehash[i].load(std::memory_order_relaxed);
+		if (!other) return;
+		if (other == cache) break;
+	} //end for
+	numroutingcache--;
+	for (j = i;;)
+	{
+		routingcachehash[i].store(NULL, std::memory_order_relaxed);
+		for (;;)
+		{
+			j = (j + 1) & mask;
+			other = routingcachehash[j].load(std::memory_order_relaxed);
+			if (!other) return;
+			k = AAS_RoutingCacheHashForCache(other) & mask;
+			//if the home slot lies cyclically in (i, j] the entry can stay
+			if (i <= j) {
+				if (i < k && k <= j) continue;
+			}
+			else {
+				if (i < k || k <= j) continue;
+			}
+			break;
+		} //end for
+		routingcachehash[i].store(other, std::memory_order_relaxed);
+		i = j;
+	} //end for
+} //end of the function AAS_UnhashRoutingCache
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
 void AAS_FreeRoutingCache(aas_routingcache_t *cache)
 {
+	int cacheclass;
+
 	AAS_UnlinkCache(cache);
+	AAS_UnhashRoutingCache(cache);
 	routingcachesize -= cache->size;
-	FreeMemory(cache);
+	routingfreesize += cache->size;
+	//keep the memory for the next cache of the same cluster
+	cacheclass = AAS_RoutingCacheClass(cache);
+	cache->next = freeroutingcache[cacheclass];
+	freeroutingcache[cacheclass] = cache;
 } //end of the function AAS_FreeRoutingCache
 //===========================================================================
 //
@@ -335,6 +687,9 @@ int AAS_EnableRoutingArea(int areanum, int enable)
 	{
 		//remove all routing cache involving this area
 		AAS_RemoveRoutingCacheUsingArea( areanum );
+		//caches calculated from now on don't hold for the map as it's loaded
+		if (!enable)
+			routingareadisabled = qtrue;
 	} //end if
 	return !flags;
 } //end of the function AAS_EnableRoutingArea
@@ -700,12 +1055,16 @@ int AAS_FreeOldestCache(void)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-int AAS_FreeOldestCache(void)
+static int AAS_FreeOldestCache(int cacheclass)
 {
 	int clusterareanum;
 	aas_routingcache_t *cache;
 
 	for (cache = aasworld.oldestcache; cache; cache = cache->time_next) {
+		// only cache of the same size can be reused
+		if (AAS_RoutingCacheClass(cache) != cacheclass) {
+			continue;
+		}
 		// never free area cache leading towards a portal
 		if (cache->type == CACHETYPE_AREA && aasworld.areasettings[cache->areanum].cluster < 0) {
 			continue;
@@ -729,6 +1088,7 @@ int AAS_FreeOldestCache(void)
 			if (cache->next) cache->next->prev = cache->prev;
 		}
 		AAS_FreeRoutingCache(cache);
+		routingstats.recycled++;
 		return qtrue;
 	}
 	return qfalse;
@@ -739,19 +1099,90 @@ int AAS_FreeOldestCache(void)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-aas_routingcache_t *AAS_AllocRoutingCache(int numtraveltimes)
+static aas_routingcacheblock_t *AAS_AllocRoutingCacheBlock(int size)
+{
+	aas_routingcacheblock_t *block;
+
+	block = (aas_routingcacheblock_t *) GetMemory(ROUTINGCACHE_BLOCKHEADER + size);
+	block->size = size;
+	block->used = 0;
+	block->next = routingcacheblocks;
+	routingcacheblocks = block;
+	routingblocksize += size;
+	routingstats.blocks++;
+	return block;
+} //end of the function AAS_AllocRoutingCacheBlock
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static QINLINE byte *AAS_RoutingCacheBlockData(aas_routingcacheblock_t *block)
+{
+	return (byte *) block + ROUTINGCACHE_BLOCKHEADER;
+} //end of the function AAS_RoutingCacheBlockData
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static QINLINE int AAS_RoutingCacheSize(int numtraveltimes)
+{
+	return ROUTINGCACHE_ALIGN((int) sizeof(aas_routingcache_t)
+						+ numtraveltimes * (int) sizeof(unsigned short int)
+						+ numtraveltimes * (int) sizeof(unsigned char));
+} //end of the function AAS_RoutingCacheSize
+//===========================================================================
+// cacheclass is the cluster for area cache and 0 for portal cache
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+aas_routingcache_t *AAS_AllocRoutingCache(int cacheclass, int numtraveltimes)
 {
 	aas_routingcache_t *cache;
-	int size;
+	aas_routingcacheblock_t *block;
+	int size, newblock;
 
+	size = AAS_RoutingCacheSize(numtraveltimes);
 	//
-	size = sizeof(aas_routingcache_t)
-						+ numtraveltimes * sizeof(unsigned short int)
-						+ numtraveltimes * sizeof(unsigned char);
+	if (!freeroutingcache[cacheclass])
+	{
+		block = routingcacheblocks;
+		newblock = !block || block->used + size > block->size;
+		//when the budget is used up recycle the oldest cache of the same size
+		if (routingarenasize + size > max_routingcachesize ||
+				(newblock && AvailableMemory() < 1 * 1024 * 1024))
+		{
+			AAS_FreeOldestCache(cacheclass);
+		} //end if
+	} //end if
+	//
+	cache = freeroutingcache[cacheclass];
+	if (cache)
+	{
+		freeroutingcache[cacheclass] = cache->next;
+		routingfreesize -= size;
+		routingstats.reused++;
+	} //end if
+	else
+	{
+		block = routingcacheblocks;
+		if (!block || block->used + size > block->size)
+		{
+			block = AAS_AllocRoutingCacheBlock(size > ROUTINGCACHE_BLOCKSIZE ? size : ROUTINGCACHE_BLOCKSIZE);
+		} //end if
+		cache = (aas_routingcache_t *) (AAS_RoutingCacheBlockData(block) + block->used);
+		block->used += size;
+		routingarenasize += size;
+	} //end else
 	//
 	routingcachesize += size;
 	//
-	cache = (aas_routingcache_t *) GetClearedMemory(size);
+	Com_Memset(cache, 0, size);
 	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t)
 								+ numtraveltimes * sizeof(unsigned short int);
 	cache->size = size;
@@ -763,6 +1194,122 @@ aas_routingcache_t *AAS_AllocRoutingCache(int numtraveltimes)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
+static void AAS_InitRoutingCacheMemory(void)
+{
+	//there's a free list for every cluster, cluster 0 doesn't exist and is used for portal cache
+	freeroutingcache = (aas_routingcache_t **) GetClearedMemory(aasworld.numclusters * sizeof(aas_routingcache_t *));
+	routingcacheblocks = NULL;
+	routingblocksize = 0;
+	routingarenasize = 0;
+	routingfreesize = 0;
+	routingcachesize = 0;
+	routingcachechanged = qfalse;
+	routingareadisabled = qfalse;
+	//
+	routingcachehash = NULL;
+	routingcachehashsize = 0;
+	numroutingcache = 0;
+	AAS_ResizeRoutingCacheHash(ROUTINGCACHE_MINHASHSIZE);
+	//forget the goal areas of the last map
+	numroutingtargets = 0;
+	Com_Memset(routingtargethash, 0, sizeof(routingtargethash));
+	//
+	Com_Memset(&routingstats, 0, sizeof(routingstats));
+} //end of the function AAS_InitRoutingCacheMemory
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_FreeRoutingCacheMemory(void)
+{
+	aas_routingcacheblock_t *block, *nextblock;
+
+	for (block = routingcacheblocks; block; block = nextblock)
+	{
+		nextblock = block->next;
+		FreeMemory(block);
+	} //end for
+	routingcacheblocks = NULL;
+	routingblocksize = 0;
+	routingarenasize = 0;
+	routingfreesize = 0;
+	routingcachesize = 0;
+	aasworld.oldestcache = NULL;
+	aasworld.newestcache = NULL;
+	//
+	if (freeroutingcache) FreeMemory(freeroutingcache);
+	freeroutingcache = NULL;
+	if (routingcachehash) FreeMemory(routingcachehash);
+	routingcachehash = NULL;
+	routingcachehashsize = 0;
+	numroutingcache = 0;
+} //end of the function AAS_FreeRoutingCacheMemory
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_FreeRoutingThreads(void)
+{
+	int i;
+	aas_routingthread_t *thread;
+
+	for (i = 0; i < numroutingthreads; i++)
+	{
+		thread = &routingthreads[i];
+		FreeMemory(thread->areaupdate);
+		FreeMemory(thread->portalupdate);
+		FreeMemory(thread->areascratch);
+		FreeMemory(thread->portalscratch);
+	} //end for
+	if (routingthreads) FreeMemory(routingthreads);
+	routingthreads = NULL;
+	numroutingthreads = 0;
+} //end of the function AAS_FreeRoutingThreads
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_InitRoutingThreads(int numthreads)
+{
+	int i, maxreachabilityareas;
+	aas_routingthread_t *thread;
+
+	if (numroutingthreads >= numthreads) return;
+	AAS_FreeRoutingThreads();
+	//
+	maxreachabilityareas = 0;
+	for (i = 0; i < aasworld.numclusters; i++)
+	{
+		if (aasworld.clusters[i].numreachabilityareas > maxreachabilityareas)
+		{
+			maxreachabilityareas = aasworld.clusters[i].numreachabilityareas;
+		} //end if
+	} //end for
+	routingthreads = (aas_routingthread_t *) GetClearedMemory(numthreads * sizeof(aas_routingthread_t));
+	for (i = 0; i < numthreads; i++)
+	{
+		thread = &routingthreads[i];
+		thread->areaupdate = (aas_routingupdate_t *) GetClearedMemory(
+									maxreachabilityareas * sizeof(aas_routingupdate_t));
+		thread->portalupdate = (aas_routingupdate_t *) GetClearedMemory(
+									(aasworld.numportals+1) * sizeof(aas_routingupdate_t));
+		thread->areascratch = (aas_routingcache_t *) GetMemory(AAS_RoutingCacheSize(maxreachabilityareas));
+		thread->portalscratch = (aas_routingcache_t *) GetMemory(AAS_RoutingCacheSize(aasworld.numportals));
+	} //end for
+	numroutingthreads = numthreads;
+} //end of the function AAS_InitRoutingThreads
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
 void AAS_FreeAllClusterAreaCache(void)
 {
 	int i, j;
@@ -922,7 +1469,8 @@ void AAS_CreateAllRoutingCache(void)
 
 //the route cache header
 //this header is followed by numportalcache + numareacache aas_routingcache_t
-//structures that store routing cache
+//structures that store routing cache, each padded to a multiple of 8 bytes
+//so the whole file can be read into one block and used in place
 typedef struct routecacheheader_s
 {
 	int ident;
@@ -936,7 +1484,7 @@ typedef struct routecacheheader_s
 } routecacheheader_t;
 
 #define RCID						(('C'<<24)+('R'<<16)+('E'<<8)+'M')
-#define RCVERSION					2
+#define RCVERSION					3
 
 void AAS_WriteRouteCache(void)
 {
@@ -947,6 +1495,8 @@ void AAS_WriteRouteCache(void)
 	char filename[MAX_QPATH];
 	routecacheheader_t routecacheheader;
 
+	if (!aasworld.portalcache || !aasworld.clusterareacache) return;
+	//
 	numportalcache = 0;
 	for (i = 0; i < aasworld.numareas; i++)
 	{
@@ -1026,29 +1576,51 @@ void AAS_WriteRouteCache(void)
 	*/
 	//
 	botimport.FS_FCloseFile(fp);
+	routingcachechanged = qfalse;
 	botimport.Print(PRT_MESSAGE, "\nroute cache written to %s\n", filename);
 	botimport.Print(PRT_MESSAGE, "written %d bytes of routing cache\n", totalsize);
 } //end of the function AAS_WriteRouteCache
 //===========================================================================
+// checks a cache read from the route cache file before it is used
 //
 // Parameter:			-
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-aas_routingcache_t *AAS_ReadCache(fileHandle_t fp)
+static int AAS_RouteCacheValid(aas_routingcache_t *cache, int maxsize, int type)
 {
-	int size;
-	aas_routingcache_t *cache;
+	int numtraveltimes, clusternum;
+	aas_portal_t *portal;
 
-	botimport.FS_Read(&size, sizeof(size), fp);
-	cache = (aas_routingcache_t *) GetMemory(size);
-	cache->size = size;
-	botimport.FS_Read((unsigned char *)cache + sizeof(size), size - sizeof(size), fp);
-	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t) - sizeof(unsigned short) +
-		(size - sizeof(aas_routingcache_t) + sizeof(unsigned short)) / 3 * 2;
-	return cache;
-} //end of the function AAS_ReadCache
+	if (maxsize < (int) sizeof(aas_routingcache_t)) return qfalse;
+	if (cache->type != type) return qfalse;
+	if (cache->areanum <= 0 || cache->areanum >= aasworld.numareas) return qfalse;
+	if (type == CACHETYPE_PORTAL)
+	{
+		numtraveltimes = aasworld.numportals;
+	} //end if
+	else
+	{
+		if (cache->cluster <= 0 || cache->cluster >= aasworld.numclusters) return qfalse;
+		//the area must be in the cluster or be one of its portals
+		clusternum = aasworld.areasettings[cache->areanum].cluster;
+		if (clusternum < 0)
+		{
+			portal = &aasworld.portals[-clusternum];
+			if (portal->frontcluster != cache->cluster && portal->backcluster != cache->cluster) return qfalse;
+		} //end if
+		else if (clusternum != cache->cluster) return qfalse;
+		numtraveltimes = aasworld.clusters[cache->cluster].numreachabilityareas;
+	} //end else
+	if (cache->size != AAS_RoutingCacheSize(numtraveltimes)) return qfalse;
+	if (cache->size > maxsize) return qfalse;
+	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t)
+								+ numtraveltimes * sizeof(unsigned short int);
+	return qtrue;
+} //end of the function AAS_RouteCacheValid
 //===========================================================================
+// the file is read with a single read into one routing cache block and
+// the caches are used where they are in that block
 //
 // Parameter:			-
 // Returns:				-
@@ -1056,87 +1628,95 @@ aas_routingcache_t *AAS_ReadCache(fileHandle_t fp)
 //===========================================================================
 int AAS_ReadRouteCache(void)
 {
-	int i, clusterareanum;//, size;
+	int i, clusterareanum, filesize, size, numcache;
 	fileHandle_t fp;
 	char filename[MAX_QPATH];
 	routecacheheader_t routecacheheader;
 	aas_routingcache_t *cache;
+	aas_routingcacheblock_t *block;
+	byte *ptr, *end;
 
 	Com_sprintf(filename, MAX_QPATH, "maps/%s.rcd", aasworld.mapname);
-	botimport.FS_FOpenFile( filename, &fp, FS_READ );
+	filesize = botimport.FS_FOpenFile( filename, &fp, FS_READ );
 	if (!fp)
 	{
 		return qfalse;
 	} //end if
+	if (filesize < (int) sizeof(routecacheheader_t))
+	{
+		botimport.FS_FCloseFile(fp);
+		return qfalse;
+	} //end if
 	botimport.FS_Read(&routecacheheader, sizeof(routecacheheader_t), fp );
 	if (routecacheheader.ident != RCID)
 	{
+		botimport.FS_FCloseFile(fp);
 		AAS_Error("%s is not a route cache dump\n", filename);
 		return qfalse;
 	} //end if
 	if (routecacheheader.version != RCVERSION)
 	{
-		AAS_Error("route cache dump has wrong version %d, should be %d", routecacheheader.version, RCVERSION);
+		//older dumps are simply replaced when the cache is saved again
+		botimport.FS_FCloseFile(fp);
 		return qfalse;
 	} //end if
-	if (routecacheheader.numareas != aasworld.numareas)
-	{
-		//AAS_Error("route cache dump has wrong number of areas\n");
-		return qfalse;
-	} //end if
-	if (routecacheheader.numclusters != aasworld.numclusters)
-	{
-		//AAS_Error("route cache dump has wrong number of clusters\n");
+	if (routecacheheader.numareas != aasworld.numareas ||
+		routecacheheader.numclusters != aasworld.numclusters ||
+		routecacheheader.areacrc !=
+			CRC_ProcessString( (unsigned char *)aasworld.areas, sizeof(aas_area_t) * aasworld.numareas ) ||
+		routecacheheader.clustercrc !=
+			CRC_ProcessString( (unsigned char *)aasworld.clusters, sizeof(aas_cluster_t) * aasworld.numclusters ))
+	{
+		//the route cache was written for a different version of the map
+		botimport.FS_FCloseFile(fp);
 		return qfalse;
 	} //end if
-	if (routecacheheader.areacrc !=
-		CRC_ProcessString( (unsigned char *)aasworld.areas, sizeof(aas_area_t) * aasworld.numareas ))
-	{
-		//AAS_Error("route cache dump area CRC incorrect\n");
-		return qfalse;
-	} //end if
-	if (routecacheheader.clustercrc !=
-		CRC_ProcessString( (unsigned char *)aasworld.clusters, sizeof(aas_cluster_t) * aasworld.numclusters ))
-	{
-		//AAS_Error("route cache dump cluster CRC incorrect\n");
-		return qfalse;
-	} //end if
-	//read all the portal cache
-	for (i = 0; i < routecacheheader.numportalcache; i++)
-	{
-		cache = AAS_ReadCache(fp);
-		cache->next = aasworld.portalcache[cache->areanum];
-		cache->prev = NULL;
-		if (aasworld.portalcache[cache->areanum])
-			aasworld.portalcache[cache->areanum]->prev = cache;
-		aasworld.portalcache[cache->areanum] = cache;
-	} //end for
-	//read all the cluster area cache
-	for (i = 0; i < routecacheheader.numareacache; i++)
+	//read all the cache at once
+	size = filesize - sizeof(routecacheheader_t);
+	block = AAS_AllocRoutingCacheBlock(size);
+	ptr = AAS_RoutingCacheBlockData(block);
+	end = ptr + size;
+	botimport.FS_Read(ptr, size, fp );
+	botimport.FS_FCloseFile(fp);
+	//link the portal cache and then the cluster area cache
+	numcache = routecacheheader.numportalcache + routecacheheader.numareacache;
+	for (i = 0; i < numcache; i++)
 	{
-		cache = AAS_ReadCache(fp);
-		clusterareanum = AAS_ClusterAreaNum(cache->cluster, cache->areanum);
-		cache->next = aasworld.clusterareacache[cache->cluster][clusterareanum];
-		cache->prev = NULL;
-		if (aasworld.clusterareacache[cache->cluster][clusterareanum])
-			aasworld.clusterareacache[cache->cluster][clusterareanum]->prev = cache;
-		aasworld.clusterareacache[cache->cluster][clusterareanum] = cache;
+		cache = (aas_routingcache_t *) ptr;
+		if (!AAS_RouteCacheValid(cache, end - ptr,
+				i < routecacheheader.numportalcache ? CACHETYPE_PORTAL : CACHETYPE_AREA))
+		{
+			botimport.Print(PRT_WARNING, "%s is damaged, only %d of %d caches used\n", filename, i, numcache);
+			break;
+		} //end if
+		ptr += cache->size;
+		//
+		if (cache->type == CACHETYPE_PORTAL)
+		{
+			cache->next = aasworld.portalcache[cache->areanum];
+			cache->prev = NULL;
+			if (aasworld.portalcache[cache->areanum])
+				aasworld.portalcache[cache->areanum]->prev = cache;
+			aasworld.portalcache[cache->areanum] = cache;
+		} //end if
+		else
+		{
+			clusterareanum = AAS_ClusterAreaNum(cache->cluster, cache->areanum);
+			cache->next = aasworld.clusterareacache[cache->cluster][clusterareanum];
+			cache->prev = NULL;
+			if (aasworld.clusterareacache[cache->cluster][clusterareanum])
+				aasworld.clusterareacache[cache->cluster][clusterareanum]->prev = cache;
+			aasworld.clusterareacache[cache->cluster][clusterareanum] = cache;
+		} //end else
+		AAS_HashRoutingCache(cache);
+		cache->time = AAS_RoutingTime();
+		AAS_LinkCache(cache);
+		routingstats.loaded++;
 	} //end for
-	// read the visareas
-	/*
-	aasworld.areavisibility = (byte **) GetClearedMemory(aasworld.numareas * sizeof(byte *));
-	aasworld.decompressedvis = (byte *) GetClearedMemory(aasworld.numareas * sizeof(byte));
-	for (i = 0; i < aasworld.numareas; i++)
-	{
-		botimport.FS_Read(&size, sizeof(size), fp );
-		if (size) {
-			aasworld.areavisibility[i] = (byte *) GetMemory(size);
-			botimport.FS_Read(aasworld.areavisibility[i], size, fp );
-		}
-	}
-	*/
-	//
-	botimport.FS_FCloseFile(fp);
+	//the rest of a damaged file is left to the allocator
+	block->used = ptr - AAS_RoutingCacheBlockData(block);
+	routingarenasize += block->used;
+	routingcachesize += block->used;
 	return qtrue;
 } //end of the function AAS_ReadRouteCache
 //===========================================================================
@@ -1244,8 +1824,8 @@ void AAS_InitRouting(void)
 	numportalcacheupdates = 0;
 #endif //ROUTING_DEBUG
 	//
-	routingcachesize = 0;
 	max_routingcachesize = 1024 * (int) LibVarValue("max_routingcache", "4096");
+	AAS_InitRoutingCacheMemory();
 	// read any routing cache if available
 	AAS_ReadRouteCache();
 } //end of the function AAS_InitRouting
@@ -1257,10 +1837,21 @@ void AAS_InitRouting(void)
 //===========================================================================
 void AAS_FreeRoutingCaches(void)
 {
+	// keep the routing cache calculated on this map for the next time it's loaded
+	if (routingcachechanged && !routingareadisabled && aasworld.loaded && LibVarValue("autosaveroutingcache", "1"))
+	{
+		AAS_WriteRouteCache();
+	} //end if
+	routingcachechanged = qfalse;
+	routingareadisabled = qfalse;
 	// free all the existing cluster area cache
 	AAS_FreeAllClusterAreaCache();
 	// free all the existing portal cache
 	AAS_FreeAllPortalCache();
+	// free the memory the routing caches were stored in
+	AAS_FreeRoutingCacheMemory();
+	// free the routing update fields of the warmup threads
+	AAS_FreeRoutingThreads();
 	// free cached travel times within areas
 	if (aasworld.areatraveltimes) FreeMemory(aasworld.areatraveltimes);
 	aasworld.areatraveltimes = NULL;
@@ -1286,29 +1877,46 @@ void AAS_FreeRoutingCaches(void)
 	aasworld.areacontentstravelflags = NULL;
 } //end of the function AAS_FreeRoutingCaches
 //===========================================================================
+// calculates a cache on a worker thread, defined further down
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_WarmupRoutingCache(aas_routingthread_t *thread, int type, int clusternum, int areanum, int travelflags);
+//===========================================================================
 // update the given routing cache
 //
-// Parameter:			areacache		: routing cache to update
+// Parameter:			thread			: NULL unless called from the warmup
+//						areacache		: routing cache to update
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
+void AAS_UpdateAreaRoutingCache(aas_routingthread_t *thread, aas_routingcache_t *areacache)
 {
 	int i, nextareanum, cluster, badtravelflags, clusterareanum, linknum;
 	int numreachabilityareas;
 	unsigned short int t, startareatraveltimes[128]; //NOTE: not more than 128 reachabilities per area allowed
+	aas_routingupdate_t *areaupdate;
 	aas_routingupdate_t *updateliststart, *updatelistend, *curupdate, *nextupdate;
 	aas_reachability_t *reach;
 	aas_reversedreachability_t *revreach;
 	aas_reversedlink_t *revlink;
 
+	if (thread)
+	{
+		areaupdate = thread->areaupdate;
+	} //end if
+	else
+	{
+		areaupdate = aasworld.areaupdate;
 #ifdef ROUTING_DEBUG
-	numareacacheupdates++;
+		numareacacheupdates++;
 #endif //ROUTING_DEBUG
+		aasworld.frameroutingupdates++;
+	} //end else
 	//number of reachability areas within this cluster
 	numreachabilityareas = aasworld.clusters[areacache->cluster].numreachabilityareas;
-	//
-	aasworld.frameroutingupdates++;
 	//clear the routing update fields
 //	Com_Memset(aasworld.areaupdate, 0, aasworld.numareas * sizeof(aas_routingupdate_t));
 	//
@@ -1319,7 +1927,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 	//
 	Com_Memset(startareatraveltimes, 0, sizeof(startareatraveltimes));
 	//
-	curupdate = &aasworld.areaupdate[clusterareanum];
+	curupdate = &areaupdate[clusterareanum];
 	curupdate->areanum = areacache->areanum;
 	//VectorCopy(areacache->origin, curupdate->start);
 	curupdate->areatraveltimes = startareatraveltimes;
@@ -1375,7 +1983,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 			{
 				areacache->traveltimes[clusterareanum] = t;
 				areacache->reachabilities[clusterareanum] = linknum - aasworld.areasettings[nextareanum].firstreachablearea;
-				nextupdate = &aasworld.areaupdate[clusterareanum];
+				nextupdate = &areaupdate[clusterareanum];
 				nextupdate->areanum = nextareanum;
 				nextupdate->tmptraveltime = t;
 				//VectorCopy(reach->start, nextupdate->start);
@@ -1403,43 +2011,56 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-aas_routingcache_t *AAS_GetAreaRoutingCache(int clusternum, int areanum, int travelflags)
+aas_routingcache_t *AAS_GetAreaRoutingCache(aas_routingthread_t *thread, int clusternum, int areanum, int travelflags)
 {
 	int clusterareanum;
 	aas_routingcache_t *cache, *clustercache;
+	aas_routingstats_t *stats;
 
-	//number of the area in the cluster
-	clusterareanum = AAS_ClusterAreaNum(clusternum, areanum);
-	//pointer to the cache for the area in the cluster
-	clustercache = aasworld.clusterareacache[clusternum][clusterareanum];
+	stats = thread ? &thread->stats : &routingstats;
+	stats->lookups++;
 	//find the cache without undesired travel flags
-	for (cache = clustercache; cache; cache = cache->next)
+	cache = AAS_FindRoutingCache(stats, CACHETYPE_AREA, clusternum, areanum, travelflags);
+	//during the warmup caches are only looked up and calculated
+	if (thread)
 	{
-		//if there aren't used any undesired travel types for the cache
-		if (cache->travelflags == travelflags) break;
-	} //end for
+		if (cache)
+		{
+			stats->hits++;
+			return cache;
+		} //end if
+		return AAS_WarmupRoutingCache(thread, CACHETYPE_AREA, clusternum, areanum, travelflags);
+	} //end if
 	//if there was no cache
 	if (!cache)
 	{
-		cache = AAS_AllocRoutingCache(aasworld.clusters[clusternum].numreachabilityareas);
+		cache = AAS_AllocRoutingCache(clusternum, aasworld.clusters[clusternum].numreachabilityareas);
+		cache->type = CACHETYPE_AREA;
 		cache->cluster = clusternum;
 		cache->areanum = areanum;
 		VectorCopy(aasworld.areas[areanum].center, cache->origin);
 		cache->starttraveltime = 1;
 		cache->travelflags = travelflags;
+		//number of the area in the cluster
+		clusterareanum = AAS_ClusterAreaNum(clusternum, areanum);
+		//pointer to the cache for the area in the cluster, the allocation might have changed it
+		clustercache = aasworld.clusterareacache[clusternum][clusterareanum];
 		cache->prev = NULL;
 		cache->next = clustercache;
 		if (clustercache) clustercache->prev = cache;
 		aasworld.clusterareacache[clusternum][clusterareanum] = cache;
-		AAS_UpdateAreaRoutingCache(cache);
+		AAS_HashRoutingCache(cache);
+		AAS_UpdateAreaRoutingCache(NULL, cache);
+		routingstats.areacreated++;
+		routingcachechanged = qtrue;
 	} //end if
 	else
 	{
+		routingstats.hits++;
 		AAS_UnlinkCache(cache);
 	} //end else
 	//the cache has been accessed
 	cache->time = AAS_RoutingTime();
-	cache->type = CACHETYPE_AREA;
 	AAS_LinkCache(cache);
 	return cache;
 } //end of the function AAS_GetAreaRoutingCache
@@ -1449,22 +2070,31 @@ aas_routingcache_t *AAS_GetAreaRoutingCache(int clusternum, int areanum, int tra
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-void AAS_UpdatePortalRoutingCache(aas_routingcache_t *portalcache)
+void AAS_UpdatePortalRoutingCache(aas_routingthread_t *thread, aas_routingcache_t *portalcache)
 {
 	int i, portalnum, clusterareanum, clusternum;
 	unsigned short int t;
 	aas_portal_t *portal;
 	aas_cluster_t *cluster;
 	aas_routingcache_t *cache;
+	aas_routingupdate_t *portalupdate;
 	aas_routingupdate_t *updateliststart, *updatelistend, *curupdate, *nextupdate;
 
+	if (thread)
+	{
+		portalupdate = thread->portalupdate;
+	} //end if
+	else
+	{
+		portalupdate = aasworld.portalupdate;
 #ifdef ROUTING_DEBUG
-	numportalcacheupdates++;
+		numportalcacheupdates++;
 #endif //ROUTING_DEBUG
+	} //end else
 	//clear the routing update fields
 //	Com_Memset(aasworld.portalupdate, 0, (aasworld.numportals+1) * sizeof(aas_routingupdate_t));
 	//
-	curupdate = &aasworld.portalupdate[aasworld.numportals];
+	curupdate = &portalupdate[aasworld.numportals];
 	curupdate->cluster = portalcache->cluster;
 	curupdate->areanum = portalcache->areanum;
 	curupdate->tmptraveltime = portalcache->starttraveltime;
@@ -1492,7 +2122,7 @@ void AAS_UpdatePortalRoutingCache(aas_routingcache_t *portalcache)
 		//
 		cluster = &aasworld.clusters[curupdate->cluster];
 		//
-		cache = AAS_GetAreaRoutingCache(curupdate->cluster,
+		cache = AAS_GetAreaRoutingCache(thread, curupdate->cluster,
 								curupdate->areanum, portalcache->travelflags);
 		//take all portals of the cluster
 		for (i = 0; i < cluster->numportals; i++)
@@ -1513,7 +2143,7 @@ void AAS_UpdatePortalRoutingCache(aas_routingcache_t *portalcache)
 					portalcache->traveltimes[portalnum] > t)
 			{
 				portalcache->traveltimes[portalnum] = t;
-				nextupdate = &aasworld.portalupdate[portalnum];
+				nextupdate = &portalupdate[portalnum];
 				if (portal->frontcluster == curupdate->cluster)
 				{
 					nextupdate->cluster = portal->backcluster;
@@ -1547,19 +2177,30 @@ void AAS_UpdatePortalRoutingCache(aas_routingcache_t *portalcache)
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-aas_routingcache_t *AAS_GetPortalRoutingCache(int clusternum, int areanum, int travelflags)
+aas_routingcache_t *AAS_GetPortalRoutingCache(aas_routingthread_t *thread, int clusternum, int areanum, int travelflags)
 {
 	aas_routingcache_t *cache;
+	aas_routingstats_t *stats;
 
+	stats = thread ? &thread->stats : &routingstats;
+	stats->lookups++;
 	//find the cached portal routing if existing
-	for (cache = aasworld.portalcache[areanum]; cache; cache = cache->next)
+	cache = AAS_FindRoutingCache(stats, CACHETYPE_PORTAL, clusternum, areanum, travelflags);
+	//during the warmup caches are only looked up and calculated
+	if (thread)
 	{
-		if (cache->travelflags == travelflags) break;
-	} //end for
+		if (cache)
+		{
+			stats->hits++;
+			return cache;
+		} //end if
+		return AAS_WarmupRoutingCache(thread, CACHETYPE_PORTAL, clusternum, areanum, travelflags);
+	} //end if
 	//if the portal routing isn't cached
 	if (!cache)
 	{
-		cache = AAS_AllocRoutingCache(aasworld.numportals);
+		cache = AAS_AllocRoutingCache(0, aasworld.numportals);
+		cache->type = CACHETYPE_PORTAL;
 		cache->cluster = clusternum;
 		cache->areanum = areanum;
 		VectorCopy(aasworld.areas[areanum].center, cache->origin);
@@ -1570,20 +2211,341 @@ aas_routingcache_t *AAS_GetPortalRoutingCache(int clusternum, int areanum, int t
 		cache->next = aasworld.portalcache[areanum];
 		if (aasworld.portalcache[areanum]) aasworld.portalcache[areanum]->prev = cache;
 		aasworld.portalcache[areanum] = cache;
+		AAS_HashRoutingCache(cache);
 		//update the cache
-		AAS_UpdatePortalRoutingCache(cache);
+		AAS_UpdatePortalRoutingCache(NULL, cache);
+		routingstats.portalcreated++;
+		routingcachechanged = qtrue;
 	} //end if
 	else
 	{
+		routingstats.hits++;
 		AAS_UnlinkCache(cache);
 	} //end else
 	//the cache has been accessed
 	cache->time = AAS_RoutingTime();
-	cache->type = CACHETYPE_PORTAL;
 	AAS_LinkCache(cache);
 	return cache;
 } //end of the function AAS_GetPortalRoutingCache
 //===========================================================================
+// new cache for the warmup, from the free list or the last block if the
+// hash table and the routing cache budget have room for it, otherwise the
+// scratch cache of the thread is used
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_AllocWarmupCache(aas_routingthread_t *thread, int cacheclass, int numtraveltimes)
+{
+	aas_routingcache_t *cache;
+	aas_routingcacheblock_t *block;
+	int size;
+
+	size = AAS_RoutingCacheSize(numtraveltimes);
+	cache = NULL;
+	if (!routingwarmupfull.load(std::memory_order_relaxed))
+	{
+		if (numroutingcache.fetch_add(1) < routingwarmuplimit)
+		{
+			routingwarmuplock.lock();
+			cache = freeroutingcache[cacheclass];
+			if (cache)
+			{
+				freeroutingcache[cacheclass] = cache->next;
+				routingfreesize -= size;
+				thread->stats.reused++;
+			} //end if
+			else
+			{
+				block = routingcacheblocks;
+				if (block && block->used + size <= block->size && routingarenasize + size <= max_routingcachesize)
+				{
+					cache = (aas_routingcache_t *) (AAS_RoutingCacheBlockData(block) + block->used);
+					block->used += size;
+					routingarenasize += size;
+				} //end if
+			} //end else
+			if (cache) routingcachesize += size;
+			routingwarmuplock.unlock();
+		} //end if
+		if (!cache)
+		{
+			numroutingcache--;
+			routingwarmupfull = true;
+		} //end if
+	} //end if
+	if (!cache)
+	{
+		cache = cacheclass ? thread->areascratch : thread->portalscratch;
+	} //end if
+	//
+	Com_Memset(cache, 0, size);
+	cache->reachabilities = (unsigned char *) cache + sizeof(aas_routingcache_t)
+								+ numtraveltimes * sizeof(unsigned short int);
+	cache->size = size;
+	return cache;
+} //end of the function AAS_AllocWarmupCache
+//===========================================================================
+// puts a cache that wasn't added to the hash table back on its free list
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_FreeWarmupCache(aas_routingcache_t *cache)
+{
+	int cacheclass;
+
+	cacheclass = AAS_RoutingCacheClass(cache);
+	routingwarmuplock.lock();
+	routingcachesize -= cache->size;
+	routingfreesize += cache->size;
+	cache->next = freeroutingcache[cacheclass];
+	freeroutingcache[cacheclass] = cache;
+	routingwarmuplock.unlock();
+	numroutingcache--;
+} //end of the function AAS_FreeWarmupCache
+//===========================================================================
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static aas_routingcache_t *AAS_WarmupRoutingCache(aas_routingthread_t *thread, int type, int clusternum, int areanum, int travelflags)
+{
+	aas_routingcache_t *cache, *other;
+
+	if (type == CACHETYPE_AREA)
+	{
+		cache = AAS_AllocWarmupCache(thread, clusternum, aasworld.clusters[clusternum].numreachabilityareas);
+	} //end if
+	else
+	{
+		cache = AAS_AllocWarmupCache(thread, 0, aasworld.numportals);
+	} //end else
+	cache->type = type;
+	cache->cluster = clusternum;
+	cache->areanum = areanum;
+	VectorCopy(aasworld.areas[areanum].center, cache->origin);
+	cache->starttraveltime = 1;
+	cache->travelflags = travelflags;
+	//calculate the cache before other threads can see it
+	if (type == CACHETYPE_AREA)
+	{
+		AAS_UpdateAreaRoutingCache(thread, cache);
+		thread->stats.areacreated++;
+	} //end if
+	else
+	{
+		AAS_UpdatePortalRoutingCache(thread, cache);
+		thread->stats.portalcreated++;
+	} //end else
+	//
+	if (cache == thread->areascratch || cache == thread->portalscratch)
+	{
+		return cache;
+	} //end if
+	other = AAS_PublishRoutingCache(cache);
+	if (other != cache)
+	{
+		//another thread calculated the same cache in the meantime
+		AAS_FreeWarmupCache(cache);
+		return other;
+	} //end if
+	//link it in once the warmup is done
+	cache->next = thread->newcache;
+	thread->newcache = cache;
+	return cache;
+} //end of the function AAS_WarmupRoutingCache
+//===========================================================================
+// remembers an area bots route to, so its routing cache can be calculated
+// on the worker pool when it's missing
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_AddRoutingTarget(int areanum, int travelflags)
+{
+	int i, index;
+	unsigned int hash;
+
+	if (areanum <= 0 || areanum >= aasworld.numareas) return;
+	hash = AAS_RoutingCacheHash(CACHETYPE_PORTAL, 0, areanum, travelflags);
+	for (i = hash & (MAX_ROUTINGTARGETS * 2 - 1);; i = (i + 1) & (MAX_ROUTINGTARGETS * 2 - 1))
+	{
+		index = routingtargethash[i] - 1;
+		if (index < 0) break;
+		if (routingtargets[index].areanum == areanum &&
+			routingtargets[index].travelflags == travelflags) return;
+	} //end for
+	if (numroutingtargets >= MAX_ROUTINGTARGETS) return;
+	routingtargets[numroutingtargets].areanum = areanum;
+	routingtargets[numroutingtargets].travelflags = travelflags;
+	routingtargethash[i] = ++numroutingtargets;
+} //end of the function AAS_AddRoutingTarget
+//===========================================================================
+// gets the caches AAS_AreaRouteToGoalArea uses for the goal area no matter
+// where the route starts, with thread NULL it only checks they're there
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static int AAS_WarmupRoutingTarget(aas_routingthread_t *thread, aas_routingtarget_t *target)
+{
+	int goalareanum, goalclusternum, travelflags;
+	aas_portal_t *portal;
+
+	goalareanum = target->areanum;
+	travelflags = target->travelflags;
+	if (AAS_AreaDoNotEnter(goalareanum)) travelflags |= TFL_DONOTENTER;
+	//
+	goalclusternum = aasworld.areasettings[goalareanum].cluster;
+	if (goalclusternum > 0)
+	{
+		//routes starting in the same cluster
+		if (thread) AAS_GetAreaRoutingCache(thread, goalclusternum, goalareanum, travelflags);
+		else if (!AAS_FindRoutingCache(NULL, CACHETYPE_AREA, goalclusternum, goalareanum, travelflags)) return qfalse;
+	} //end if
+	else
+	{
+		//routes starting in either cluster of the portal
+		portal = &aasworld.portals[-goalclusternum];
+		if (thread)
+		{
+			AAS_GetAreaRoutingCache(thread, portal->frontcluster, goalareanum, travelflags);
+			AAS_GetAreaRoutingCache(thread, portal->backcluster, goalareanum, travelflags);
+		} //end if
+		else
+		{
+			if (!AAS_FindRoutingCache(NULL, CACHETYPE_AREA, portal->frontcluster, goalareanum, travelflags)) return qfalse;
+			if (!AAS_FindRoutingCache(NULL, CACHETYPE_AREA, portal->backcluster, goalareanum, travelflags)) return qfalse;
+		} //end else
+		goalclusternum = portal->frontcluster;
+	} //end else
+	//routes from other clusters, this also calculates the area cache of the portals on the way
+	if (thread) AAS_GetPortalRoutingCache(thread, goalclusternum, goalareanum, travelflags);
+	else if (!AAS_FindRoutingCache(NULL, CACHETYPE_PORTAL, goalclusternum, goalareanum, travelflags)) return qfalse;
+	return qtrue;
+} //end of the function AAS_WarmupRoutingTarget
+//===========================================================================
+// called on the main thread at the start of a frame, returns the number of
+// routing targets to pass to AAS_WarmupRouting
+//
+// Parameter:			numthreads		: worker threads, 1 or less turns the warmup off
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+int AAS_PrepareRoutingWarmup(int numthreads)
+{
+	int i, numwarmup, size, room;
+	aas_routingcacheblock_t *block;
+
+	routingrecordtargets = numthreads > 1;
+	if (numthreads <= 1 || !aasworld.initialized) return 0;
+	if (numthreads > MAX_ROUTINGTHREADS) numthreads = MAX_ROUTINGTHREADS;
+	//
+	numwarmup = 0;
+	for (i = 0; i < numroutingtargets; i++)
+	{
+		if (!AAS_WarmupRoutingTarget(NULL, &routingtargets[i])) routingwarmup[numwarmup++] = i;
+	} //end for
+	if (!numwarmup) return 0;
+	//
+	AAS_InitRoutingThreads(numthreads);
+	//the workers can't allocate memory, start a new block if the last one is running out
+	block = routingcacheblocks;
+	if (routingarenasize + ROUTINGCACHE_BLOCKSIZE / 2 <= max_routingcachesize &&
+			(!block || block->size - block->used < ROUTINGCACHE_BLOCKSIZE / 2) &&
+			AvailableMemory() >= 1 * 1024 * 1024 + ROUTINGCACHE_BLOCKSIZE)
+	{
+		block = AAS_AllocRoutingCacheBlock(ROUTINGCACHE_BLOCKSIZE);
+	} //end if
+	//when the budget is used up the cache is calculated on demand and old cache recycled
+	room = block ? block->size - block->used : 0;
+	if (room > max_routingcachesize - routingarenasize) room = max_routingcachesize - routingarenasize;
+	if (room + routingfreesize < AAS_RoutingCacheSize(aasworld.numportals)) return 0;
+	//and the hash table can't grow while they run
+	size = routingcachehashsize;
+	while (size < 65536 && (numroutingcache + numwarmup * (2 + aasworld.numportals)) * 2 > size) size *= 2;
+	if (size > routingcachehashsize) AAS_ResizeRoutingCacheHash(size);
+	routingwarmuplimit = routingcachehashsize / 2;
+	routingwarmupfull = false;
+	//
+	routingstats.warmups++;
+	return numwarmup;
+} //end of the function AAS_PrepareRoutingWarmup
+//===========================================================================
+// called from the worker pool for every target AAS_PrepareRoutingWarmup
+// returned, threadnum is below the number of threads passed to it
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_WarmupRouting(int index, int threadnum)
+{
+	aas_routingthread_t *thread;
+
+	if (threadnum < 0 || threadnum >= numroutingthreads) return;
+	//no use calculating cache that can't be kept
+	if (routingwarmupfull.load(std::memory_order_relaxed)) return;
+	thread = &routingthreads[threadnum];
+	AAS_WarmupRoutingTarget(thread, &routingtargets[routingwarmup[index]]);
+	thread->stats.warmed++;
+} //end of the function AAS_WarmupRouting
+//===========================================================================
+// called on the main thread once the worker pool is done, links the new
+// caches into the lists and the time list
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_FinishRoutingWarmup(void)
+{
+	int i, clusterareanum;
+	aas_routingthread_t *thread;
+	aas_routingcache_t *cache, *nextcache, **list;
+
+	for (i = 0; i < numroutingthreads; i++)
+	{
+		thread = &routingthreads[i];
+		for (cache = thread->newcache; cache; cache = nextcache)
+		{
+			nextcache = cache->next;
+			if (cache->type == CACHETYPE_AREA)
+			{
+				clusterareanum = AAS_ClusterAreaNum(cache->cluster, cache->areanum);
+				list = &aasworld.clusterareacache[cache->cluster][clusterareanum];
+			} //end if
+			else
+			{
+				list = &aasworld.portalcache[cache->areanum];
+			} //end else
+			cache->prev = NULL;
+			cache->next = *list;
+			if (*list) (*list)->prev = cache;
+			*list = cache;
+			cache->time = AAS_RoutingTime();
+			AAS_LinkCache(cache);
+			routingcachechanged = qtrue;
+		} //end for
+		thread->newcache = NULL;
+		//
+		routingstats.lookups += thread->stats.lookups;
+		routingstats.hits += thread->stats.hits;
+		routingstats.probes += thread->stats.probes;
+		routingstats.areacreated += thread->stats.areacreated;
+		routingstats.portalcreated += thread->stats.portalcreated;
+		routingstats.reused += thread->stats.reused;
+		routingstats.warmed += thread->stats.warmed;
+		Com_Memset(&thread->stats, 0, sizeof(thread->stats));
+	} //end for
+} //end of the function AAS_FinishRoutingWarmup
+//===========================================================================
 //
 // Parameter:			-
 // Returns:				-
@@ -1623,10 +2585,13 @@ int AAS_AreaRouteToGoalArea(int areanum, vec3_t origin, int goalareanum, int tra
 		} //end if
 		return qfalse;
 	} //end if
-	// make sure the routing cache doesn't grow to large
-	while(AvailableMemory() < 1 * 1024 * 1024) {
-		if (!AAS_FreeOldestCache()) break;
-	}
+	//NOTE: the routing cache is kept within max_routingcachesize by AAS_AllocRoutingCache
+	//
+	//remember the goal for the next warmup
+	if (routingrecordtargets)
+	{
+		AAS_AddRoutingTarget(goalareanum, travelflags);
+	} //end if
 	//
 	if (AAS_AreaDoNotEnter(areanum) || AAS_AreaDoNotEnter(goalareanum))
 	{
@@ -1670,7 +2635,7 @@ int AAS_AreaRouteToGoalArea(int areanum, vec3_t origin, int goalareanum, int tra
 	if (clusternum > 0 && goalclusternum > 0 && clusternum == goalclusternum)
 	{
 		//
-		areacache = AAS_GetAreaRoutingCache(clusternum, goalareanum, travelflags);
+		areacache = AAS_GetAreaRoutingCache(NULL, clusternum, goalareanum, travelflags);
 		//the number of the area in the cluster
 		clusterareanum = AAS_ClusterAreaNum(clusternum, areanum);
 		//the cluster the area is in
@@ -1704,7 +2669,7 @@ int AAS_AreaRouteToGoalArea(int areanum, vec3_t origin, int goalareanum, int tra
 		goalclusternum = portal->frontcluster;
 	} //end if
 	//get the portal routing cache
-	portalcache = AAS_GetPortalRoutingCache(goalclusternum, goalareanum, travelflags);
+	portalcache = AAS_GetPortalRoutingCache(NULL, goalclusternum, goalareanum, travelflags);
 	//if the area is a cluster portal, read directly from the portal cache
 	if (clusternum < 0)
 	{
@@ -1727,7 +2692,7 @@ int AAS_AreaRouteToGoalArea(int areanum, vec3_t origin, int goalareanum, int tra
 		//
 		portal = &aasworld.portals[portalnum];
 		//get the cache of the portal area
-		areacache = AAS_GetAreaRoutingCache(clusternum, portal->areanum, travelflags);
+		areacache = AAS_GetAreaRoutingCache(NULL, clusternum, portal->areanum, travelflags);
 		//current area inside the current cluster
 		clusterareanum = AAS_ClusterAreaNum(clusternum, areanum);
 		//if the area is NOT a reachability area
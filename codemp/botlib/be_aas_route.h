@@ -50,6 +50,16 @@ void AAS_WriteRouteCache(void);
 void AAS_RoutingInfo(void);
 #endif //AASINTERN
 
+//prints routing cache lookup and memory statistics
+void AAS_RoutingStats(void);
+//remembers a goal area bots route to for the routing cache warmup
+void AAS_AddRoutingTarget(int areanum, int travelflags);
+//returns the number of routing targets to warm up on numthreads threads this frame
+int AAS_PrepareRoutingWarmup(int numthreads);
+//calculates the routing cache of a routing target, safe to call from a worker thread
+void AAS_WarmupRouting(int index, int threadnum);
+//links the routing cache calculated by the warmup in, called on the main thread
+void AAS_FinishRoutingWarmup(void);
 //returns the travel flag for the given travel type
 int AAS_TravelFlagForType(int traveltype);
 //return the travel flag(s) for traveling through this area
@@ -856,6 +856,25 @@ void BotSetAvoidGoalTime(int goalstate, int number, float avoidtime)
 	} //end else
 } //end of the function BotSetAvoidGoalTime
 //===========================================================================
+// the level items are the goals bots evaluate most, so their routing cache
+// is worth calculating before the bots ask for it
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void BotAddLevelItemRoutingTargets(void)
+{
+	levelitem_t *li;
+
+	for (li = levelitems; li; li = li->next)
+	{
+		if (li->flags & IFL_NOTBOT) continue;
+		if (!li->goalareanum) continue;
+		AAS_AddRoutingTarget(li->goalareanum, TFL_DEFAULT);
+	} //end for
+} //end of the function BotAddLevelItemRoutingTargets
+//===========================================================================
 //
 // Parameter:			-
 // Returns:				-
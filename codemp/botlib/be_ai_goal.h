@@ -103,6 +103,8 @@ float BotAvoidGoalTime(int goalstate, int number);
 void BotSetAvoidGoalTime(int goalstate, int number, float avoidtime);
 //initializes the items in the level
 void BotInitLevelItems(void);
+//adds the level items to the routing targets of the routing cache warmup
+void BotAddLevelItemRoutingTargets(void);
 //regularly update dynamic entity items (dropped weapons, flags etc.)
 void BotUpdateEntityItems(void);
 //interbreed the goal fuzzy logic
@@ -266,6 +266,17 @@ int Export_BotLibVarGet(char *var_name, char *value, int size)
 } //end of the function Export_BotLibVarGet
 //===========================================================================
 //
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+int Export_AAS_PrepareRoutingWarmup(int numthreads)
+{
+	if (numthreads > 1) BotAddLevelItemRoutingTargets();
+	return AAS_PrepareRoutingWarmup(numthreads);
+} //end of the function Export_AAS_PrepareRoutingWarmup
+//===========================================================================
+//
 // Parameter:				-
 // Returns:					-
 // Changes Globals:		-
@@ -719,6 +730,10 @@ static void Init_AAS_Export( aas_export_t *aas ) {
 	aas->AAS_AreaTravelTimeToGoalArea = AAS_AreaTravelTimeToGoalArea;
 	aas->AAS_EnableRoutingArea = AAS_EnableRoutingArea;
 	aas->AAS_PredictRoute = AAS_PredictRoute;
+	aas->AAS_RoutingStats = AAS_RoutingStats;
+	aas->AAS_PrepareRoutingWarmup = Export_AAS_PrepareRoutingWarmup;
+	aas->AAS_WarmupRouting = AAS_WarmupRouting;
+	aas->AAS_FinishRoutingWarmup = AAS_FinishRoutingWarmup;
 	//--------------------------------------------
 	// be_aas_altroute.c
 	//--------------------------------------------
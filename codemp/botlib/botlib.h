@@ -256,6 +256,10 @@ typedef struct aas_export_s
 	int			(*AAS_PredictRoute)(struct aas_predictroute_s *route, int areanum, vec3_t origin,
 							int goalareanum, int travelflags, int maxareas, int maxtime,
 							int stopevent, int stopcontents, int stoptfl, int stopareanum);
+	void		(*AAS_RoutingStats)(void);
+	int			(*AAS_PrepareRoutingWarmup)(int numthreads);
+	void		(*AAS_WarmupRouting)(int index, int threadnum);
+	void		(*AAS_FinishRoutingWarmup)(void);
 	//--------------------------------------------
 	// be_aas_altroute.c
 	//--------------------------------------------
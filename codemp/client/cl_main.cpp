@@ -37,6 +37,14 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "snd_local.h"
 #include "sys/sys_loadlib.h"
 
+#include <vector>
+
+#ifdef USE_INTERNAL_ZLIB
+#include "zlib/zlib.h"
+#else
+#include <zlib.h>
+#endif
+
 cvar_t	*cl_renderer;
 
 cvar_t	*cl_nodelta;
@@ -426,6 +434,132 @@ void CL_DemoCompleted( void ) {
 	CL_NextDemo();
 }
 
+/*
+=======================================================================
+
+COMPRESSED DEMOS
+
+Servers with sv_demoCompress write .dm_26z demos, the frames of a deflate
+stream that inflate to the bytes of a plain .dm_26 (the layout is described
+in sv_demo.cpp).  They're inflated a frame at a time while they play.
+
+=======================================================================
+*/
+
+#define DEMO_FRAME_MAX	( 64 * 1024 * 1024 )	// way more than a server writes at once
+
+typedef struct demoInflate_s {
+	qboolean			active;
+	z_stream			zs;
+	std::vector<byte>	in;
+	std::vector<byte>	out;		// the current frame inflated
+	size_t				pos;		// read so far of out
+} demoInflate_t;
+
+static demoInflate_t	clDemoInflate;
+
+static void CL_DemoInflateEnd( void ) {
+	if ( clDemoInflate.active ) {
+		inflateEnd( &clDemoInflate.zs );
+	}
+	clDemoInflate.active = qfalse;
+	std::vector<byte>().swap( clDemoInflate.in );
+	std::vector<byte>().swap( clDemoInflate.out );
+	clDemoInflate.pos = 0;
+}
+
+// checks the header of the opened .dm_26z, qfalse if it can't be played
+static qboolean CL_DemoInflateStart( void ) {
+	int header[3];
+
+	CL_DemoInflateEnd();
+
+	if ( FS_Read( header, sizeof( header ), clc.demofile ) != sizeof( header )
+		|| LittleLong( header[0] ) != (int)DEMO_COMPRESSED_ID
+		|| LittleLong( header[1] ) != DEMO_COMPRESSED_VERSION
+		|| LittleLong( header[2] ) != PROTOCOL_VERSION ) {
+		return qfalse;
+	}
+
+	Com_Memset( &clDemoInflate.zs, 0, sizeof( clDemoInflate.zs ) );
+	if ( inflateInit( &clDemoInflate.zs ) != Z_OK ) {
+		return qfalse;
+	}
+	clDemoInflate.active = qtrue;
+	return qtrue;
+}
+
+// inflates the next frame, qfalse at the end of the demo or if it's damaged
+static qboolean CL_DemoInflateFrame( void ) {
+	demoInflate_t	*demo = &clDemoInflate;
+	int				header[2], rawLength, length, r;
+
+	demo->out.clear();
+	demo->pos = 0;
+
+	if ( FS_Read( header, sizeof( header ), clc.demofile ) != sizeof( header ) ) {
+		return qfalse;
+	}
+	rawLength = LittleLong( header[0] );
+	length = LittleLong( header[1] );
+
+	// -1, -1 ends the demo
+	if ( rawLength < 0 || length < 0 || rawLength > DEMO_FRAME_MAX || length > DEMO_FRAME_MAX ) {
+		return qfalse;
+	}
+
+	demo->in.resize( length );
+	if ( length && FS_Read( demo->in.data(), length, clc.demofile ) != length ) {
+		return qfalse;
+	}
+	if ( !rawLength ) {
+		return qtrue;	// only the end of the deflate stream
+	}
+
+	demo->out.resize( rawLength );
+	demo->zs.next_in = demo->in.data();
+	demo->zs.avail_in = (uInt)length;
+	demo->zs.next_out = demo->out.data();
+	demo->zs.avail_out = (uInt)rawLength;
+	r = inflate( &demo->zs, Z_SYNC_FLUSH );
+	if ( ( r != Z_OK && r != Z_STREAM_END ) || demo->zs.avail_out ) {
+		demo->out.clear();
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+=================
+CL_DemoRead
+
+FS_Read on the demo being played, inflating it if it's compressed
+=================
+*/
+static int CL_DemoRead( void *buffer, int len ) {
+	demoInflate_t	*demo = &clDemoInflate;
+	int				done = 0;
+
+	if ( !demo->active ) {
+		return FS_Read( buffer, len, clc.demofile );
+	}
+
+	while ( done < len ) {
+		if ( demo->pos == demo->out.size() ) {
+			if ( !CL_DemoInflateFrame() ) {
+				break;
+			}
+			continue;
+		}
+
+		int n = Q_min( len - done, (int)( demo->out.size() - demo->pos ) );
+		Com_Memcpy( (byte *)buffer + done, demo->out.data() + demo->pos, n );
+		demo->pos += n;
+		done += n;
+	}
+	return done;
+}
+
 /*
 =================
 CL_ReadDemoMessage
@@ -443,7 +577,7 @@ void CL_ReadDemoMessage( void ) {
 	}
 
 	// get the sequence number
-	r = FS_Read( &s, 4, clc.demofile);
+	r = CL_DemoRead( &s, 4 );
 	if ( r != 4 ) {
 		CL_DemoCompleted ();
 		return;
@@ -454,7 +588,7 @@ void CL_ReadDemoMessage( void ) {
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
 
 	// get the length
-	r = FS_Read (&buf.cursize, 4, clc.demofile);
+	r = CL_DemoRead( &buf.cursize, 4 );
 	if ( r != 4 ) {
 		CL_DemoCompleted ();
 		return;
@@ -467,7 +601,7 @@ void CL_ReadDemoMessage( void ) {
 	if ( buf.cursize > buf.maxsize ) {
 		Com_Error (ERR_DROP, "CL_ReadDemoMessage: demoMsglen > MAX_MSGLEN");
 	}
-	r = FS_Read( buf.data, buf.cursize, clc.demofile );
+	r = CL_DemoRead( buf.data, buf.cursize );
 	if ( r != buf.cursize ) {
 		Com_Printf( "Demo file was truncated.\n");
 		CL_DemoCompleted ();
@@ -504,8 +638,9 @@ demo <demoname>
 ====================
 */
 void CL_PlayDemo_f( void ) {
-	char		name[MAX_OSPATH], extension[32];
+	char		name[MAX_OSPATH], extension[32], zextension[32];
 	char		*arg;
+	qboolean	hasExtension;
 
 	if (Cmd_Argc() != 2) {
 		Com_Printf ("demo <demoname>\n");
@@ -522,13 +657,26 @@ void CL_PlayDemo_f( void ) {
 	CL_Disconnect( qtrue );
 
 	Com_sprintf(extension, sizeof(extension), ".dm_%d", PROTOCOL_VERSION);
-	if ( !Q_stricmp( arg + strlen(arg) - strlen(extension), extension ) ) {
+	Com_sprintf(zextension, sizeof(zextension), ".dm_%dz", PROTOCOL_VERSION);
+	hasExtension = (qboolean)( ( strlen(arg) > strlen(extension) && !Q_stricmp( arg + strlen(arg) - strlen(extension), extension ) )
+		|| ( strlen(arg) > strlen(zextension) && !Q_stricmp( arg + strlen(arg) - strlen(zextension), zextension ) ) );
+	if ( hasExtension ) {
 		Com_sprintf (name, sizeof(name), "demos/%s", arg);
 	} else {
 		Com_sprintf (name, sizeof(name), "demos/%s.dm_%d", arg, PROTOCOL_VERSION);
 	}
 
 	FS_FOpenFileRead( name, &clc.demofile, qtrue );
+	if ( !clc.demofile && !hasExtension ) {
+		// recorded by a server with sv_demoCompress
+		char zname[MAX_OSPATH];
+
+		Com_sprintf (zname, sizeof(zname), "demos/%s%s", arg, zextension);
+		FS_FOpenFileRead( zname, &clc.demofile, qtrue );
+		if ( clc.demofile ) {
+			Q_strncpyz( name, zname, sizeof( name ) );
+		}
+	}
 	if (!clc.demofile) {
 		if (!Q_stricmp(arg, "(null)"))
 		{
@@ -540,6 +688,12 @@ void CL_PlayDemo_f( void ) {
 		}
 		return;
 	}
+	if ( !Q_stricmp( name + strlen(name) - strlen(zextension), zextension ) && !CL_DemoInflateStart() ) {
+		FS_FCloseFile( clc.demofile );
+		clc.demofile = 0;
+		Com_Error( ERR_DROP, "%s is not a compressed demo this version can play", name );
+		return;
+	}
 	Q_strncpyz( clc.demoName, Cmd_Argv(1), sizeof( clc.demoName ) );
 
 	Con_Close();
@@ -791,6 +945,7 @@ void CL_Disconnect( qboolean showMainMenu ) {
 		FS_FCloseFile( clc.demofile );
 		clc.demofile = 0;
 	}
+	CL_DemoInflateEnd();
 
 	if ( cls.uiStarted && showMainMenu ) {
 		UIVM_SetActiveMenu( UIMENU_NONE );
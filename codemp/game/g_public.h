@@ -261,6 +261,21 @@ typedef struct sharedEntity_s {
 
 } sharedEntity_t;
 
+// one ray of trap->TraceBatch, the arguments of trap->Trace
+#define MAX_TRACE_BATCH		4096	// most requests one trap->TraceBatch takes
+
+typedef struct traceRequest_s {
+	vec3_t		start;
+	vec3_t		mins;
+	vec3_t		maxs;
+	vec3_t		end;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+	int			traceFlags;
+	int			useLod;
+} traceRequest_t;
+
 // playerstate mGameFlags
 #define	PSG_VOTED				(1<<0)		// already cast a vote
 #define PSG_TEAMVOTED			(1<<1)		// already cast a team vote
@@ -726,7 +741,8 @@ typedef enum gameImportLegacy_e {
 	G_CM_REGISTER_TERRAIN,
 	G_RMG_INIT,
 	G_BOT_UPDATEWAYPOINTS,
-	G_BOT_CALCULATEPATHS
+	G_BOT_CALCULATEPATHS,
+	G_TRACEBATCH
 } gameImportLegacy_t;
 
 typedef enum gameExportLegacy_e {
@@ -1108,6 +1124,9 @@ typedef struct gameImport_s {
 	void		(*G2API_CleanEntAttachments)			( void );
 	qboolean	(*G2API_OverrideServer)					( void *serverInstance );
 	void		(*G2API_GetSurfaceName)					( void *ghoul2, int surfNumber, int modelIndex, char *fillBuf );
+
+	// traces numRequests rays at once, sharing the entity lookup between rays close to each other
+	void		(*TraceBatch)							( trace_t *results, const traceRequest_t *requests, int numRequests );
 } gameImport_t;
 
 typedef struct gameExport_s {
@@ -993,6 +993,9 @@ void trap_Bot_UpdateWaypoints(int wpnum, wpobject_t **wps) {
 void trap_Bot_CalculatePaths(int rmg) {
 	Q_syscall(G_BOT_CALCULATEPATHS, rmg);
 }
+void trap_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests ) {
+	Q_syscall( G_TRACEBATCH, results, requests, numRequests );
+}
 
 
 // Translate import table funcptrs to syscalls
@@ -1075,6 +1078,7 @@ static void TranslateSyscalls( void ) {
 	trap->EntitiesInBox						= trap_EntitiesInBox;
 	trap->EntityContact						= SVSyscall_EntityContact;
 	trap->Trace								= SVSyscall_Trace;
+	trap->TraceBatch						= trap_TraceBatch;
 	trap->GetConfigstring					= trap_GetConfigstring;
 	trap->GetEntityToken					= trap_GetEntityToken;
 	trap->GetServerinfo						= trap_GetServerinfo;
@@ -44,11 +44,11 @@ void SetPlaneSignbits (cplane_t *out) {
 #endif //BSPC
 
 // to allow boxes to be treated as brush models, we allocate
-// some extra indexes along with those needed by the map
-#define	BOX_BRUSHES		1
-#define	BOX_SIDES		6
+// some extra indexes along with those needed by the map, one box per thread
+#define	BOX_BRUSHES		MAX_JOB_THREADS
+#define	BOX_SIDES		(6*MAX_JOB_THREADS)
 #define	BOX_LEAFS		2
-#define	BOX_PLANES		12
+#define	BOX_PLANES		(12*MAX_JOB_THREADS)
 
 #define	LL(x) x=LittleLong(x)
 
@@ -67,14 +67,15 @@ cvar_t		*cm_playerCurveClip;
 cvar_t		*cm_extraVerbose;
 #endif
 
-cmodel_t	box_model;
-cplane_t	*box_planes;
-cbrush_t	*box_brush;
+cmThread_t	cmThreads[MAX_JOB_THREADS];
+int			cmNumThreads = 1;
 
 
 
 void	CM_InitBoxHull (void);
 void	CM_FloodAreaConnections (clipMap_t &cm);
+static void CM_AllocChecks( clipMap_t &cm, int numThreads );
+static void CM_FreeChecks( clipMap_t &cm );
 
 //rwwRMG - added:
 clipMap_t	SubBSP[MAX_SUB_BSP];
@@ -240,6 +241,45 @@ void CM_BoundBrush( cbrush_t *b ) {
 }
 
 
+/*
+=================
+CM_BuildBrushPlanes
+
+Copies the side planes of every brush into blocks of four, laid out for
+testing a trace against four planes at once
+=================
+*/
+static void CM_BuildBrushPlanes( clipMap_t &cm ) {
+	cbrush_t		*b;
+	cbrushPlanes_t	*block;
+	cplane_t		*plane;
+	int				i, j, k, numBlocks;
+
+	numBlocks = 0;
+	for ( i = 0, b = cm.brushes ; i < cm.numBrushes ; i++, b++ ) {
+		numBlocks += ( b->numsides + 3 ) / 4;
+	}
+
+	if ( !numBlocks ) {
+		return;
+	}
+	block = (cbrushPlanes_t *)Hunk_Alloc( numBlocks * sizeof( *block ), h_high );
+
+	for ( i = 0, b = cm.brushes ; i < cm.numBrushes ; i++, b++ ) {
+		b->sidePlanes = block;
+
+		for ( j = 0 ; j < b->numsides ; j++ ) {
+			plane = b->sides[j].plane;
+			for ( k = 0 ; k < 3 ; k++ ) {
+				block[j >> 2].normal[k][j & 3] = plane->normal[k];
+				block[j >> 2].negative[k][j & 3] = ( plane->signbits & ( 1 << k ) ) ? ~0 : 0;
+			}
+			block[j >> 2].dist[j & 3] = plane->dist;
+		}
+		block += ( b->numsides + 3 ) / 4;
+	}
+}
+
 /*
 =================
 CMod_LoadBrushes
@@ -275,6 +315,7 @@ void CMod_LoadBrushes( const lump_t *l, clipMap_t &cm ) {
 		CM_BoundBrush( out );
 	}
 
+	CM_BuildBrushPlanes( cm );
 }
 
 /*
@@ -776,6 +817,8 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 
 	CM_FloodAreaConnections (cm);
 
+	CM_AllocChecks( cm, cmNumThreads );
+
 	// allow this to be cached if it is loaded by the server
 	if ( !clientload ) {
 		Q_strncpyz( cm.name, origName, sizeof( cm.name ) );
@@ -805,11 +848,13 @@ void CM_ClearMap( void )
 {
 	int		i;
 
+	CM_FreeChecks( cmg );
 	Com_Memset( &cmg, 0, sizeof( cmg ) );
 	CM_ClearLevelPatches();
 
 	for(i = 0; i < NumSubBSP; i++)
 	{
+		CM_FreeChecks( SubBSP[i] );
 		memset(&SubBSP[i], 0, sizeof(SubBSP[0]));
 	}
 	NumSubBSP = 0;
@@ -843,7 +888,7 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle, clipMap_t **clipMap ) {
 		{
 			*clipMap = &cmg;
 		}
-		return &box_model;
+		return &CM_GetThread( Job_ThreadNum() )->boxModel;
 	}
 
 	count = cmg.numSubModels;
@@ -902,6 +947,10 @@ int		CM_LeafCluster( int leafnum ) {
 	return cmg.leafs[leafnum].cluster;
 }
 
+int		CM_NumClusters( void ) {
+	return cmg.numClusters;
+}
+
 int		CM_LeafArea( int leafnum ) {
 	if ( leafnum < 0 || leafnum >= cmg.numLeafs ) {
 		Com_Error (ERR_DROP, "CM_LeafArea: bad number");
@@ -922,47 +971,53 @@ can just be stored out and get a proper clipping hull structure.
 */
 void CM_InitBoxHull (void)
 {
-	int			i;
+	int			i, t;
 	int			side;
 	cplane_t	*p;
 	cbrushside_t	*s;
+	cmThread_t	*thread;
 
-	box_planes = &cmg.planes[cmg.numPlanes];
+	for (t=0 ; t<MAX_JOB_THREADS ; t++)
+	{
+		thread = &cmThreads[t];
 
-	box_brush = &cmg.brushes[cmg.numBrushes];
-	box_brush->numsides = 6;
-	box_brush->sides = cmg.brushsides + cmg.numBrushSides;
-	box_brush->contents = CONTENTS_BODY;
+		thread->boxPlanes = &cmg.planes[cmg.numPlanes + t*12];
 
-	box_model.firstNode = -1;
-	box_model.leaf.numLeafBrushes = 1;
-//	box_model.leaf.firstLeafBrush = cmg.numBrushes;
-	box_model.leaf.firstLeafBrush = cmg.numLeafBrushes;
-	cmg.leafbrushes[cmg.numLeafBrushes] = cmg.numBrushes;
+		thread->boxBrush = &cmg.brushes[cmg.numBrushes + t];
+		thread->boxBrush->numsides = 6;
+		thread->boxBrush->sides = cmg.brushsides + cmg.numBrushSides + t*6;
+		thread->boxBrush->contents = CONTENTS_BODY;
 
-	for (i=0 ; i<6 ; i++)
-	{
-		side = i&1;
-
-		// brush sides
-		s = &cmg.brushsides[cmg.numBrushSides+i];
-		s->plane = 	cmg.planes + (cmg.numPlanes+i*2+side);
-		s->shaderNum = cmg.numShaders;
-
-		// planes
-		p = &box_planes[i*2];
-		p->type = i>>1;
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = 1;
-
-		p = &box_planes[i*2+1];
-		p->type = 3 + (i>>1);
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = -1;
-
-		SetPlaneSignbits( p );
+		Com_Memset( &thread->boxModel, 0, sizeof( thread->boxModel ) );
+		thread->boxModel.firstNode = -1;
+		thread->boxModel.leaf.numLeafBrushes = 1;
+		thread->boxModel.leaf.firstLeafBrush = cmg.numLeafBrushes + t;
+		cmg.leafbrushes[cmg.numLeafBrushes + t] = cmg.numBrushes + t;
+
+		for (i=0 ; i<6 ; i++)
+		{
+			side = i&1;
+
+			// brush sides
+			s = &thread->boxBrush->sides[i];
+			s->plane = 	thread->boxPlanes + (i*2+side);
+			s->shaderNum = cmg.numShaders;
+
+			// planes
+			p = &thread->boxPlanes[i*2];
+			p->type = i>>1;
+			p->signbits = 0;
+			VectorClear (p->normal);
+			p->normal[i>>1] = 1;
+
+			p = &thread->boxPlanes[i*2+1];
+			p->type = 3 + (i>>1);
+			p->signbits = 0;
+			VectorClear (p->normal);
+			p->normal[i>>1] = -1;
+
+			SetPlaneSignbits( p );
+		}
 	}
 }
 
@@ -973,12 +1028,17 @@ CM_TempBoxModel
 To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
 Capsules are handled differently though.
+
+Every thread has a box of its own, the handle is only good on the thread that
+made it.
 ===================
 */
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule ) {
+	cmThread_t	*thread = CM_GetThread( Job_ThreadNum() );
+	cplane_t	*box_planes = thread->boxPlanes;
 
-	VectorCopy( mins, box_model.mins );
-	VectorCopy( maxs, box_model.maxs );
+	VectorCopy( mins, thread->boxModel.mins );
+	VectorCopy( maxs, thread->boxModel.maxs );
 
 	if ( capsule ) {
 		return CAPSULE_MODEL_HANDLE;
@@ -997,12 +1057,95 @@ clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule
 	box_planes[10].dist = mins[2];
 	box_planes[11].dist = -mins[2];
 
-	VectorCopy( mins, box_brush->bounds[0] );
-	VectorCopy( maxs, box_brush->bounds[1] );
+	VectorCopy( mins, thread->boxBrush->bounds[0] );
+	VectorCopy( maxs, thread->boxBrush->bounds[1] );
 
 	return BOX_MODEL_HANDLE;
 }
 
+/*
+===================
+CM_GetThread
+
+Trace state of a thread, threads that weren't reserved can't trace
+===================
+*/
+cmThread_t *CM_GetThread( int threadNum ) {
+	if ( threadNum >= cmNumThreads ) {
+		Com_Error( ERR_DROP, "CM_GetThread: thread %i wasn't reserved for traces", threadNum );
+	}
+	return &cmThreads[threadNum];
+}
+
+/*
+===================
+CM_AllocChecks
+===================
+*/
+static void CM_AllocChecks( clipMap_t &cm, int numThreads ) {
+	int		count;
+
+	count = cm.numBrushes + BOX_BRUSHES + cm.numSurfaces;
+	for ( ; cm.numCheckThreads < numThreads ; cm.numCheckThreads++ ) {
+		cm.checks[cm.numCheckThreads] = (int *)Z_Malloc( count * sizeof( int ), TAG_BSP, qtrue );
+	}
+}
+
+/*
+===================
+CM_FreeChecks
+===================
+*/
+static void CM_FreeChecks( clipMap_t &cm ) {
+	int		i;
+
+	for ( i = 0 ; i < cm.numCheckThreads ; i++ ) {
+		Z_Free( cm.checks[i] );
+		cm.checks[i] = NULL;
+	}
+	cm.numCheckThreads = 0;
+}
+
+/*
+===================
+CM_ReserveThreads
+
+Lets jobs of a batch limited to maxThreads trace, call it before the batch
+===================
+*/
+void CM_ReserveThreads( int maxThreads ) {
+	int		i, numThreads;
+
+	numThreads = Job_NumThreads( maxThreads );
+	if ( numThreads <= cmNumThreads ) {
+		return;
+	}
+
+	if ( cmg.numNodes ) {
+		CM_AllocChecks( cmg, numThreads );
+	}
+	for ( i = 0 ; i < NumSubBSP ; i++ ) {
+		CM_AllocChecks( SubBSP[i], numThreads );
+	}
+	cmNumThreads = numThreads;
+}
+
+/*
+===================
+CM_SetTraceChecks
+
+Points a trace at the marks its thread keeps for a clip map
+===================
+*/
+void CM_SetTraceChecks( traceWork_t *tw, clipMap_t *local ) {
+	if ( tw->threadNum >= local->numCheckThreads ) {
+		tw->brushChecks = tw->patchChecks = NULL;
+		return;
+	}
+	tw->brushChecks = local->checks[tw->threadNum];
+	tw->patchChecks = tw->brushChecks + local->numBrushes + BOX_BRUSHES;
+}
+
 /*
 ===================
 CM_ModelBounds
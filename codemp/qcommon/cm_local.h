@@ -63,13 +63,28 @@ typedef struct cbrushside_s {
 	int			shaderNum;
 } cbrushside_t;
 
+// planes of the brush sides are tested four at a time where the compiler does
+// scalar float math in SSE registers too, so both ways round the same
+#if defined(__SSE2_MATH__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#define CM_SIMD_PLANES	1
+#else
+	#define CM_SIMD_PLANES	0
+#endif
+
+// the planes of four consecutive sides of a brush, unused lanes are zero
+typedef struct cbrushPlanes_s {
+	float				normal[3][4];
+	float				dist[4];
+	int					negative[3][4];	// ~0 where signbits has the axis set
+} cbrushPlanes_t;
+
 typedef struct cbrush_s {
 	int					shaderNum;		// the shader that determined the contents
 	int					contents;
 	vec3_t				bounds[2];
 	cbrushside_t		*sides;
 	unsigned short		numsides;
-	unsigned short		checkcount;		// to avoid repeated testings
+	cbrushPlanes_t		*sidePlanes;	// ( numsides + 3 ) / 4 blocks, NULL for the box brushes
 } cbrush_t;
 
 class CCMShader
@@ -87,7 +102,6 @@ public:
 };
 
 typedef struct cPatch_s {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -145,9 +159,29 @@ typedef struct clipMap_s {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
+
+	// to avoid repeated testings, one set per thread that traces: numBrushes
+	// (plus the box brushes) marks followed by numSurfaces marks
+	int			*checks[MAX_JOB_THREADS];
+	int			numCheckThreads;
 } clipMap_t;
 
+/*
+Everything a trace changes is kept per thread, so traces can run from jobs of
+the worker pool at the same time as the main thread.  Thread 0 is anything
+outside of a job, including the thread that issued the batch.  Only threads
+below cmNumThreads may trace, CM_ReserveThreads raises that before a batch.
+*/
+typedef struct cmThread_s {
+	int			checkcount;				// incremented on each trace
+	cmodel_t	boxModel;				// CM_TempBoxModel of this thread
+	cplane_t	*boxPlanes;
+	cbrush_t	*boxBrush;
+} cmThread_t;
+
+extern	cmThread_t	cmThreads[MAX_JOB_THREADS];
+extern	int			cmNumThreads;
+
 
 // keep 1/8 unit away to keep the position valid before network snapping
 // and to avoid various numeric issues
@@ -160,6 +194,7 @@ extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
 extern	cvar_t		*cm_extraVerbose;
+extern	qboolean	cm_simdPlanes;
 
 // cm_test.c
 
@@ -197,6 +232,11 @@ typedef struct traceWork_s { //rwwRMG - modified
 	bool			startout;
 	bool			getout;
 
+	int				threadNum;		// Job_ThreadNum of the thread tracing
+	int				checkcount;
+	int				*brushChecks;	// marks of the clip map being traced
+	int				*patchChecks;
+
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -215,6 +255,8 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum );
 void CM_BoxLeafnums_r( leafList_t *ll, int nodenum );
 
 cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle, clipMap_t **clipMap = 0 );
+cmThread_t	*CM_GetThread( int threadNum );
+void		CM_SetTraceChecks( traceWork_t *tw, clipMap_t *local );
 
 // cm_patch.c
 
@@ -55,6 +55,7 @@ int			CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *boxList,
 //rwwRMG - changed to boxList to not conflict with list type
 
 int			CM_LeafCluster (int leafnum);
+int			CM_NumClusters (void);
 int			CM_LeafArea (int leafnum);
 
 void		CM_AdjustAreaPortalState( int area1, int area2, qboolean open );
@@ -80,3 +81,22 @@ void CM_DrawDebugSurface( void (*drawPoly)(int color, int numPoints, float *poin
 
 // cm_trace.cpp
 bool CM_CullWorldBox (const cplane_t *frustum, const vec3pair_t bounds);
+
+typedef struct cmBoxTrace_s {
+	vec3_t			start, end;
+	vec3_t			mins, maxs;
+	clipHandle_t	model;
+	int				brushmask;
+	int				capsule;
+	trace_t			trace;			// filled in by CM_BoxTraceBatch
+} cmBoxTrace_t;
+
+void		CM_BoxTraceBatch( cmBoxTrace_t *traces, int count, int maxThreads );
+#ifndef FINAL_BUILD
+void		CM_TraceTest_f( void );
+#endif
+
+// cm_load.cpp
+// traces, point contents and temp box models are safe from jobs of batches
+// limited to maxThreads once this has been called on the main thread
+void		CM_ReserveThreads( int maxThreads );
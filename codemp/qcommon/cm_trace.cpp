@@ -23,6 +23,12 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "cm_local.h"
 
+#if CM_SIMD_PLANES
+#include <emmintrin.h>
+#endif
+
+qboolean	cm_simdPlanes = qtrue;		// cmTraceTest turns it off to compare
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -124,6 +130,53 @@ POSITION TESTING
 ===============================================================================
 */
 
+#if CM_SIMD_PLANES
+/*
+================
+CM_SidePlaneDists
+
+Distances of the trace start ( and end, if d2 is given ) from four side planes
+pushed out by the box, done exactly like the scalar code does it for one plane:
+
+dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+d1 = DotProduct( tw->start, plane->normal ) - dist;
+================
+*/
+static QINLINE void CM_SidePlaneDists( const cbrushPlanes_t *block, const traceWork_t *tw, float *d1, float *d2 ) {
+	__m128	nx, ny, nz;
+	__m128	mx, my, mz;
+	__m128	ox, oy, oz;
+	__m128	dist;
+
+	nx = _mm_loadu_ps( block->normal[0] );
+	ny = _mm_loadu_ps( block->normal[1] );
+	nz = _mm_loadu_ps( block->normal[2] );
+
+	// offsets[signbits][i] is size[1][i] where signbits has bit i set
+	mx = _mm_castsi128_ps( _mm_loadu_si128( (const __m128i *)block->negative[0] ) );
+	my = _mm_castsi128_ps( _mm_loadu_si128( (const __m128i *)block->negative[1] ) );
+	mz = _mm_castsi128_ps( _mm_loadu_si128( (const __m128i *)block->negative[2] ) );
+	ox = _mm_or_ps( _mm_and_ps( mx, _mm_set1_ps( tw->offsets[7][0] ) ), _mm_andnot_ps( mx, _mm_set1_ps( tw->offsets[0][0] ) ) );
+	oy = _mm_or_ps( _mm_and_ps( my, _mm_set1_ps( tw->offsets[7][1] ) ), _mm_andnot_ps( my, _mm_set1_ps( tw->offsets[0][1] ) ) );
+	oz = _mm_or_ps( _mm_and_ps( mz, _mm_set1_ps( tw->offsets[7][2] ) ), _mm_andnot_ps( mz, _mm_set1_ps( tw->offsets[0][2] ) ) );
+
+	dist = _mm_sub_ps( _mm_loadu_ps( block->dist ),
+		_mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) ) );
+
+	_mm_storeu_ps( d1, _mm_sub_ps( _mm_add_ps( _mm_add_ps(
+		_mm_mul_ps( _mm_set1_ps( tw->start[0] ), nx ),
+		_mm_mul_ps( _mm_set1_ps( tw->start[1] ), ny ) ),
+		_mm_mul_ps( _mm_set1_ps( tw->start[2] ), nz ) ), dist ) );
+
+	if ( d2 ) {
+		_mm_storeu_ps( d2, _mm_sub_ps( _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( _mm_set1_ps( tw->end[0] ), nx ),
+			_mm_mul_ps( _mm_set1_ps( tw->end[1] ), ny ) ),
+			_mm_mul_ps( _mm_set1_ps( tw->end[2] ), nz ) ), dist ) );
+	}
+}
+#endif
+
 /*
 ================
 CM_TestBoxInBrush
@@ -179,6 +232,30 @@ void CM_TestBoxInBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush ) {
 			}
 		}
 	} else {
+#if CM_SIMD_PLANES
+		if ( brush->sidePlanes && cm_simdPlanes ) {
+			float	d[4];
+			int		j;
+
+			// the first six planes are the axial planes, so we only
+			// need to test the remainder
+			for ( i = 4 ; i < brush->numsides ; i += 4 ) {
+				CM_SidePlaneDists( &brush->sidePlanes[i >> 2], tw, d, NULL );
+				for ( j = ( i < 6 ) ? 6 - i : 0 ; j < 4 && i + j < brush->numsides ; j++ ) {
+					// if completely in front of face, no intersection
+					if ( d[j] > 0 ) {
+						return;
+					}
+				}
+			}
+
+			// inside this brush
+			trace.startsolid = trace.allsolid = qtrue;
+			trace.fraction = 0;
+			trace.contents = brush->contents;
+			return;
+		}
+#endif
 		// the first six planes are the axial planes, so we only
 		// need to test the remainder
 		for ( i = 6 ; i < brush->numsides ; i++ ) {
@@ -213,6 +290,7 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 {
 	int			k;
 	int			brushnum;
+	int			surfaceNum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -220,10 +298,10 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
 		b = &local->brushes[brushnum];
-		if (b->checkcount == local->checkcount) {
+		if (tw->brushChecks[brushnum] == tw->checkcount) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		tw->brushChecks[brushnum] = tw->checkcount;
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -242,14 +320,15 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfaceNum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfaceNum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( tw->patchChecks[surfaceNum] == tw->checkcount ) {
 				continue;	// already checked this brush in another leaf
 			}
-			patch->checkcount = local->checkcount;
+			tw->patchChecks[surfaceNum] = tw->checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -369,6 +448,7 @@ void CM_TestBoundingBoxInCapsule( traceWork_t *tw, trace_t &trace, clipHandle_t
 	h = CM_TempBoxModel(tw->size[0], tw->size[1], qfalse);
 	// calculate collision
 	cmod = CM_ClipHandleToModel( h );
+	CM_SetTraceChecks( tw, &cmg );
 	CM_TestInLeaf( tw, trace, &cmod->leaf, &cmg );
 }
 
@@ -399,12 +479,9 @@ void CM_PositionTest( traceWork_t *tw, trace_t &trace ) {
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
 
-	cmg.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-
-	cmg.checkcount++;
+	CM_SetTraceChecks( tw, &cmg );
 
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
@@ -433,7 +510,9 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, trace_t &trace, cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	if ( !tw->threadNum ) {
+		c_patch_traces++;
+	}
 
 	oldFrac = trace.fraction;
 
@@ -447,25 +526,18 @@ void CM_TraceThroughPatch( traceWork_t *tw, trace_t &trace, cPatch_t *patch ) {
 
 /*
 ================
-CM_PlaneCollision
+CM_PlaneCollisionDists
 
+  CM_PlaneCollision with the distances of start and end already known
   Returns false for a quick getout
 ================
 */
 
-bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
+static QINLINE bool CM_PlaneCollisionDists(traceWork_t *tw, cbrushside_t *side, float d1, float d2)
 {
-	float			dist, f;
-	float			d1, d2;
-
+	float			f;
 	cplane_t		*plane = side->plane;
 
-	// adjust the plane distance appropriately for mins/maxs
-	dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
-
-	d1 = DotProduct( tw->start, plane->normal ) - dist;
-	d2 = DotProduct( tw->end, plane->normal ) - dist;
-
 	if (d2 > 0.0f)
 	{
 		// endpoint is not in solid
@@ -528,6 +600,29 @@ bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
 	return(true);
 }
 
+/*
+================
+CM_PlaneCollision
+
+  Returns false for a quick getout
+================
+*/
+bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
+{
+	float			dist;
+	float			d1, d2;
+
+	cplane_t		*plane = side->plane;
+
+	// adjust the plane distance appropriately for mins/maxs
+	dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+
+	d1 = DotProduct( tw->start, plane->normal ) - dist;
+	d2 = DotProduct( tw->end, plane->normal ) - dist;
+
+	return CM_PlaneCollisionDists(tw, side, d1, d2);
+}
+
 /*
 ================
 CM_TraceThroughBrush
@@ -569,6 +664,29 @@ void CM_TraceThroughBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush, boo
 	// find the latest time the trace crosses a plane towards the interior
 	// and the earliest time the trace crosses a plane towards the exterior
 	//
+#if CM_SIMD_PLANES
+	if ( brush->sidePlanes && cm_simdPlanes )
+	{
+		float	d1[4], d2[4];
+		int		j;
+
+		for (i = 0; i < brush->numsides; i += 4)
+		{
+			CM_SidePlaneDists( &brush->sidePlanes[i >> 2], tw, d1, d2 );
+
+			for (j = 0; j < 4 && i + j < brush->numsides; j++)
+			{
+				side = brush->sides + i + j;
+
+				if(!CM_PlaneCollisionDists(tw, side, d1[j], d2[j]))
+				{
+					return;
+				}
+			}
+		}
+	}
+	else
+#endif
 	for (i = 0; i < brush->numsides; i++)
 	{
 		side = brush->sides + i;
@@ -651,6 +769,7 @@ CM_TraceThroughLeaf
 void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLeaf_t *leaf ) {
 	int			k;
 	int			brushnum;
+	int			surfaceNum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -659,10 +778,10 @@ void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLe
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
 
 		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount ) {
+		if ( tw->brushChecks[brushnum] == tw->checkcount ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		tw->brushChecks[brushnum] = tw->checkcount;
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -682,14 +801,15 @@ void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLe
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfaceNum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfaceNum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( tw->patchChecks[surfaceNum] == tw->checkcount ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
+			tw->patchChecks[surfaceNum] = tw->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -993,6 +1113,7 @@ void CM_TraceBoundingBoxThroughCapsule( traceWork_t *tw, trace_t &trace, clipHan
 	h = CM_TempBoxModel(tw->size[0], tw->size[1], qfalse);
 	// calculate collision
 	cmod = CM_ClipHandleToModel( h );
+	CM_SetTraceChecks( tw, &cmg );
 	CM_TraceThroughLeaf( tw, trace, &cmg, &cmod->leaf );
 }
 
@@ -1007,6 +1128,7 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 {
 	int			k;
 	int			brushnum;
+	int			surfaceNum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -1016,11 +1138,11 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 		brushnum = local->leafbrushes[leaf->firstLeafBrush + k];
 
 		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount )
+		if ( tw->brushChecks[brushnum] == tw->checkcount )
 		{
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		tw->brushChecks[brushnum] = tw->checkcount;
 
 		if ( !(b->contents & tw->contents) )
 		{
@@ -1041,14 +1163,15 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfaceNum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfaceNum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( tw->patchChecks[surfaceNum] == tw->checkcount ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
+			tw->patchChecks[surfaceNum] = tw->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1222,16 +1345,24 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
 	vec3_t		offset;
 	cmodel_t	*cmod;
 	clipMap_t	*local = 0;
+	cmThread_t	*thread;
+
+	// fill in a default trace
+	Com_Memset( &tw, 0, sizeof(tw) );
+	memset(trace, 0, sizeof(*trace));
+
+	tw.threadNum = Job_ThreadNum();
+	thread = CM_GetThread( tw.threadNum );
 
 	cmod = CM_ClipHandleToModel( model, &local );
 
-	local->checkcount++;		// for multi-check avoidance
+	tw.checkcount = ++thread->checkcount;	// for multi-check avoidance
+	CM_SetTraceChecks( &tw, local );
 
-	c_traces++;				// for statistics, may be zeroed
+	if ( !tw.threadNum ) {
+		c_traces++;				// for statistics, may be zeroed
+	}
 
-	// fill in a default trace
-	Com_Memset( &tw, 0, sizeof(tw) );
-	memset(trace, 0, sizeof(*trace));
 	trace->fraction = 1;	// assume it goes the entire distance until shown otherwise
 	VectorCopy(origin, tw.modelOrigin);
 
@@ -1618,3 +1749,171 @@ bool CM_CullWorldBox (const cplane_t *frustum, const vec3pair_t bounds)
 
 	return(CM_CullBox(frustum, transformed));
 }
+
+/*
+===============================================================================
+
+BATCHED TRACES
+
+===============================================================================
+*/
+
+#define	TRACE_BATCH_CHUNK	16		// traces per job, a single one is too little work
+
+typedef struct traceBatch_s {
+	cmBoxTrace_t	*traces;
+	int				count;
+} traceBatch_t;
+
+static void CM_BoxTraceJob( void *data, int index, int threadNum ) {
+	traceBatch_t	*batch = (traceBatch_t *)data;
+	cmBoxTrace_t	*t;
+	int				i, end;
+
+	end = ( index + 1 ) * TRACE_BATCH_CHUNK;
+	if ( end > batch->count ) {
+		end = batch->count;
+	}
+
+	for ( i = index * TRACE_BATCH_CHUNK ; i < end ; i++ ) {
+		t = &batch->traces[i];
+		CM_BoxTrace( &t->trace, t->start, t->end, t->mins, t->maxs, t->model, t->brushmask, t->capsule );
+	}
+}
+
+/*
+==================
+CM_BoxTraceBatch
+
+Runs CM_BoxTrace for every entry, spread over up to maxThreads threads of the
+worker pool.  Handles from CM_TempBoxModel only mean something on the thread
+that made them, so those can't be batched.
+==================
+*/
+void CM_BoxTraceBatch( cmBoxTrace_t *traces, int count, int maxThreads ) {
+	traceBatch_t	batch;
+
+	batch.traces = traces;
+	batch.count = count;
+
+	CM_ReserveThreads( maxThreads );
+	Job_ParallelFor( ( count + TRACE_BATCH_CHUNK - 1 ) / TRACE_BATCH_CHUNK, maxThreads, CM_BoxTraceJob, &batch );
+}
+
+#ifndef FINAL_BUILD
+/*
+==================
+CM_TraceTest_f
+
+Traces random boxes through the loaded map one at a time, again with the side
+planes tested one by one instead of four at a time, and then as batches on the
+worker pool.  The results have to come out exactly the same every time.
+==================
+*/
+void CM_TraceTest_f( void ) {
+	static const vec3_t	playerMins = { -15, -15, -24 }, playerMaxs = { 15, 15, 32 };
+	cmBoxTrace_t		*traces;
+	trace_t				*serial;
+	vec3_t				worldMins, worldMaxs;
+	int					count, numThreads, passes;
+	int					i, j, pass, mismatches;
+	int					numModels;
+	int64_t				start, timeSerial, timeBatch;
+
+	if ( !cmg.numNodes ) {
+		Com_Printf( "cmTraceTest: no map loaded\n" );
+		return;
+	}
+
+	count = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 20000;
+	numThreads = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : MAX_JOB_THREADS;
+	passes = Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : 4;
+	if ( count < 1 ) {
+		count = 1;
+	}
+	numThreads = Job_NumThreads( numThreads );
+
+	traces = (cmBoxTrace_t *)Z_Malloc( count * sizeof( *traces ), TAG_TEMP_WORKSPACE, qtrue );
+	serial = (trace_t *)Z_Malloc( count * sizeof( *serial ), TAG_TEMP_WORKSPACE, qtrue );
+
+	CM_GetWorldBounds( worldMins, worldMaxs );
+	numModels = CM_NumInlineModels();
+
+	// a quarter points, the rest player boxes, a few against brush models
+	for ( i = 0 ; i < count ; i++ ) {
+		cmBoxTrace_t *t = &traces[i];
+
+		for ( j = 0 ; j < 3 ; j++ ) {
+			t->start[j] = worldMins[j] + ( worldMaxs[j] - worldMins[j] ) * random();
+			t->end[j] = t->start[j] + crandom() * 1024.0f;
+		}
+		if ( i & 3 ) {
+			VectorCopy( playerMins, t->mins );
+			VectorCopy( playerMaxs, t->maxs );
+		}
+		t->model = ( numModels > 1 && !( i % 16 ) ) ? 1 + rand() % ( numModels - 1 ) : 0;
+		t->brushmask = ( i & 1 ) ? MASK_PLAYERSOLID : MASK_SHOT;
+		t->capsule = qfalse;
+	}
+
+	start = Sys_Microseconds();
+	for ( i = 0 ; i < count ; i++ ) {
+		cmBoxTrace_t *t = &traces[i];
+		CM_BoxTrace( &serial[i], t->start, t->end, t->mins, t->maxs, t->model, t->brushmask, t->capsule );
+	}
+	timeSerial = Sys_Microseconds() - start;
+
+	mismatches = 0;
+#if CM_SIMD_PLANES
+	int64_t timeScalar;
+
+	cm_simdPlanes = qfalse;
+	start = Sys_Microseconds();
+	for ( i = 0 ; i < count ; i++ ) {
+		cmBoxTrace_t *t = &traces[i];
+		CM_BoxTrace( &t->trace, t->start, t->end, t->mins, t->maxs, t->model, t->brushmask, t->capsule );
+	}
+	timeScalar = Sys_Microseconds() - start;
+	cm_simdPlanes = qtrue;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( memcmp( &traces[i].trace, &serial[i], sizeof( serial[i] ) ) ) {
+			if ( !mismatches ) {
+				Com_Printf( "cmTraceTest: trace %i differs with scalar planes, fraction %f / %f\n",
+					i, traces[i].trace.fraction, serial[i].fraction );
+			}
+			mismatches++;
+		}
+	}
+	Com_Printf( "cmTraceTest: side planes four at a time %i usec, one at a time %i usec\n",
+		(int)timeSerial, (int)timeScalar );
+#endif
+
+	timeBatch = 0;
+	for ( pass = 0 ; pass < passes ; pass++ ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			Com_Memset( &traces[i].trace, 0xff, sizeof( traces[i].trace ) );
+		}
+
+		start = Sys_Microseconds();
+		CM_BoxTraceBatch( traces, count, numThreads );
+		timeBatch += Sys_Microseconds() - start;
+
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( memcmp( &traces[i].trace, &serial[i], sizeof( serial[i] ) ) ) {
+				if ( !mismatches ) {
+					Com_Printf( "cmTraceTest: trace %i of pass %i differs, fraction %f / %f\n",
+						i, pass, traces[i].trace.fraction, serial[i].fraction );
+				}
+				mismatches++;
+			}
+		}
+	}
+
+	Com_Printf( "cmTraceTest: %i traces, %i threads, %i passes: serial %i usec, batched %i usec per pass, %i mismatches\n",
+		count, numThreads, passes, (int)timeSerial, passes ? (int)( timeBatch / passes ) : 0, mismatches );
+
+	Z_Free( serial );
+	Z_Free( traces );
+}
+#endif	// FINAL_BUILD
@@ -249,6 +249,17 @@ void NORETURN QDECL Com_Error( int code, const char *fmt, ... ) {
 	static int	errorCount;
 	int			currentTime;
 
+	if ( Job_InJob() ) {
+		char message[MAXPRINTMSG];
+
+		// the thread that started the job raises it once the other jobs are done
+		va_start (argptr,fmt);
+		Q_vsnprintf (message,sizeof(message), fmt,argptr);
+		va_end (argptr);
+
+		Job_Error( code, message );
+	}
+
 	if ( com_errorEntered ) {
 		Sys_Error( "recursive error after: %s", com_errorMessage );
 	}
@@ -1178,6 +1189,8 @@ void Com_Init( char *commandLine ) {
 		Cmd_AddCommand ("quit", Com_Quit_f, "Quits the game" );
 #ifndef FINAL_BUILD
 		Cmd_AddCommand ("changeVectors", MSG_ReportChangeVectors_f );
+		Cmd_AddCommand ("msgHuffTest", MSG_HuffTest_f, "Check the Huffman tables against the trees and time entity deltas" );
+		Cmd_AddCommand ("cmTraceTest", CM_TraceTest_f, "Check traces run on the worker pool against serial ones on the loaded map" );
 #endif
 		Cmd_AddCommand ("writeconfig", Com_WriteConfig_f, "Write the configuration to file" );
 		Cmd_SetCommandCompletionFunc( "writeconfig", Cmd_CompleteCfgName );
@@ -1517,6 +1530,10 @@ void Com_Frame( void ) {
 
 		timeVal = Com_TimeVal(minMsec);
 		do {
+			// A dedicated server can sleep right up to the next frame where that is supported
+			if(com_dedicated->integer && !com_busyWait->integer && timeVal > 0 && NET_WaitTimed(timeVal))
+				continue;
+
 			// Busy sleep the last millisecond for better timeout precision
 			if(com_busyWait->integer || timeVal < 1)
 				NET_Sleep(0);
@@ -1677,6 +1694,8 @@ void Com_Shutdown (void)
 	}
 
 	MSG_shutdownHuffman();
+
+	Job_Shutdown();
 /*
 	// Only used for testing changes to huffman frequency table when tuning.
 	{
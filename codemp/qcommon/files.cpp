@@ -50,6 +50,10 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 	#include <unistd.h>
 #endif
 
+#include <map>
+#include <string>
+#include <vector>
+
 /*
 =============================================================================
 
@@ -243,6 +247,9 @@ static cvar_t		*fs_cdpath;
 static cvar_t		*fs_copyfiles;
 static cvar_t		*fs_gamedirvar;
 static cvar_t		*fs_dirbeforepak; //rww - when building search path, keep directories at top and insert pk3's under them
+static cvar_t		*fs_cacheSize;
+static cvar_t		*fs_loadThreads;
+static cvar_t		*fs_pakIndexCache;
 static searchpath_t	*fs_searchpaths;
 static int			fs_readCount;			// total bytes read
 static int			fs_loadCount;			// total files read
@@ -267,6 +274,7 @@ typedef struct fileHandleData_s {
 	int			fileSize;
 	int			zipFilePos;
 	int			zipFileLen;
+	pack_t		*zipPack;
 	qboolean	zipFile;
 	char		name[MAX_ZPATH];
 } fileHandleData_t;
@@ -377,6 +385,201 @@ static long FS_HashFileName( const char *fname, int hashSize ) {
 	return hash;
 }
 
+/*
+=============================================================================
+
+FILE INDEX
+
+Every file in the loaded pk3s goes into one open addressing table, keyed by
+its name (case and separator insensitive, like FS_FilenameCompare) and
+pointing at the first pak on the search path that has it.  FS_FOpenFileRead
+looks into that pak only, instead of hashing the name for every pak.
+
+Directories aren't indexed, files come and go there.  Instead an entry
+remembers that none of the directories ahead of its pak had the file, and a
+name no pak has gets an entry of its own the first time it isn't found.  That
+only holds while fs_indexGeneration stays the same, which changes whenever
+the engine creates or renames a file or the pure pak list changes.
+
+The index is built again whenever the search paths change.
+
+=============================================================================
+*/
+
+#define FS_INDEX_MAX_MISSING	16384	// names no pak has that are remembered
+
+typedef struct fileIndexEntry_s {
+	fileInPack_t	*file;			// name and position in the pak
+	searchpath_t	*search;		// first pak that has the file, NULL if none
+	unsigned int	hash;
+	int				dirsMissing;	// fs_indexGeneration when no directory ahead of search had it
+} fileIndexEntry_t;
+
+static fileIndexEntry_t	*fs_indexEntries;
+static int				fs_indexNumEntries;
+static int				fs_indexMaxEntries;
+static int				*fs_indexTable;			// entry + 1, 0 if free
+static int				fs_indexTableSize;		// power of two, at least twice fs_indexMaxEntries
+static int				fs_indexNumMissing;
+static int				fs_indexGeneration = 1;
+
+static unsigned int FS_IndexHash( const char *name ) {
+	unsigned int hash = 2166136261u;
+	int c;
+
+	while ( ( c = *name++ ) != '\0' ) {
+		if ( c >= 'A' && c <= 'Z' ) {
+			c += 'a' - 'A';
+		}
+		if ( c == '\\' || c == ':' ) {
+			c = '/';
+		}
+		hash = ( hash ^ (unsigned int)c ) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+=================
+FS_IndexSlot
+
+The slot holding name, or the free slot it would go in
+=================
+*/
+static int *FS_IndexSlot( const char *name, unsigned int hash ) {
+	int i;
+
+	for ( i = hash & ( fs_indexTableSize - 1 ); fs_indexTable[i]; i = ( i + 1 ) & ( fs_indexTableSize - 1 ) ) {
+		fileIndexEntry_t *entry = &fs_indexEntries[fs_indexTable[i] - 1];
+
+		if ( entry->hash == hash && !FS_FilenameCompare( entry->file->name, name ) ) {
+			break;
+		}
+	}
+	return &fs_indexTable[i];
+}
+
+static fileIndexEntry_t *FS_IndexFind( const char *name ) {
+	int *slot;
+
+	if ( !fs_indexTable ) {
+		return NULL;
+	}
+	slot = FS_IndexSlot( name, FS_IndexHash( name ) );
+	return *slot ? &fs_indexEntries[*slot - 1] : NULL;
+}
+
+static fileIndexEntry_t *FS_IndexAdd( int *slot, fileInPack_t *file, searchpath_t *search, unsigned int hash ) {
+	fileIndexEntry_t *entry = &fs_indexEntries[fs_indexNumEntries];
+
+	entry->file = file;
+	entry->search = search;
+	entry->hash = hash;
+	entry->dirsMissing = 0;
+	*slot = ++fs_indexNumEntries;
+	return entry;
+}
+
+/*
+=================
+FS_IndexAddMissing
+
+Remembers a name that isn't in any pak or directory
+=================
+*/
+static void FS_IndexAddMissing( const char *name ) {
+	fileIndexEntry_t *entry;
+	fileInPack_t *file;
+	unsigned int hash;
+	int *slot;
+
+	if ( !fs_indexTable || fs_indexNumMissing >= FS_INDEX_MAX_MISSING ) {
+		return;
+	}
+
+	hash = FS_IndexHash( name );
+	slot = FS_IndexSlot( name, hash );
+	if ( *slot ) {
+		return;
+	}
+
+	file = (fileInPack_t *)Z_Malloc( sizeof( *file ) + strlen( name ) + 1, TAG_FILESYS, qtrue );
+	file->name = (char *)( file + 1 );
+	strcpy( file->name, name );
+
+	entry = FS_IndexAdd( slot, file, NULL, hash );
+	entry->dirsMissing = fs_indexGeneration;
+	fs_indexNumMissing++;
+}
+
+static void FS_FreeFileIndex( void ) {
+	int i;
+
+	for ( i = 0; i < fs_indexNumEntries; i++ ) {
+		if ( !fs_indexEntries[i].search ) {
+			Z_Free( fs_indexEntries[i].file );
+		}
+	}
+	if ( fs_indexEntries ) {
+		Z_Free( fs_indexEntries );
+		fs_indexEntries = NULL;
+	}
+	if ( fs_indexTable ) {
+		Z_Free( fs_indexTable );
+		fs_indexTable = NULL;
+	}
+	fs_indexNumEntries = fs_indexMaxEntries = fs_indexTableSize = 0;
+	fs_indexNumMissing = 0;
+}
+
+/*
+=================
+FS_BuildFileIndex
+
+Called whenever the search paths change
+=================
+*/
+static void FS_BuildFileIndex( void ) {
+	searchpath_t *search;
+	int i;
+
+	FS_FreeFileIndex();
+	fs_indexGeneration++;
+
+	fs_indexMaxEntries = FS_INDEX_MAX_MISSING;
+	for ( search = fs_searchpaths; search; search = search->next ) {
+		if ( search->pack ) {
+			fs_indexMaxEntries += search->pack->numfiles;
+		}
+	}
+	for ( fs_indexTableSize = 1024; fs_indexTableSize < fs_indexMaxEntries * 2; fs_indexTableSize <<= 1 ) {
+	}
+
+	fs_indexEntries = (fileIndexEntry_t *)Z_Malloc( fs_indexMaxEntries * sizeof( *fs_indexEntries ), TAG_FILESYS, qfalse );
+	fs_indexTable = (int *)Z_Malloc( fs_indexTableSize * sizeof( *fs_indexTable ), TAG_FILESYS, qtrue );
+
+	for ( search = fs_searchpaths; search; search = search->next ) {
+		if ( !search->pack ) {
+			continue;
+		}
+		// backwards, a name that is in a pak twice is found on its last entry
+		for ( i = search->pack->numfiles - 1; i >= 0; i-- ) {
+			fileInPack_t *file = &search->pack->buildBuffer[i];
+			unsigned int hash;
+			int *slot;
+
+			if ( !file->name ) {
+				continue;	// the zip directory was cut short
+			}
+			hash = FS_IndexHash( file->name );
+			slot = FS_IndexSlot( file->name, hash );
+			if ( !*slot ) {
+				FS_IndexAdd( slot, file, search, hash );
+			}
+		}
+	}
+}
+
 static fileHandle_t FS_HandleForFile(void) {
 	int		i;
 
@@ -540,6 +743,9 @@ qboolean FS_CreatePath (char *OSPath) {
 		return qtrue;
 	}
 
+	// a file is about to show up, forget which ones were missing
+	fs_indexGeneration++;
+
 	Q_strncpyz( path, OSPath, sizeof( path ) );
 	FS_ReplaceSeparators( path );
 
@@ -926,6 +1132,8 @@ void FS_SV_Rename( const char *from, const char *to, qboolean safe ) {
 		FS_CheckFilenameIsMutable( to_ospath, __func__ );
 	}
 
+	fs_indexGeneration++;
+
 	if (rename( from_ospath, to_ospath )) {
 		// Failed, try copying it and deleting the original
 		FS_CopyFile ( from_ospath, to_ospath );
@@ -956,6 +1164,8 @@ void FS_Rename( const char *from, const char *to ) {
 
 	FS_CheckFilenameIsMutable( to_ospath, __func__ );
 
+	fs_indexGeneration++;
+
 	if (rename( from_ospath, to_ospath )) {
 		// Failed, try copying it and deleting the original
 		FS_CopyFile ( from_ospath, to_ospath );
@@ -1268,6 +1478,8 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 	//void			*temp;
 	int				l;
 	bool			isUserConfig = false;
+	fileIndexEntry_t	*indexed = NULL;
+	bool			useIndex;
 
 	hash = 0;
 
@@ -1303,6 +1515,16 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 
 	isUserConfig = !Q_stricmp( filename, "autoexec.cfg" ) || !Q_stricmp( filename, Q3CONFIG_CFG );
 
+	// the index knows the only pak worth looking in, unless that one isn't
+	// pure and a later one has to be found the slow way
+	useIndex = fs_indexTable && !isUserConfig && !fs_copyfiles->integer;
+	if ( useIndex ) {
+		indexed = FS_IndexFind( filename );
+		if ( indexed && indexed->search && !FS_PakIsPure( indexed->search->pack ) ) {
+			useIndex = false;
+		}
+	}
+
 	//
 	// search through the path, one element at a time
 	//
@@ -1322,6 +1544,14 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 		bFasterToReOpenUsingNewLocalFile = qfalse;
 
 		for ( search = fs_searchpaths ; search ; search = search->next ) {
+			if ( useIndex ) {
+				if ( search->pack && ( !indexed || search != indexed->search ) ) {
+					continue;
+				}
+				if ( search->dir && indexed && indexed->dirsMissing == fs_indexGeneration ) {
+					continue;
+				}
+			}
 			//
 			if ( search->pack ) {
 				hash = FS_HashFileName(filename, search->pack->hashSize);
@@ -1424,11 +1654,17 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 #endif
 						fsh[*file].zipFilePos = pakFile->pos;
 						fsh[*file].zipFileLen = pakFile->len;
+						fsh[*file].zipPack = pak;
 
 						if ( fs_debug->integer ) {
 							Com_Printf( "FS_FOpenFileRead: %s (found in '%s')\n",
 								filename, pak->pakFilename );
 						}
+
+						if ( useIndex ) {
+							// every directory ahead of the pak was looked in
+							indexed->dirsMissing = fs_indexGeneration;
+						}
 	#ifndef DEDICATED
 	#ifndef FINAL_BUILD
 						// Check for unprecached files when in game but not in the menus
@@ -1572,6 +1808,14 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 	}
 	while ( bFasterToReOpenUsingNewLocalFile );
 
+	if ( useIndex ) {
+		if ( indexed ) {
+			indexed->dirsMissing = fs_indexGeneration;
+		} else {
+			FS_IndexAddMissing( filename );
+		}
+	}
+
 	Com_DPrintf ("Can't find %s\n", filename);
 #ifdef FS_MISSING
 	if (missingFiles) {
@@ -1825,6 +2069,7 @@ int	FS_FileIsInPAK(const char *filename, int *pChecksum ) {
 	pack_t			*pak;
 	fileInPack_t	*pakFile;
 	long			hash = 0;
+	fileIndexEntry_t	*indexed;
 
 	FS_AssertInitialised();
 
@@ -1844,6 +2089,19 @@ int	FS_FileIsInPAK(const char *filename, int *pChecksum ) {
 		return -1;
 	}
 
+	if ( fs_indexTable ) {
+		indexed = FS_IndexFind( filename );
+		if ( !indexed || !indexed->search ) {
+			return -1;
+		}
+		if ( FS_PakIsPure( indexed->search->pack ) ) {
+			if ( pChecksum ) {
+				*pChecksum = indexed->search->pack->pure_checksum;
+			}
+			return 1;
+		}
+	}
+
 	//
 	// search through the path, one element at a time
 	//
@@ -1878,6 +2136,237 @@ int	FS_FileIsInPAK(const char *filename, int *pChecksum ) {
 	return -1;
 }
 
+/*
+=============================================================================
+
+FILE CACHE
+
+The decompressed contents of files read out of pk3s with FS_ReadFile are
+kept around, least recently used first out, up to fs_cacheSize megabytes.
+Entries are keyed by the pak checksum and the position in the zip, not by
+pointers into the pak, so they stay good across the FS_Restart every map
+change does and the same models, shaders and ext_data come straight back
+from memory.
+
+Files that are stored in the zip without compression are copied straight
+out of a read only mapping of the pk3 instead of going through minizip.
+
+=============================================================================
+*/
+
+#define FILECACHE_HASH_SIZE		1024
+#define FILECACHE_MAX_SHARE		8		// no single file takes more than 1/8th of the budget
+
+typedef struct fileCacheEntry_s {
+	int							checksum;		// pack_t::checksum, doesn't depend on the checksum feed
+	unsigned long				pos;
+	unsigned long				len;
+	byte						*data;
+	struct fileCacheEntry_s		*hashNext;
+	struct fileCacheEntry_s		*prev, *next;	// most recently used first
+} fileCacheEntry_t;
+
+static fileCacheEntry_t	*fs_cacheHash[FILECACHE_HASH_SIZE];
+static fileCacheEntry_t	fs_cacheList;			// sentinel of the lru list
+static size_t			fs_cacheBytes;
+static int				fs_cacheEntries;
+static int				fs_cacheHits, fs_cacheMisses, fs_cacheStoredReads;
+static size_t			fs_cacheHitBytes;
+
+static fileCacheEntry_t **FS_CacheBucket( int checksum, unsigned long pos ) {
+	return &fs_cacheHash[( (unsigned int)checksum ^ (unsigned int)( pos * 2654435761u ) ) & ( FILECACHE_HASH_SIZE - 1 )];
+}
+
+static void FS_CacheUnlink( fileCacheEntry_t *entry ) {
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void FS_CacheLinkFront( fileCacheEntry_t *entry ) {
+	entry->prev = &fs_cacheList;
+	entry->next = fs_cacheList.next;
+	fs_cacheList.next->prev = entry;
+	fs_cacheList.next = entry;
+}
+
+static void FS_CacheFree( fileCacheEntry_t *entry ) {
+	fileCacheEntry_t **link;
+
+	for ( link = FS_CacheBucket( entry->checksum, entry->pos ); *link != entry; link = &( *link )->hashNext ) {
+	}
+	*link = entry->hashNext;
+	FS_CacheUnlink( entry );
+
+	fs_cacheBytes -= entry->len;
+	fs_cacheEntries--;
+	Z_Free( entry );
+}
+
+/*
+=================
+FS_CacheTrim
+
+Throws out the least recently used files until the cache fits in size bytes
+=================
+*/
+static void FS_CacheTrim( size_t size ) {
+	if ( !fs_cacheList.next ) {
+		fs_cacheList.next = fs_cacheList.prev = &fs_cacheList;
+	}
+	while ( fs_cacheBytes > size && fs_cacheList.prev != &fs_cacheList ) {
+		FS_CacheFree( fs_cacheList.prev );
+	}
+}
+
+static size_t FS_CacheBudget( void ) {
+	if ( !fs_cacheSize || fs_cacheSize->integer <= 0 ) {
+		return 0;
+	}
+	return (size_t)fs_cacheSize->integer * 1024 * 1024;
+}
+
+static void FS_ClearFileCache( void ) {
+	FS_CacheTrim( 0 );
+}
+
+static FILE		*fs_storedPakFile;		// raw handle on the pk3 last read from
+static pack_t	*fs_storedPak;
+
+static void FS_CloseStoredPak( void ) {
+	if ( fs_storedPakFile ) {
+		fclose( fs_storedPakFile );
+	}
+	fs_storedPakFile = NULL;
+	fs_storedPak = NULL;
+}
+
+/*
+=================
+FS_ReadStoredFile
+
+Copies a file stored without compression straight out of the pk3 with a
+plain read, skipping minizip's buffering and CRC.  A pk3 that is replaced or
+truncated under us only makes the read come up short, which falls back to
+FS_Read.  The handle must have the file opened.
+=================
+*/
+static qboolean FS_ReadStoredFile( fileHandle_t f, byte *buffer, long len ) {
+	pack_t			*pak = fsh[f].zipPack;
+	unz_file_info	info;
+	ZPOS64_T		offset;
+
+	if ( unzGetCurrentFileInfo( fsh[f].handleFiles.file.z, &info, NULL, 0, NULL, 0, NULL, 0 ) != UNZ_OK ) {
+		return qfalse;
+	}
+	if ( info.compression_method != 0 || ( info.flag & 1 ) || info.uncompressed_size != (unsigned long)len ) {
+		return qfalse;	// deflated or encrypted
+	}
+
+	offset = unzGetCurrentFileZStreamPos64( fsh[f].handleFiles.file.z );
+	if ( !offset || offset > LONG_MAX ) {
+		return qfalse;
+	}
+
+	if ( fs_storedPak != pak ) {
+		FS_CloseStoredPak();
+		fs_storedPakFile = fopen( pak->pakFilename, "rb" );
+		if ( !fs_storedPakFile ) {
+			return qfalse;
+		}
+		fs_storedPak = pak;
+	}
+
+	if ( fseek( fs_storedPakFile, (long)offset, SEEK_SET ) || fread( buffer, 1, len, fs_storedPakFile ) != (size_t)len ) {
+		FS_CloseStoredPak();
+		return qfalse;
+	}
+
+	fs_cacheStoredReads++;
+	return qtrue;
+}
+
+/*
+=================
+FS_ReadPakFile
+
+Reads a whole file opened out of a pk3, through the cache
+=================
+*/
+static void FS_ReadPakFile( fileHandle_t f, byte *buffer, long len ) {
+	pack_t				*pak = fsh[f].zipPack;
+	unsigned long		pos = fsh[f].zipFilePos;
+	fileCacheEntry_t	*entry, **bucket;
+	size_t				budget;
+
+	budget = FS_CacheBudget();
+	FS_CacheTrim( budget );
+
+	bucket = FS_CacheBucket( pak->checksum, pos );
+	for ( entry = *bucket; entry; entry = entry->hashNext ) {
+		if ( entry->checksum == pak->checksum && entry->pos == pos && entry->len == (unsigned long)len ) {
+			break;
+		}
+	}
+
+	if ( entry ) {
+		Com_Memcpy( buffer, entry->data, len );
+		FS_CacheUnlink( entry );
+		FS_CacheLinkFront( entry );
+		fs_cacheHits++;
+		fs_cacheHitBytes += len;
+		return;
+	}
+
+	if ( !FS_ReadStoredFile( f, buffer, len ) ) {
+		FS_Read( buffer, len, f );
+	}
+	fs_cacheMisses++;
+
+	if ( !len || (size_t)len > budget / FILECACHE_MAX_SHARE ) {
+		return;
+	}
+
+	FS_CacheTrim( budget - len );
+
+	entry = (fileCacheEntry_t *)Z_Malloc( sizeof( *entry ) + len, TAG_FILESYS, qfalse );
+	entry->checksum = pak->checksum;
+	entry->pos = pos;
+	entry->len = len;
+	entry->data = (byte *)( entry + 1 );
+	Com_Memcpy( entry->data, buffer, len );
+
+	entry->hashNext = *bucket;
+	*bucket = entry;
+	FS_CacheLinkFront( entry );
+
+	fs_cacheBytes += len;
+	fs_cacheEntries++;
+}
+
+/*
+================
+FS_CacheInfo_f
+================
+*/
+static void FS_CacheInfo_f( void ) {
+	int lookups = fs_cacheHits + fs_cacheMisses;
+
+	if ( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "clear" ) ) {
+		FS_ClearFileCache();
+		fs_cacheHits = fs_cacheMisses = fs_cacheStoredReads = 0;
+		fs_cacheHitBytes = 0;
+		Com_Printf( "File cache cleared\n" );
+		return;
+	}
+
+	Com_Printf( "%d files, %.2f of %d MB cached\n", fs_cacheEntries,
+		fs_cacheBytes / ( 1024.0f * 1024.0f ), fs_cacheSize->integer );
+	Com_Printf( "%d hits (%.2f MB), %d misses, %d%% hit rate\n", fs_cacheHits,
+		fs_cacheHitBytes / ( 1024.0f * 1024.0f ), fs_cacheMisses,
+		lookups ? fs_cacheHits * 100 / lookups : 0 );
+	Com_Printf( "%d misses read directly from stored pk3 entries\n", fs_cacheStoredReads );
+}
+
 /*
 ============
 FS_ReadFile
@@ -1978,7 +2467,11 @@ long FS_ReadFile( const char *qpath, void **buffer ) {
 
 //	Z_Label(buf, qpath);
 
-	FS_Read (buf, len, h);
+	if ( fsh[h].zipFile ) {
+		FS_ReadPakFile( h, buf, len );
+	} else {
+		FS_Read (buf, len, h);
+	}
 
 	// guarantee that it will have a trailing 0 for string operations
 	buf[len] = 0;
@@ -2162,6 +2655,8 @@ Frees a pak structure and releases all associated resources
 
 void FS_FreePak(pack_t *thepak)
 {
+	if (thepak == fs_storedPak)
+		FS_CloseStoredPak();
 	unzClose(thepak->handle);
 	Z_Free(thepak->buildBuffer);
 	Z_Free(thepak);
@@ -2199,6 +2694,524 @@ qboolean FS_CompareZipChecksum(const char *zipfile)
 /*
 =================================================================================
 
+PARALLEL PK3 SCANNING
+
+The central directories of all the pk3s in a game directory are read and
+checksummed on the job pool, then the pack_t structures are put together on
+the calling thread in the usual order.  Jobs can't use the zone allocator and
+minizip allocates out of it, so the scan reads the zip records itself.  Zips
+it doesn't understand (zip64, broken headers) are left to FS_LoadZipFile.
+
+Scans are remembered in pk3index.dat in fs_homepath, keyed by the path, size
+and modification time of the pk3, so unchanged pk3s aren't read at all the
+next time.  Only pk3s used since the engine started are written back.
+
+=================================================================================
+*/
+
+#define PAKINDEX_FILE		"pk3index.dat"
+#define PAKINDEX_ID			INT_ID('P','K','I','X')
+#define PAKINDEX_VERSION	1
+
+#define ZIP_END_SIZE		22				// end of central directory record
+#define ZIP_END_MAX_COMMENT	0xffff
+#define ZIP_CENTRAL_SIZE	46				// central directory record, without name, extra and comment
+
+typedef struct pakScanEntry_s {
+	unsigned int	pos;				// fileInPack_t::pos, offset of the central directory record
+	unsigned int	len;
+	unsigned int	crc;
+	unsigned int	nameOfs;			// into pakScan_t::names
+} pakScanEntry_t;
+
+typedef struct pakScan_s {
+	long long					size;
+	long long					mtime;
+	int							checksum;
+	std::vector<pakScanEntry_t>	entries;
+	std::vector<char>			names;		// lower case, 0 terminated
+	bool						used;		// by this run of the engine
+} pakScan_t;
+
+typedef struct pakLoad_s {
+	char			path[MAX_OSPATH];
+	pakScan_t		*scan;				// NULL if it has to go through FS_LoadZipFile
+	bool			fresh;				// not from the index
+	int				pure_checksum;
+} pakLoad_t;
+
+static std::map<std::string, pakScan_t *>	fs_pakIndex;
+static bool									fs_pakIndexLoaded;
+static bool									fs_pakIndexDirty;
+static int									fs_pakIndexHits, fs_pakIndexScans;
+
+static unsigned int FS_ZipShort( const byte *p ) {
+	return p[0] | ( p[1] << 8 );
+}
+
+static unsigned int FS_ZipLong( const byte *p ) {
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned int)p[3] << 24 );
+}
+
+/*
+=================
+FS_ScanZipFile
+
+Reads the central directory the way minizip would, runs on worker threads
+=================
+*/
+static pakScan_t *FS_ScanZipFile( FILE *f, long long size ) {
+	std::vector<byte>	tail, central;
+	unsigned int		numEntries, centralSize, centralOfs, skip, i;
+	long long			endPos, tailStart, before;
+	size_t				at;
+	pakScan_t			*scan;
+
+	if ( size < ZIP_END_SIZE || size > 0x7fffffff ) {
+		return NULL;
+	}
+
+	// find the end of central directory record, it is followed by a comment of up to 64k
+	tailStart = size - ZIP_END_SIZE - ZIP_END_MAX_COMMENT;
+	if ( tailStart < 0 ) {
+		tailStart = 0;
+	}
+	tail.resize( (size_t)( size - tailStart ) );
+	if ( fseek( f, (long)tailStart, SEEK_SET ) || fread( tail.data(), tail.size(), 1, f ) != 1 ) {
+		return NULL;
+	}
+	for ( endPos = (long long)tail.size() - ZIP_END_SIZE; endPos >= 0; endPos-- ) {
+		if ( FS_ZipLong( &tail[endPos] ) == 0x06054b50 ) {
+			break;
+		}
+	}
+	if ( endPos < 0 ) {
+		return NULL;
+	}
+
+	const byte *end = &tail[endPos];
+	numEntries = FS_ZipShort( end + 10 );
+	centralSize = FS_ZipLong( end + 12 );
+	centralOfs = FS_ZipLong( end + 16 );
+	if ( FS_ZipShort( end + 4 ) || FS_ZipShort( end + 6 ) || FS_ZipShort( end + 8 ) != numEntries ) {
+		return NULL;	// spanned
+	}
+	if ( numEntries == 0xffff || centralSize == 0xffffffff || centralOfs == 0xffffffff ) {
+		return NULL;	// zip64
+	}
+
+	// data prepended to the zip shifts everything, fileInPack_t::pos doesn't include it
+	before = tailStart + endPos - ( (long long)centralOfs + centralSize );
+	if ( before < 0 ) {
+		return NULL;
+	}
+
+	central.resize( centralSize );
+	if ( centralSize && ( fseek( f, (long)( centralOfs + before ), SEEK_SET ) || fread( central.data(), centralSize, 1, f ) != 1 ) ) {
+		return NULL;
+	}
+
+	scan = new pakScan_t;
+	scan->size = size;
+	scan->entries.resize( numEntries );
+
+	for ( i = 0, at = 0; i < numEntries; i++ ) {
+		pakScanEntry_t	*entry = &scan->entries[i];
+		const byte		*rec;
+		unsigned int	nameLen, copyLen, j;
+
+		if ( at + ZIP_CENTRAL_SIZE > central.size() || FS_ZipLong( &central[at] ) != 0x02014b50 ) {
+			delete scan;
+			return NULL;
+		}
+		rec = &central[at];
+		nameLen = FS_ZipShort( rec + 28 );
+		skip = ZIP_CENTRAL_SIZE + nameLen + FS_ZipShort( rec + 30 ) + FS_ZipShort( rec + 32 );
+		if ( at + skip > central.size() || FS_ZipLong( rec + 24 ) == 0xffffffff ) {
+			delete scan;
+			return NULL;
+		}
+
+		entry->pos = centralOfs + (unsigned int)at;
+		entry->len = FS_ZipLong( rec + 24 );
+		entry->crc = FS_ZipLong( rec + 16 );
+		entry->nameOfs = (unsigned int)scan->names.size();
+
+		// names get cut to fit MAX_ZPATH, same as FS_LoadZipFile
+		copyLen = nameLen < MAX_ZPATH - 1 ? nameLen : MAX_ZPATH - 1;
+		for ( j = 0; j < copyLen && rec[ZIP_CENTRAL_SIZE + j]; j++ ) {
+			scan->names.push_back( (char)tolower( rec[ZIP_CENTRAL_SIZE + j] ) );
+		}
+		scan->names.push_back( '\0' );
+
+		at += skip;
+	}
+
+	return scan;
+}
+
+/*
+=================
+FS_ScanChecksums
+
+Same sums as FS_LoadZipFile, out of the crcs of the non empty files
+=================
+*/
+static void FS_ScanChecksums( const pakScan_t *scan, int *checksum, int *pure_checksum ) {
+	std::vector<int>	headerLongs;
+	size_t				i;
+
+	headerLongs.reserve( scan->entries.size() + 1 );
+	headerLongs.push_back( LittleLong( fs_checksumFeed ) );
+	for ( i = 0; i < scan->entries.size(); i++ ) {
+		if ( scan->entries[i].len > 0 ) {
+			headerLongs.push_back( LittleLong( scan->entries[i].crc ) );
+		}
+	}
+
+	if ( checksum ) {
+		*checksum = LittleLong( Com_BlockChecksum( headerLongs.data() + 1, sizeof( int ) * ( headerLongs.size() - 1 ) ) );
+	}
+	*pure_checksum = LittleLong( Com_BlockChecksum( headerLongs.data(), sizeof( int ) * headerLongs.size() ) );
+}
+
+static void FS_ScanPakJob( void *data, int index, int threadNum ) {
+	pakLoad_t	*load = &( (pakLoad_t *)data )[index];
+	long long	size, mtime;
+	FILE		*f;
+
+	f = fopen( load->path, "rb" );
+	if ( !f ) {
+		return;
+	}
+	mtime = (long long)Sys_FileTime( load->path );
+	if ( fseek( f, 0, SEEK_END ) ) {
+		fclose( f );
+		return;
+	}
+	size = ftell( f );
+
+	// the index isn't touched while jobs are running
+	std::map<std::string, pakScan_t *>::const_iterator it = fs_pakIndex.find( load->path );
+	if ( it != fs_pakIndex.end() && it->second->size == size && it->second->mtime == mtime ) {
+		load->scan = it->second;
+		FS_ScanChecksums( load->scan, NULL, &load->pure_checksum );
+		fclose( f );
+		return;
+	}
+
+	load->scan = FS_ScanZipFile( f, size );
+	fclose( f );
+
+	if ( load->scan ) {
+		load->scan->mtime = mtime;
+		load->fresh = true;
+		FS_ScanChecksums( load->scan, &load->scan->checksum, &load->pure_checksum );
+	}
+}
+
+/*
+=================
+FS_LoadScannedZipFile
+
+FS_LoadZipFile for a pk3 that has been scanned already
+=================
+*/
+static pack_t *FS_LoadScannedZipFile( const pakLoad_t *load, const char *basename ) {
+	const pakScan_t	*scan = load->scan;
+	fileInPack_t	*buildBuffer;
+	pack_t			*pack;
+	unzFile			uf;
+	int				numfiles;
+	int				i;
+	long			hash;
+
+	uf = unzOpen( load->path );
+	if ( !uf ) {
+		return NULL;
+	}
+
+	numfiles = (int)scan->entries.size();
+	buildBuffer = (fileInPack_t *)Z_Malloc( numfiles * sizeof( fileInPack_t ) + scan->names.size(), TAG_FILESYS, qtrue );
+	if ( !scan->names.empty() ) {
+		Com_Memcpy( buildBuffer + numfiles, scan->names.data(), scan->names.size() );
+	}
+
+	for ( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 ) {
+		if ( i > numfiles ) {
+			break;
+		}
+	}
+
+	pack = (pack_t *)Z_Malloc( sizeof( pack_t ) + i * sizeof( fileInPack_t * ), TAG_FILESYS, qtrue );
+	pack->hashSize = i;
+	pack->hashTable = (fileInPack_t **)( ( (char *)pack ) + sizeof( pack_t ) );
+
+	Q_strncpyz( pack->pakFilename, load->path, sizeof( pack->pakFilename ) );
+	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+
+	// strip .pk3 if needed
+	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
+		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+	}
+
+	pack->handle = uf;
+	pack->numfiles = numfiles;
+
+	for ( i = 0; i < numfiles; i++ ) {
+		buildBuffer[i].name = (char *)( buildBuffer + numfiles ) + scan->entries[i].nameOfs;
+		buildBuffer[i].pos = scan->entries[i].pos;
+		buildBuffer[i].len = scan->entries[i].len;
+		hash = FS_HashFileName( buildBuffer[i].name, pack->hashSize );
+		buildBuffer[i].next = pack->hashTable[hash];
+		pack->hashTable[hash] = &buildBuffer[i];
+	}
+
+	pack->checksum = scan->checksum;
+	pack->pure_checksum = load->pure_checksum;
+	pack->buildBuffer = buildBuffer;
+	return pack;
+}
+
+static void FS_PakIndexPath( char *path, int size ) {
+	Com_sprintf( path, size, "%s%c%s", fs_homepath->string, PATH_SEP, PAKINDEX_FILE );
+}
+
+static void FS_FreePakIndex( void ) {
+	std::map<std::string, pakScan_t *>::iterator it;
+
+	for ( it = fs_pakIndex.begin(); it != fs_pakIndex.end(); ++it ) {
+		delete it->second;
+	}
+	fs_pakIndex.clear();
+	fs_pakIndexLoaded = false;
+	fs_pakIndexDirty = false;
+}
+
+/*
+=================
+FS_LoadPakIndex
+=================
+*/
+static void FS_LoadPakIndex( void ) {
+	char		path[MAX_OSPATH];
+	int			header[3], i;
+	long		fileLen;
+	FILE		*f;
+	bool		ok = true;
+
+	fs_pakIndexLoaded = true;
+	if ( !fs_pakIndexCache->integer ) {
+		return;
+	}
+
+	FS_PakIndexPath( path, sizeof( path ) );
+	f = fopen( path, "rb" );
+	if ( !f ) {
+		return;
+	}
+
+	if ( fread( header, sizeof( header ), 1, f ) != 1 || header[0] != PAKINDEX_ID || header[1] != PAKINDEX_VERSION || header[2] < 0 ) {
+		fclose( f );
+		return;
+	}
+	fileLen = FS_fplength( f );
+
+	for ( i = 0; i < header[2] && ok; i++ ) {
+		char		pakPath[MAX_OSPATH];
+		int			counts[4];		// path length, checksum, entries, name bytes
+		pakScan_t	*scan;
+		size_t		j;
+
+		if ( fread( counts, sizeof( counts ), 1, f ) != 1 || counts[0] <= 0 || counts[0] >= MAX_OSPATH
+			|| counts[2] < 0 || counts[3] < 0 || fread( pakPath, counts[0], 1, f ) != 1 ) {
+			ok = false;
+			break;
+		}
+		pakPath[counts[0]] = '\0';
+
+		// a damaged count must not make us allocate more than the file holds
+		const long pos = ftell( f );
+		if ( pos < 0 || pos > fileLen ) {
+			ok = false;
+			break;
+		}
+		const size_t remaining = (size_t)( fileLen - pos );
+		if ( (size_t)counts[2] > remaining / sizeof( pakScanEntry_t )
+			|| (size_t)counts[3] > remaining - counts[2] * sizeof( pakScanEntry_t ) ) {
+			ok = false;
+			break;
+		}
+
+		scan = new pakScan_t;
+		scan->checksum = counts[1];
+		scan->used = false;
+		scan->entries.resize( counts[2] );
+		scan->names.resize( counts[3] );
+		if ( fread( &scan->size, sizeof( scan->size ), 1, f ) != 1
+			|| fread( &scan->mtime, sizeof( scan->mtime ), 1, f ) != 1
+			|| ( counts[2] && fread( scan->entries.data(), sizeof( pakScanEntry_t ) * counts[2], 1, f ) != 1 )
+			|| ( counts[3] && fread( scan->names.data(), counts[3], 1, f ) != 1 )
+			|| ( counts[3] && scan->names.back() != '\0' ) ) {
+			delete scan;
+			ok = false;
+			break;
+		}
+		for ( j = 0; j < scan->entries.size(); j++ ) {
+			if ( scan->entries[j].nameOfs >= scan->names.size() ) {
+				break;
+			}
+		}
+		if ( j < scan->entries.size() ) {
+			delete scan;
+			ok = false;
+			break;
+		}
+
+		pakScan_t *&slot = fs_pakIndex[pakPath];
+		delete slot;
+		slot = scan;
+	}
+	fclose( f );
+
+	if ( !ok ) {
+		Com_Printf( "WARNING: %s is damaged, pk3s will be scanned again\n", path );
+		FS_FreePakIndex();
+		fs_pakIndexLoaded = true;
+	}
+}
+
+/*
+=================
+FS_SavePakIndex
+
+Writes the scans of every pk3 used since startup, if any of them is new
+=================
+*/
+static void FS_SavePakIndex( void ) {
+	std::map<std::string, pakScan_t *>::iterator it;
+	char		path[MAX_OSPATH], tempPath[MAX_OSPATH];
+	int			header[3];
+	FILE		*f;
+	bool		ok = true;
+
+	if ( !fs_pakIndexDirty || !fs_pakIndexCache->integer ) {
+		return;
+	}
+	fs_pakIndexDirty = false;
+
+	FS_PakIndexPath( path, sizeof( path ) );
+	Com_sprintf( tempPath, sizeof( tempPath ), "%s.tmp", path );
+	FS_CreatePath( tempPath );
+
+	f = fopen( tempPath, "wb" );
+	if ( !f ) {
+		Com_Printf( "WARNING: couldn't write %s\n", path );
+		return;
+	}
+
+	header[0] = PAKINDEX_ID;
+	header[1] = PAKINDEX_VERSION;
+	header[2] = 0;
+	for ( it = fs_pakIndex.begin(); it != fs_pakIndex.end(); ++it ) {
+		if ( it->second->used ) {
+			header[2]++;
+		}
+	}
+	ok = fwrite( header, sizeof( header ), 1, f ) == 1;
+
+	for ( it = fs_pakIndex.begin(); it != fs_pakIndex.end() && ok; ++it ) {
+		const pakScan_t *scan = it->second;
+		int counts[4];
+
+		if ( !scan->used ) {
+			continue;
+		}
+		counts[0] = (int)it->first.size();
+		counts[1] = scan->checksum;
+		counts[2] = (int)scan->entries.size();
+		counts[3] = (int)scan->names.size();
+		ok = fwrite( counts, sizeof( counts ), 1, f ) == 1
+			&& fwrite( it->first.data(), counts[0], 1, f ) == 1
+			&& fwrite( &scan->size, sizeof( scan->size ), 1, f ) == 1
+			&& fwrite( &scan->mtime, sizeof( scan->mtime ), 1, f ) == 1
+			&& ( !counts[2] || fwrite( scan->entries.data(), sizeof( pakScanEntry_t ) * counts[2], 1, f ) == 1 )
+			&& ( !counts[3] || fwrite( scan->names.data(), counts[3], 1, f ) == 1 );
+	}
+
+	if ( fclose( f ) || !ok ) {
+		Com_Printf( "WARNING: couldn't write %s\n", path );
+		remove( tempPath );
+		return;
+	}
+
+#ifdef _WIN32
+	// rename won't replace an existing file here, on POSIX it replaces it atomically
+	remove( path );
+#endif
+	if ( rename( tempPath, path ) ) {
+		Com_Printf( "WARNING: couldn't write %s\n", path );
+		remove( tempPath );
+	}
+}
+
+/*
+=================
+FS_LoadZipFiles
+
+Loads the sorted pk3s of one directory, paks[i] is NULL for the ones that
+couldn't be loaded
+=================
+*/
+static void FS_LoadZipFiles( const char *path, const char *dir, char **sorted, int numfiles, pack_t **paks ) {
+	std::vector<pakLoad_t>	loads( numfiles );
+	int						i;
+
+	if ( !fs_pakIndexLoaded ) {
+		FS_LoadPakIndex();
+	}
+
+	for ( i = 0; i < numfiles; i++ ) {
+		Q_strncpyz( loads[i].path, FS_BuildOSPath( path, dir, sorted[i] ), sizeof( loads[i].path ) );
+		loads[i].scan = NULL;
+		loads[i].fresh = false;
+		loads[i].pure_checksum = 0;
+	}
+
+	Job_ParallelFor( numfiles, fs_loadThreads->integer, FS_ScanPakJob, loads.data() );
+
+	for ( i = 0; i < numfiles; i++ ) {
+		pakLoad_t *load = &loads[i];
+
+		if ( !load->scan ) {
+			// not something the scan understands, let minizip have a go
+			paks[i] = FS_LoadZipFile( load->path, sorted[i] );
+			continue;
+		}
+
+		paks[i] = FS_LoadScannedZipFile( load, sorted[i] );
+
+		if ( load->fresh ) {
+			fs_pakIndexScans++;
+			if ( fs_pakIndexCache->integer ) {
+				pakScan_t *&slot = fs_pakIndex[load->path];
+				delete slot;
+				slot = load->scan;
+				fs_pakIndexDirty = true;
+			} else {
+				delete load->scan;
+				continue;
+			}
+		} else {
+			fs_pakIndexHits++;
+		}
+		load->scan->used = true;
+	}
+}
+
+/*
+=================================================================================
+
 DIRECTORY SCANNING FUNCTIONS
 
 =================================================================================
@@ -2963,10 +3976,11 @@ static void FS_AddGameDirectory( const char *path, const char *dir ) {
 	searchpath_t	*search;
 	searchpath_t	*thedir;
 	pack_t			*pak;
-	char			curpath[MAX_OSPATH + 1], *pakfile;
+	char			curpath[MAX_OSPATH + 1];
 	int				numfiles;
 	char			**pakfiles;
 	char			*sorted[MAX_PAKFILES];
+	pack_t			*paks[MAX_PAKFILES];
 
 	// this fixes the case where fs_basepath is the same as fs_cdpath
 	// which happens on full installs
@@ -3009,9 +4023,10 @@ static void FS_AddGameDirectory( const char *path, const char *dir ) {
 
 	qsort( sorted, numfiles, sizeof(char*), paksort );
 
+	FS_LoadZipFiles( path, dir, sorted, numfiles, paks );
+
 	for ( i = 0 ; i < numfiles ; i++ ) {
-		pakfile = FS_BuildOSPath( path, dir, sorted[i] );
-		if ( ( pak = FS_LoadZipFile( pakfile, sorted[i] ) ) == 0 )
+		if ( ( pak = paks[i] ) == 0 )
 			continue;
 		Q_strncpyz(pak->pakPathname, curpath, sizeof(pak->pakPathname));
 		// store the game name for downloading
@@ -3236,6 +4251,8 @@ void FS_Shutdown( qboolean closemfp ) {
 		}
 	}
 
+	FS_FreeFileIndex();
+
 	// free everything
 	for ( p = fs_searchpaths ; p ; p = next ) {
 		next = p->next;
@@ -3257,6 +4274,13 @@ void FS_Shutdown( qboolean closemfp ) {
 	Cmd_RemoveCommand( "fdir" );
 	Cmd_RemoveCommand( "touchFile" );
 	Cmd_RemoveCommand( "which" );
+	Cmd_RemoveCommand( "fs_cacheInfo" );
+
+	// the cache outlives restarts, only the final shutdown frees it
+	if ( closemfp ) {
+		FS_ClearFileCache();
+		FS_FreePakIndex();
+	}
 
 #ifdef FS_MISSING
 	if (closemfp) {
@@ -3284,6 +4308,9 @@ void FS_UpdateGamedir(void)
 			FS_AddGameDirectory(fs_homepath->string, fs_gamedirvar->string);
 		}
 	}
+
+	FS_BuildFileIndex();
+	FS_SavePakIndex();
 }
 
 /*
@@ -3324,6 +4351,8 @@ static void FS_ReorderPurePaks()
 			p_previous = &s->next;
 		}
 	}
+
+	FS_BuildFileIndex();
 }
 
 /**
@@ -3364,6 +4393,10 @@ void FS_Startup( const char *gameName ) {
 	fs_gamedirvar = Cvar_Get ("fs_game", "", CVAR_INIT|CVAR_SYSTEMINFO, "Mod directory" );
 
 	fs_dirbeforepak = Cvar_Get("fs_dirbeforepak", "0", CVAR_INIT|CVAR_PROTECTED, "Prioritize directories before paks if not pure" );
+	fs_cacheSize = Cvar_Get( "fs_cacheSize", "64", CVAR_ARCHIVE_ND, "Megabytes of decompressed pk3 files kept in memory, 0 to disable" );
+	fs_loadThreads = Cvar_Get( "fs_loadThreads", "4", CVAR_ARCHIVE_ND, "Number of threads reading pk3 directories at startup, 1 reads them serially" );
+	fs_pakIndexCache = Cvar_Get( "fs_pakIndexCache", "1", CVAR_ARCHIVE_ND, "Remember pk3 directories in " PAKINDEX_FILE " so unchanged pk3s aren't read again" );
+	fs_pakIndexHits = fs_pakIndexScans = 0;
 
 	// add search path elements in reverse priority order (lowest priority first)
 	if (fs_cdpath->string[0]) {
@@ -3420,11 +4453,16 @@ void FS_Startup( const char *gameName ) {
 	Cmd_AddCommand ("fdir", FS_NewDir_f, "Lists a folder with filters" );
 	Cmd_AddCommand ("touchFile", FS_TouchFile_f, "Touches a file" );
 	Cmd_AddCommand ("which", FS_Which_f, "Determines which search path a file was loaded from" );
+	Cmd_AddCommand ("fs_cacheInfo", FS_CacheInfo_f, "Shows pk3 file cache usage, \"clear\" to empty it" );
 
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=506
 	// reorder the pure pk3 files according to server order
 	FS_ReorderPurePaks();
 
+	if ( !fs_indexTable ) {
+		FS_BuildFileIndex();
+	}
+
 	// print the current search paths
 	FS_Path_f();
 
@@ -3437,7 +4475,10 @@ void FS_Startup( const char *gameName ) {
 		missingFiles = fopen( "\\missing.txt", "ab" );
 	}
 #endif
+	FS_SavePakIndex();
+
 	Com_Printf( "%d files in pk3 files\n", fs_packFiles );
+	Com_DPrintf( "%d pk3s scanned, %d from %s\n", fs_pakIndexScans, fs_pakIndexHits, PAKINDEX_FILE );
 }
 
 /*
@@ -3679,6 +4720,9 @@ void FS_PureServerSetLoadedPaks( const char *pakSums, const char *pakNames ) {
 		fs_serverPaks[i] = atoi( Cmd_Argv( i ) );
 	}
 
+	// which paks and directories count has changed
+	fs_indexGeneration++;
+
 	if (fs_numServerPaks) {
 		Com_DPrintf( "Connected to a pure server.\n" );
 	}
@@ -29,22 +29,23 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 static int			bloc = 0;
 
+// the offset based functions below don't touch bloc, so that several
+// threads can encode and decode messages with the static msg tables at once
+
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int pos = *offset;
+	if ((pos&7) == 0) {
+		fout[(pos>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(pos>>3)] |= bit << (pos&7);
+	*offset = pos + 1;
 }
 
 int		Huff_getBit( byte *fin, int *offset) {
 	int t;
-	bloc = *offset;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	*offset = bloc;
+	int pos = *offset;
+	t = (fin[(pos>>3)] >> (pos&7)) & 0x1;
+	*offset = pos + 1;
 	return t;
 }
 
@@ -270,13 +271,14 @@ int Huff_Receive (node_t *node, int *ch, byte *fin) {
 
 /* Get a symbol */
 void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
-	bloc = *offset;
+	int pos = *offset;
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if ((fin[(pos>>3)] >> (pos&7)) & 0x1) {
 			node = node->right;
 		} else {
 			node = node->left;
 		}
+		pos++;
 	}
 	if (!node) {
 		*ch = 0;
@@ -284,7 +286,7 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
 //		Com_Error(ERR_DROP, "Illegal tree!\n");
 	}
 	*ch = node->symbol;
-	*offset = bloc;
+	*offset = pos;
 }
 
 /* Send the prefix code for this node */
@@ -315,10 +317,142 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout) {
 	}
 }
 
+/* Send the prefix code for this node at *offset */
+static void offset_send(node_t *node, node_t *child, byte *fout, int *offset) {
+	if (node->parent) {
+		offset_send(node->parent, node, fout, offset);
+	}
+	if (child) {
+		Huff_putBit(node->right == child ? 1 : 0, fout, offset);
+	}
+}
+
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout);
-	*offset = bloc;
+	offset_send(huff->loc[ch], NULL, fout, offset);
+}
+
+/*
+Table driven coding for trees that don't change any more, like the static msg
+tree.  The output is bit for bit what Huff_offsetTransmit and
+Huff_offsetReceive produce.
+*/
+
+/* Put the low bits of value at *offset, same as that many Huff_putBit calls */
+void Huff_putBits( uint32_t value, int bits, byte *fout, int *offset ) {
+	int			pos = *offset;
+	int			shift = pos & 7;
+	byte		*p = fout + (pos >> 3);
+	uint64_t	acc;
+	int			total;
+
+	// Huff_putBit clears a byte when it starts on it, keep only what is already written
+	acc = (uint64_t)(p[0] & ((1 << shift) - 1)) | ((uint64_t)value << shift);
+
+	for (total = shift + bits; total > 0; total -= 8) {
+		*p++ = (byte)acc;
+		acc >>= 8;
+	}
+
+	*offset = pos + bits;
+}
+
+static void Huff_fillTables(huffTables_t *tables, node_t *node, uint32_t code, int depth) {
+	int i;
+
+	if (!node || node->symbol != INTERNAL_NODE || depth == HUFF_LOOKUP_BITS) {
+		// every index whose low depth bits are this code ends up here
+		for (i = code; i < (1 << HUFF_LOOKUP_BITS); i += (1 << depth)) {
+			huffLookup_t *entry = &tables->lookup[i];
+
+			if (!node) {
+				// broken tree, Huff_offsetReceive gives 0 and doesn't move
+				entry->symbol = 0;
+				entry->length = 0;
+				entry->node = NULL;
+			} else if (node->symbol == INTERNAL_NODE) {
+				entry->symbol = INTERNAL_NODE;
+				entry->length = depth;
+				entry->node = node;
+			} else {
+				entry->symbol = node->symbol;
+				entry->length = depth;
+				entry->node = NULL;
+			}
+		}
+	}
+
+	if (node && node->symbol != INTERNAL_NODE) {
+		return;
+	}
+
+	if (node && depth < HUFF_LOOKUP_BITS) {
+		Huff_fillTables(tables, node->left, code, depth + 1);
+		Huff_fillTables(tables, node->right, code | (1 << depth), depth + 1);
+	}
+}
+
+/* Flatten the current shape of the tree, has to be redone if it changes */
+void Huff_BuildTables( huff_t *huff, huffTables_t *tables ) {
+	int			ch, depth;
+	uint32_t	code;
+	node_t		*node;
+
+	Com_Memset(tables, 0, sizeof(*tables));
+	tables->huff = huff;
+
+	for (ch = 0; ch <= HMAX; ch++) {
+		if (!huff->loc[ch]) {
+			continue;
+		}
+
+		// walk up to the root, the bit nearest the root goes out first
+		code = 0;
+		depth = 0;
+		for (node = huff->loc[ch]; node->parent; node = node->parent) {
+			code = (code << 1) | (node->parent->right == node ? 1 : 0);
+			depth++;
+		}
+
+		if (depth <= 32) {
+			tables->code[ch] = code;
+			tables->length[ch] = depth;
+		}
+	}
+
+	Huff_fillTables(tables, huff->tree, 0, 0);
+}
+
+void Huff_tableTransmit( const huffTables_t *tables, int ch, byte *fout, int *offset ) {
+	if (!tables->length[ch]) {
+		// symbol only reachable through the tree, or a code too long for the table
+		Huff_offsetTransmit(tables->huff, ch, fout, offset);
+		return;
+	}
+
+	Huff_putBits(tables->code[ch], tables->length[ch], fout, offset);
+}
+
+/* Reads up to three bytes from fin + *offset / 8 */
+void Huff_tableReceive( const huffTables_t *tables, int *ch, byte *fin, int *offset ) {
+	int					pos = *offset;
+	const byte			*p = fin + (pos >> 3);
+	uint32_t			window;
+	const huffLookup_t	*entry;
+
+	window = (p[0] | (p[1] << 8) | (p[2] << 16)) >> (pos & 7);
+	entry = &tables->lookup[window & ((1 << HUFF_LOOKUP_BITS) - 1)];
+
+	if (entry->node) {
+		*offset = pos + entry->length;
+		Huff_offsetReceive(entry->node, ch, fin, offset);
+		if (!*ch && *offset == pos + entry->length) {
+			*offset = pos;		// same as a walk from the root running into a hole
+		}
+		return;
+	}
+
+	*ch = entry->symbol;
+	*offset = pos + entry->length;
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
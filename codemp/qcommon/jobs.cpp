@@ -0,0 +1,290 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// jobs.cpp -- small worker pool for splitting per-frame work across cores
+
+#include "qcommon/qcommon.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+The pool is lazily grown to the largest thread count anyone has asked for
+and lives until Com_Shutdown.  Only one batch runs at a time; a Job_ParallelFor
+issued while another batch is in flight (i.e. from inside a job) simply runs
+serially on the calling thread.
+
+The calling thread always takes part as thread number 0, so a batch limited to
+one thread never touches the pool at all.  Per thread state indexed by
+threadNum therefore has slot 0 shared by every thread outside the pool, so
+batches must all come from the same thread; one issued from elsewhere while a
+batch is running is a fatal error.  A batch issued from inside a job runs
+serially on that job's own threadNum.
+
+Jobs must not touch the zone allocator, the console or the filesystem.  A
+Com_Error raised inside a job only records the message; the calling thread
+raises it for real once the batch has drained.
+*/
+
+typedef struct jobBatch_s {
+	jobFunc_t			func;
+	void				*data;
+	int					count;
+	int					maxThreads;
+	std::atomic<int>	next;
+	std::atomic<int>	remaining;
+	int					errorCode;			// first Com_Error raised by a job, protected by jobMutex
+	char				errorMessage[MAXPRINTMSG];
+} jobBatch_t;
+
+static std::vector<std::thread>	jobThreads;
+static std::mutex				jobMutex;
+static std::condition_variable	jobWake;
+static std::condition_variable	jobDone;
+static jobBatch_t				jobBatch;
+static int						jobGeneration;
+static int						jobBusy;			// workers currently inside Job_RunBatch
+static bool						jobQuit;
+static std::atomic<bool>		jobActive( false );
+static std::thread::id			jobCallerId;		// thread that issued the current batch
+static bool						jobCallerRunning;	// caller is inside Job_RunBatch
+static thread_local int			jobSelf;			// threadNum of a pool worker, 0 on every other thread
+
+static void Job_RunBatch( int threadNum ) {
+	jobBatch_t *batch = &jobBatch;
+	int index;
+
+	while ( (index = batch->next.fetch_add( 1 )) < batch->count ) {
+		try {
+			batch->func( batch->data, index, threadNum );
+		} catch ( int code ) {
+			std::lock_guard<std::mutex> lock( jobMutex );
+			if ( !batch->errorCode ) {
+				batch->errorCode = code;
+				Q_strncpyz( batch->errorMessage, "error in job", sizeof( batch->errorMessage ) );
+			}
+		}
+
+		batch->remaining.fetch_sub( 1 );
+	}
+}
+
+static void Job_WorkerThread( int threadNum ) {
+	int seenGeneration = 0;
+
+	jobSelf = threadNum;
+
+	for ( ;; ) {
+		{
+			std::unique_lock<std::mutex> lock( jobMutex );
+			jobWake.wait( lock, [&] { return jobQuit || jobGeneration != seenGeneration; } );
+			if ( jobQuit ) {
+				return;
+			}
+			seenGeneration = jobGeneration;
+
+			if ( threadNum >= jobBatch.maxThreads ) {
+				continue;
+			}
+			jobBusy++;
+		}
+
+		Job_RunBatch( threadNum );
+
+		{
+			std::lock_guard<std::mutex> lock( jobMutex );
+			jobBusy--;
+		}
+		jobDone.notify_all();
+	}
+}
+
+/*
+================
+Job_InJob
+
+True if the calling thread is currently running a job of a parallel batch
+================
+*/
+qboolean Job_InJob( void ) {
+	if ( jobSelf ) {
+		return qtrue;	// workers only ever run jobs
+	}
+	if ( !jobActive ) {
+		return qfalse;
+	}
+	if ( std::this_thread::get_id() == jobCallerId ) {
+		return jobCallerRunning ? qtrue : qfalse;
+	}
+	return qfalse;
+}
+
+/*
+================
+Job_ThreadNum
+
+threadNum of the job the calling thread is running, 0 outside of jobs and on
+the thread that issued the batch.  Any other thread would share slot 0 with
+the batch's caller while it runs, so that is an error.
+================
+*/
+int Job_ThreadNum( void ) {
+	if ( jobSelf ) {
+		return jobSelf;
+	}
+	if ( jobActive && std::this_thread::get_id() != jobCallerId ) {
+		Com_Error( ERR_FATAL, "Job_ThreadNum: called from a thread outside the job pool during a batch" );
+	}
+	return 0;
+}
+
+/*
+================
+Job_Error
+
+Com_Error from inside a job, unwinds the job and hands the error to the caller
+================
+*/
+void NORETURN Job_Error( int code, const char *message ) {
+	{
+		std::lock_guard<std::mutex> lock( jobMutex );
+		if ( !jobBatch.errorCode ) {
+			jobBatch.errorCode = code;
+			Q_strncpyz( jobBatch.errorMessage, message, sizeof( jobBatch.errorMessage ) );
+		}
+	}
+	throw code;
+}
+
+/*
+================
+Job_NumThreads
+
+Number of threads (including the caller) a batch limited to maxThreads will use
+================
+*/
+int Job_NumThreads( int maxThreads ) {
+	if ( maxThreads < 1 ) {
+		return 1;
+	}
+	if ( maxThreads > MAX_JOB_THREADS ) {
+		return MAX_JOB_THREADS;
+	}
+	return maxThreads;
+}
+
+/*
+================
+Job_ParallelFor
+
+Calls func( data, index, threadNum ) for every index in [0, count) and returns
+once all of them have finished.  threadNum is in [0, Job_NumThreads( maxThreads ))
+and can be used to pick per-thread scratch space.
+================
+*/
+void Job_ParallelFor( int count, int maxThreads, jobFunc_t func, void *data ) {
+	int i, numThreads, threadNum;
+	int errorCode;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	numThreads = Job_NumThreads( maxThreads );
+	if ( numThreads > count ) {
+		numThreads = count;
+	}
+
+	// nested batches run serially in the slot the calling job already owns
+	if ( numThreads == 1 || Job_InJob() ) {
+		threadNum = Job_ThreadNum();
+		for ( i = 0; i < count; i++ ) {
+			func( data, i, threadNum );
+		}
+		return;
+	}
+
+	if ( jobActive.exchange( true ) ) {
+		Com_Error( ERR_FATAL, "Job_ParallelFor: batch issued from another thread while one is running" );
+	}
+
+	{
+		std::unique_lock<std::mutex> lock( jobMutex );
+
+		// a worker that woke up late for the previous batch may still be
+		// draining it, don't change the batch underneath it
+		jobDone.wait( lock, [] { return jobBusy == 0; } );
+
+		while ( (int)jobThreads.size() < numThreads - 1 ) {
+			jobThreads.push_back( std::thread( Job_WorkerThread, (int)jobThreads.size() + 1 ) );
+		}
+
+		jobBatch.func = func;
+		jobBatch.data = data;
+		jobBatch.count = count;
+		jobBatch.maxThreads = numThreads;
+		jobBatch.next = 0;
+		jobBatch.remaining = count;
+		jobBatch.errorCode = 0;
+		jobCallerId = std::this_thread::get_id();
+		jobGeneration++;
+	}
+	jobWake.notify_all();
+
+	jobCallerRunning = true;
+	Job_RunBatch( 0 );
+	jobCallerRunning = false;
+
+	{
+		std::unique_lock<std::mutex> lock( jobMutex );
+		// also wait for every worker to leave Job_RunBatch, so none of them
+		// can pick up an index of the next batch with this batch's threadNum
+		jobDone.wait( lock, [] { return jobBatch.remaining.load() == 0 && jobBusy == 0; } );
+	}
+
+	errorCode = jobBatch.errorCode;
+	jobActive = false;
+
+	if ( errorCode ) {
+		Com_Error( errorCode, "%s", jobBatch.errorMessage );
+	}
+}
+
+/*
+================
+Job_Shutdown
+================
+*/
+void Job_Shutdown( void ) {
+	{
+		std::lock_guard<std::mutex> lock( jobMutex );
+		jobQuit = true;
+	}
+	jobWake.notify_all();
+
+	for ( size_t i = 0; i < jobThreads.size(); i++ ) {
+		jobThreads[i].join();
+	}
+	jobThreads.clear();
+	jobQuit = false;
+}
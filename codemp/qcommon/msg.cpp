@@ -30,6 +30,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 //#define _USINGNEWHUFFTABLE_		// Build a new frequency table to cut and paste.
 
 static huffman_t		msgHuff;
+static huffTables_t		msgHuffCompress;
+static huffTables_t		msgHuffDecompress;
+static qboolean			msgHuffTables = qtrue;	// msgHuffTest compares against walking the trees
 
 static qboolean			msgInit = qfalse;
 #ifdef _NEWHUFFTABLE_
@@ -197,9 +200,14 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 		if (bits&7) {
 			int nbits;
 			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				Huff_putBit((value&1), msg->data, &msg->bit);
-				value = (value>>1);
+			if ( msgHuffTables ) {
+				Huff_putBits( value & ((1<<nbits)-1), nbits, msg->data, &msg->bit );
+				value = (value>>nbits);
+			} else {
+				for(i=0;i<nbits;i++) {
+					Huff_putBit((value&1), msg->data, &msg->bit);
+					value = (value>>1);
+				}
 			}
 			bits = bits - nbits;
 		}
@@ -208,7 +216,11 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 #ifdef _NEWHUFFTABLE_
 				fwrite(&value, 1, 1, fp);
 #endif // _NEWHUFFTABLE_
-				Huff_offsetTransmit (&msgHuff.compressor, (value&0xff), msg->data, &msg->bit);
+				if ( msgHuffTables ) {
+					Huff_tableTransmit (&msgHuffCompress, (value&0xff), msg->data, &msg->bit);
+				} else {
+					Huff_offsetTransmit (&msgHuff.compressor, (value&0xff), msg->data, &msg->bit);
+				}
 				value = (value>>8);
 			}
 		}
@@ -253,14 +265,26 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 		nbits = 0;
 		if (bits&7) {
 			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
+			if ( msgHuffTables && (msg->bit>>3) + 1 < msg->maxsize ) {
+				const byte *p = msg->data + (msg->bit>>3);
+
+				value = ((p[0] | (p[1]<<8)) >> (msg->bit&7)) & ((1<<nbits)-1);
+				msg->bit += nbits;
+			} else {
+				for(i=0;i<nbits;i++) {
+					value |= (Huff_getBit(msg->data, &msg->bit)<<i);
+				}
 			}
 			bits = bits - nbits;
 		}
 		if (bits) {
 			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit);
+				// the tables look three bytes ahead, don't let that run off the buffer
+				if ( msgHuffTables && (msg->bit>>3) + 2 < msg->maxsize ) {
+					Huff_tableReceive (&msgHuffDecompress, &get, msg->data, &msg->bit);
+				} else {
+					Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit);
+				}
 #ifdef _NEWHUFFTABLE_
 				fwrite(&get, 1, 1, fp);
 #endif // _NEWHUFFTABLE_
@@ -3043,6 +3067,10 @@ void MSG_initHuffman() {
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+
+	// the trees are done changing
+	Huff_BuildTables(&msgHuff.compressor, &msgHuffCompress);
+	Huff_BuildTables(&msgHuff.decompressor, &msgHuffDecompress);
 }
 
 #else
@@ -3078,6 +3106,9 @@ void MSG_initHuffman() {
 	}
 	Com_Printf("};\n");
 	FS_FreeFile( data );
+
+	Huff_BuildTables(&msgHuff.compressor, &msgHuffCompress);
+	Huff_BuildTables(&msgHuff.decompressor, &msgHuffDecompress);
 	Cbuf_AddText( "condump dump.txt\n" );
 }
 
@@ -3123,6 +3154,164 @@ void MSG_ReportChangeVectors_f( void ) {
 	}
 
 }
+
+/*
+=================
+MSG_HuffTest_f
+
+Checks the Huffman tables against walking the trees bit by bit with random
+writes, reads and garbage input, then times MSG_WriteDeltaEntity both ways
+=================
+*/
+static int MSG_HuffTestValue( int bits ) {
+	int value = ( rand() << 16 ) ^ ( rand() << 1 ) ^ rand();
+
+	if ( bits < 0 ) {
+		value &= ( 1u << -bits ) - 1;
+		if ( value & ( 1 << ( -bits - 1 ) ) ) {
+			value |= -1 ^ ( ( 1 << -bits ) - 1 );
+		}
+	} else if ( bits < 32 ) {
+		value &= ( 1 << bits ) - 1;
+	}
+	return value;
+}
+
+void MSG_HuffTest_f( void ) {
+	static byte		bufTables[MAX_MSGLEN], bufTree[MAX_MSGLEN];
+	static int		values[256], widths[256];
+	static entityState_t	from[256], to[256];
+	msg_t			msgTables, msgTree;
+	int				iterations, i, j, count, failed = 0;
+	int64_t			start, timeTables, timeTree;
+	int				bytes;
+
+	iterations = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 1000;
+
+	for ( i = 0; i < iterations && !failed; i++ ) {
+		// same garbage in both buffers, the coders mustn't depend on it
+		for ( j = 0; j < (int)sizeof( bufTables ); j++ ) {
+			bufTables[j] = bufTree[j] = rand();
+		}
+
+		MSG_Init( &msgTables, bufTables, sizeof( bufTables ) );
+		MSG_Init( &msgTree, bufTree, sizeof( bufTree ) );
+
+		count = 1 + rand() % ARRAY_LEN( values );
+		for ( j = 0; j < count; j++ ) {
+			widths[j] = 1 + rand() % 32;
+			if ( widths[j] < 32 && ( rand() & 1 ) ) {
+				widths[j] = -widths[j];
+			}
+			values[j] = MSG_HuffTestValue( widths[j] );
+
+			msgHuffTables = qtrue;
+			MSG_WriteBits( &msgTables, values[j], widths[j] );
+			msgHuffTables = qfalse;
+			MSG_WriteBits( &msgTree, values[j], widths[j] );
+		}
+
+		if ( msgTables.cursize != msgTree.cursize || memcmp( bufTables, bufTree, msgTree.cursize ) ) {
+			Com_Printf( "msgHuffTest: encoding differs on pass %i\n", i );
+			failed++;
+			break;
+		}
+
+		MSG_BeginReading( &msgTables );
+		MSG_BeginReading( &msgTree );
+		for ( j = 0; j < count; j++ ) {
+			int valueTables, valueTree;
+
+			msgHuffTables = qtrue;
+			valueTables = MSG_ReadBits( &msgTables, widths[j] );
+			msgHuffTables = qfalse;
+			valueTree = MSG_ReadBits( &msgTree, widths[j] );
+
+			// negative widths that aren't whole bytes come back with the sign extended from the
+			// wrong bit, that's how it has always been on the wire so only compare the coders there
+			qboolean exact = ( widths[j] > 0 || !( widths[j] & 7 ) ) ? qtrue : qfalse;
+
+			if ( valueTables != valueTree || ( exact && valueTree != values[j] ) || msgTables.bit != msgTree.bit ) {
+				Com_Printf( "msgHuffTest: %i bit read %i of pass %i gave %i / %i, wrote %i\n", widths[j], j, i, valueTables, valueTree, values[j] );
+				failed++;
+				break;
+			}
+		}
+
+		// decoding garbage has to go exactly the same way too
+		MSG_BeginReading( &msgTables );
+		MSG_BeginReading( &msgTree );
+		for ( j = 0; j < 1024 && !failed; j++ ) {
+			int bits = 1 + rand() % 32;
+
+			msgHuffTables = qtrue;
+			int valueTables = MSG_ReadBits( &msgTables, bits );
+			msgHuffTables = qfalse;
+			int valueTree = MSG_ReadBits( &msgTree, bits );
+
+			if ( valueTables != valueTree || msgTables.bit != msgTree.bit ) {
+				Com_Printf( "msgHuffTest: garbage read %i of pass %i differs\n", j, i );
+				failed++;
+			}
+		}
+	}
+
+	msgHuffTables = qtrue;
+
+	if ( failed ) {
+		return;
+	}
+	Com_Printf( "msgHuffTest: %i passes match\n", iterations );
+
+	// entity deltas, about as busy as a crowded snapshot
+	for ( i = 0; i < (int)ARRAY_LEN( from ); i++ ) {
+		Com_Memset( &from[i], 0, sizeof( from[i] ) );
+		from[i].number = i;
+		to[i] = from[i];
+
+		to[i].eType = rand() % 16;
+		to[i].eFlags = rand() & 0xffff;
+		to[i].pos.trType = (trType_t)( rand() % 6 );
+		to[i].pos.trTime = rand();
+		to[i].apos.trType = (trType_t)( rand() % 6 );
+		for ( j = 0; j < 3; j++ ) {
+			to[i].pos.trBase[j] = (float)( rand() % 8192 - 4096 );
+			to[i].pos.trDelta[j] = ( rand() % 2000 - 1000 ) * 0.37f;
+			to[i].apos.trBase[j] = ( rand() % 36000 ) * 0.01f;
+			to[i].origin[j] = to[i].pos.trBase[j];
+		}
+		to[i].modelindex = rand() % 256;
+		to[i].frame = rand() % 512;
+		to[i].legsAnim = rand() % 1024;
+		to[i].torsoAnim = rand() % 1024;
+		to[i].weapon = rand() % 16;
+		to[i].event = rand() % 256;
+	}
+
+	for ( j = 0; j < 2; j++ ) {
+		msgHuffTables = j ? qfalse : qtrue;
+		bytes = 0;
+
+		start = Sys_Microseconds();
+		for ( i = 0; i < iterations; i++ ) {
+			MSG_Init( &msgTables, bufTables, sizeof( bufTables ) );
+			for ( count = 0; count < (int)ARRAY_LEN( from ); count++ ) {
+				MSG_WriteDeltaEntity( &msgTables, &from[count], &to[count], qfalse );
+			}
+			bytes += msgTables.cursize;
+		}
+
+		if ( j ) {
+			timeTree = Sys_Microseconds() - start;
+		} else {
+			timeTables = Sys_Microseconds() - start;
+		}
+	}
+	msgHuffTables = qtrue;
+
+	Com_Printf( "MSG_WriteDeltaEntity: %i deltas, %i bytes, tables %i usec, tree %i usec\n",
+		iterations * (int)ARRAY_LEN( from ), bytes, (int)timeTables, (int)timeTree );
+}
 #endif	// FINAL_BUILD
 
 //===========================================================================
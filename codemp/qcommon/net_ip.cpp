@@ -71,6 +71,14 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <sys/filio.h>
 #endif
 
+#ifdef __linux__
+#define NET_MMSG	// recvmmsg / sendmmsg
+#define NET_EPOLL	// epoll + timerfd frame waits
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 typedef int SOCKET;
 #define INVALID_SOCKET                -1
 #define SOCKET_ERROR                        -1
@@ -96,12 +104,32 @@ static cvar_t	*net_ip;
 static cvar_t	*net_port;
 
 static cvar_t	*net_dropsim;
+static cvar_t	*net_batch;
 
 static struct sockaddr_in	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
 static SOCKET	socks_socket = INVALID_SOCKET;
 
+#ifdef NET_EPOLL
+static int		netEpoll = -1;
+static int		netTimer = -1;
+static SOCKET	netEpollSocket = INVALID_SOCKET;	// ip_socket as last added to netEpoll
+static qboolean	netEpollFailed = qfalse;
+
+static void NET_CloseEpoll( void ) {
+	if ( netEpoll != -1 ) {
+		close( netEpoll );
+		netEpoll = -1;
+	}
+	if ( netTimer != -1 ) {
+		close( netTimer );
+		netTimer = -1;
+	}
+	netEpollSocket = INVALID_SOCKET;
+}
+#endif
+
 #define	MAX_IPS		16
 static	int		numIP;
 static	byte	localIP[MAX_IPS][4];
@@ -236,6 +264,64 @@ qboolean Sys_StringToAdr( const char *s, netadr_t *a ) {
 
 //=============================================================================
 
+/*
+==================
+Socket call counters, see net_stats
+==================
+*/
+typedef struct netStats_s {
+	int		recvCalls;
+	int		recvPackets;
+	int64_t	recvUsec;
+	int		sendCalls;
+	int		sendPackets;
+	int64_t	sendUsec;
+	int		timerWakes;			// NET_WaitTimed reached its deadline
+	int		packetWakes;		// NET_WaitTimed woke up for packets
+	int64_t	wakeLateUsec;		// summed over timerWakes
+	int64_t	wakeLateMax;
+} netStats_t;
+
+static netStats_t	netStats;
+
+/*
+==================
+NET_ReadPacket
+
+Turns what a receive call left in net_message into a packet from net_from
+==================
+*/
+static qboolean NET_ReadPacket( struct sockaddr_in *fromAddr, socklen_t fromlen, int ret, netadr_t *net_from, msg_t *net_message ) {
+	struct sockaddr_in &from = *fromAddr;
+
+	memset( from.sin_zero, 0, 8 );
+
+	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
+		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
+			return qfalse;
+		}
+		net_from->type = NA_IP;
+		net_from->ip[0] = net_message->data[4];
+		net_from->ip[1] = net_message->data[5];
+		net_from->ip[2] = net_message->data[6];
+		net_from->ip[3] = net_message->data[7];
+		memcpy( &net_from->port, &net_message->data[8], 2 );
+		net_message->readcount = 10;
+	}
+	else {
+		SockadrToNetadr( &from, net_from );
+		net_message->readcount = 0;
+	}
+
+	if( ret >= net_message->maxsize ) {
+		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
+		return qfalse;
+	}
+
+	net_message->cursize = ret;
+	return qtrue;
+}
+
 /*
 ==================
 NET_GetPacket
@@ -251,6 +337,7 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 	int ret, err;
 	socklen_t fromlen;
 	struct sockaddr_in from;
+	int64_t start;
 
 	if ( ip_socket == INVALID_SOCKET || !FD_ISSET(ip_socket, fdr) ) {
 		return qfalse;
@@ -260,7 +347,10 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 #ifdef _DEBUG
 	recvfromCount++;		// performance check
 #endif
+	start = Sys_Microseconds();
 	ret = recvfrom( ip_socket, (char *)net_message->data, net_message->maxsize, 0, (struct sockaddr *)&from, &fromlen );
+	netStats.recvUsec += Sys_Microseconds() - start;
+	netStats.recvCalls++;
 
 	if ( ret == SOCKET_ERROR ) {
 		err = socketError;
@@ -272,38 +362,209 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 		return qfalse;
 	}
 
-	memset( from.sin_zero, 0, 8 );
+	netStats.recvPackets++;
+	return NET_ReadPacket( &from, fromlen, ret, net_from, net_message );
+}
 
-	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
-		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-			return qfalse;
-		}
-		net_from->type = NA_IP;
-		net_from->ip[0] = net_message->data[4];
-		net_from->ip[1] = net_message->data[5];
-		net_from->ip[2] = net_message->data[6];
-		net_from->ip[3] = net_message->data[7];
-		memcpy( &net_from->port, &net_message->data[8], 2 );
-		net_message->readcount = 10;
+#ifdef NET_MMSG
+/*
+==================
+NET_GetPacketBatch
+
+Drains up to NET_BATCH_PACKETS datagrams with a single recvmmsg into a ring
+of message buffers.  Returns the number received, which are left in
+netRecvMsgs / netRecvFrom for NET_Event to hand out in order.
+==================
+*/
+#define	NET_BATCH_PACKETS	32
+
+static byte					netRecvBufs[NET_BATCH_PACKETS][MAX_MSGLEN + 1];
+static struct mmsghdr		netRecvHdrs[NET_BATCH_PACKETS];
+static struct iovec			netRecvIov[NET_BATCH_PACKETS];
+static struct sockaddr_in	netRecvAddrs[NET_BATCH_PACKETS];
+
+static int NET_GetPacketBatch( void ) {
+	int ret, i;
+	int64_t start;
+
+	if ( ip_socket == INVALID_SOCKET ) {
+		return 0;
 	}
-	else {
-		SockadrToNetadr( &from, net_from );
-		net_message->readcount = 0;
+
+	for ( i = 0; i < NET_BATCH_PACKETS; i++ ) {
+		netRecvIov[i].iov_base = netRecvBufs[i];
+		netRecvIov[i].iov_len = sizeof( netRecvBufs[i] );
+
+		memset( &netRecvHdrs[i], 0, sizeof( netRecvHdrs[i] ) );
+		netRecvHdrs[i].msg_hdr.msg_name = &netRecvAddrs[i];
+		netRecvHdrs[i].msg_hdr.msg_namelen = sizeof( netRecvAddrs[i] );
+		netRecvHdrs[i].msg_hdr.msg_iov = &netRecvIov[i];
+		netRecvHdrs[i].msg_hdr.msg_iovlen = 1;
 	}
 
-	if( ret >= net_message->maxsize ) {
-		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-		return qfalse;
+	start = Sys_Microseconds();
+	ret = recvmmsg( ip_socket, netRecvHdrs, NET_BATCH_PACKETS, MSG_DONTWAIT, NULL );
+	netStats.recvUsec += Sys_Microseconds() - start;
+	netStats.recvCalls++;
+
+	if ( ret == SOCKET_ERROR ) {
+		int err = socketError;
+
+		if ( err != EAGAIN && err != ECONNRESET ) {
+			Com_Printf( "NET_GetPacketBatch: %s\n", NET_ErrorString() );
+		}
+		return 0;
 	}
 
-	net_message->cursize = ret;
-	return qtrue;
+	netStats.recvPackets += ret;
+	return ret;
 }
+#endif
 
 //=============================================================================
 
 static char socksBuf[4096];
 
+/*
+==================
+NET_SendError
+==================
+*/
+static void NET_SendError( netadrtype_t type ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( err == EADDRNOTAVAIL && type == NA_BROADCAST ) {
+		return;
+	}
+
+	Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+}
+
+#ifdef NET_MMSG
+/*
+==================
+Send queue
+
+Between NET_BeginSendBatch and NET_FlushSendBatch packets are copied into a
+queue and go out with one sendmmsg per NET_BATCH_PACKETS, instead of a
+sendto each.  Anything too big for a slot flushes the queue and is sent on
+its own so the order on the wire doesn't change.
+==================
+*/
+#define	NET_BATCH_SENDSIZE	1500
+
+static qboolean				netSendQueueing;
+static int					netNumSendQueued;
+static byte					netSendBufs[NET_BATCH_PACKETS][NET_BATCH_SENDSIZE];
+static struct mmsghdr		netSendHdrs[NET_BATCH_PACKETS];
+static struct iovec			netSendIov[NET_BATCH_PACKETS];
+static struct sockaddr_in	netSendAddrs[NET_BATCH_PACKETS];
+static netadrtype_t			netSendTypes[NET_BATCH_PACKETS];
+
+static void NET_FlushSendQueue( void ) {
+	int sent, ret;
+	int64_t start;
+
+	for ( sent = 0; sent < netNumSendQueued; ) {
+		if ( ip_socket == INVALID_SOCKET ) {
+			break;
+		}
+
+		start = Sys_Microseconds();
+		ret = sendmmsg( ip_socket, netSendHdrs + sent, netNumSendQueued - sent, 0 );
+		netStats.sendUsec += Sys_Microseconds() - start;
+		netStats.sendCalls++;
+
+		if ( ret == SOCKET_ERROR ) {
+			// the first packet failed, drop it and carry on with the rest
+			NET_SendError( netSendTypes[sent] );
+			sent++;
+			continue;
+		}
+
+		netStats.sendPackets += ret;
+		sent += ret;
+	}
+
+	netNumSendQueued = 0;
+}
+
+/*
+==================
+NET_BeginSendBatch
+==================
+*/
+void NET_BeginSendBatch( void ) {
+	netSendQueueing = ( net_batch && net_batch->integer ) ? qtrue : qfalse;
+}
+
+/*
+==================
+NET_FlushSendBatch
+==================
+*/
+void NET_FlushSendBatch( void ) {
+	NET_FlushSendQueue();
+	netSendQueueing = qfalse;
+}
+
+static qboolean NET_QueuePacket( int length, const void *data, netadr_t *to, struct sockaddr_in *addr ) {
+	struct mmsghdr *hdr;
+	int slot;
+
+	if ( !netSendQueueing || length + 10 > NET_BATCH_SENDSIZE ) {
+		NET_FlushSendQueue();
+		return qfalse;
+	}
+
+	if ( netNumSendQueued == NET_BATCH_PACKETS ) {
+		NET_FlushSendQueue();
+	}
+
+	slot = netNumSendQueued++;
+	netSendTypes[slot] = to->type;
+	netSendIov[slot].iov_base = netSendBufs[slot];
+
+	if( usingSocks && to->type == NA_IP ) {
+		netSendBufs[slot][0] = 0;	// reserved
+		netSendBufs[slot][1] = 0;
+		netSendBufs[slot][2] = 0;	// fragment (not fragmented)
+		netSendBufs[slot][3] = 1;	// address type: IPV4
+		memcpy( &netSendBufs[slot][4], &addr->sin_addr, 4 );
+		memcpy( &netSendBufs[slot][8], &addr->sin_port, 2 );
+		memcpy( &netSendBufs[slot][10], data, length );
+		netSendIov[slot].iov_len = length + 10;
+		netSendAddrs[slot] = socksRelayAddr;
+	}
+	else {
+		memcpy( netSendBufs[slot], data, length );
+		netSendIov[slot].iov_len = length;
+		netSendAddrs[slot] = *addr;
+	}
+
+	hdr = &netSendHdrs[slot];
+	memset( hdr, 0, sizeof( *hdr ) );
+	hdr->msg_hdr.msg_name = &netSendAddrs[slot];
+	hdr->msg_hdr.msg_namelen = sizeof( netSendAddrs[slot] );
+	hdr->msg_hdr.msg_iov = &netSendIov[slot];
+	hdr->msg_hdr.msg_iovlen = 1;
+
+	return qtrue;
+}
+#else
+void NET_BeginSendBatch( void ) {
+}
+
+void NET_FlushSendBatch( void ) {
+}
+#endif
+
 /*
 ==================
 Sys_SendPacket
@@ -312,6 +573,7 @@ Sys_SendPacket
 void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 	int					ret;
 	struct sockaddr_in	addr;
+	int64_t				start;
 
 	if ( to.type != NA_BROADCAST && to.type != NA_IP ) {
 		Com_Error( ERR_FATAL, "Sys_SendPacket: bad address type" );
@@ -324,6 +586,13 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 
 	NetadrToSockadr( &to, &addr );
 
+#ifdef NET_MMSG
+	if ( NET_QueuePacket( length, data, &to, &addr ) ) {
+		return;
+	}
+#endif
+
+	start = Sys_Microseconds();
 	if( usingSocks && to.type == NA_IP ) {
 		socksBuf[0] = 0;	// reserved
 		socksBuf[1] = 0;
@@ -337,20 +606,14 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 	else {
 		ret = sendto( ip_socket, (const char *)data, length, 0, (sockaddr *)&addr, sizeof(addr) );
 	}
-	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
-
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
-		}
-
-		// some PPP links do not allow broadcasts and return an error
-		if( err == EADDRNOTAVAIL && to.type == NA_BROADCAST ) {
-			return;
-		}
+	netStats.sendUsec += Sys_Microseconds() - start;
+	netStats.sendCalls++;
 
-		Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+	if( ret != SOCKET_ERROR ) {
+		netStats.sendPackets++;
+	}
+	else {
+		NET_SendError( to.type );
 	}
 }
 
@@ -893,6 +1156,8 @@ static qboolean NET_GetCvars( void ) {
 
 	net_dropsim = Cvar_Get( "net_dropsim", "", CVAR_TEMP);
 
+	net_batch = Cvar_Get( "net_batch", "1", CVAR_ARCHIVE_ND, "Move several packets per system call where the platform supports it" );
+
 	return modified ? qtrue : qfalse;
 }
 
@@ -939,6 +1204,12 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if ( stop ) {
+		NET_FlushSendBatch();
+#ifdef NET_EPOLL
+		// closing the socket takes it out of the epoll set
+		netEpollSocket = INVALID_SOCKET;
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -976,6 +1247,7 @@ void NET_Init( void ) {
 	NET_Config( qtrue );
 
 	Cmd_AddCommand ("net_restart", NET_Restart_f, "Restart the networking sub-system" );
+	Cmd_AddCommand ("net_stats", NET_Stats_f, "Show packets per socket call since the last net_stats" );
 }
 
 /*
@@ -989,12 +1261,33 @@ void NET_Shutdown( void ) {
 	}
 
 	NET_Config( qfalse );
+#ifdef NET_EPOLL
+	NET_CloseEpoll();
+	netEpollFailed = qfalse;
+#endif
 #ifdef _WIN32
 	WSACleanup();
 	winsockInitialized = qfalse;
 #endif
 }
 
+/*
+====================
+NET_DropSim
+====================
+*/
+static qboolean NET_DropSim( void )
+{
+	if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
+	{
+		// com_dropsim->value percent of incoming packets get dropped.
+		if(rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value))
+			return qtrue;
+	}
+
+	return qfalse;
+}
+
 /*
 ====================
 NET_Event
@@ -1009,18 +1302,44 @@ void NET_Event(fd_set *fdr)
 	netadr_t from;
 	msg_t netmsg;
 
-	while(1)
+#ifdef NET_MMSG
+	if(net_batch->integer && ip_socket != INVALID_SOCKET && FD_ISSET(ip_socket, fdr))
 	{
-		MSG_Init(&netmsg, bufData, sizeof(bufData));
+		int received;
 
-		if(NET_GetPacket(&from, &netmsg, fdr))
+		do
 		{
-			if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
+			received = NET_GetPacketBatch();
+
+			for(int i = 0; i < received; i++)
 			{
-				// com_dropsim->value percent of incoming packets get dropped.
-				if(rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value))
+				MSG_Init(&netmsg, netRecvBufs[i], sizeof(netRecvBufs[i]));
+
+				if(!NET_ReadPacket(&netRecvAddrs[i], netRecvHdrs[i].msg_hdr.msg_namelen, netRecvHdrs[i].msg_len, &from, &netmsg))
+					continue;
+
+				if(NET_DropSim())
 					continue;          // drop this packet
+
+				if(com_sv_running->integer)
+					Com_RunAndTimeServerPacket(&from, &netmsg);
+				else
+					CL_PacketEvent(from, &netmsg);
 			}
+		} while(received == NET_BATCH_PACKETS);
+
+		return;
+	}
+#endif
+
+	while(1)
+	{
+		MSG_Init(&netmsg, bufData, sizeof(bufData));
+
+		if(NET_GetPacket(&from, &netmsg, fdr))
+		{
+			if(NET_DropSim())
+				continue;          // drop this packet
 
 			if(com_sv_running->integer)
 				Com_RunAndTimeServerPacket(&from, &netmsg);
@@ -1048,6 +1367,9 @@ void NET_Sleep( int msec ) {
 	if (msec < 0)
 		msec = 0;
 
+	// nothing should still be queued, but don't sit on it if it is
+	NET_FlushSendBatch();
+
 	FD_ZERO(&fdset);
 	if (ip_socket != INVALID_SOCKET) {
 		FD_SET(ip_socket, &fdset); // network socket
@@ -1075,6 +1397,118 @@ void NET_Sleep( int msec ) {
 		NET_Event(&fdset);
 }
 
+/*
+====================
+NET_WaitTimed
+
+Sleeps until the millisecond clock has moved msec past its current value, or
+until packets arrive, which are handled before returning.  Unlike NET_Sleep
+the wakeup is not rounded to whole milliseconds and nothing spins.
+
+Returns qfalse if the platform can't do this, the caller should fall back to
+NET_Sleep.
+====================
+*/
+qboolean NET_WaitTimed( int msec ) {
+#ifdef NET_EPOLL
+	struct epoll_event	ev, events[2];
+	struct itimerspec	spec;
+	struct timeval		tv;
+	int64_t				deadline, now;
+	int					i, n;
+	qboolean			timerFired = qfalse;
+	qboolean			packets = qfalse;
+
+	if ( netEpollFailed ) {
+		return qfalse;
+	}
+
+	NET_FlushSendBatch();
+
+	if ( netEpoll == -1 ) {
+		netEpoll = epoll_create1( EPOLL_CLOEXEC );
+		netTimer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+
+		if ( netEpoll == -1 || netTimer == -1 ) {
+			Com_Printf( "NET_WaitTimed: %s, using select\n", strerror( errno ) );
+			NET_CloseEpoll();
+			netEpollFailed = qtrue;
+			return qfalse;
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.fd = netTimer;
+		epoll_ctl( netEpoll, EPOLL_CTL_ADD, netTimer, &ev );
+	}
+
+	if ( ip_socket != netEpollSocket ) {
+		if ( netEpollSocket != INVALID_SOCKET ) {
+			epoll_ctl( netEpoll, EPOLL_CTL_DEL, netEpollSocket, NULL );
+		}
+
+		netEpollSocket = ip_socket;
+
+		if ( ip_socket != INVALID_SOCKET ) {
+			ev.events = EPOLLIN;
+			ev.data.fd = ip_socket;
+			epoll_ctl( netEpoll, EPOLL_CTL_ADD, ip_socket, &ev );
+		}
+	}
+
+	// Sys_Milliseconds counts gettimeofday milliseconds, line the deadline up
+	// with the moment it ticks over to the value the caller is waiting for
+	gettimeofday( &tv, NULL );
+	now = Sys_Microseconds();
+	deadline = now + (int64_t)msec * 1000 - tv.tv_usec % 1000;
+
+	Com_Memset( &spec, 0, sizeof( spec ) );
+	spec.it_value.tv_sec = deadline / 1000000;
+	spec.it_value.tv_nsec = ( deadline % 1000000 ) * 1000;
+	timerfd_settime( netTimer, TFD_TIMER_ABSTIME, &spec, NULL );
+
+	do {
+		n = epoll_wait( netEpoll, events, ARRAY_LEN( events ), -1 );
+	} while ( n == -1 && errno == EINTR );
+
+	for ( i = 0; i < n; i++ ) {
+		if ( events[i].data.fd == netTimer ) {
+			uint64_t expirations;
+
+			if ( read( netTimer, &expirations, sizeof( expirations ) ) > 0 ) {
+				timerFired = qtrue;
+			}
+		}
+		else if ( events[i].data.fd == ip_socket ) {
+			packets = qtrue;
+		}
+	}
+
+	if ( timerFired ) {
+		int64_t late = Sys_Microseconds() - deadline;
+
+		netStats.timerWakes++;
+		netStats.wakeLateUsec += late;
+		if ( late > netStats.wakeLateMax ) {
+			netStats.wakeLateMax = late;
+		}
+	}
+
+	if ( packets ) {
+		fd_set fdset;
+
+		netStats.packetWakes++;
+
+		FD_ZERO( &fdset );
+		FD_SET( ip_socket, &fdset );
+		NET_Event( &fdset );
+	}
+
+	return qtrue;
+#else
+	return qfalse;
+#endif
+}
+
 /*
 ====================
 NET_Restart_f
@@ -1083,3 +1517,21 @@ NET_Restart_f
 void NET_Restart_f( void ) {
 	NET_Config( qtrue );
 }
+
+/*
+====================
+NET_Stats_f
+====================
+*/
+void NET_Stats_f( void ) {
+	Com_Printf( "recv: %i packets in %i calls, %.2f per call, %i usec\n", netStats.recvPackets, netStats.recvCalls,
+		netStats.recvCalls ? (float)netStats.recvPackets / netStats.recvCalls : 0.0f, (int)netStats.recvUsec );
+	Com_Printf( "send: %i packets in %i calls, %.2f per call, %i usec\n", netStats.sendPackets, netStats.sendCalls,
+		netStats.sendCalls ? (float)netStats.sendPackets / netStats.sendCalls : 0.0f, (int)netStats.sendUsec );
+	if ( netStats.timerWakes || netStats.packetWakes ) {
+		Com_Printf( "wait: %i frame wakeups, %i usec late on average, %i usec at most, %i packet wakeups\n", netStats.timerWakes,
+			(int)( netStats.wakeLateUsec / Q_max( netStats.timerWakes, 1 ) ), (int)netStats.wakeLateMax, netStats.packetWakes );
+	}
+
+	Com_Memset( &netStats, 0, sizeof( netStats ) );
+}
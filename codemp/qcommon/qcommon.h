@@ -100,6 +100,7 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct pl
 
 #ifndef FINAL_BUILD
 void MSG_ReportChangeVectors_f( void );
+void MSG_HuffTest_f( void );
 #endif
 
 //============================================================================
@@ -134,6 +135,9 @@ typedef enum {
 void		NET_Init( void );
 void		NET_Shutdown( void );
 void		NET_Restart_f( void );
+void		NET_Stats_f( void );
+void		NET_BeginSendBatch( void );
+void		NET_FlushSendBatch( void );
 void		NET_Config( qboolean enableNetworking );
 
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
@@ -148,6 +152,7 @@ const char	*NET_AdrToString (netadr_t a);
 qboolean	NET_StringToAdr ( const char *s, netadr_t *a);
 qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
 void		NET_Sleep(int msec);
+qboolean	NET_WaitTimed(int msec);
 
 void		Sys_SendPacket( int length, const void *data, netadr_t to );
 //Does NOT parse port numbers, only base addresses.
@@ -213,6 +218,10 @@ PROTOCOL
 
 #define	PROTOCOL_VERSION	26
 
+// header of the deflated .dm_26z demos written with sv_demoCompress, see sv_demo.cpp
+#define DEMO_COMPRESSED_ID		INT_ID( 'J', 'K', 'D', 'Z' )
+#define DEMO_COMPRESSED_VERSION	1
+
 #define	UPDATE_SERVER_NAME			"master.moviebattles.org"
 #define MASTER_SERVER_NAME			"master.moviebattles.org"
 
@@ -600,6 +609,7 @@ void FS_HomeRmdir( const char *homePath, qboolean recursive );
 qboolean FS_FileExists( const char *file );
 
 char   *FS_BuildOSPath( const char *base, const char *game, const char *qpath );
+qboolean FS_CreatePath( char *OSPath );
 qboolean FS_CompareZipChecksum(const char *zipfile);
 
 int		FS_GetFileList(  const char *path, const char *extension, char *listbuf, int bufsize );
@@ -1028,6 +1038,23 @@ typedef struct huffman_s {
 	huff_t		decompressor;
 } huffman_t;
 
+// flattened copy of a tree that no longer changes, for encoding and decoding
+// without walking it one bit at a time
+#define HUFF_LOOKUP_BITS	11
+
+typedef struct huffLookup_s {
+	short		symbol;
+	short		length;		// bits to consume
+	node_t		*node;		// code is longer than HUFF_LOOKUP_BITS, carry on walking from here
+} huffLookup_t;
+
+typedef struct huffTables_s {
+	huff_t			*huff;
+	uint32_t		code[HMAX+1];		// first bit on the wire in bit 0
+	byte			length[HMAX+1];		// 0 if the code has to be sent from the tree
+	huffLookup_t	lookup[1 << HUFF_LOOKUP_BITS];	// indexed by the next HUFF_LOOKUP_BITS bits
+} huffTables_t;
+
 void	Huff_Compress(msg_t *buf, int offset);
 void	Huff_Decompress(msg_t *buf, int offset);
 void	Huff_Init(huffman_t *huff);
@@ -1038,6 +1065,10 @@ void	Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset);
 void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset);
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
+void	Huff_BuildTables( huff_t *huff, huffTables_t *tables );
+void	Huff_tableTransmit( const huffTables_t *tables, int ch, byte *fout, int *offset );
+void	Huff_tableReceive( const huffTables_t *tables, int *ch, byte *fin, int *offset );
+void	Huff_putBits( uint32_t value, int bits, byte *fout, int *offset );
 
 extern huffman_t clientHuffTables;
 
@@ -1055,6 +1086,16 @@ inline int Round(float value)
 bool PD_Store ( const char *name, const void *data, size_t size );
 const void *PD_Load ( const char *name, size_t *size );
 
+// Worker pool API (jobs.cpp)
+#define MAX_JOB_THREADS		32
+typedef void (*jobFunc_t)( void *data, int index, int threadNum );
+int Job_NumThreads( int maxThreads );
+void Job_ParallelFor( int count, int maxThreads, jobFunc_t func, void *data );
+qboolean Job_InJob( void );
+int Job_ThreadNum( void );
+void NORETURN Job_Error( int code, const char *message );
+void Job_Shutdown( void );
+
 uint32_t ConvertUTF8ToUTF32( char *utf8CurrentChar, char **utf8NextChar );
 
 #include "sys/sys_public.h"
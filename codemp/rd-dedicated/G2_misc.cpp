@@ -175,7 +175,48 @@ CGoreSet::~CGoreSet()
 };
 #endif // _SOF2
 
+#if G2_SIMD
+#include <emmintrin.h>
+#endif
+
 const mdxaBone_t &EvalBoneCache(int index,CBoneCache *boneCache);
+
+// Skinned verts for collision traces, kept per LOD in the bone cache of the model instance.
+// Each surface remembers the bone matrices it was skinned with, and is only skinned again
+// once one of them changes, so repeated traces against a model in the same frame (and
+// against parts of it that did not move) reuse the verts. The bounds of each surface let
+// traces skip the triangles of surfaces the ray does not come near.
+class CTraceVertLod
+{
+public:
+	vec3_t					scale;
+	std::vector<int>		surfVerts;		// where each surface starts in verts, by surface index
+	std::vector<int>		surfBones;		// where each surface starts in bones
+	std::vector<byte>		surfValid;
+	std::vector<float>		verts;			// 5 floats per vert, same as the miniheap copies
+	std::vector<float>		bounds;			// mins and maxs per surface
+	std::vector<mdxaBone_t>	bones;			// bone matrices each surface was last skinned with
+};
+
+class CTraceVertCache
+{
+public:
+	const model_t				*mod;
+	std::vector<CTraceVertLod>	lods;
+
+	CTraceVertCache() :
+		mod(0)
+	{
+	}
+};
+
+CTraceVertCache *&G2_BoneCacheTraceVerts(CBoneCache *boneCache);
+
+void G2_FreeTraceVerts(CTraceVertCache *traceVerts)
+{
+	delete traceVerts;
+}
+
 class CTraceSurface
 {
 public:
@@ -194,6 +235,7 @@ public:
 	int					traceFlags;
 	bool				hitOne;
 	float				m_fRadius;
+	const CTraceVertLod	*traceVerts;	// bounds of the cached surfaces, if the verts came from there
 
 #ifdef _G2_GORE
 	//gore application thing
@@ -259,6 +301,7 @@ public:
 		VectorCopy(initrayStart, rayStart);
 		VectorCopy(initrayEnd, rayEnd);
 		hitOne = false;
+		traceVerts = 0;
 	}
 
 };
@@ -386,25 +429,93 @@ int G2_DecideTraceLod(CGhoul2Info &ghoul2, int useLod)
 	return returnLod;
 }
 
-void R_TransformEachSurface( const mdxmSurface_t *surface, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertsArray,CBoneCache *boneCache)
+#if G2_SIMD
+// Skins four floats at a time: the bones a surface uses are turned into columns once, so each
+// weight of a vertex is three multiplies and adds of whole columns. The sums are done in the
+// same order as the scalar code, which makes the results identical.
+static void G2_SkinSurfaceVertsSIMD( const mdxmSurface_t *surface, const vec3_t scale, CBoneCache *boneCache, float *TransformedVerts )
+{
+	__m128 boneColumns[iMAX_G2_BONEREFS_PER_SURFACE][4];
+	int j, k;
+
+	const int *piBoneReferences = (int*) ((byte*)surface + surface->ofsBoneReferences);
+	const int numBoneReferences = Q_min( surface->numBoneReferences, iMAX_G2_BONEREFS_PER_SURFACE );
+	for ( j = 0; j < numBoneReferences; j++ )
+	{
+		const mdxaBone_t &bone = EvalBoneCache( piBoneReferences[j], boneCache );
+		__m128 row0 = _mm_loadu_ps( bone.matrix[0] );
+		__m128 row1 = _mm_loadu_ps( bone.matrix[1] );
+		__m128 row2 = _mm_loadu_ps( bone.matrix[2] );
+		__m128 row3 = _mm_setzero_ps();
+
+		_MM_TRANSPOSE4_PS( row0, row1, row2, row3 );
+		boneColumns[j][0] = row0;
+		boneColumns[j][1] = row1;
+		boneColumns[j][2] = row2;
+		boneColumns[j][3] = row3;
+	}
+
+	const bool scaled = (scale[0] != 1.0) || (scale[1] != 1.0) || (scale[2] != 1.0);
+	const __m128 scaleVec = _mm_setr_ps( scale[0], scale[1], scale[2], 1.0f );
+	const int numVerts = surface->numVerts;
+	const mdxmVertex_t *v = (mdxmVertex_t *) ((byte *)surface + surface->ofsVerts);
+	const mdxmVertexTexCoord_t *pTexCoords = (mdxmVertexTexCoord_t *) &v[numVerts];
+
+	for ( j = 0; j < numVerts; j++, v++ )
+	{
+		const __m128 x = _mm_set1_ps( v->vertCoords[0] );
+		const __m128 y = _mm_set1_ps( v->vertCoords[1] );
+		const __m128 z = _mm_set1_ps( v->vertCoords[2] );
+		const int iNumWeights = G2_GetVertWeights( v );
+		float fTotalWeight = 0.0f;
+		__m128 tempVert = _mm_setzero_ps();
+
+		for ( k = 0 ; k < iNumWeights ; k++ )
+		{
+			const int		iBoneIndex	= G2_GetVertBoneIndex( v, k );
+			const float		fBoneWeight	= G2_GetVertBoneWeight( v, k, fTotalWeight, iNumWeights );
+			const __m128	*column		= boneColumns[iBoneIndex < numBoneReferences ? iBoneIndex : 0];
+
+			const __m128 point = _mm_add_ps( _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( column[0], x ),
+				_mm_mul_ps( column[1], y ) ),
+				_mm_mul_ps( column[2], z ) ),
+				column[3] );
+			tempVert = _mm_add_ps( tempVert, _mm_mul_ps( _mm_set1_ps( fBoneWeight ), point ) );
+		}
+
+		if ( scaled )
+		{
+			tempVert = _mm_mul_ps( tempVert, scaleVec );
+		}
+
+		// the fourth float lands on s, which gets written right after
+		float *out = &TransformedVerts[j * 5];
+		_mm_storeu_ps( out, tempVert );
+		out[3] = pTexCoords[j].texCoords[0];
+		out[4] = pTexCoords[j].texCoords[1];
+	}
+}
+#endif
+
+static void G2_SkinSurfaceVerts( const mdxmSurface_t *surface, vec3_t scale, CBoneCache *boneCache, float *TransformedVerts )
 {
 	int				 j, k;
 	mdxmVertex_t 	*v;
-	float			*TransformedVerts;
+
+#if G2_SIMD
+	if ( g2_simd )
+	{
+		G2_SkinSurfaceVertsSIMD( surface, scale, boneCache, TransformedVerts );
+		return;
+	}
+#endif
 
 	//
 	// deform the vertexes by the lerped bones
 	//
 	int *piBoneReferences = (int*) ((byte*)surface + surface->ofsBoneReferences);
 
-	// alloc some space for the transformed verts to get put in
-	TransformedVerts = (float *)G2VertSpace->MiniHeapAlloc(surface->numVerts * 5 * 4);
-	TransformedVertsArray[surface->thisSurfaceIndex] = (size_t)TransformedVerts;
-	if (!TransformedVerts)
-	{
-		Com_Error(ERR_DROP, "Ran out of transform space for Ghoul2 Models. Adjust MiniHeapSize in SV_SpawnServer.\n");
-	}
-
 	// whip through and actually transform each vertex
 	const int numVerts = surface->numVerts;
 	v = (mdxmVertex_t *) ((byte *)surface + surface->ofsVerts);
@@ -497,8 +608,116 @@ void R_TransformEachSurface( const mdxmSurface_t *surface, vec3_t scale, IHeapAl
 	}
 }
 
+void R_TransformEachSurface( const mdxmSurface_t *surface, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertsArray,CBoneCache *boneCache)
+{
+	float			*TransformedVerts;
+
+	// alloc some space for the transformed verts to get put in
+	TransformedVerts = (float *)G2VertSpace->MiniHeapAlloc(surface->numVerts * 5 * 4);
+	TransformedVertsArray[surface->thisSurfaceIndex] = (size_t)TransformedVerts;
+	if (!TransformedVerts)
+	{
+		Com_Error(ERR_DROP, "Ran out of transform space for Ghoul2 Models. Adjust MiniHeapSize in SV_SpawnServer.\n");
+	}
+
+	G2_SkinSurfaceVerts(surface, scale, boneCache, TransformedVerts);
+}
+
+// get the cached verts of a model at this lod ready for use, laying them out if the model or lod is new to the cache
+static CTraceVertLod *G2_GetTraceVerts(CGhoul2Info &g, int lod, const vec3_t scale)
+{
+	CTraceVertCache *&traceVerts = G2_BoneCacheTraceVerts(g.mBoneCache);
+	const model_t *mod = g.currentModel;
+	int i;
+
+	if (!traceVerts)
+	{
+		traceVerts = new CTraceVertCache;
+	}
+	if (traceVerts->mod != mod)
+	{
+		traceVerts->mod = mod;
+		traceVerts->lods.clear();
+		traceVerts->lods.resize(mod->mdxm->numLODs);
+	}
+	if (lod < 0 || lod >= (int)traceVerts->lods.size())
+	{
+		return 0;
+	}
+
+	CTraceVertLod &cache = traceVerts->lods[lod];
+	if (cache.surfVerts.empty())
+	{
+		const int numSurfaces = mod->mdxm->numSurfaces;
+		int numVerts = 0, numBones = 0;
+
+		cache.surfVerts.resize(numSurfaces);
+		cache.surfBones.resize(numSurfaces);
+		cache.surfValid.assign(numSurfaces, 0);
+		cache.bounds.resize(numSurfaces * 6);
+		for (i = 0; i < numSurfaces; i++)
+		{
+			const mdxmSurface_t *surface = (mdxmSurface_t *)G2_FindSurface((void *)mod, i, lod);
+
+			cache.surfVerts[i] = numVerts;
+			cache.surfBones[i] = numBones;
+			numVerts += surface->numVerts * 5;
+			numBones += surface->numBoneReferences;
+		}
+		cache.verts.resize(numVerts);
+		cache.bones.resize(numBones);
+		VectorCopy(scale, cache.scale);
+	}
+	else if (!VectorCompare(scale, cache.scale))
+	{
+		VectorCopy(scale, cache.scale);
+		std::fill(cache.surfValid.begin(), cache.surfValid.end(), 0);
+	}
+
+	return &cache;
+}
+
+// use the cached verts of a surface if none of its bones moved since, otherwise skin them again
+static void G2_TransformCachedSurface(const mdxmSurface_t *surface, vec3_t scale, CTraceVertLod &cache, size_t *TransformedVertsArray, CBoneCache *boneCache)
+{
+	const int surfNum = surface->thisSurfaceIndex;
+	const int *piBoneReferences = (int *)((byte *)surface + surface->ofsBoneReferences);
+	mdxaBone_t *bones = cache.bones.data() + cache.surfBones[surfNum];
+	float *verts = cache.verts.data() + cache.surfVerts[surfNum];
+	bool skin = !cache.surfValid[surfNum];
+	int i;
+
+	for (i = 0; i < surface->numBoneReferences; i++)
+	{
+		const mdxaBone_t &bone = EvalBoneCache(piBoneReferences[i], boneCache);
+
+		if (memcmp(&bone, &bones[i], sizeof(bone)))
+		{
+			bones[i] = bone;
+			skin = true;
+		}
+	}
+
+	TransformedVertsArray[surfNum] = (size_t)verts;
+	if (!skin)
+	{
+		return;
+	}
+
+	G2_SkinSurfaceVerts(surface, scale, boneCache, verts);
+
+	float *mins = &cache.bounds[surfNum * 6];
+	float *maxs = mins + 3;
+	ClearBounds(mins, maxs);
+	for (i = 0; i < surface->numVerts; i++)
+	{
+		AddPointToBounds(&verts[i * 5], mins, maxs);
+	}
+	cache.surfValid[surfNum] = 1;
+}
+
 void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList,
-					CBoneCache *boneCache, const model_t *currentModel, int lod, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertArray, bool secondTimeAround)
+					CBoneCache *boneCache, const model_t *currentModel, int lod, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertArray, bool secondTimeAround, CTraceVertLod *traceVerts)
 {
 	int	i;
 	assert(currentModel);
@@ -521,8 +740,14 @@ void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList,
 	// if this surface is not off, add it to the shader render list
 	if (!offFlags)
 	{
-
-		R_TransformEachSurface(surface, scale, G2VertSpace, TransformedVertArray, boneCache);
+		if (traceVerts)
+		{
+			G2_TransformCachedSurface(surface, scale, *traceVerts, TransformedVertArray, boneCache);
+		}
+		else
+		{
+			R_TransformEachSurface(surface, scale, G2VertSpace, TransformedVertArray, boneCache);
+		}
 	}
 
 	// if we are turning off all descendants, then stop this recursion now
@@ -534,7 +759,7 @@ void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList,
 	// now recursively call for the children
 	for (i=0; i< surfInfo->numChildren; i++)
 	{
-		G2_TransformSurfaces(surfInfo->childIndexes[i], rootSList, boneCache, currentModel, lod, scale, G2VertSpace, TransformedVertArray, secondTimeAround);
+		G2_TransformSurfaces(surfInfo->childIndexes[i], rootSList, boneCache, currentModel, lod, scale, G2VertSpace, TransformedVertArray, secondTimeAround, traceVerts);
 	}
 }
 
@@ -629,9 +854,21 @@ void G2_TransformModel(CGhoul2Info_v &ghoul2, const int frameNum, vec3_t scale,
 		memset(g.mTransformedVertsArray, 0, g.currentModel->mdxm->numSurfaces * sizeof (size_t));
 
 		G2_FindOverrideSurface(-1,g.mSlist); //reset the quick surface override lookup;
-		// recursively call the model surface transform
 
-		G2_TransformSurfaces(g.mSurfaceRoot, g.mSlist, g.mBoneCache,  g.currentModel, lod, correctScale, G2VertSpace, g.mTransformedVertsArray, false);
+		// plain traces skin into the verts cached with the model, gore and the zone allocated
+		// transforms of G2API_CollisionDetectCache hang on to their own copies
+		CTraceVertLod *traceVerts = 0;
+#ifdef _G2_GORE
+		if (!ApplyGore && !(g.mFlags & GHOUL2_ZONETRANSALLOC))
+#else
+		if (!(g.mFlags & GHOUL2_ZONETRANSALLOC))
+#endif
+		{
+			traceVerts = G2_GetTraceVerts(g, lod, correctScale);
+		}
+
+		// recursively call the model surface transform
+		G2_TransformSurfaces(g.mSurfaceRoot, g.mSlist, g.mBoneCache,  g.currentModel, lod, correctScale, G2VertSpace, g.mTransformedVertsArray, false, traceVerts);
 
 #ifdef _G2_GORE
 		if (ApplyGore && firstModelOnly)
@@ -1400,6 +1637,89 @@ static bool G2_RadiusTracePolys(
 }
 
 
+// the cached verts of a model at this lod, if there are any
+static const CTraceVertLod *G2_FindTraceVerts(CGhoul2Info &g, int lod)
+{
+	if (!g.mBoneCache)
+	{
+		return 0;
+	}
+
+	const CTraceVertCache *traceVerts = G2_BoneCacheTraceVerts(g.mBoneCache);
+	if (!traceVerts || traceVerts->mod != g.currentModel || lod < 0 || lod >= (int)traceVerts->lods.size())
+	{
+		return 0;
+	}
+	if (traceVerts->lods[lod].surfVerts.empty())
+	{
+		return 0;
+	}
+	return &traceVerts->lods[lod];
+}
+
+// true if the ray can't touch any poly of the surface. Only known for surfaces traced against
+// the cached verts, as those are the ones with bounds.
+static bool G2_RayMissesSurface(const mdxmSurface_t *surface, const CTraceSurface &TS)
+{
+	const int surfNum = surface->thisSurfaceIndex;
+	const CTraceVertLod *cache = TS.traceVerts;
+	int i;
+
+	if (!cache || !cache->surfValid[surfNum] ||
+		TS.TransformedVertsArray[surfNum] != (size_t)(cache->verts.data() + cache->surfVerts[surfNum]))
+	{
+		return false;
+	}
+
+	// radius traces take verts within a square of half size m_fRadius around the ray
+	float expand = 1.0f;
+	if (!(fabs(TS.m_fRadius) < 0.1))
+	{
+		expand += fabs(TS.m_fRadius) * 1.5f;
+	}
+
+	const float *mins = &cache->bounds[surfNum * 6];
+	const float *maxs = mins + 3;
+	float enter = 0.0f, leave = 1.0f;
+	for (i = 0; i < 3; i++)
+	{
+		const float lo = mins[i] - expand;
+		const float hi = maxs[i] + expand;
+		const float delta = TS.rayEnd[i] - TS.rayStart[i];
+
+		if (fabs(delta) < 1E-6f)
+		{
+			if (TS.rayStart[i] < lo || TS.rayStart[i] > hi)
+			{
+				return true;
+			}
+			continue;
+		}
+
+		float t1 = (lo - TS.rayStart[i]) / delta;
+		float t2 = (hi - TS.rayStart[i]) / delta;
+		if (t1 > t2)
+		{
+			const float t = t1;
+			t1 = t2;
+			t2 = t;
+		}
+		if (t1 > enter)
+		{
+			enter = t1;
+		}
+		if (t2 < leave)
+		{
+			leave = t2;
+		}
+		if (enter > leave)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 // look at a surface and then do the trace on each poly
 static void G2_TraceSurfaces(CTraceSurface &TS)
 {
@@ -1436,7 +1756,11 @@ static void G2_TraceSurfaces(CTraceSurface &TS)
 		if (TS.collRecMap)
 		{
 #endif
-			if (!(fabs(TS.m_fRadius) < 0.1))	// if not a point-trace
+			if (G2_RayMissesSurface(surface, TS))
+			{
+				// nowhere near this one, the children still get looked at below
+			}
+			else if (!(fabs(TS.m_fRadius) < 0.1))	// if not a point-trace
 			{
 				// .. then use radius check
 				//
@@ -1568,6 +1892,7 @@ void G2_TraceModels(CGhoul2Info_v &ghoul2, vec3_t rayStart, vec3_t rayEnd, Colli
 #else
 		CTraceSurface TS(ghoul2[i].mSurfaceRoot, ghoul2[i].mSlist,  (model_t *)ghoul2[i].currentModel, lod, rayStart, rayEnd, collRecMap, entNum, i, skin, cust_shader, ghoul2[i].mTransformedVertsArray, eG2TraceType, fRadius);
 #endif
+		TS.traceVerts = G2_FindTraceVerts(ghoul2[i], lod);
 		// start the surface recursion loop
 		G2_TraceSurfaces(TS);
 
@@ -1901,3 +2226,146 @@ void G2_LerpAngles(CGhoul2Info_v &ghoul2,CGhoul2Info_v &nextGhoul2, float interp
 		}
 	}
 }
+
+#ifndef FINAL_BUILD
+// pose the model at time and skin lod 0, the matrices of every bone go to bones
+static void G2_SkinTestBones(CGhoul2Info_v &ghoul2, int time, mdxaBone_t *bones)
+{
+	CGhoul2Info &g = ghoul2[0];
+	const vec3_t scale = { 0.0f, 0.0f, 0.0f };
+	int i;
+
+	G2_ConstructGhoulSkeleton(ghoul2, time, true, scale);
+	for (i = 0; i < g.aHeader->numBones; i++)
+	{
+		bones[i] = EvalBoneCache(i, g.mBoneCache);
+	}
+}
+
+static void G2_SkinTestVerts(CGhoul2Info_v &ghoul2, float *verts)
+{
+	CGhoul2Info &g = ghoul2[0];
+	vec3_t scale = { 1.0f, 1.0f, 1.0f };
+	int i;
+
+	for (i = 0; i < g.currentModel->mdxm->numSurfaces; i++)
+	{
+		const mdxmSurface_t *surface = (mdxmSurface_t *)G2_FindSurface((void *)g.currentModel, i, 0);
+
+		G2_SkinSurfaceVerts(surface, scale, g.mBoneCache, verts);
+		verts += surface->numVerts * 5;
+	}
+}
+
+/*
+================
+G2_SkinTest_f
+
+g2SkinTest [model] [instances] [frames]
+
+Loops instances of a model through all of their animation, transforming every bone and
+skinning lod 0 each frame. With SSE2 the bones and verts are checked against the scalar
+code, and both are timed.
+================
+*/
+void G2_SkinTest_f(void)
+{
+	const char *modelName = ri.Cmd_Argc() > 1 ? ri.Cmd_Argv(1) : "models/players/kyle/model.glm";
+	const int numInstances = ri.Cmd_Argc() > 2 ? Q_max(1, Q_min(256, atoi(ri.Cmd_Argv(2)))) : 32;
+	const int numFrames = ri.Cmd_Argc() > 3 ? Q_max(1, atoi(ri.Cmd_Argv(3))) : 200;
+	std::vector<CGhoul2Info_v *> instances(numInstances, (CGhoul2Info_v *)NULL);
+	int i, n, numBones = 0, numFloats = 0;
+
+	for (n = 0; n < numInstances; n++)
+	{
+		if (G2API_InitGhoul2Model(&instances[n], modelName, 0) < 0 || !instances[n] ||
+			!G2_SetupModelPointers(&(*instances[n])[0]))
+		{
+			Com_Printf("g2SkinTest: couldn't load %s\n", modelName);
+			break;
+		}
+
+		CGhoul2Info &g = (*instances[n])[0];
+		numBones = g.aHeader->numBones;
+		G2API_SetBoneAnim(*instances[n], 0, "model_root", 0, g.aHeader->numFrames - 1, BONE_ANIM_OVERRIDE_LOOP, 1.0f, n * 50);
+	}
+
+	if (n == numInstances)
+	{
+		CGhoul2Info &g = (*instances[0])[0];
+
+		for (i = 0; i < g.currentModel->mdxm->numSurfaces; i++)
+		{
+			numFloats += ((mdxmSurface_t *)G2_FindSurface((void *)g.currentModel, i, 0))->numVerts * 5;
+		}
+
+		std::vector<mdxaBone_t> bones(numBones * 2);
+		std::vector<float> verts(numFloats * 2);
+		int64_t timeBones[2] = { 0, 0 }, timeVerts[2] = { 0, 0 };
+		int mismatches = 0;
+		int pass, frame;
+
+#if G2_SIMD
+		for (frame = 0; frame < numFrames; frame++)
+		{
+			CGhoul2Info_v &ghoul2 = *instances[frame % numInstances];
+
+			g2_simd = qfalse;
+			G2_SkinTestBones(ghoul2, frame * 50, &bones[0]);
+			G2_SkinTestVerts(ghoul2, &verts[0]);
+			g2_simd = qtrue;
+			G2_SkinTestBones(ghoul2, frame * 50, &bones[numBones]);
+			G2_SkinTestVerts(ghoul2, &verts[numFloats]);
+
+			if (memcmp(&bones[0], &bones[numBones], numBones * sizeof(bones[0])) ||
+				memcmp(&verts[0], &verts[numFloats], numFloats * sizeof(verts[0])))
+			{
+				if (!mismatches)
+				{
+					Com_Printf("g2SkinTest: frame %i differs from the scalar code\n", frame);
+				}
+				mismatches++;
+			}
+		}
+#endif
+
+		for (pass = 0; pass < 2; pass++)
+		{
+#if G2_SIMD
+			g2_simd = pass ? qfalse : qtrue;
+#endif
+			for (frame = 0; frame < numFrames; frame++)
+			{
+				for (n = 0; n < numInstances; n++)
+				{
+					int64_t start = Sys_Microseconds();
+					G2_SkinTestBones(*instances[n], frame * 50 + n * 13, &bones[0]);
+					int64_t skinned = Sys_Microseconds();
+					G2_SkinTestVerts(*instances[n], &verts[0]);
+					timeBones[pass] += skinned - start;
+					timeVerts[pass] += Sys_Microseconds() - skinned;
+				}
+			}
+		}
+#if G2_SIMD
+		g2_simd = qtrue;
+#endif
+
+		Com_Printf("g2SkinTest: %i poses of %s, %i bones and %i verts each\n",
+			numFrames * numInstances, modelName, numBones, numFloats / 5);
+#if G2_SIMD
+		Com_Printf("g2SkinTest: SSE2 bones %i usec, skinning %i usec\n", (int)timeBones[0], (int)timeVerts[0]);
+#endif
+		Com_Printf("g2SkinTest: scalar bones %i usec, skinning %i usec\n", (int)timeBones[1], (int)timeVerts[1]);
+		Com_Printf("g2SkinTest: %i mismatches\n", mismatches);
+	}
+
+	for (n = 0; n < numInstances; n++)
+	{
+		if (instances[n])
+		{
+			G2API_CleanGhoul2Models(&instances[n]);
+		}
+	}
+}
+#endif
@@ -32,8 +32,14 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "qcommon/disablewarnings.h"
 
+#if G2_SIMD
+#include <emmintrin.h>
+#endif
+
 #define	LL(x) x=LittleLong(x)
 
+qboolean	g2_simd = qtrue;
+
 #ifdef G2_PERFORMANCE_ANALYSIS
 #include "qcommon/timing.h"
 
@@ -199,6 +205,9 @@ struct SBoneCalc
 class CBoneCache;
 void G2_TransformBone(int index,CBoneCache &CB);
 
+class CTraceVertCache;
+void G2_FreeTraceVerts(CTraceVertCache *traceVerts);
+
 class CBoneCache
 {
 	void SetRenderMatrix(CTransformBone *bone) {
@@ -338,9 +347,13 @@ public:
 	bool			mUnsquash;
 	float			mSmoothFactor;
 
+	// skinned verts kept between collision traces, see G2_TransformModel
+	CTraceVertCache	*mTraceVerts;
+
 	CBoneCache(const model_t *amod,const mdxaHeader_t *aheader) :
 		header(aheader),
-		mod(amod)
+		mod(amod),
+		mTraceVerts(0)
 	{
 		assert(amod);
 		assert(aheader);
@@ -495,13 +508,17 @@ void RemoveBoneCache(CBoneCache *boneCache)
 	g_Ghoul2Allocations -= sizeof(*boneCache);
 #endif
 
+	G2_FreeTraceVerts(boneCache->mTraceVerts);
 	delete boneCache;
 }
 
 #ifdef _G2_LISTEN_SERVER_OPT
 void CopyBoneCache(CBoneCache *to, CBoneCache *from)
 {
+	CTraceVertCache *traceVerts = to->mTraceVerts;
+
 	memcpy(to, from, sizeof(CBoneCache));
+	to->mTraceVerts = traceVerts;
 }
 #endif
 
@@ -511,6 +528,12 @@ const mdxaBone_t &EvalBoneCache(int index,CBoneCache *boneCache)
 	return boneCache->Eval(index);
 }
 
+CTraceVertCache *&G2_BoneCacheTraceVerts(CBoneCache *boneCache)
+{
+	assert(boneCache);
+	return boneCache->mTraceVerts;
+}
+
 //rww - RAGDOLL_BEGIN
 const mdxaHeader_t *G2_GetModA(CGhoul2Info &ghoul2)
 {
@@ -894,9 +917,40 @@ void G2_CreateMatrixFromQuaterion(mdxaBone_t *mat, vec4_t quat)
     mat->matrix[0][3]  = mat->matrix[1][3] = mat->matrix[2][3] = 0;
 }
 
+#if G2_SIMD
+// one row of Multiply_3x4Matrix, summed in the same order as the scalar code so the results match exactly
+static QINLINE __m128 G2_MultiplyRow(__m128 a, __m128 in0, __m128 in1, __m128 in2)
+{
+	const __m128 lastColumn = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	const __m128 sum = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0,0,0,0)), in0),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1,1,1,1)), in1)),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2,2,2,2)), in2));
+
+	// only the translation gets the row's own last column added
+	return _mm_or_ps(_mm_andnot_ps(lastColumn, sum), _mm_and_ps(lastColumn, _mm_add_ps(sum, a)));
+}
+#endif
+
 // nasty little matrix multiply going on here..
 void Multiply_3x4Matrix(mdxaBone_t *out, mdxaBone_t *in2, mdxaBone_t *in)
 {
+#if G2_SIMD
+	if (g2_simd)
+	{
+		const __m128 in0 = _mm_loadu_ps(in->matrix[0]);
+		const __m128 in1 = _mm_loadu_ps(in->matrix[1]);
+		const __m128 inB = _mm_loadu_ps(in->matrix[2]);
+		const __m128 r0 = G2_MultiplyRow(_mm_loadu_ps(in2->matrix[0]), in0, in1, inB);
+		const __m128 r1 = G2_MultiplyRow(_mm_loadu_ps(in2->matrix[1]), in0, in1, inB);
+		const __m128 r2 = G2_MultiplyRow(_mm_loadu_ps(in2->matrix[2]), in0, in1, inB);
+
+		_mm_storeu_ps(out->matrix[0], r0);
+		_mm_storeu_ps(out->matrix[1], r1);
+		_mm_storeu_ps(out->matrix[2], r2);
+		return;
+	}
+#endif
 	// first row of out
 	out->matrix[0][0] = (in2->matrix[0][0] * in->matrix[0][0]) + (in2->matrix[0][1] * in->matrix[1][0]) + (in2->matrix[0][2] * in->matrix[2][0]);
 	out->matrix[0][1] = (in2->matrix[0][0] * in->matrix[0][1]) + (in2->matrix[0][1] * in->matrix[1][1]) + (in2->matrix[0][2] * in->matrix[2][1]);
@@ -1307,6 +1361,33 @@ void G2_RagGetAnimMatrix(CGhoul2Info &ghoul2, const int boneNum, mdxaBone_t &mat
 	matrix = bone.animFrameMatrix;
 }
 
+// out = ( aLerp * a ) + ( bLerp * b ) over the whole bone, out may be one of the inputs
+static QINLINE void G2_LerpBone(mdxaBone_t *out, float aLerp, const mdxaBone_t *a, float bLerp, const mdxaBone_t *b)
+{
+	int i;
+
+#if G2_SIMD
+	if (g2_simd)
+	{
+		const __m128 aScale = _mm_set1_ps(aLerp);
+		const __m128 bScale = _mm_set1_ps(bLerp);
+
+		for (i = 0; i < 3; i++)
+		{
+			_mm_storeu_ps(out->matrix[i], _mm_add_ps(
+				_mm_mul_ps(aScale, _mm_loadu_ps(a->matrix[i])),
+				_mm_mul_ps(bScale, _mm_loadu_ps(b->matrix[i]))));
+		}
+		return;
+	}
+#endif
+
+	for (i = 0; i < 12; i++)
+	{
+		((float *)out)[i] = (aLerp * ((const float *)a)[i]) + (bLerp * ((const float *)b)[i]);
+	}
+}
+
 void G2_TransformBone (int child,CBoneCache &BC)
 {
 	SBoneCalc &TB=BC.mBones[child];
@@ -1476,11 +1557,7 @@ void G2_TransformBone (int child,CBoneCache &BC)
 		UnCompressBone(tbone[3].matrix, child, BC.header, TB.blendFrame);
 		UnCompressBone(tbone[4].matrix, child, BC.header, TB.blendOldFrame);
 
-		for ( j = 0 ; j < 12 ; j++ )
-		{
-  			((float *)&tbone[5])[j] = (backlerp * ((float *)&tbone[3])[j])
-				+ (frontlerp * ((float *)&tbone[4])[j]);
-		}
+		G2_LerpBone(&tbone[5], backlerp, &tbone[3], frontlerp, &tbone[4]);
 	}
 
   	//
@@ -1495,11 +1572,7 @@ void G2_TransformBone (int child,CBoneCache &BC)
 		if (TB.blendMode)
 		{
 			float blendFrontlerp = 1.0 - TB.blendLerp;
-	  		for ( j = 0 ; j < 12 ; j++ )
-			{
-  				((float *)&tbone[2])[j] = (TB.blendLerp * ((float *)&tbone[2])[j])
-					+ (blendFrontlerp * ((float *)&tbone[5])[j]);
-			}
+			G2_LerpBone(&tbone[2], TB.blendLerp, &tbone[2], blendFrontlerp, &tbone[5]);
 		}
 
   		if (!child)
@@ -1516,21 +1589,13 @@ void G2_TransformBone (int child,CBoneCache &BC)
 		UnCompressBone(tbone[0].matrix, child, BC.header, TB.newFrame);
 		UnCompressBone(tbone[1].matrix, child, BC.header, TB.currentFrame);
 
-		for ( j = 0 ; j < 12 ; j++ )
-		{
-  			((float *)&tbone[2])[j] = (TB.backlerp * ((float *)&tbone[0])[j])
-				+ (frontlerp * ((float *)&tbone[1])[j]);
-		}
+		G2_LerpBone(&tbone[2], TB.backlerp, &tbone[0], frontlerp, &tbone[1]);
 
 		// blend in the other frame if we need to
 		if (TB.blendMode)
 		{
 			float blendFrontlerp = 1.0 - TB.blendLerp;
-	  		for ( j = 0 ; j < 12 ; j++ )
-			{
-  				((float *)&tbone[2])[j] = (TB.blendLerp * ((float *)&tbone[2])[j])
-					+ (blendFrontlerp * ((float *)&tbone[5])[j]);
-			}
+			G2_LerpBone(&tbone[2], TB.blendLerp, &tbone[2], blendFrontlerp, &tbone[5]);
 		}
 
   		if (!child)
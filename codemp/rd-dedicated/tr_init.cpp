@@ -286,6 +286,9 @@ static consoleCommand_t	commands[] = {
 	{ "modellist",			R_Modellist_f },
 	{ "modelist",			R_ModeList_f },
 	{ "modelcacheinfo",		RE_RegisterModels_Info_f },
+#ifndef FINAL_BUILD
+	{ "g2SkinTest",			G2_SkinTest_f },
+#endif
 };
 
 static const size_t numCommands = ARRAY_LEN( commands );
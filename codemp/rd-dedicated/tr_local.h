@@ -1830,8 +1830,21 @@ void RE_TakeVideoFrame( int width, int height, byte *captureBuffer, byte *encode
 /*
 Ghoul2 Insert Start
 */
+// bone transforms and skinning have SSE2 paths wherever the compiler can use it
+#if defined(__SSE2_MATH__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define G2_SIMD	1
+#else
+	#define G2_SIMD	0
+#endif
+
 // tr_ghoul2.cpp
+extern qboolean	g2_simd;		// g2SkinTest turns it off to compare
 void		Multiply_3x4Matrix(mdxaBone_t *out, mdxaBone_t *in2, mdxaBone_t *in);
+
+#ifndef FINAL_BUILD
+// G2_misc.cpp
+void		G2_SkinTest_f( void );
+#endif
 extern qboolean R_LoadMDXM (model_t *mod, void *buffer, const char *name, qboolean &bAlreadyCached );
 extern qboolean R_LoadMDXA (model_t *mod, void *buffer, const char *name, qboolean &bAlreadyCached );
 void		RE_InsertModelIntoHash(const char *name, model_t *mod);
@@ -40,11 +40,13 @@ CNavigator		navigator;
 
 cvar_t		*d_altRoutes;
 cvar_t		*d_patched;
+cvar_t		*sv_navThreads;
 
 void NAV_CvarInit()
 {
 	d_altRoutes = Cvar_Get("d_altRoutes", "0", CVAR_CHEAT);
 	d_patched = Cvar_Get("d_patched", "0", CVAR_CHEAT);
+	sv_navThreads = Cvar_Get("sv_navThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to precompute NPC routes, 1 computes them serially");
 }
 
 void NAV_Free()
@@ -105,15 +107,11 @@ CNode::CNode( void )
 {
 	m_numEdges		= 0;
 	m_radius		= 0;
-	m_ranks			= NULL;
 }
 
 CNode::~CNode( void )
 {
 	m_edges.clear();
-
-	if ( m_ranks )
-		delete [] m_ranks;
 }
 
 /*
@@ -205,19 +203,6 @@ int CNode::GetEdgeNumToNode( int ID )
 	return -1;
 }
 
-/*
--------------------------
-AddRank
--------------------------
-*/
-
-void CNode::AddRank( int ID, int rank )
-{
-	assert( m_ranks );
-
-	m_ranks[ ID ] = rank;
-}
-
 /*
 -------------------------
 Draw
@@ -342,40 +327,6 @@ void CNode::SetEdgeFlags( int edgeNum, int newFlags )
 	}
 
 }
-/*
--------------------------
-InitRanks
--------------------------
-*/
-
-void CNode::InitRanks( int size )
-{
-	//Clear it if it's already allocated
-	if ( m_ranks != NULL )
-	{
-		delete [] m_ranks;
-		m_ranks = NULL;
-	}
-
-	m_ranks = new int[size];
-
-	memset( m_ranks, -1, sizeof(int)*size );
-}
-
-/*
--------------------------
-GetRank
--------------------------
-*/
-
-int CNode::GetRank( int ID )
-{
-	assert( m_ranks );
-
-	return m_ranks[ ID ];
-}
-
-
 /*
 -------------------------
 Save
@@ -406,13 +357,10 @@ int	CNode::Save( int numNodes, fileHandle_t file )
 		FS_Write( &(*ei), sizeof( edge_t ), file );
 	}
 
-	//Write out the node ranks
-	FS_Write( &numNodes, sizeof( numNodes ), file );
+	//Node ranks aren't stored anymore, paths are searched for on demand
+	int	numRanks = 0;
 
-	for ( i = 0; i < numNodes; i++ )
-	{
-		FS_Write( &m_ranks[i], sizeof( int ), file );
-	}
+	FS_Write( &numRanks, sizeof( numRanks ), file );
 
 	return true;
 }
@@ -453,17 +401,14 @@ int CNode::Load( int numNodes, fileHandle_t file )
 		STL_INSERT( m_edges, edge );
 	}
 
-	//Read the node ranks
+	//Skip the node ranks older files still have
 	int	numRanks;
 
 	FS_Read( &numRanks, sizeof( numRanks ), file );
 
-	//Allocate the memory
-	InitRanks( numRanks );
-
-	for ( i = 0; i < numRanks; i++ )
+	if ( numRanks > 0 )
 	{
-		FS_Read( &m_ranks[i], sizeof( int ), file );
+		FS_Seek( file, numRanks * sizeof( int ), FS_SEEK_CUR );
 	}
 
 	return true;
@@ -477,6 +422,22 @@ CNavigator
 
 CNavigator::CNavigator( void )
 {
+	m_graphValid = false;
+	m_lastGoalSearch = NULL;
+	m_goalSearchStamp = 0;
+	m_numFailedEdges = 0;
+	m_graphChecksum = m_baseChecksum = 0;
+	m_checksumValid = false;
+	m_haveBaseGraph = false;
+	m_cacheName[0] = '\0';
+	m_gridValid = false;
+	m_pathStamp = 0;
+
+	for ( int i = 0; i < NAV_GOAL_SEARCHES; i++ )
+	{
+		m_goalSearches[i].goalID = NODE_NONE;
+	}
+
 #if 0 // RAVEN... why u make it so hard to double link list cvars
 	if (!d_altRoutes || !d_patched)
 	{
@@ -591,13 +552,21 @@ void CNavigator::Free( void )
 {
 	node_v::iterator	ni;
 
+	SaveGoalCache();
+	m_haveBaseGraph = false;
+	m_goalUses.clear();
+
 	STL_ITERATE( ni, m_nodes )
 	{
 		delete (*ni);
 	}
 
 	m_nodes.clear();
-	m_edgeLookupMap.clear();
+	m_numFailedEdges = 0;
+	m_gridValid = false;
+
+	InvalidatePaths();
+	ClearNearestCache();
 }
 
 /*
@@ -613,6 +582,8 @@ bool CNavigator::Load( const char *filename, int checksum )
 	// Free previous map just in case. jampgame doesn't do this by default...
 	Free();
 
+	Q_strncpyz( m_cacheName, filename, sizeof( m_cacheName ) );
+
 	//Attempt to load the file
 	FS_FOpenFileByMode( va( "maps/%s.nav", filename ), &file, FS_READ );
 
@@ -623,7 +594,7 @@ bool CNavigator::Load( const char *filename, int checksum )
 	//Check the header id
 	int navID = GetLong( file );
 
-	if ( navID != NAV_HEADER_ID )
+	if ( navID != NAV_HEADER_ID && navID != NAV_HEADER_ID_RANKS )
 	{
 		FS_FCloseFile( file );
 		return false;
@@ -657,12 +628,16 @@ bool CNavigator::Load( const char *filename, int checksum )
 	FS_Read( &failedEdges, sizeof( failedEdges ), file );
 	for ( int j = 0; j < MAX_FAILED_EDGES; j++ )
 	{
-		m_edgeLookupMap.insert(std::pair<int, int>(failedEdges[j].startID, j));
+		if ( failedEdges[j].startID != WAYPOINT_NONE )
+		{
+			m_numFailedEdges++;
+		}
 	}
 
-
 	FS_FCloseFile( file );
 
+	BuildNodeGrid();
+
 	return true;
 }
 
@@ -731,6 +706,9 @@ int CNavigator::AddRawPoint( vec3_t point, int flags, int radius )
 	//TODO: Correct stuck waypoints
 
 	STL_INSERT( m_nodes, node );
+	InvalidatePaths();
+	ClearNearestCache();
+	m_gridValid = false;
 
 	return node->GetID();
 }
@@ -787,6 +765,69 @@ void CNavigator::SetEdgeCost( int ID1, int ID2, int cost )
 	//set it
 	node1->AddEdge( ID2, cost );
 	node2->AddEdge( ID1, cost );
+
+	//routes only go around failed edges with alternate routing on
+	if ( d_altRoutes->integer )
+	{
+		PatchEdgeCost( ID1, ID2, cost );
+		PatchEdgeCost( ID2, ID1, cost );
+		DropEdgeSearches( ID1, ID2 );
+	}
+}
+
+/*
+-------------------------
+PatchEdgeCost
+
+Changes the cost of one edge in the search graph without rebuilding it
+-------------------------
+*/
+
+void CNavigator::PatchEdgeCost( int fromID, int toID, int cost )
+{
+	if ( !m_graphValid )
+		return;	//picked up from the nodes when the graph is rebuilt
+
+	for ( int i = m_edgeOffsets[fromID]; i < m_edgeOffsets[fromID + 1]; i++ )
+	{
+		if ( m_edgeTargets[i] == toID )
+		{
+			m_edgeCosts[i] = ( cost > 0 ) ? cost : 0;
+			m_checksumValid = false;
+		}
+	}
+}
+
+/*
+-------------------------
+DropEdgeSearches
+
+Forgets the cached searches that already went over the edge between ID1 and
+ID2.  Only settled nodes have had their edges followed, so a search that
+hasn't settled either end picks up the new cost when it gets there.
+-------------------------
+*/
+
+void CNavigator::DropEdgeSearches( int ID1, int ID2 )
+{
+	for ( int i = 0; i < NAV_GOAL_SEARCHES; i++ )
+	{
+		goalSearch_t	*search = &m_goalSearches[i];
+
+		if ( search->goalID == NODE_NONE )
+			continue;
+
+		if ( !search->settled[ID1] && !search->settled[ID2] )
+			continue;
+
+		search->goalID = NODE_NONE;
+		if ( m_lastGoalSearch == search )
+		{
+			m_lastGoalSearch = NULL;
+		}
+	}
+
+	m_pathStamp++;
 }
 
 /*
@@ -817,73 +858,455 @@ void CNavigator::AddNodeEdges( CNode *node, int addDist, edge_l	&edgeList, bool
 
 /*
 -------------------------
-CalculatePath
+BuildGraph
 -------------------------
 */
 
-void CNavigator::CalculatePath( CNode *node )
+void CNavigator::BuildGraph( void )
 {
-	int	curRank = 0;
+	int	numNodes = m_nodes.size();
+	int	numEdges = 0;
+
+	for ( int i = 0; i < numNodes; i++ )
+	{
+		numEdges += m_nodes[i]->GetNumEdges();
+	}
 
-	CPriorityQueue	*pathList = new CPriorityQueue();
-	byte			*checked;
+	m_edgeOffsets.resize( numNodes + 1 );
+	m_edgeTargets.resize( numEdges );
+	m_edgeCosts.resize( numEdges );
 
-	//Init the completion table
-	checked = new byte[ m_nodes.size() ];
-	memset( checked, 0, m_nodes.size() );
+	numEdges = 0;
+	for ( int i = 0; i < numNodes; i++ )
+	{
+		CNode	*node = m_nodes[i];
 
-	//Mark this node as checked
-	checked[ node->GetID() ] = true;
-	node->AddRank( node->GetID(), curRank++ );
+		m_edgeOffsets[i] = numEdges;
+		for ( int j = 0; j < node->GetNumEdges(); j++ )
+		{
+			int	cost = node->GetEdgeCost( j );
 
-	//Add all initial nodes
-	int i;
-	for ( i = 0; i < node->GetNumEdges(); i++ )
+			m_edgeTargets[numEdges] = node->GetEdge( j );
+			m_edgeCosts[numEdges] = ( cost > 0 ) ? cost : 0;
+			numEdges++;
+		}
+	}
+	m_edgeOffsets[numNodes] = numEdges;
+
+	UpdateGraphChecksum();
+
+	m_goalUses.resize( numNodes, 0 );
+	m_graphValid = true;
+
+	//First time round for this map, the goals we know from last time can be restored
+	if ( !m_haveBaseGraph )
 	{
-		CNode	*nextNode = m_nodes[ node->GetEdge(i) ];
-		assert(nextNode);
+		m_baseChecksum = m_graphChecksum;
+		m_haveBaseGraph = true;
+		LoadGoalCache();
+	}
+}
+
+/*
+-------------------------
+UpdateGraphChecksum
+-------------------------
+*/
+
+void CNavigator::UpdateGraphChecksum( void )
+{
+	int	numNodes = m_nodes.size();
+	int	numEdges = m_edgeTargets.size();
+
+	m_graphChecksum = numNodes;
+	for ( int i = 0; i <= numNodes; i++ )
+		m_graphChecksum = m_graphChecksum * 31 + m_edgeOffsets[i];
+	for ( int i = 0; i < numEdges; i++ )
+		m_graphChecksum = ( m_graphChecksum * 31 + m_edgeTargets[i] ) * 31 + m_edgeCosts[i];
 
-		checked[ nextNode->GetID() ] = true;
+	m_checksumValid = true;
+}
 
-		pathList->Push( new CEdge( nextNode->GetID(), nextNode->GetID(), node->GetEdgeCost(i) ) );
+/*
+-------------------------
+InvalidatePaths
+
+Edges changed, every cached search is out of date
+-------------------------
+*/
+
+void CNavigator::InvalidatePaths( void )
+{
+	m_graphValid = false;
+	m_lastGoalSearch = NULL;
+	m_pathStamp++;
+
+	for ( int i = 0; i < NAV_GOAL_SEARCHES; i++ )
+	{
+		m_goalSearches[i].goalID = NODE_NONE;
 	}
+}
 
-	//float				minDist;
-	CEdge				*test;
+/*
+-------------------------
+GetGoalSearch
+
+Returns the search rooted at goalID, starting a new one in the least recently
+used slot if there is none
+-------------------------
+*/
 
-	//Now flood fill all the others
-	while ( !pathList->Empty() )
+CNavigator::goalSearch_t *CNavigator::GetGoalSearch( int goalID )
+{
+	goalSearch_t	*search, *oldest = &m_goalSearches[0];
+
+	if ( !m_graphValid )
+	{
+		BuildGraph();
+	}
+
+	m_goalSearchStamp++;
+	m_goalUses[goalID]++;
+
+	if ( m_lastGoalSearch && m_lastGoalSearch->goalID == goalID )
+	{
+		m_lastGoalSearch->lastUsed = m_goalSearchStamp;
+		return m_lastGoalSearch;
+	}
+
+	for ( int i = 0; i < NAV_GOAL_SEARCHES; i++ )
+	{
+		search = &m_goalSearches[i];
+
+		if ( search->goalID == goalID )
+		{
+			search->lastUsed = m_goalSearchStamp;
+			m_lastGoalSearch = search;
+			return search;
+		}
+
+		//Prefer an unused slot, otherwise the least recently used one
+		if ( oldest->goalID != NODE_NONE && ( search->goalID == NODE_NONE || search->lastUsed < oldest->lastUsed ) )
+		{
+			oldest = search;
+		}
+	}
+
+	//Start over from the goal
+	search = oldest;
+	search->goalID = goalID;
+	search->lastUsed = m_goalSearchStamp;
+	search->cost.assign( m_nodes.size(), -1 );
+	search->settled.assign( m_nodes.size(), 0 );
+	search->open.clear();
+
+	search->cost[goalID] = 0;
+	search->open.push_back( std::make_pair( 0, goalID ) );
+
+	m_lastGoalSearch = search;
+	return search;
+}
+
+/*
+-------------------------
+SettleSearch
+
+Runs the search until nodeID's cost is final, or to the end with NODE_NONE.
+Only touches the search itself, so different searches can run side by side.
+-------------------------
+*/
+
+void CNavigator::SettleSearch( goalSearch_t *search, int nodeID )
+{
+	while ( ( nodeID == NODE_NONE || !search->settled[nodeID] ) && !search->open.empty() )
 	{
-		//minDist = Q3_INFINITE;
-		test	 = pathList->Pop();
+		std::pop_heap( search->open.begin(), search->open.end() );
+
+		int	cost = -search->open.back().first;
+		int	testID = search->open.back().second;
 
-		CNode	*testNode = m_nodes[ (*test).m_first ];
-		assert( testNode );
+		search->open.pop_back();
+
+		if ( search->settled[testID] )
+			continue;
 
-		node->AddRank( testNode->GetID(), curRank++ );
+		search->settled[testID] = true;
 
-		//Add in all the new edges
-		for ( i = 0; i < testNode->GetNumEdges(); i++ )
+		for ( int i = m_edgeOffsets[testID]; i < m_edgeOffsets[testID + 1]; i++ )
 		{
-			CNode	*addNode = m_nodes[ testNode->GetEdge(i) ];
-			assert( addNode );
+			int	addID = m_edgeTargets[i];
 
-			if ( checked[ addNode->GetID() ] )
+			if ( search->settled[addID] )
 				continue;
 
-			int	newDist = (*test).m_cost + testNode->GetEdgeCost(i);
-			pathList->Push( new CEdge( addNode->GetID(), (*test).m_second, newDist ) );
+			//failed edges cost Q3_INFINITE, don't let a few of them wrap around
+			int	newCost = ( cost > INT_MAX - m_edgeCosts[i] ) ? INT_MAX : cost + m_edgeCosts[i];
+
+			if ( search->cost[addID] != -1 && search->cost[addID] <= newCost )
+				continue;
+
+			search->cost[addID] = newCost;
+			search->open.push_back( std::make_pair( -newCost, addID ) );
+			std::push_heap( search->open.begin(), search->open.end() );
+		}
+	}
+}
+
+/*
+-------------------------
+GetRank
+
+Cost of the cheapest route from nodeID to goalID, NODE_NONE if there is none.
+Only searches as far out from the goal as it has to.
+-------------------------
+*/
+
+int CNavigator::GetRank( int goalID, int nodeID )
+{
+	goalSearch_t	*search = GetGoalSearch( goalID );
+
+	SettleSearch( search, nodeID );
+
+	return search->settled[nodeID] ? search->cost[nodeID] : NODE_NONE;
+}
+
+/*
+-------------------------
+PrecomputeGoals
+
+Runs the searches for a set of goals to completion, spread over sv_navThreads
+-------------------------
+*/
+
+void CNavigator::PrecomputeGoalJob( void *data, int index, int threadNum )
+{
+	goalWork_t	*work = (goalWork_t *)data;
+
+	work->navigator->SettleSearch( work->searches[index], NODE_NONE );
+}
+
+void CNavigator::PrecomputeGoals( const std::vector<int> &goals )
+{
+	goalWork_t		work;
+	int				numThreads = Job_NumThreads( sv_navThreads ? sv_navThreads->integer : 1 );
+
+	work.navigator = this;
+
+	for ( size_t i = 0; i < goals.size() && i < NAV_GOAL_SEARCHES; i++ )
+	{
+		if ( goals[i] < 0 || goals[i] >= (int)m_nodes.size() )
+			continue;
+
+		goalSearch_t	*search = GetGoalSearch( goals[i] );
+
+		//don't count these as real queries
+		m_goalUses[goals[i]]--;
+
+		//a damaged cache can list a goal twice, two jobs must never share a search
+		if ( !search->open.empty() && std::find( work.searches.begin(), work.searches.end(), search ) == work.searches.end() )
+		{
+			work.searches.push_back( search );
+		}
+	}
+
+	Job_ParallelFor( work.searches.size(), numThreads, PrecomputeGoalJob, &work );
+}
+
+/*
+-------------------------
+LoadGoalCache
+
+Restores the finished searches saved for this map, or reruns them if the
+graph changed since
+-------------------------
+*/
+
+void CNavigator::LoadGoalCache( void )
+{
+	fileHandle_t		file;
+	int					numNodes = m_nodes.size();
+	int					fileLength;
+	int					header[4];		//id, node count, checksum, goal count
+	std::vector<int>	goals;
+	std::vector<int>	costs;
+	bool				valid;
+
+	if ( !m_cacheName[0] || !numNodes )
+		return;
+
+	fileLength = FS_FOpenFileByMode( va( "maps/%s.navc", m_cacheName ), &file, FS_READ );
+
+	if ( file == 0 )
+		return;
+
+	if ( FS_Read( header, sizeof( header ), file ) != sizeof( header )
+		|| header[0] != (int)NAV_CACHE_ID || header[1] != numNodes )
+	{
+		FS_FCloseFile( file );
+		return;
+	}
+
+	unsigned int	checksum = header[2];
+	int				numGoals = header[3];
+
+	//Everything is read before any of it is used, a short or damaged file
+	//must not leave stale costs behind marked as settled
+	valid = ( numGoals >= 0 && numGoals <= NAV_GOAL_SEARCHES
+		&& fileLength == (int)sizeof( header ) + numGoals * ( 1 + numNodes ) * (int)sizeof( int ) );
+
+	if ( valid )
+	{
+		costs.resize( (size_t)numGoals * numNodes );
+	}
+
+	for ( int i = 0; valid && i < numGoals; i++ )
+	{
+		int	goalID;
+		int	*cost = &costs[(size_t)i * numNodes];
+
+		if ( FS_Read( &goalID, sizeof( goalID ), file ) != sizeof( goalID ) || goalID < 0 || goalID >= numNodes )
+		{
+			valid = false;
+			break;
+		}
+
+		goals.push_back( goalID );
+
+		if ( FS_Read( cost, numNodes * sizeof( int ), file ) != (int)( numNodes * sizeof( int ) ) || cost[goalID] != 0 )
+		{
+			valid = false;
+			break;
+		}
+
+		for ( int j = 0; j < numNodes; j++ )
+		{
+			if ( cost[j] < -1 )
+			{
+				valid = false;
+				break;
+			}
+		}
+	}
+
+	FS_FCloseFile( file );
+
+	if ( !valid || checksum != m_graphChecksum )
+	{
+		//Same goals are likely to be wanted again, redo them for the current graph
+		PrecomputeGoals( goals );
+		if ( !valid )
+		{
+			Com_Printf( S_COLOR_YELLOW "WARNING: nav route cache for %s is damaged, recomputed %d goals\n", m_cacheName, (int)goals.size() );
+		}
+		else
+		{
+			Com_DPrintf( "Nav route cache for %s out of date, recomputed %d goals\n", m_cacheName, (int)goals.size() );
+		}
+		m_lastGoalSearch = NULL;
+		return;
+	}
+
+	for ( int i = 0; i < numGoals; i++ )
+	{
+		goalSearch_t	*search = GetGoalSearch( goals[i] );
+
+		m_goalUses[goals[i]]--;
+
+		std::copy( costs.begin() + (size_t)i * numNodes, costs.begin() + (size_t)( i + 1 ) * numNodes, search->cost.begin() );
+		search->open.clear();
 
-			checked[ addNode->GetID() ] = true;
+		for ( int j = 0; j < numNodes; j++ )
+		{
+			search->settled[j] = ( search->cost[j] >= 0 );
 		}
-		delete test;
+	}
+
+	Com_DPrintf( "Nav route cache for %s restored %d goals\n", m_cacheName, numGoals );
+
+	m_lastGoalSearch = NULL;
+}
+
+/*
+-------------------------
+SaveGoalCache
+
+Finishes and writes out the searches for the goals that were asked for most
+-------------------------
+*/
+
+static bool NAV_GoalUsedMore( const std::pair<int, int> &a, const std::pair<int, int> &b )
+{
+	return a.first > b.first;
+}
+
+void CNavigator::SaveGoalCache( void )
+{
+	std::vector< std::pair<int, int> >	uses;
+	std::vector<int>					goals;
+	fileHandle_t						file;
+	int									numNodes = m_nodes.size();
+
+	if ( !m_haveBaseGraph || !m_cacheName[0] || !numNodes )
+		return;
 
+	if ( !m_graphValid )
+	{
+		BuildGraph();
+	}
+	else if ( !m_checksumValid )
+	{
+		UpdateGraphChecksum();
 	}
 
-	node->RemoveFlag( NF_RECALC );
+	//Edges are failed right now, the searches wouldn't match the graph on the next load
+	if ( m_graphChecksum != m_baseChecksum )
+		return;
 
-	delete pathList;
-	delete [] checked;
+	for ( int i = 0; i < numNodes; i++ )
+	{
+		if ( m_goalUses[i] > 0 )
+		{
+			uses.push_back( std::make_pair( m_goalUses[i], i ) );
+		}
+	}
+
+	if ( uses.empty() )
+		return;
+
+	std::sort( uses.begin(), uses.end(), NAV_GoalUsedMore );
+	if ( uses.size() > NAV_GOAL_SEARCHES )
+	{
+		uses.resize( NAV_GOAL_SEARCHES );
+	}
+	for ( size_t i = 0; i < uses.size(); i++ )
+	{
+		goals.push_back( uses[i].second );
+	}
+
+	PrecomputeGoals( goals );
+
+	file = FS_FOpenFileWrite( va( "maps/%s.navc", m_cacheName ) );
+
+	if ( file == 0 )
+		return;
+
+	unsigned int	id = NAV_CACHE_ID;
+	int				numGoals = goals.size();
+
+	FS_Write( &id, sizeof( id ), file );
+	FS_Write( &numNodes, sizeof( numNodes ), file );
+	FS_Write( &m_graphChecksum, sizeof( m_graphChecksum ), file );
+	FS_Write( &numGoals, sizeof( numGoals ), file );
+
+	for ( int i = 0; i < numGoals; i++ )
+	{
+		goalSearch_t	*search = GetGoalSearch( goals[i] );
+
+		FS_Write( &goals[i], sizeof( int ), file );
+		FS_Write( &search->cost[0], numNodes * sizeof( int ), file );
+	}
+
+	FS_FCloseFile( file );
 }
 
 /*
@@ -893,19 +1316,19 @@ CalculatePaths
 */
 void CNavigator::CalculatePaths( qboolean recalc )
 {
-#if _HARD_CONNECT
-#else
-#endif
-
-	for ( size_t i = 0; i < m_nodes.size(); i++ )
+	//Routes are searched for when they're asked for, just start from a clean slate
+	if ( !m_cacheName[0] && sv_mapname )
 	{
-		//Allocate the needed memory
-		m_nodes[i]->InitRanks( m_nodes.size() );
+		Q_strncpyz( m_cacheName, sv_mapname->string, sizeof( m_cacheName ) );
 	}
 
+	InvalidatePaths();
+	BuildGraph();
+	BuildNodeGrid();
+
 	for ( size_t i = 0; i < m_nodes.size(); i++ )
 	{
-		CalculatePath( m_nodes[i] );
+		m_nodes[i]->RemoveFlag( NF_RECALC );
 	}
 
 	if(!recalc)	//Mike says doesn't need to happen on recalc
@@ -1146,6 +1569,8 @@ void CNavigator::HardConnect( int first, int second )
 
 	start->AddEdge( second, cost, flags );
 	end->AddEdge( first, cost, flags );
+
+	InvalidatePaths();
 }
 
 #endif
@@ -1255,75 +1680,266 @@ CollectNearestNodes
 #define NODE_COLLECT_RADIUS	512		//Default radius to search for nodes in
 #define NODE_COLLECT_RADIUS_SQR		( NODE_COLLECT_RADIUS * NODE_COLLECT_RADIUS )
 
-int CNavigator::CollectNearestNodes( vec3_t origin, int radius, int maxCollect, nodeChain_l &nodeChain )
+int CNavigator::CollectNearestNodes( vec3_t origin, int radius, int maxCollect, nodeList_t *nodeChain )
 {
-	node_v::iterator	ni;
-	float				dist;
-	vec3_t				position;
-	int					collected = 0;
-	bool				added = false;
+	vec3_t	position;
+	float	dist;
+	float	radiusSqr = (float) ( radius * radius );
+	int		collected = 0;
+	int		mins[2], maxs[2];
 
-	//Get a distance rating for each node in the system
-	STL_ITERATE( ni, m_nodes )
+	if ( !m_gridValid )
 	{
-		//If we've got our quota, then stop looking
-		//Get the distance to the node
-		(*ni)->GetPosition( position );
-		dist = DistanceSquared( position, origin );
+		BuildNodeGrid();
+	}
 
-		//Must be within our radius range
-		if ( dist > (float) ( radius * radius ) )
-			continue;
+	if ( m_nodes.size() == 0 || maxCollect <= 0 )
+		return 0;
 
-		nodeList_t				nChain;
-		nodeChain_l::iterator	nci;
+	//Only look at the cells the radius overlaps
+	for ( int k = 0; k < 2; k++ )
+	{
+		mins[k] = (int) floor( ( origin[k] - radius - m_gridMins[k] ) / NAV_GRID_CELL );
+		maxs[k] = (int) floor( ( origin[k] + radius - m_gridMins[k] ) / NAV_GRID_CELL );
 
-		//Always add the first node
-		if ( nodeChain.size() == 0 )
-		{
-			nChain.nodeID = (*ni)->GetID();
-			nChain.distance = dist;
+		if ( mins[k] < 0 )
+			mins[k] = 0;
 
-			nodeChain.insert( nodeChain.begin(), nChain );
-			continue;
-		}
+		if ( maxs[k] >= m_gridSize[k] )
+			maxs[k] = m_gridSize[k] - 1;
 
-		added = false;
+		if ( mins[k] > maxs[k] )
+			return 0;
+	}
 
-		//Compare it to what we already have
-		STL_ITERATE( nci, nodeChain )
+	for ( int y = mins[1]; y <= maxs[1]; y++ )
+	{
+		for ( int x = mins[0]; x <= maxs[0]; x++ )
 		{
-			//If we're less, than this entry, then insert before it
-			if ( dist < (*nci).distance )
+			int	cell = y * m_gridSize[0] + x;
+
+			for ( int n = m_gridStart[cell]; n < m_gridStart[cell + 1]; n++ )
 			{
-				nChain.nodeID = (*ni)->GetID();
-				nChain.distance = dist;
+				int	nodeID = m_gridNodes[n];
+
+				m_nodes[nodeID]->GetPosition( position );
+				dist = DistanceSquared( position, origin );
+
+				//Must be within our radius range
+				if ( dist > radiusSqr )
+					continue;
 
-				nodeChain.insert( nci, nChain );
-				collected = nodeChain.size();
-				added = true;
+				//Keep the closest ones sorted, lower IDs first on a tie like a full scan would
+				int	slot = collected;
 
-				//If we've hit our collection limit, throw off the oldest one
-				if ( (int)nodeChain.size() > maxCollect )
+				while ( slot > 0 && ( dist < nodeChain[slot - 1].distance || ( dist == nodeChain[slot - 1].distance && nodeID < nodeChain[slot - 1].nodeID ) ) )
 				{
-					nodeChain.pop_back();
+					if ( slot < maxCollect )
+					{
+						nodeChain[slot] = nodeChain[slot - 1];
+					}
+					slot--;
 				}
 
-				break;
+				if ( slot >= maxCollect )
+					continue;
+
+				nodeChain[slot].nodeID = nodeID;
+				nodeChain[slot].distance = dist;
+
+				if ( collected < maxCollect )
+				{
+					collected++;
+				}
 			}
 		}
+	}
+
+	return collected;
+}
 
-		//Otherwise, always pad out the collection if possible so we don't miss anything
-		if ( ( added == false ) && ( (int)nodeChain.size() < maxCollect ) )
+/*
+-------------------------
+BuildNodeGrid
+-------------------------
+*/
+
+void CNavigator::BuildNodeGrid( void )
+{
+	vec3_t	position;
+	float	maxs[2];
+	int		numNodes = m_nodes.size();
+	int		numCells;
+
+	m_gridValid = true;
+	m_gridMins[0] = m_gridMins[1] = 0;
+	m_gridSize[0] = m_gridSize[1] = 0;
+	m_gridStart.assign( 1, 0 );
+	m_gridNodes.clear();
+
+	if ( numNodes == 0 )
+		return;
+
+	m_nodes[0]->GetPosition( position );
+	m_gridMins[0] = maxs[0] = position[0];
+	m_gridMins[1] = maxs[1] = position[1];
+
+	for ( int i = 1; i < numNodes; i++ )
+	{
+		m_nodes[i]->GetPosition( position );
+
+		for ( int k = 0; k < 2; k++ )
 		{
-			nChain.nodeID = (*ni)->GetID();
-			nChain.distance = dist;
+			if ( position[k] < m_gridMins[k] )
+				m_gridMins[k] = position[k];
 
-			nodeChain.insert( nodeChain.end(), nChain );
+			if ( position[k] > maxs[k] )
+				maxs[k] = position[k];
 		}
 	}
 
-	return collected;
+	m_gridSize[0] = (int) ( ( maxs[0] - m_gridMins[0] ) / NAV_GRID_CELL ) + 1;
+	m_gridSize[1] = (int) ( ( maxs[1] - m_gridMins[1] ) / NAV_GRID_CELL ) + 1;
+	numCells = m_gridSize[0] * m_gridSize[1];
+
+	//Count the nodes per cell, then lay the cells out back to back
+	std::vector<int>	nodeCells( numNodes );
+
+	m_gridStart.assign( numCells + 1, 0 );
+
+	for ( int i = 0; i < numNodes; i++ )
+	{
+		m_nodes[i]->GetPosition( position );
+
+		int	x = (int) ( ( position[0] - m_gridMins[0] ) / NAV_GRID_CELL );
+		int	y = (int) ( ( position[1] - m_gridMins[1] ) / NAV_GRID_CELL );
+
+		nodeCells[i] = y * m_gridSize[0] + x;
+		m_gridStart[nodeCells[i] + 1]++;
+	}
+
+	for ( int c = 0; c < numCells; c++ )
+	{
+		m_gridStart[c + 1] += m_gridStart[c];
+	}
+
+	std::vector<int>	fill( m_gridStart.begin(), m_gridStart.end() - 1 );
+
+	m_gridNodes.resize( numNodes );
+
+	for ( int i = 0; i < numNodes; i++ )
+	{
+		m_gridNodes[fill[nodeCells[i]]++] = i;
+	}
+}
+
+/*
+-------------------------
+CheckNearestCache
+
+Returns the node last found for this entity with the same flags and target if
+it is still good enough, NODE_NONE otherwise
+-------------------------
+*/
+
+#define	NAV_NEAREST_CACHE_MSEC	500		//how long an answer is trusted for
+#define	NAV_NEAREST_CACHE_DIST	16		//how far the entity may have moved since
+
+int CNavigator::CheckNearestCache( sharedEntity_t *ent, int flags, int targetID )
+{
+	int	entNum = ent->s.number;
+
+	if ( entNum < 0 || entNum >= MAX_GENTITIES || m_nearestCache.empty() )
+		return NODE_NONE;
+
+	nearestCache_t	*entry = &m_nearestCache[entNum * NAV_NEAREST_CACHE];
+
+	for ( int i = 0; i < NAV_NEAREST_CACHE; i++, entry++ )
+	{
+		if ( entry->nodeID == NODE_NONE || entry->flags != flags || entry->targetID != targetID )
+			continue;
+
+		if ( svs.time - entry->time > NAV_NEAREST_CACHE_MSEC || svs.time < entry->time )
+			continue;
+
+		if ( targetID != NODE_NONE && entry->pathStamp != m_pathStamp )
+			continue;
+
+		if ( DistanceSquared( entry->origin, ent->r.currentOrigin ) > NAV_NEAREST_CACHE_DIST * NAV_NEAREST_CACHE_DIST )
+			continue;
+
+		//The node may have been marked bad for this entity since
+		if ( NodeFailed( ent, entry->nodeID ) )
+		{
+			entry->nodeID = NODE_NONE;
+			continue;
+		}
+
+		return entry->nodeID;
+	}
+
+	return NODE_NONE;
+}
+
+/*
+-------------------------
+StoreNearestCache
+-------------------------
+*/
+
+int CNavigator::StoreNearestCache( sharedEntity_t *ent, int flags, int targetID, int nodeID )
+{
+	int	entNum = ent->s.number;
+
+	if ( nodeID == NODE_NONE || entNum < 0 || entNum >= MAX_GENTITIES )
+		return nodeID;
+
+	if ( m_nearestCache.empty() )
+	{
+		nearestCache_t	empty;
+
+		memset( &empty, 0, sizeof( empty ) );
+		empty.nodeID = NODE_NONE;
+		m_nearestCache.assign( MAX_GENTITIES * NAV_NEAREST_CACHE, empty );
+	}
+
+	//Replace the same question or else the oldest answer
+	nearestCache_t	*entry = &m_nearestCache[entNum * NAV_NEAREST_CACHE];
+	nearestCache_t	*best = entry;
+
+	for ( int i = 0; i < NAV_NEAREST_CACHE; i++, entry++ )
+	{
+		if ( entry->flags == flags && entry->targetID == targetID )
+		{
+			best = entry;
+			break;
+		}
+
+		if ( best->nodeID != NODE_NONE && ( entry->nodeID == NODE_NONE || entry->time < best->time ) )
+		{
+			best = entry;
+		}
+	}
+
+	best->nodeID = nodeID;
+	best->flags = flags;
+	best->targetID = targetID;
+	best->time = svs.time;
+	best->pathStamp = m_pathStamp;
+	VectorCopy( ent->r.currentOrigin, best->origin );
+
+	return nodeID;
+}
+
+/*
+-------------------------
+ClearNearestCache
+-------------------------
+*/
+
+void CNavigator::ClearNearestCache( void )
+{
+	m_nearestCache.clear();
 }
 
 int CNavigator::GetBestPathBetweenEnts( sharedEntity_t *ent, sharedEntity_t *goal, int flags )
@@ -1334,14 +1950,14 @@ int CNavigator::GetBestPathBetweenEnts( sharedEntity_t *ent, sharedEntity_t *goa
 
 #define	MAX_Z_DELTA	18
 
-	nodeChain_l				nodeChain;
-	nodeChain_l::iterator	nci;
-	nodeChain_l				nodeChain2;
-	nodeChain_l::iterator	nci2;
+	nodeList_t				nodeChain[NODE_COLLECT_MAX];
+	nodeList_t				*nci;
+	nodeList_t				nodeChain2[NODE_COLLECT_MAX];
+	nodeList_t				*nci2;
 
 	//Collect all nodes within a certain radius
-	CollectNearestNodes( ent->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain );
-	CollectNearestNodes( goal->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain2 );
+	int	numCollected = CollectNearestNodes( ent->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain );
+	int	numCollected2 = CollectNearestNodes( goal->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain2 );
 
 	vec3_t				position;
 	vec3_t				position2;
@@ -1350,14 +1966,13 @@ int CNavigator::GetBestPathBetweenEnts( sharedEntity_t *ent, sharedEntity_t *goa
 	CNode				*node, *node2;
 	int					nodeNum, nodeNum2;
 	int					nextNode = NODE_NONE, bestNode = NODE_NONE;
-	int					nodeFlags = 0;
 //	bool				recalc = false;
 
 	ent->waypoint = NODE_NONE;
 	goal->waypoint = NODE_NONE;
 
 	//Look through all nodes
-	STL_ITERATE( nci, nodeChain )
+	for ( nci = nodeChain; nci < nodeChain + numCollected; nci++ )
 	{
 		node = m_nodes[(*nci).nodeID];
 		nodeNum = (*nci).nodeID;
@@ -1409,32 +2024,10 @@ int CNavigator::GetBestPathBetweenEnts( sharedEntity_t *ent, sharedEntity_t *goa
 			SetCheckedNode( nodeNum, ent->s.number, CHECKED_PASSED );
 		}
 
-		if ( d_altRoutes->integer )
-		{
-			//calc the paths for this node if they're out of date
-			nodeFlags = node->GetFlags();
-			if ( (nodeFlags&NF_RECALC) )
-			{
-				//Com_Printf( S_COLOR_CYAN"%d recalcing paths from node %d\n", svs.time, nodeNum );
-				CalculatePath( node );
-			}
-		}
-
-		STL_ITERATE( nci2, nodeChain2 )
+		for ( nci2 = nodeChain2; nci2 < nodeChain2 + numCollected2; nci2++ )
 		{
 			node2 = m_nodes[(*nci2).nodeID];
 			nodeNum2 = (*nci2).nodeID;
-			if ( d_altRoutes->integer )
-			{
-				//calc the paths for this node if they're out of date
-				nodeFlags = node2->GetFlags();
-				if ( (nodeFlags&NF_RECALC) )
-				{
-					//Com_Printf( S_COLOR_CYAN"%d recalcing paths from node %d\n", svs.time, nodeNum2 );
-					CalculatePath( node2 );
-				}
-			}
-
 			node2->GetPosition( position2 );
 			//Okay, first get the entire path cost, including distance to first node from ents' positions
 			cost = floor(Distance( ent->r.currentOrigin, position ) + Distance( goal->r.currentOrigin, position2 ));
@@ -1527,13 +2120,19 @@ int CNavigator::GetNearestNode( sharedEntity_t *ent, int lastID, int flags, int
 	if ( m_nodes.size() == 0 )
 		return NODE_NONE;
 
+	//Asked the same thing from about the same spot a moment ago?
+	bestNode = CheckNearestCache( ent, flags, targetID );
+
+	if ( bestNode != NODE_NONE )
+		return bestNode;
+
 	if ( targetID == NODE_NONE )
 	{
 		//Try and find an early match using our last node
 		bestNode = TestBestFirst( ent, lastID, flags );
 
 		if ( bestNode != NODE_NONE )
-			return bestNode;
+			return StoreNearestCache( ent, flags, targetID, bestNode );
 	}//else can't rely on testing last, we want best to targetID
 
 /////////////////////////////////////////////////
@@ -1542,11 +2141,11 @@ int CNavigator::GetNearestNode( sharedEntity_t *ent, int lastID, int flags, int
 
 /////////////////////////////////////////////////
 
-	nodeChain_l				nodeChain;
-	nodeChain_l::iterator	nci;
+	nodeList_t				nodeChain[NODE_COLLECT_MAX];
+	nodeList_t				*nci;
 
 	//Collect all nodes within a certain radius
-	CollectNearestNodes( ent->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain );
+	int	numCollected = CollectNearestNodes( ent->r.currentOrigin, NODE_COLLECT_RADIUS, NODE_COLLECT_MAX, nodeChain );
 
 	vec3_t				position;
 	int					radius;
@@ -1554,7 +2153,7 @@ int CNavigator::GetNearestNode( sharedEntity_t *ent, int lastID, int flags, int
 	CNode				*node;
 
 	//Look through all nodes
-	STL_ITERATE( nci, nodeChain )
+	for ( nci = nodeChain; nci < nodeChain + numCollected; nci++ )
 	{
 		node = m_nodes[(*nci).nodeID];
 
@@ -1573,7 +2172,7 @@ int CNavigator::GetNearestNode( sharedEntity_t *ent, int lastID, int flags, int
 			if ( fabs( position[2] - ent->r.currentOrigin[2] ) < MAX_Z_DELTA )
 			{
 				//Found one
-				return (*nci).nodeID;
+				return StoreNearestCache( ent, flags, targetID, (*nci).nodeID );
 			}
 		}
 
@@ -1629,7 +2228,7 @@ int CNavigator::GetNearestNode( sharedEntity_t *ent, int lastID, int flags, int
 	}
 
 	//Found one, we're done
-	return bestNode;
+	return StoreNearestCache( ent, flags, targetID, bestNode );
 }
 
 /*
@@ -1867,6 +2466,10 @@ void CNavigator::ClearFailedEdge( failedEdge_t *failedEdge )
 	}
 	*/
 	//clear failedEdge info
+	if ( failedEdge->startID != WAYPOINT_NONE )
+	{
+		m_numFailedEdges--;
+	}
 	SetEdgeCost( failedEdge->startID, failedEdge->endID, -1 );
 	failedEdge->startID = failedEdge->endID = WAYPOINT_NONE;
 	failedEdge->entID = ENTITYNUM_NONE;
@@ -1880,36 +2483,15 @@ void CNavigator::ClearAllFailedEdges( void )
 	{
 		ClearFailedEdge( &failedEdges[j] );
 	}
+	m_numFailedEdges = 0;
 }
 
 int CNavigator::EdgeFailed( int startID, int endID )
 {
-	//OPTIMIZED WAY  (bjg 01/02)
-	//find in lookup map
-	std::pair <EdgeMultimapIt, EdgeMultimapIt> findValue;
-	findValue = m_edgeLookupMap.equal_range(startID);
-	while ( findValue.first != findValue.second )
-	{
-		if( failedEdges[findValue.first->second].endID == endID)
-		{
-			return findValue.first->second;
-		}
-		++findValue.first;
-	}
-	findValue = m_edgeLookupMap.equal_range(endID);
-	while ( findValue.first != findValue.second )
-	{
-		if( failedEdges[findValue.first->second].endID == startID)
-		{
-			return findValue.first->second;
-		}
-		++findValue.first;
-	}
-
-	return -1;
+	//Nearly always nothing has failed
+	if ( !m_numFailedEdges )
+		return -1;
 
-	//Old way (linear search)
-	/*
 	for ( int j = 0; j < MAX_FAILED_EDGES; j++ )
 	{
 		if ( failedEdges[j].startID == startID )
@@ -1928,7 +2510,6 @@ int CNavigator::EdgeFailed( int startID, int endID )
 		}
 	}
 	return -1;
-	*/
 }
 
 void CNavigator::AddFailedEdge( int entID, int startID, int endID )
@@ -1995,7 +2576,7 @@ void CNavigator::AddFailedEdge( int entID, int startID, int endID )
 			//Check one second from now to see if it's clear
 			failedEdges[j].checkTime = svs.time + CHECK_FAILED_EDGE_INTERVAL + Q_irand( 0, 1000 );
 
-			m_edgeLookupMap.insert(std::pair<int, int>(startID, j));
+			m_numFailedEdges++;
 
 			/*
 			//DISABLED this for now, makes people stand around too long when
@@ -2013,7 +2594,7 @@ void CNavigator::AddFailedEdge( int entID, int startID, int endID )
 					continue;
 				}
 
-				if ( nextID == endID || end->GetRank( nextID ) >= 0 )
+				if ( nextID == endID || GetRank( endID, nextID ) >= 0 )
 				{//neighbor of or route to end
 					//There's an alternate route, so don't check this one for 10 seconds
 					failedEdges[j].checkTime = svs.time + CHECK_FAILED_EDGE_INTITIAL;
@@ -2044,8 +2625,6 @@ void CNavigator::AddFailedEdge( int entID, int startID, int endID )
 			}
 			*/
 
-			//stuff the index to this one in our lookup map
-
 			//now recalc all the paths!
 			if ( pathsCalculated )
 			{
@@ -2182,7 +2761,6 @@ qboolean CNavigator::RouteBlocked( int startID, int testEdgeID, int endID, int r
 	int		bestRank = rejectRank;
 	int		testRank;
 	qboolean	allEdgesFailed;
-	CNode	*end;
 	CNode	*next;
 
 
@@ -2197,7 +2775,6 @@ qboolean CNavigator::RouteBlocked( int startID, int testEdgeID, int endID, int r
 	}
 
 	//Okay, first edge is clear, now check rest of route!
-	end	= m_nodes[ endID ];
 	nextID = testEdgeID;
 	lastID = startID;
 
@@ -2232,7 +2809,7 @@ qboolean CNavigator::RouteBlocked( int startID, int testEdgeID, int endID, int r
 			}
 
 			//Still going...
-			testRank = end->GetRank( edgeID );
+			testRank = GetRank( endID, edgeID );
 
 			if ( testRank < 0 )
 			{//No route this way
@@ -2397,10 +2974,9 @@ int CNavigator::GetBestNode( int startID, int endID, int rejectID )
 		return startID;
 
 	CNode	*start	= m_nodes[ startID ];
-	CNode	*end	= m_nodes[ endID ];
 
 	int		bestNode = -1;
-	int		bestRank = Q3_INFINITE;
+	int		bestRank = INT_MAX;
 	int		testRank, rejectRank = 0;
 
 	if ( rejectID != WAYPOINT_NONE )
@@ -2409,7 +2985,7 @@ int CNavigator::GetBestNode( int startID, int endID, int rejectID )
 		{
 			if ( start->GetEdge(i) == rejectID )
 			{
-				rejectRank = end->GetRank( start->GetEdge(i) );
+				rejectRank = GetRank( endID, start->GetEdge(i) );
 				break;
 			}
 		}
@@ -2423,7 +2999,7 @@ int CNavigator::GetBestNode( int startID, int endID, int rejectID )
 		if ( edgeID == endID )
 			return edgeID;
 
-		testRank = end->GetRank( edgeID );
+		testRank = GetRank( endID, edgeID );
 
 		//Found one
 		if ( testRank <= rejectRank )
@@ -2519,7 +3095,6 @@ bool CNavigator::Connected( int startID, int endID )
 		return true;
 
 	CNode	*start	= m_nodes[ startID ];
-	CNode	*end	= m_nodes[ endID ];
 
 	for ( int i = 0; i < start->GetNumEdges(); i++ )
 	{
@@ -2529,7 +3104,7 @@ bool CNavigator::Connected( int startID, int endID )
 		if ( edgeID == endID )
 			return true;
 
-		if ( ( end->GetRank( edgeID ) ) != NODE_NONE )
+		if ( GetRank( endID, edgeID ) != NODE_NONE )
 			return true;
 	}
 
@@ -2559,63 +3134,11 @@ unsigned int CNavigator::GetPathCost( int startID, int endID )
 		return Q3_INFINITE; // return 0;
 	}
 
-	CNode	*endNode	= m_nodes[ endID ];
-
-	CNode	*moveNode = startNode;
-
-	int		bestNode;
-	int		pathCost = 0;
-	int		bestCost;
-
-	int		bestRank;
-	int		testRank;
-
-	int		dontScrewUp = 0;
-
-	//Draw out our path
-	while ( moveNode != endNode )
-	{
-		bestRank = WORLD_SIZE;
-		bestNode = -1;
-		bestCost = 0;
+	int		pathCost = GetRank( endID, startID );
 
-		for ( int i = 0; i < moveNode->GetNumEdges(); i++ )
-		{
-			int	edgeID = moveNode->GetEdge(i);
-
-			//Done
-			if ( edgeID == endID )
-			{
-				return pathCost + moveNode->GetEdgeCost( i );
-			}
-
-			testRank = endNode->GetRank( edgeID );
-
-			//No possible connection
-			if ( testRank == NODE_NONE )
-			{
-				return Q3_INFINITE; // return 0;
-			}
-
-			//Found a better one
-			if ( testRank < bestRank )
-			{
-				bestNode = edgeID;
-				bestRank = testRank;
-				bestCost = moveNode->GetEdgeCost( i );
-			}
-		}
-
-		pathCost += bestCost;
-
-		//Take a new best node
-		moveNode = m_nodes[ bestNode ];
-		dontScrewUp++;
-
-		if (dontScrewUp > 40000)
-		{ //ok, I think something probably screwed up.
-			break;
-		}
+	if ( pathCost == NODE_NONE )
+	{//No possible connection
+		return Q3_INFINITE; // return 0;
 	}
 
 	return pathCost;
@@ -45,12 +45,14 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 //Miscellaneous defines
 #define	NODE_NONE		-1
-#define	NAV_HEADER_ID	INT_ID('J','N','V','5')
+#define	NAV_HEADER_ID	INT_ID('J','N','V','6')
+#define	NAV_HEADER_ID_RANKS	INT_ID('J','N','V','5')	//older files, still carry the all-pairs rank table
+#define	NAV_GOAL_SEARCHES	64		//searches kept around for the most recently used goals
+#define	NAV_GRID_CELL		256		//size of a node grid cell on x and y
+#define	NAV_NEAREST_CACHE	4		//nearest node answers remembered per entity
+#define	NAV_CACHE_ID	INT_ID('N','V','C','1')
 #define	NODE_HEADER_ID	INT_ID('N','O','D','E')
 
-typedef std::multimap<int, int> EdgeMultimap;
-typedef EdgeMultimap::iterator EdgeMultimapIt;
-
 
 /*
 -------------------------
@@ -98,7 +100,6 @@ public:
 	static CNode *Create( void );
 
 	void AddEdge( int ID, int cost, int flags = EFLAG_NONE );
-	void AddRank( int ID, int rank );
 
 	void Draw( qboolean radius );
 
@@ -113,9 +114,6 @@ public:
 	void SetEdgeFlags( int edgeNum, int newFlags );
 	int	GetRadius( void )				const	{	return m_radius;	}
 
-	void InitRanks( int size );
-	int GetRank( int ID );
-
 	int	GetFlags( void )				const	{	return m_flags;	}
 	void AddFlag( int newFlag )			{	m_flags |= newFlag;	}
 	void RemoveFlag( int oldFlag )		{	m_flags &= ~oldFlag; }
@@ -132,7 +130,6 @@ protected:
 
 	edge_v	m_edges;
 
-	int		*m_ranks;
 	int		m_numEdges;
 };
 
@@ -152,11 +149,9 @@ class CNavigator
 	struct nodeList_t
 	{
 		int				nodeID;
-		unsigned int	distance;
+		float			distance;
 	};
 
-	typedef std::list < nodeList_t >		nodeChain_l;
-
 #endif	//__NEWCOLLECT
 
 public:
@@ -233,29 +228,115 @@ protected:
 	int		TestBestFirst( sharedEntity_t *ent, int lastID, int flags );
 
 #if __NEWCOLLECT
-	int		CollectNearestNodes( vec3_t origin, int radius, int maxCollect, nodeChain_l &nodeChain );
+	int		CollectNearestNodes( vec3_t origin, int radius, int maxCollect, nodeList_t *nodeChain );
 #else
 	int		CollectNearestNodes( vec3_t origin, int radius, int maxCollect, int *nodeChain );
 #endif	//__NEWCOLLECT
 
+	/*
+	Nodes are bucketed on a 2D grid over their x/y position so nearby nodes can
+	be collected without looking at every node on the map.  The grid is built
+	once the nodes are loaded or calculated and only changes when nodes do.
+	*/
+	void	BuildNodeGrid( void );
+
+	/*
+	Each entity remembers the last few nodes GetNearestNode gave it.  As long as
+	it hasn't moved far and not much time has passed, the same answer is given
+	again without collecting or tracing.
+	*/
+	struct nearestCache_t
+	{
+		int		nodeID;				//NODE_NONE if unused
+		int		flags;
+		int		targetID;
+		int		time;
+		int		pathStamp;			//only matters with a targetID
+		vec3_t	origin;
+	};
+
+	int		CheckNearestCache( sharedEntity_t *ent, int flags, int targetID );
+	int		StoreNearestCache( sharedEntity_t *ent, int flags, int targetID, int nodeID );
+	void	ClearNearestCache( void );
+
 	char	GetChar( fileHandle_t file );
 	int		GetInt( fileHandle_t file );
 	float	GetFloat( fileHandle_t file );
 	long	GetLong( fileHandle_t file );
 
 	void	SetEdgeCost( int ID1, int ID2, int cost );
+	void	PatchEdgeCost( int fromID, int toID, int cost );
+	void	DropEdgeSearches( int ID1, int ID2 );
 	int		GetEdgeCost( CNode *first, CNode *second );
 	void	AddNodeEdges( CNode *node, int addDist, edge_l &edgeList, bool *checkedNodes );
 
-	void	CalculatePath( CNode *node );
+	/*
+	Searches run backwards from a goal over a compressed sparse row copy of the
+	edges, and are resumed whenever a cost to that goal is asked for that isn't
+	settled yet.  The same search serves every NPC heading for the goal, so the
+	most recently used ones are kept.
+	*/
+	struct goalSearch_t
+	{
+		int					goalID;			//NODE_NONE if unused
+		int					lastUsed;
+		std::vector<int>	cost;			//best known cost to the goal, -1 if not reached yet
+		std::vector<byte>	settled;
+		std::vector< std::pair<int, int> >	open;	//heap of ( -cost, node )
+	};
+
+	void	BuildGraph( void );
+	void	UpdateGraphChecksum( void );
+	void	InvalidatePaths( void );
+	goalSearch_t *GetGoalSearch( int goalID );
+	void	SettleSearch( goalSearch_t *search, int nodeID );
+	int		GetRank( int goalID, int nodeID );
+
+	struct goalWork_t
+	{
+		CNavigator					*navigator;
+		std::vector<goalSearch_t *>	searches;
+	};
+
+	void	PrecomputeGoals( const std::vector<int> &goals );
+	static void PrecomputeGoalJob( void *data, int index, int threadNum );
+	void	LoadGoalCache( void );
+	void	SaveGoalCache( void );
+
+	std::vector<int>	m_edgeOffsets;		//m_edgeOffsets[n]..m_edgeOffsets[n+1] are the edges of node n
+	std::vector<int>	m_edgeTargets;
+	std::vector<int>	m_edgeCosts;
+	bool				m_graphValid;
+
+	goalSearch_t		m_goalSearches[NAV_GOAL_SEARCHES];
+	goalSearch_t		*m_lastGoalSearch;
+	int					m_goalSearchStamp;
+
+	//Searches for the busiest goals are saved to maps/<mapname>.navc, keyed by
+	//a checksum of the graph as it was loaded
+	unsigned int		m_graphChecksum;
+	bool				m_checksumValid;	//false once edge costs are patched after it was worked out
+	unsigned int		m_baseChecksum;
+	bool				m_haveBaseGraph;
+	std::vector<int>	m_goalUses;
+	char				m_cacheName[MAX_QPATH];
 
 	//rww - made failedEdges private as it doesn't seem to need to be public.
 	//And I'd rather shoot myself than have to devise a way of setting/accessing this
 	//array via trap calls.
 	failedEdge_t	failedEdges[MAX_FAILED_EDGES];
+	int				m_numFailedEdges;
+
+	std::vector<int>	m_gridStart;		//m_gridStart[c]..m_gridStart[c+1] are the nodes of cell c in m_gridNodes
+	std::vector<int>	m_gridNodes;
+	float				m_gridMins[2];
+	int					m_gridSize[2];
+	bool				m_gridValid;
+
+	std::vector<nearestCache_t>	m_nearestCache;		//NAV_NEAREST_CACHE entries per entity
+	int							m_pathStamp;
 
 	node_v			m_nodes;
-	EdgeMultimap	m_edgeLookupMap;
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -45,16 +45,22 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #define SMOD_LEVEL_2 2;
 #define SMOD_LEVEL_3 3;
 
-typedef struct svEntity_s {
-	struct worldSector_s *worldSector;
-	struct svEntity_s *nextEntityInWorldSector;
+// one per cluster an entity is linked into, chained off SV_ClusterEntities
+typedef struct svClusterLink_s {
+	struct svClusterLink_s	*next;
+	struct svClusterLink_s	**prevNext;		// whatever points at this link
+	int						entityNum;
+} svClusterLink_t;
 
+typedef struct svEntity_s {
 	entityState_t	baseline;		// for delta compression of initial sighting
 	int			numClusters;		// if -1, use headnode instead
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
+
+	int				numClusterLinks;	// distinct entries of clusternums
+	svClusterLink_t	clusterLinks[MAX_ENT_CLUSTERS];
 } svEntity_t;
 
 typedef enum {
@@ -69,7 +75,6 @@ typedef struct server_s {
 	int				serverId;			// changes each server start
 	int				restartedServerId;	// serverId before a map_restart
 	int				checksumFeed;		//
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	char			*configstrings[MAX_CONFIGSTRINGS];
@@ -135,7 +140,6 @@ typedef struct {
 	qboolean	demorecording;
 	qboolean	demowaiting;	// don't record until a non-delta message is sent
 	int			minDeltaFrame;	// the first non-delta frame stored in the demo.  cannot delta against frames older than this
-	fileHandle_t	demofile;
 	qboolean	isBot;
 	int			botReliableAcknowledge; // for bots, need to maintain a separate reliableAcknowledge to record server messages into the demo file
 } demoInfo_t;
@@ -295,8 +299,13 @@ extern	cvar_t	*sv_filterCommands;
 extern	cvar_t	*sv_autoDemo;
 extern	cvar_t	*sv_autoDemoBots;
 extern	cvar_t	*sv_autoDemoMaxMaps;
+extern	cvar_t	*sv_demoCompress;
 extern	cvar_t	*sv_legacyFixes;
 extern	cvar_t	*sv_banFile;
+extern	cvar_t	*sv_snapshotThreads;
+extern	cvar_t	*sv_botThreads;
+extern	cvar_t	*sv_traceThreads;
+extern	cvar_t	*sv_broadphase;
 
 extern	cvar_t* g_chaosEnable;
 extern	cvar_t* g_chaosCooldown;
@@ -385,6 +394,9 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd );
 void SV_DropClient( client_t *drop, const char *reason );
 
 void SV_ExecuteClientCommand( client_t *cl, const char *s, qboolean clientOK );
+void SV_BeginPrivilegedCommands( void );
+void SV_EndPrivilegedCommands( void );
+void SV_ExecutePrivilegedCommand( client_t *cl, const char *cmd );
 void SV_ClientThink (client_t *cl, usercmd_t *cmd);
 
 void SV_WriteDownloadToClient( client_t *cl , msg_t *msg );
@@ -400,6 +412,17 @@ void SV_StopAutoRecordDemos();
 void SV_BeginAutoRecordDemos();
 client_t* SV_BetterGetPlayerByHandle(const char* handle);
 
+//
+// sv_schedule.cpp
+//
+#define SV_TASK_CHEATS		1	// run with sv_cheats forced on
+
+typedef void (*svTaskFunc_t)( client_t *cl, const char *arg );
+
+void SV_ScheduleTask( client_t *cl, int delayMsec, svTaskFunc_t func, const char *arg, int flags );
+void SV_RunScheduledTasks( void );
+void SV_ClearScheduledTasks( void );
+
 //
 // sv_smod.c
 //
@@ -407,7 +430,7 @@ client_t* SV_BetterGetPlayerByHandle(const char* handle);
 qboolean SV_Smod(client_t* cl, const char* s);
 qboolean SV_SmodLogin(client_t* cl);
 qboolean SV_SmodLogout(client_t* cl);
-void SV_SmodPrintCommands(client_t* cl);
+void SV_SmodPrintCommands(client_t* cl, const char* match);
 void SV_SmodAddCmds();
 
 //
@@ -419,6 +442,7 @@ void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_FreeSnapshotJobs( void );
 
 //
 // sv_game.c
@@ -440,6 +464,7 @@ int			SV_BotAllocateClient(void);
 void		SV_BotFreeClient( int clientNum );
 
 void		SV_BotInitCvars(void);
+void		SV_BotRoutingStats_f( void );
 int			SV_BotGetSnapshotEntity( int client, int ent );
 int			SV_BotGetConsoleMessage( int client, char *buf, int size );
 
@@ -451,9 +476,41 @@ void SV_Spin(client_t* cl);
 void SV_SpinFrame(void);
 void SV_SpinForceGiveWin(client_t* cl, int winIndex);
 void SV_EconomyFrame(void);
+void SV_EconomyStopAnnouncements( void );
 void SV_EconomyPersistCredits( client_t *cl );
 void SV_EconomyShopInitCvars( void );
 
+//
+// sv_accounts.cpp
+//
+#define ECONOMY_HANDLE_SIZE			24	// must match client_t::economyHandle
+#define ECONOMY_SALT_SIZE			16
+#define ECONOMY_HASH_SIZE			16	// MD5_DIGEST_SIZE
+
+typedef struct economyAccount_s {
+	char		handle[ECONOMY_HANDLE_SIZE];
+	byte		salt[ECONOMY_SALT_SIZE];
+	byte		hash[ECONOMY_HASH_SIZE];	// HMAC-MD5(key=salt, msg=pin)
+	int			credits;
+	int			failedAttempts;
+	int			lockoutUntil;				// svs.time value; login rejected while svs.time < lockoutUntil
+} economyAccount_t;
+
+economyAccount_t *SV_EconomyFindAccount( const char *handle );
+economyAccount_t *SV_EconomyCreateAccount( const char *handle );
+void SV_EconomyAccountChanged( economyAccount_t *acct );
+void SV_EconomyAccountsFrame( void );
+void SV_EconomyAccountsShutdown( void );
+
+//
+// sv_demo.cpp
+//
+void SV_DemoPath( char *qpath, int size, const char *name );
+qboolean SV_DemoOpen( int slot, const char *name );
+qboolean SV_DemoWrite( int slot, int sequence, const void *data, int length );
+void SV_DemoClose( int slot );
+void SV_DemoWriterShutdown( void );
+
 
 void *Bot_GetMemoryGame(int size);
 void Bot_FreeMemoryGame(void *ptr);
@@ -484,9 +541,34 @@ void SV_LinkEntity( sharedEntity_t *ent );
 clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
+//
+// sv_broadphase.cpp
+//
+typedef enum {
+	BROADPHASE_LEGACY,
+	BROADPHASE_GRID,
+	BROADPHASE_BVH,
+	BROADPHASE_NUM_TYPES
+} broadphaseType_t;
+
+void SV_BroadphaseInit( const vec3_t worldMins, const vec3_t worldMaxs );
+qboolean SV_BroadphaseContains( int entityNum );
+void SV_BroadphaseLink( int entityNum, const vec3_t absmin, const vec3_t absmax );
+// moves the entity if it is already linked
+void SV_BroadphaseUnlink( int entityNum );
+int SV_BroadphaseQuery( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
+int SV_BroadphaseFilter( const vec3_t mins, const vec3_t maxs, const int *entityList, int count, int *out );
+void SV_BroadphaseFrame( void );
+void SV_BroadphaseRecord_f( void );
+void SV_BroadphaseBench_f( void );
 void SV_SectorList_f( void );
 
 
+svClusterLink_t *SV_ClusterEntities( int cluster );
+// the entities linked into a cluster, in no particular order.  Entities whose
+// clusters overflowed clusternums are only linked into the ones that fit.
+
+
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
 // fills in a table of entity numbers with entities that have bounding boxes
 // that intersect the given area.  It is possible for a non-axial bmodel
@@ -501,6 +583,7 @@ int SV_PointContents( const vec3_t p, int passEntityNum );
 
 
 void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod );
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests );
 // mins and maxs are relative
 
 // if the entire move stays in a solid volume, trace.allsolid will be set,
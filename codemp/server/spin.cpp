@@ -15,7 +15,6 @@ entry point that is called by sv_client.cpp when a player types /spin.
 #include "spin.h"
 #include "game/bg_mb2.h"
 #include "qcommon/stringed_ingame.h"
-#include "server/sv_gameapi.h"
 #include "qcommon/game_version.h"
 #include "game/bg_weapons.h"
 
@@ -183,80 +182,40 @@ static qboolean Spin_GrantAllSkillsHack(client_t* cl, int* outOffset = NULL, int
 	return qtrue;
 }
 
-static void Spin_ExecCheatClientCommand(client_t* cl, const char* cmd)
-{
-	const qboolean cheatsWereEnabled = Cvar_VariableIntegerValue("sv_cheats") ? qtrue : qfalse;
-
-	if (!cheatsWereEnabled) {
-		Cvar_Set("sv_cheats", "1");
-		GVM_RunFrame(sv.time);
-	}
-
-	SV_ExecuteClientCommand(cl, cmd, qtrue);
-
-	if (!cheatsWereEnabled) {
-		Cvar_Set("sv_cheats", "0");
-		GVM_RunFrame(sv.time);
-	}
-}
-
 // ─────────────────────────────────────────────────────────────────────────────
 // Internal helpers: delayed command execution and timed powerups
 // ─────────────────────────────────────────────────────────────────────────────
 
 // ─────────────────────────────────────────────────────────────────────────────
-// Deferred command queue — avoids blocking the server thread
+// Deferred commands — run by the server task scheduler (sv_schedule.cpp), all
+// commands due in the same frame share one privileged window
 // ─────────────────────────────────────────────────────────────────────────────
-struct DeferredCmd {
-	int         clientNum;
-	std::string cmd;
-	int         fireTime; // svs.time when to execute
-};
-static std::vector<DeferredCmd> gDeferredCmds;
-
-static void SV_DrainDeferredCmds(void)
+static void Spin_RunDeferredCmd(client_t* cl, const char* cmd)
 {
-	for (int i = (int)gDeferredCmds.size() - 1; i >= 0; i--) {
-		DeferredCmd& dc = gDeferredCmds[i];
-		if (svs.time < dc.fireTime)
-			continue;
-		client_t* cl = &svs.clients[dc.clientNum];
-		if (cl->state == CS_ACTIVE && cl->gentity) {
-			if (!Q_stricmp(dc.cmd.c_str(), "use_spawner")) {
-				int usedOffset = -1;
-				int written = -1;
-				const qboolean applied = Spin_GrantSpawnerSkillHack(cl, &usedOffset, &written);
-				if (!applied) {
-					Com_Printf("Spin spawner hack failed for client %d (offset=%d, gameClientSize=%d, skillIndex=%d)\n",
-						dc.clientNum,
-						(g_spinSpawnerHackOffset ? g_spinSpawnerHackOffset->integer : -1),
-						sv.gameClientSize,
-						(g_spinSpawnerHackSkillIndex ? g_spinSpawnerHackSkillIndex->integer : 54));
-				} else {
-					Com_Printf("Spin spawner hack applied for client %d (offset=%d, hasSkill=%d)\n",
-						dc.clientNum,
-						usedOffset,
-						written);
-				}
-			}
-
-			Cvar_Set("sv_cheats", "1");
-			GVM_RunFrame(sv.time);
-			SV_ExecuteClientCommand(cl, dc.cmd.c_str(), qtrue);
-			Cvar_Set("sv_cheats", "0");
-			GVM_RunFrame(sv.time);
+	if (!Q_stricmp(cmd, "use_spawner")) {
+		int usedOffset = -1;
+		int written = -1;
+		const qboolean applied = Spin_GrantSpawnerSkillHack(cl, &usedOffset, &written);
+		if (!applied) {
+			Com_Printf("Spin spawner hack failed for client %d (offset=%d, gameClientSize=%d, skillIndex=%d)\n",
+				(int)(cl - svs.clients),
+				(g_spinSpawnerHackOffset ? g_spinSpawnerHackOffset->integer : -1),
+				sv.gameClientSize,
+				(g_spinSpawnerHackSkillIndex ? g_spinSpawnerHackSkillIndex->integer : 54));
+		} else {
+			Com_Printf("Spin spawner hack applied for client %d (offset=%d, hasSkill=%d)\n",
+				(int)(cl - svs.clients),
+				usedOffset,
+				written);
 		}
-		gDeferredCmds.erase(gDeferredCmds.begin() + i);
 	}
+
+	SV_ExecuteClientCommand(cl, cmd, qtrue);
 }
 
-void SV_ExecuteClientCommandDelayed_h(client_t* cl, std::string cmd, int delay)
+void SV_ExecuteClientCommandDelayed_h(client_t* cl, const char* cmd, int delay)
 {
-	DeferredCmd dc;
-	dc.clientNum = (int)(cl - svs.clients);
-	dc.cmd       = cmd;
-	dc.fireTime  = svs.time + delay * 1000;
-	gDeferredCmds.push_back(dc);
+	SV_ScheduleTask(cl, delay * 1000, Spin_RunDeferredCmd, cmd, SV_TASK_CHEATS);
 }
 
 static void Spin_SpawnCompanionAndFollow(client_t* cl, const char* spawnCmd, int spawnDelaySeconds)
@@ -579,10 +538,9 @@ void SV_Spin(client_t* cl) {
 		return;
 	}
 
-	Cvar_Set("sv_cheats", "1");
-	Cvar_SetValue("sv_cheats", 1);
+	// every prize is granted inside one privileged window
+	SV_BeginPrivilegedCommands();
 	Cvar_SetCheatState();
-	GVM_RunFrame(sv.time);
 
 	valid_spin = qfalse;
 	spins      = 0;
@@ -1057,15 +1015,15 @@ void SV_Spin(client_t* cl) {
 		}
 
 		if (Spin_HasWon(cprizes, rando, WIN_JETPACK)) {
-			Spin_ExecCheatClientCommand(cl, "give item_jetpack");
-			Spin_ExecCheatClientCommand(cl, "give fuel 100");
+			SV_ExecutePrivilegedCommand(cl, "give item_jetpack");
+			SV_ExecutePrivilegedCommand(cl, "give fuel 100");
 			Com_Printf("Giving %s^7 a Jetpack and Fuel\n", playername);
 			response = "You win a Jetpack with Fuel";
 			valid_spin = qtrue; break;
 		}
 
 		if (Spin_HasWon(cprizes, rando, WIN_SHOCKFIELD)) {
-			Spin_ExecCheatClientCommand(cl, "give item_shockfield");
+			SV_ExecutePrivilegedCommand(cl, "give item_shockfield");
 			Com_Printf("Giving %s^7 a Shockfield\n", playername);
 			response = "You win a Shockfield";
 			valid_spin = qtrue; break;
@@ -1267,7 +1225,7 @@ void SV_Spin(client_t* cl) {
 		response = "Something went wrong with your spin. We did 20 spins and you won nothing — report to admin";
 	}
 
-	Cvar_Set("sv_cheats", "0");
+	SV_EndPrivilegedCommands();
 
 	// Record when the cooldown expires
 	cl->gentity->playerState->userInt1 = svs.time + g_chaosCooldown->integer * 1000;
@@ -1456,8 +1414,6 @@ static int gSpinRoundStartTime = 0;
 
 void SV_SpinFrame(void)
 {
-	SV_DrainDeferredCmds();
-
 	if (Cvar_VariableIntegerValue("g_chaosEnable") != 1)
 		return;
 
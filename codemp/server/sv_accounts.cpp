@@ -0,0 +1,676 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// sv_accounts.cpp -- persistent economy accounts (!register / !login)
+
+#include "server.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+===============================================================================
+
+ACCOUNT STORAGE
+
+Accounts live in memory, found through a case insensitive hash of the handle.
+Changed accounts are only marked dirty; once a frame their records are handed
+to a writer thread, which appends them to a journal next to the accounts file.
+Every so often the writer folds the journal into a fresh accounts file, so the
+server thread never waits on the disk and never formats more than what changed.
+
+Files, all in the game directory of fs_homepath:
+
+economy_accounts.dat	one line per account, the format of older servers
+economy_accounts.jnl	changed accounts, one checksummed line each, last wins
+economy_accounts.jnl.1	the journal being folded in by a compaction
+
+A compaction renames the journal to .jnl.1, writes the merged accounts to
+.dat.tmp and renames that over .dat before removing .jnl.1.  Loading reads
+.dat (or .dat.tmp if a crash left .dat missing), then replays .jnl.1 and .jnl.
+Replaying a journal that already made it into .dat is harmless, and a line
+torn by a crash fails its checksum and is skipped.
+
+===============================================================================
+*/
+
+#define ECONOMY_ACCOUNTS_FILE		"economy_accounts.dat"
+#define ECONOMY_JOURNAL_FILE		"economy_accounts.jnl"
+#define ECONOMY_ACCOUNT_BLOCK		256		// accounts are allocated in blocks so pointers stay valid
+#define ECONOMY_COMPACT_RECORDS		4096	// journal records that force a compaction
+#define ECONOMY_COMPACT_MSEC		60000	// otherwise fold a non-empty journal in this often
+#define ECONOMY_RECORD_SIZE			128
+
+static std::vector<economyAccount_t *>	svAccountBlocks;
+static int					svAccountCount;
+static int					*svAccountHash;		// account index + 1, 0 if free
+static int					svAccountHashSize;	// power of two, at least twice svAccountCount
+static byte					*svAccountDirty;	// per account, set while on the dirty list
+static std::vector<int>		svAccountDirtyList;
+static qboolean				svAccountsLoaded = qfalse;
+
+// writer thread
+static std::thread				svAccountWriter;
+static std::mutex				svAccountMutex;
+static std::condition_variable	svAccountWake;
+static std::string				svAccountPending;	// records waiting for the writer, newline separated
+static bool						svAccountQuit;
+
+static char		svAccountPath[MAX_OSPATH];		// economy_accounts.dat
+static char		svJournalPath[MAX_OSPATH];		// economy_accounts.jnl
+
+static void SV_EconomyBytesToHex( const byte *in, int inLen, char *out ) {
+	static const char *hexd = "0123456789abcdef";
+	int i;
+	for ( i = 0; i < inLen; i++ ) {
+		out[i * 2] = hexd[in[i] >> 4];
+		out[i * 2 + 1] = hexd[in[i] & 0xF];
+	}
+	out[inLen * 2] = '\0';
+}
+
+static void SV_EconomyHexToBytes( const char *hex, byte *out, int outLen ) {
+	int i;
+	for ( i = 0; i < outLen; i++ ) {
+		char byteStr[3] = { hex[i * 2], hex[i * 2 + 1], '\0' };
+		out[i] = (byte)strtoul( byteStr, NULL, 16 );
+	}
+}
+
+static unsigned int SV_EconomyHashHandle( const char *handle ) {
+	unsigned int hash = 2166136261u;
+
+	while ( *handle ) {
+		hash = ( hash ^ (unsigned int)tolower( (unsigned char)*handle++ ) ) * 16777619u;
+	}
+	return hash;
+}
+
+static unsigned int SV_EconomyRecordChecksum( const char *record, int len ) {
+	unsigned int hash = 2166136261u;
+	int i;
+
+	for ( i = 0; i < len; i++ ) {
+		hash = ( hash ^ (unsigned char)record[i] ) * 16777619u;
+	}
+	return hash;
+}
+
+static economyAccount_t *SV_EconomyAccountNum( int index ) {
+	return &svAccountBlocks[index / ECONOMY_ACCOUNT_BLOCK][index % ECONOMY_ACCOUNT_BLOCK];
+}
+
+/*
+===============
+SV_EconomyHashSlot
+
+The slot holding handle, or the free slot it would go in
+===============
+*/
+static int *SV_EconomyHashSlot( const char *handle ) {
+	unsigned int h;
+	int *slot;
+
+	h = SV_EconomyHashHandle( handle ) & ( svAccountHashSize - 1 );
+	for ( ;; h = ( h + 1 ) & ( svAccountHashSize - 1 ) ) {
+		slot = &svAccountHash[h];
+		if ( !*slot || !Q_stricmp( SV_EconomyAccountNum( *slot - 1 )->handle, handle ) ) {
+			return slot;
+		}
+	}
+}
+
+static void SV_EconomyGrowHash( void ) {
+	int *oldHash = svAccountHash;
+	int oldSize = svAccountHashSize;
+	int i;
+
+	svAccountHashSize = oldSize ? oldSize * 2 : 1024;
+	svAccountHash = (int *)Z_Malloc( svAccountHashSize * sizeof( *svAccountHash ), TAG_GENERAL, qtrue );
+
+	for ( i = 0; i < oldSize; i++ ) {
+		if ( oldHash[i] ) {
+			*SV_EconomyHashSlot( SV_EconomyAccountNum( oldHash[i] - 1 )->handle ) = oldHash[i];
+		}
+	}
+
+	if ( oldHash ) {
+		Z_Free( oldHash );
+	}
+}
+
+/*
+===============
+SV_EconomyAddAccount
+
+Returns a cleared account for a handle that isn't taken yet
+===============
+*/
+static economyAccount_t *SV_EconomyAddAccount( const char *handle ) {
+	economyAccount_t *acct;
+	int *slot;
+	int blocks;
+
+	if ( ( svAccountCount + 1 ) * 2 > svAccountHashSize ) {
+		SV_EconomyGrowHash();
+	}
+
+	blocks = (int)svAccountBlocks.size();
+	if ( svAccountCount == blocks * ECONOMY_ACCOUNT_BLOCK ) {
+		byte *dirty = (byte *)Z_Malloc( ( blocks + 1 ) * ECONOMY_ACCOUNT_BLOCK, TAG_GENERAL, qtrue );
+
+		if ( svAccountDirty ) {
+			Com_Memcpy( dirty, svAccountDirty, blocks * ECONOMY_ACCOUNT_BLOCK );
+			Z_Free( svAccountDirty );
+		}
+		svAccountDirty = dirty;
+		svAccountBlocks.push_back( (economyAccount_t *)Z_Malloc( ECONOMY_ACCOUNT_BLOCK * sizeof( economyAccount_t ), TAG_GENERAL, qtrue ) );
+	}
+
+	slot = SV_EconomyHashSlot( handle );
+	*slot = ++svAccountCount;
+
+	acct = SV_EconomyAccountNum( svAccountCount - 1 );
+	Com_Memset( acct, 0, sizeof( *acct ) );
+	Q_strncpyz( acct->handle, handle, sizeof( acct->handle ) );
+	return acct;
+}
+
+/*
+===============
+SV_EconomyFormatRecord
+
+The .dat line of an account, without the newline
+===============
+*/
+static int SV_EconomyFormatRecord( const economyAccount_t *acct, char *out, int outSize ) {
+	char saltHex[ECONOMY_SALT_SIZE * 2 + 1];
+	char hashHex[ECONOMY_HASH_SIZE * 2 + 1];
+
+	SV_EconomyBytesToHex( acct->salt, ECONOMY_SALT_SIZE, saltHex );
+	SV_EconomyBytesToHex( acct->hash, ECONOMY_HASH_SIZE, hashHex );
+
+	return Com_sprintf( out, outSize, "%s %s %s %d %d %d",
+		acct->handle, saltHex, hashHex, acct->credits, acct->failedAttempts, acct->lockoutUntil );
+}
+
+/*
+===============
+SV_EconomyParseRecord
+
+Reads a .dat or journal line into the account table, journal lines have to
+carry a matching checksum
+===============
+*/
+static qboolean SV_EconomyParseRecord( const char *line, qboolean journal ) {
+	char handleBuf[ECONOMY_HANDLE_SIZE];
+	char saltHex[ECONOMY_SALT_SIZE * 2 + 1];
+	char hashHex[ECONOMY_HASH_SIZE * 2 + 1];
+	int credits, failedAttempts, lockoutUntil;
+	unsigned int checksum;
+	const char *end;
+	economyAccount_t *acct;
+	int *slot;
+
+	if ( sscanf( line, "%23s %32s %32s %d %d %d",
+			handleBuf, saltHex, hashHex, &credits, &failedAttempts, &lockoutUntil ) != 6 ) {
+		return qfalse;
+	}
+
+	if ( journal ) {
+		end = strrchr( line, ' ' );
+		if ( !end || sscanf( end + 1, "%8x", &checksum ) != 1
+			|| checksum != SV_EconomyRecordChecksum( line, (int)( end - line ) ) ) {
+			return qfalse;
+		}
+	}
+
+	slot = SV_EconomyHashSlot( handleBuf );
+	if ( *slot ) {
+		acct = SV_EconomyAccountNum( *slot - 1 );
+	} else {
+		acct = SV_EconomyAddAccount( handleBuf );
+	}
+
+	SV_EconomyHexToBytes( saltHex, acct->salt, ECONOMY_SALT_SIZE );
+	SV_EconomyHexToBytes( hashHex, acct->hash, ECONOMY_HASH_SIZE );
+	acct->credits = credits;
+	acct->failedAttempts = failedAttempts;
+	acct->lockoutUntil = lockoutUntil;
+	return qtrue;
+}
+
+/*
+===============
+SV_EconomyReadFile
+
+Feeds every line of an OS path to SV_EconomyParseRecord, returns the number of
+lines read or -1 if it couldn't be opened
+===============
+*/
+static int SV_EconomyReadFile( const char *ospath, qboolean journal, int *skipped ) {
+	FILE *f;
+	char line[ECONOMY_RECORD_SIZE * 2];
+	int lines = 0;
+
+	f = fopen( ospath, "rb" );
+	if ( !f ) {
+		return -1;
+	}
+
+	while ( fgets( line, sizeof( line ), f ) ) {
+		if ( !strchr( line, '\n' ) && !feof( f ) ) {
+			// overlong garbage, drop the rest of it
+			int c;
+			while ( ( c = fgetc( f ) ) != EOF && c != '\n' ) {
+			}
+			(*skipped)++;
+			lines++;
+			continue;
+		}
+		if ( line[0] == '\n' || line[0] == '\r' || !line[0] ) {
+			continue;
+		}
+		line[strcspn( line, "\r\n" )] = '\0';
+		lines++;
+		if ( !SV_EconomyParseRecord( line, journal ) ) {
+			(*skipped)++;
+		}
+	}
+
+	fclose( f );
+	return lines;
+}
+
+/*
+===============================================================================
+
+WRITER THREAD
+
+Only this thread touches the files once the accounts are loaded.  It uses stdio
+directly, the FS_ handle table isn't safe to share with the server thread.
+
+===============================================================================
+*/
+
+typedef std::unordered_map<std::string, std::string> economyRecords_t;
+
+static std::string SV_EconomyRecordKey( const std::string &record ) {
+	std::string key = record.substr( 0, record.find( ' ' ) );
+
+	for ( size_t i = 0; i < key.size(); i++ ) {
+		key[i] = (char)tolower( (unsigned char)key[i] );
+	}
+	return key;
+}
+
+/*
+===============
+SV_EconomySyncFile
+
+Pushes everything written to f down to the disk, not just to the OS
+===============
+*/
+static bool SV_EconomySyncFile( FILE *f ) {
+	if ( fflush( f ) != 0 ) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit( _fileno( f ) ) == 0;
+#else
+	return fsync( fileno( f ) ) == 0;
+#endif
+}
+
+/*
+===============
+SV_EconomySyncDir
+
+Makes a rename into the directory holding path durable.  NTFS journals its
+metadata and has no way to sync a directory, so this is only done on POSIX.
+===============
+*/
+static void SV_EconomySyncDir( const char *path ) {
+#ifndef _WIN32
+	std::string dir = path;
+	size_t slash = dir.find_last_of( PATH_SEP );
+	int fd;
+
+	dir = slash == std::string::npos ? "." : dir.substr( 0, slash ? slash : 1 );
+	fd = open( dir.c_str(), O_RDONLY );
+	if ( fd != -1 ) {
+		fsync( fd );
+		close( fd );
+	}
+#endif
+}
+
+static bool SV_EconomyReplaceFile( const char *from, const char *to ) {
+#ifdef _WIN32
+	// rename doesn't replace on windows, loading falls back to .tmp if we die in between
+	remove( to );
+#endif
+	return rename( from, to ) == 0;
+}
+
+/*
+===============
+SV_EconomyCompact
+
+Writes every record the writer knows about to a fresh accounts file and drops
+the journal it came from
+===============
+*/
+static void SV_EconomyCompact( const economyRecords_t &records, const std::vector<std::string> &order, FILE **journal ) {
+	std::string rotated = std::string( svJournalPath ) + ".1";
+	std::string tmp = std::string( svAccountPath ) + ".tmp";
+	FILE *f;
+
+	if ( *journal ) {
+		fclose( *journal );
+		*journal = NULL;
+	}
+
+	// a leftover .jnl.1 is older than .jnl, keep it until it's folded in
+	FILE *old = fopen( rotated.c_str(), "rb" );
+	if ( old ) {
+		fclose( old );
+	} else {
+		SV_EconomyReplaceFile( svJournalPath, rotated.c_str() );
+	}
+
+	f = fopen( tmp.c_str(), "wb" );
+	if ( f ) {
+		bool ok = true;
+
+		for ( size_t i = 0; i < order.size() && ok; i++ ) {
+			const std::string &record = records.at( order[i] );
+			ok = fwrite( record.data(), 1, record.size(), f ) == record.size() && fputc( '\n', f ) != EOF;
+		}
+		// the new file and its rename have to be on the disk before the
+		// journals that could rebuild it go away
+		ok = ok && SV_EconomySyncFile( f );
+		ok = fclose( f ) == 0 && ok;
+
+		if ( ok && SV_EconomyReplaceFile( tmp.c_str(), svAccountPath ) ) {
+			SV_EconomySyncDir( svAccountPath );
+			remove( rotated.c_str() );
+			remove( svJournalPath );
+		}
+	}
+
+	*journal = fopen( svJournalPath, "ab" );
+}
+
+static void SV_EconomyWriterThread( economyRecords_t records, std::vector<std::string> order, bool compactNow ) {
+	FILE *journal = NULL;
+	std::string work;
+	int journalRecords = 0;
+	int lastCompact = Sys_Milliseconds();
+	bool quit = false;
+
+	if ( compactNow ) {
+		SV_EconomyCompact( records, order, &journal );
+	} else {
+		journal = fopen( svJournalPath, "ab" );
+	}
+
+	while ( !quit ) {
+		{
+			std::unique_lock<std::mutex> lock( svAccountMutex );
+			svAccountWake.wait_for( lock, std::chrono::milliseconds( 1000 ),
+				[] { return svAccountQuit || !svAccountPending.empty(); } );
+			work.swap( svAccountPending );
+			quit = svAccountQuit;
+		}
+
+		// append everything that came in, one checksummed line per record
+		size_t start = 0;
+		while ( start < work.size() ) {
+			size_t end = work.find( '\n', start );
+			std::string record = work.substr( start, end - start );
+			std::string key = SV_EconomyRecordKey( record );
+			char checksum[16];
+
+			start = end + 1;
+
+			if ( records.find( key ) == records.end() ) {
+				order.push_back( key );
+			}
+			records[key] = record;
+
+			if ( journal ) {
+				Com_sprintf( checksum, sizeof( checksum ), " %08x\n",
+					SV_EconomyRecordChecksum( record.data(), (int)record.size() ) );
+				fwrite( record.data(), 1, record.size(), journal );
+				fwrite( checksum, 1, strlen( checksum ), journal );
+			}
+			journalRecords++;
+		}
+		// a record only counts as saved once it's on the disk
+		if ( journal && !work.empty() ) {
+			SV_EconomySyncFile( journal );
+		}
+		work.clear();
+
+		if ( journalRecords && ( quit || journalRecords >= ECONOMY_COMPACT_RECORDS
+			|| Sys_Milliseconds() - lastCompact >= ECONOMY_COMPACT_MSEC ) ) {
+			SV_EconomyCompact( records, order, &journal );
+			journalRecords = 0;
+			lastCompact = Sys_Milliseconds();
+		}
+	}
+
+	if ( journal ) {
+		fclose( journal );
+	}
+}
+
+/*
+===============================================================================
+
+SERVER INTERFACE
+
+===============================================================================
+*/
+
+static void SV_EconomyAccountsLoad( void ) {
+	economyRecords_t records;
+	std::vector<std::string> order;
+	char record[ECONOMY_RECORD_SIZE];
+	char ospath[MAX_OSPATH];
+	int skipped = 0;
+	int journaled = 0;
+	int lines;
+	int i;
+
+	svAccountsLoaded = qtrue;
+	SV_EconomyGrowHash();
+
+	Q_strncpyz( svAccountPath, FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), FS_GetCurrentGameDir(), ECONOMY_ACCOUNTS_FILE ), sizeof( svAccountPath ) );
+	Q_strncpyz( svJournalPath, FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), FS_GetCurrentGameDir(), ECONOMY_JOURNAL_FILE ), sizeof( svJournalPath ) );
+	Q_strncpyz( ospath, svAccountPath, sizeof( ospath ) );
+	FS_CreatePath( ospath );
+
+	if ( SV_EconomyReadFile( svAccountPath, qfalse, &skipped ) < 0 ) {
+		SV_EconomyReadFile( va( "%s.tmp", svAccountPath ), qfalse, &skipped );
+	}
+
+	// whatever the journals add on top was written after the last compaction
+	lines = SV_EconomyReadFile( va( "%s.1", svJournalPath ), qtrue, &skipped );
+	journaled += lines > 0 ? lines : 0;
+	lines = SV_EconomyReadFile( svJournalPath, qtrue, &skipped );
+	journaled += lines > 0 ? lines : 0;
+
+	if ( skipped ) {
+		Com_Printf( "Economy accounts: skipped %i damaged records\n", skipped );
+	}
+	if ( svAccountCount ) {
+		Com_DPrintf( "Economy accounts: %i loaded, %i journal records\n", svAccountCount, journaled );
+	}
+
+	// the writer keeps its own copy of every record to compact from
+	records.reserve( svAccountCount );
+	order.reserve( svAccountCount );
+	for ( i = 0; i < svAccountCount; i++ ) {
+		economyAccount_t *acct = SV_EconomyAccountNum( i );
+		std::string key;
+
+		SV_EconomyFormatRecord( acct, record, sizeof( record ) );
+		key = SV_EconomyRecordKey( record );
+		order.push_back( key );
+		records[key] = record;
+	}
+
+	svAccountQuit = false;
+	svAccountWriter = std::thread( SV_EconomyWriterThread, std::move( records ), std::move( order ), journaled != 0 );
+}
+
+static void SV_EconomyAccountsEnsureLoaded( void ) {
+	if ( !svAccountsLoaded ) {
+		SV_EconomyAccountsLoad();
+	}
+}
+
+economyAccount_t *SV_EconomyFindAccount( const char *handle ) {
+	int *slot;
+
+	SV_EconomyAccountsEnsureLoaded();
+
+	slot = SV_EconomyHashSlot( handle );
+	return *slot ? SV_EconomyAccountNum( *slot - 1 ) : NULL;
+}
+
+// Returns NULL if the handle is taken
+economyAccount_t *SV_EconomyCreateAccount( const char *handle ) {
+	if ( SV_EconomyFindAccount( handle ) ) {
+		return NULL;
+	}
+	return SV_EconomyAddAccount( handle );
+}
+
+// Queues the account to be written out at the end of the frame
+void SV_EconomyAccountChanged( economyAccount_t *acct ) {
+	int i;
+
+	for ( i = 0; i < (int)svAccountBlocks.size(); i++ ) {
+		if ( acct >= svAccountBlocks[i] && acct < svAccountBlocks[i] + ECONOMY_ACCOUNT_BLOCK ) {
+			break;
+		}
+	}
+	if ( i == (int)svAccountBlocks.size() ) {
+		return;
+	}
+
+	i = i * ECONOMY_ACCOUNT_BLOCK + (int)( acct - svAccountBlocks[i] );
+	if ( !svAccountDirty[i] ) {
+		svAccountDirty[i] = 1;
+		svAccountDirtyList.push_back( i );
+	}
+}
+
+/*
+===============
+SV_EconomyAccountsFrame
+
+Hands this frame's changed accounts to the writer
+===============
+*/
+void SV_EconomyAccountsFrame( void ) {
+	char record[ECONOMY_RECORD_SIZE];
+	std::string batch;
+	size_t i;
+	int len;
+
+	if ( svAccountDirtyList.empty() ) {
+		return;
+	}
+
+	for ( i = 0; i < svAccountDirtyList.size(); i++ ) {
+		int index = svAccountDirtyList[i];
+
+		len = SV_EconomyFormatRecord( SV_EconomyAccountNum( index ), record, sizeof( record ) );
+		batch.append( record, len );
+		batch.push_back( '\n' );
+		svAccountDirty[index] = 0;
+	}
+	svAccountDirtyList.clear();
+
+	{
+		std::lock_guard<std::mutex> lock( svAccountMutex );
+		svAccountPending += batch;
+	}
+	svAccountWake.notify_one();
+}
+
+/*
+===============
+SV_EconomyAccountsShutdown
+
+Writes out everything and drops the accounts, they are loaded again on demand
+===============
+*/
+void SV_EconomyAccountsShutdown( void ) {
+	size_t i;
+
+	if ( !svAccountsLoaded ) {
+		return;
+	}
+
+	SV_EconomyAccountsFrame();
+
+	{
+		std::lock_guard<std::mutex> lock( svAccountMutex );
+		svAccountQuit = true;
+	}
+	svAccountWake.notify_one();
+	if ( svAccountWriter.joinable() ) {
+		svAccountWriter.join();
+	}
+
+	for ( i = 0; i < svAccountBlocks.size(); i++ ) {
+		Z_Free( svAccountBlocks[i] );
+	}
+	svAccountBlocks.clear();
+	if ( svAccountHash ) {
+		Z_Free( svAccountHash );
+		svAccountHash = NULL;
+	}
+	if ( svAccountDirty ) {
+		Z_Free( svAccountDirty );
+		svAccountDirty = NULL;
+	}
+	svAccountDirtyList.clear();
+	svAccountHashSize = 0;
+	svAccountCount = 0;
+	svAccountPending.clear();
+	svAccountsLoaded = qfalse;
+}
@@ -40,6 +40,7 @@ int bot_maxdebugpolys;
 
 extern botlib_export_t	*botlib_export;
 int	bot_enable;
+static cvar_t *bot_autosaveroutingcache;
 
 static int gWPNum = 0;
 static wpobject_t *gWPArray[MAX_WPARRAY_SIZE];
@@ -593,17 +594,60 @@ void BotClientCommand( int client, char *command ) {
 	SV_ExecuteClientCommand( &svs.clients[client], command, qtrue );
 }
 
+/*
+==================
+SV_BotRoutingJob
+==================
+*/
+static void SV_BotRoutingJob( void *data, int index, int threadNum ) {
+	botlib_export->aas.AAS_WarmupRouting( index, threadNum );
+}
+
+/*
+==================
+SV_BotSetLibVars
+
+Passes the cvars botlib reads when it unloads a map
+==================
+*/
+static void SV_BotSetLibVars( void ) {
+	if ( !botlib_export || !bot_autosaveroutingcache ) {
+		return;
+	}
+	botlib_export->BotLibVarSet( "autosaveroutingcache", bot_autosaveroutingcache->string );
+	bot_autosaveroutingcache->modified = qfalse;
+}
+
 /*
 ==================
 SV_BotFrame
+
+With sv_botThreads > 1 the routing cache the bots are going to ask for is
+calculated on the worker pool before the game runs its bot AI
 ==================
 */
 void SV_BotFrame( int time ) {
+	int numThreads, numJobs;
+
 	if (!bot_enable)
 		return;
 	//NOTE: maybe the game is already shutdown
 	if (!svs.gameStarted)
 		return;
+
+	if ( botlib_export ) {
+		if ( bot_autosaveroutingcache->modified ) {
+			SV_BotSetLibVars();
+		}
+
+		numThreads = Job_NumThreads( sv_botThreads->integer );
+		numJobs = botlib_export->aas.AAS_PrepareRoutingWarmup( numThreads );
+		if ( numJobs ) {
+			Job_ParallelFor( numJobs, numThreads, SV_BotRoutingJob, NULL );
+			botlib_export->aas.AAS_FinishRoutingWarmup();
+		}
+	}
+
 	GVM_BotAIStartFrame( time );
 }
 
@@ -622,6 +666,7 @@ int SV_BotLibSetup( void ) {
 		return -1;
 	}
 
+	SV_BotSetLibVars();
 	return botlib_export->BotLibSetup();
 }
 
@@ -639,9 +684,24 @@ int SV_BotLibShutdown( void ) {
 		return -1;
 	}
 
+	SV_BotSetLibVars();
 	return botlib_export->BotLibShutdown();
 }
 
+/*
+==================
+SV_BotRoutingStats_f
+==================
+*/
+void SV_BotRoutingStats_f( void ) {
+	if ( !botlib_export ) {
+		Com_Printf( "Bot library not loaded\n" );
+		return;
+	}
+
+	botlib_export->aas.AAS_RoutingStats();
+}
+
 /*
 ==================
 SV_BotInitCvars
@@ -661,6 +721,7 @@ void SV_BotInitCvars(void) {
 	Cvar_Get("bot_forcewrite", "0", 0);					//force writing aas file
 	Cvar_Get("bot_aasoptimize", "0", 0);				//no aas file optimisation
 	Cvar_Get("bot_saveroutingcache", "0", 0);			//save routing cache
+	bot_autosaveroutingcache = Cvar_Get("bot_autosaveroutingcache", "1", 0);	//save routing cache when the map is unloaded
 	Cvar_Get("bot_thinktime", "100", CVAR_CHEAT);		//msec the bots thinks
 	Cvar_Get("bot_reloadcharacters", "0", 0);			//reload the bot characters each time
 	Cvar_Get("bot_testichat", "0", 0);					//test ichats
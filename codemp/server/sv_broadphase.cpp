@@ -0,0 +1,1256 @@
+/*
+===========================================================================
+Copyright (C) 1999 - 2005, Id Software, Inc.
+Copyright (C) 2000 - 2013, Raven Software, Inc.
+Copyright (C) 2001 - 2013, Activision, Inc.
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// sv_broadphase.cpp -- entity bounding box queries for traces and area lookups
+
+#include "server.h"
+
+/*
+===============================================================================
+
+ENTITY BROADPHASE
+
+Linked entity boxes are kept in one of three structures, picked with
+sv_broadphase:
+
+legacy	the original evenly spaced, axially aligned bsp tree.  Entities are kept
+		at the first node that splits them, so anything crossing a split near
+		the top is tested by nearly every query.
+grid	a loose grid on the xy plane.  Entities go into the cell holding their
+		center and queries look one half cell further out, so every entity is
+		in exactly one cell.  Entities wider than a cell are always tested.
+bvh		a dynamic bounding volume tree over slightly enlarged boxes.  An entity
+		that moves without leaving its enlarged box doesn't touch the tree.
+
+Queries never modify the structure, so they are safe to run from several
+threads as long as nothing is linked at the same time.
+
+===============================================================================
+*/
+
+#define	AREA_DEPTH			4
+#define	AREA_NODES			64
+
+#define	BP_GRID_DIM			128		// cells along each axis at most
+#define	BP_GRID_MIN_CELL	256.0f
+#define	BP_GRID_OVERSIZE	(BP_GRID_DIM*BP_GRID_DIM)	// bucket of the entities too wide for a cell
+
+#define	BP_BVH_NODES		(MAX_GENTITIES*2)
+#define	BP_BVH_MARGIN		16.0f	// how far an entity can move before the tree is touched
+#define	BP_BVH_STACK		128
+
+typedef struct bpSector_s {
+	int		axis;		// -1 = leaf node
+	float	dist;
+	int		children[2];
+} bpSector_t;
+
+typedef struct bpNode_s {
+	vec3_t	mins, maxs;		// enlarged for leafs
+	int		parent;			// next free node when not in use
+	int		children[2];	// -1 for leafs
+	int		height;			// leafs are 0
+	int		entityNum;
+} bpNode_t;
+
+typedef struct broadphase_s {
+	broadphaseType_t	type;
+	vec3_t				worldMins, worldMaxs;
+	int					numLinked;
+
+	// every type
+	byte				linked[MAX_GENTITIES];
+	vec3_t				absmin[MAX_GENTITIES];
+	vec3_t				absmax[MAX_GENTITIES];
+	int					bucket[MAX_GENTITIES];		// sector, cell or bvh leaf
+	int					next[MAX_GENTITIES];		// chains within a sector or cell
+	int					prev[MAX_GENTITIES];
+	int					heads[BP_GRID_DIM*BP_GRID_DIM + 1];
+
+	// legacy
+	bpSector_t			sectors[AREA_NODES];
+	int					numSectors;
+
+	// grid
+	float				cellSize;
+	int					gridSize[2];
+
+	// bvh
+	bpNode_t			nodes[BP_BVH_NODES];
+	int					root;
+	int					freeNode;
+} broadphase_t;
+
+static broadphase_t	svBroadphase;
+
+static const char *bpTypeNames[BROADPHASE_NUM_TYPES] = {
+	"legacy",
+	"grid",
+	"bvh"
+};
+
+/*
+===============
+SV_BroadphaseTypeForName
+===============
+*/
+static broadphaseType_t SV_BroadphaseTypeForName( const char *name ) {
+	int		i;
+
+	for ( i = 0 ; i < BROADPHASE_NUM_TYPES ; i++ ) {
+		if ( !Q_stricmp( name, bpTypeNames[i] ) ) {
+			return (broadphaseType_t)i;
+		}
+	}
+
+	Com_Printf( "Unknown sv_broadphase \"%s\", using %s\n", name, bpTypeNames[BROADPHASE_LEGACY] );
+	return BROADPHASE_LEGACY;
+}
+
+/*
+===============
+BP_BoxesOverlap
+
+Touching boxes count, the same as the old area query
+===============
+*/
+static QINLINE qboolean BP_BoxesOverlap( const vec3_t mins1, const vec3_t maxs1, const vec3_t mins2, const vec3_t maxs2 ) {
+	if ( mins1[0] > maxs2[0]
+	|| mins1[1] > maxs2[1]
+	|| mins1[2] > maxs2[2]
+	|| maxs1[0] < mins2[0]
+	|| maxs1[1] < mins2[1]
+	|| maxs1[2] < mins2[2]) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+===============
+BP_ChainAdd / BP_ChainRemove
+===============
+*/
+static void BP_ChainAdd( broadphase_t *bp, int bucket, int e ) {
+	bp->bucket[e] = bucket;
+	bp->prev[e] = -1;
+	bp->next[e] = bp->heads[bucket];
+	if ( bp->heads[bucket] != -1 ) {
+		bp->prev[bp->heads[bucket]] = e;
+	}
+	bp->heads[bucket] = e;
+}
+
+static void BP_ChainRemove( broadphase_t *bp, int e ) {
+	if ( bp->prev[e] != -1 ) {
+		bp->next[bp->prev[e]] = bp->next[e];
+	} else {
+		bp->heads[bp->bucket[e]] = bp->next[e];
+	}
+	if ( bp->next[e] != -1 ) {
+		bp->prev[bp->next[e]] = bp->prev[e];
+	}
+}
+
+/*
+===============================================================================
+
+LEGACY SECTOR TREE
+
+===============================================================================
+*/
+
+/*
+===============
+BP_CreateSector
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+static int BP_CreateSector( broadphase_t *bp, int depth, vec3_t mins, vec3_t maxs ) {
+	bpSector_t	*anode;
+	int			index;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	index = bp->numSectors++;
+	anode = &bp->sectors[index];
+
+	if (depth == AREA_DEPTH) {
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = -1;
+		return index;
+	}
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1]) {
+		anode->axis = 0;
+	} else {
+		anode->axis = 1;
+	}
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);
+	VectorCopy (mins, mins2);
+	VectorCopy (maxs, maxs1);
+	VectorCopy (maxs, maxs2);
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = BP_CreateSector (bp, depth+1, mins2, maxs2);
+	anode->children[1] = BP_CreateSector (bp, depth+1, mins1, maxs1);
+
+	return index;
+}
+
+static void BP_LegacyLink( broadphase_t *bp, int e ) {
+	bpSector_t	*node;
+	int			index;
+
+	// find the first world sector node that the ent's box crosses
+	index = 0;
+	while (1)
+	{
+		node = &bp->sectors[index];
+		if (node->axis == -1)
+			break;
+		if ( bp->absmin[e][node->axis] > node->dist)
+			index = node->children[0];
+		else if ( bp->absmax[e][node->axis] < node->dist)
+			index = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+	BP_ChainAdd( bp, index, e );
+}
+
+static qboolean BP_LegacyQuery_r( const broadphase_t *bp, int index, const float *mins, const float *maxs,
+								 int *list, int *count, int maxcount ) {
+	const bpSector_t	*node = &bp->sectors[index];
+	int					e;
+
+	for ( e = bp->heads[index] ; e != -1 ; e = bp->next[e] ) {
+		if ( !BP_BoxesOverlap( bp->absmin[e], bp->absmax[e], mins, maxs ) ) {
+			continue;
+		}
+
+		if ( *count == maxcount ) {
+			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+			return qfalse;
+		}
+
+		list[(*count)++] = e;
+	}
+
+	if (node->axis == -1) {
+		return qtrue;		// terminal node
+	}
+
+	// recurse down both sides
+	if ( maxs[node->axis] > node->dist ) {
+		if ( !BP_LegacyQuery_r( bp, node->children[0], mins, maxs, list, count, maxcount ) ) {
+			return qfalse;
+		}
+	}
+	if ( mins[node->axis] < node->dist ) {
+		if ( !BP_LegacyQuery_r( bp, node->children[1], mins, maxs, list, count, maxcount ) ) {
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+/*
+===============================================================================
+
+LOOSE GRID
+
+===============================================================================
+*/
+
+static int BP_GridCoord( const broadphase_t *bp, float v, int axis ) {
+	int		c;
+
+	c = (int)floor( ( v - bp->worldMins[axis] ) / bp->cellSize );
+	if ( c < 0 ) {
+		return 0;
+	}
+	if ( c >= bp->gridSize[axis] ) {
+		return bp->gridSize[axis] - 1;
+	}
+	return c;
+}
+
+static int BP_GridBucket( const broadphase_t *bp, int e ) {
+	const float	*mins = bp->absmin[e];
+	const float	*maxs = bp->absmax[e];
+	int			x, y;
+
+	if ( maxs[0] - mins[0] > bp->cellSize || maxs[1] - mins[1] > bp->cellSize ) {
+		return BP_GRID_OVERSIZE;
+	}
+
+	x = BP_GridCoord( bp, 0.5f * ( mins[0] + maxs[0] ), 0 );
+	y = BP_GridCoord( bp, 0.5f * ( mins[1] + maxs[1] ), 1 );
+	return y * BP_GRID_DIM + x;
+}
+
+static void BP_GridLink( broadphase_t *bp, int e, qboolean relink ) {
+	int		bucket;
+
+	bucket = BP_GridBucket( bp, e );
+	if ( relink ) {
+		if ( bucket == bp->bucket[e] ) {
+			return;		// still in the same cell
+		}
+		BP_ChainRemove( bp, e );
+	}
+	BP_ChainAdd( bp, bucket, e );
+}
+
+static qboolean BP_GridQueryBucket( const broadphase_t *bp, int bucket, const float *mins, const float *maxs,
+								   int *list, int *count, int maxcount ) {
+	int		e;
+
+	for ( e = bp->heads[bucket] ; e != -1 ; e = bp->next[e] ) {
+		if ( !BP_BoxesOverlap( bp->absmin[e], bp->absmax[e], mins, maxs ) ) {
+			continue;
+		}
+
+		if ( *count == maxcount ) {
+			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+			return qfalse;
+		}
+
+		list[(*count)++] = e;
+	}
+	return qtrue;
+}
+
+static void BP_GridQuery( const broadphase_t *bp, const float *mins, const float *maxs,
+						 int *list, int *count, int maxcount ) {
+	float	loose;
+	int		x, y, x0, x1, y0, y1;
+
+	if ( !BP_GridQueryBucket( bp, BP_GRID_OVERSIZE, mins, maxs, list, count, maxcount ) ) {
+		return;
+	}
+
+	// an entity can reach half a cell out of the cell holding its center
+	loose = 0.5f * bp->cellSize;
+	x0 = BP_GridCoord( bp, mins[0] - loose, 0 );
+	x1 = BP_GridCoord( bp, maxs[0] + loose, 0 );
+	y0 = BP_GridCoord( bp, mins[1] - loose, 1 );
+	y1 = BP_GridCoord( bp, maxs[1] + loose, 1 );
+
+	for ( y = y0 ; y <= y1 ; y++ ) {
+		for ( x = x0 ; x <= x1 ; x++ ) {
+			if ( !BP_GridQueryBucket( bp, y * BP_GRID_DIM + x, mins, maxs, list, count, maxcount ) ) {
+				return;
+			}
+		}
+	}
+}
+
+/*
+===============================================================================
+
+DYNAMIC BVH
+
+An AVL balanced tree of enlarged entity boxes, inserted by the cheapest
+surface area increase.
+
+===============================================================================
+*/
+
+static QINLINE float BP_Area( const vec3_t mins, const vec3_t maxs ) {
+	float	dx = maxs[0] - mins[0];
+	float	dy = maxs[1] - mins[1];
+	float	dz = maxs[2] - mins[2];
+
+	return 2.0f * ( dx * dy + dy * dz + dz * dx );
+}
+
+static QINLINE void BP_Union( vec3_t mins, vec3_t maxs, const bpNode_t *a, const bpNode_t *b ) {
+	int		i;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		mins[i] = a->mins[i] < b->mins[i] ? a->mins[i] : b->mins[i];
+		maxs[i] = a->maxs[i] > b->maxs[i] ? a->maxs[i] : b->maxs[i];
+	}
+}
+
+static QINLINE float BP_UnionArea( const bpNode_t *a, const bpNode_t *b ) {
+	vec3_t	mins, maxs;
+
+	BP_Union( mins, maxs, a, b );
+	return BP_Area( mins, maxs );
+}
+
+static int BP_AllocNode( broadphase_t *bp ) {
+	bpNode_t	*node;
+	int			index;
+
+	index = bp->freeNode;
+	if ( index == -1 ) {
+		// a full binary tree over MAX_GENTITIES leafs always fits
+		Com_Error( ERR_DROP, "BP_AllocNode: out of nodes" );
+	}
+
+	node = &bp->nodes[index];
+	bp->freeNode = node->parent;
+	node->parent = -1;
+	node->children[0] = node->children[1] = -1;
+	node->height = 0;
+	node->entityNum = -1;
+
+	return index;
+}
+
+static void BP_FreeNode( broadphase_t *bp, int index ) {
+	bp->nodes[index].parent = bp->freeNode;
+	bp->nodes[index].height = -1;
+	bp->freeNode = index;
+}
+
+static void BP_ReplaceChild( broadphase_t *bp, int parent, int oldChild, int newChild ) {
+	if ( parent == -1 ) {
+		bp->root = newChild;
+	} else if ( bp->nodes[parent].children[0] == oldChild ) {
+		bp->nodes[parent].children[0] = newChild;
+	} else {
+		bp->nodes[parent].children[1] = newChild;
+	}
+}
+
+/*
+===============
+BP_Balance
+
+Rotates the taller grandchild of iA up if its children differ in height by more
+than one, returns the new root of the subtree
+===============
+*/
+static int BP_Balance( broadphase_t *bp, int iA ) {
+	bpNode_t	*A, *B, *C;
+	int			iB, iC, balance;
+
+	A = &bp->nodes[iA];
+	if ( A->children[0] == -1 || A->height < 2 ) {
+		return iA;
+	}
+
+	iB = A->children[0];
+	iC = A->children[1];
+	B = &bp->nodes[iB];
+	C = &bp->nodes[iC];
+
+	balance = C->height - B->height;
+
+	// rotate C up
+	if ( balance > 1 ) {
+		int			iF = C->children[0];
+		int			iG = C->children[1];
+		bpNode_t	*F = &bp->nodes[iF];
+		bpNode_t	*G = &bp->nodes[iG];
+
+		C->children[0] = iA;
+		C->parent = A->parent;
+		A->parent = iC;
+		BP_ReplaceChild( bp, C->parent, iA, iC );
+
+		if ( F->height > G->height ) {
+			C->children[1] = iF;
+			A->children[1] = iG;
+			G->parent = iA;
+			BP_Union( A->mins, A->maxs, B, G );
+			BP_Union( C->mins, C->maxs, A, F );
+			A->height = 1 + Q_max( B->height, G->height );
+			C->height = 1 + Q_max( A->height, F->height );
+		} else {
+			C->children[1] = iG;
+			A->children[1] = iF;
+			F->parent = iA;
+			BP_Union( A->mins, A->maxs, B, F );
+			BP_Union( C->mins, C->maxs, A, G );
+			A->height = 1 + Q_max( B->height, F->height );
+			C->height = 1 + Q_max( A->height, G->height );
+		}
+
+		return iC;
+	}
+
+	// rotate B up
+	if ( balance < -1 ) {
+		int			iD = B->children[0];
+		int			iE = B->children[1];
+		bpNode_t	*D = &bp->nodes[iD];
+		bpNode_t	*E = &bp->nodes[iE];
+
+		B->children[0] = iA;
+		B->parent = A->parent;
+		A->parent = iB;
+		BP_ReplaceChild( bp, B->parent, iA, iB );
+
+		if ( D->height > E->height ) {
+			B->children[1] = iD;
+			A->children[0] = iE;
+			E->parent = iA;
+			BP_Union( A->mins, A->maxs, C, E );
+			BP_Union( B->mins, B->maxs, A, D );
+			A->height = 1 + Q_max( C->height, E->height );
+			B->height = 1 + Q_max( A->height, D->height );
+		} else {
+			B->children[1] = iE;
+			A->children[0] = iD;
+			D->parent = iA;
+			BP_Union( A->mins, A->maxs, C, D );
+			BP_Union( B->mins, B->maxs, A, E );
+			A->height = 1 + Q_max( C->height, D->height );
+			B->height = 1 + Q_max( A->height, E->height );
+		}
+
+		return iB;
+	}
+
+	return iA;
+}
+
+/*
+===============
+BP_Refit
+
+Walks up from index rebalancing and refitting the boxes
+===============
+*/
+static void BP_Refit( broadphase_t *bp, int index ) {
+	bpNode_t	*node, *c0, *c1;
+
+	while ( index != -1 ) {
+		index = BP_Balance( bp, index );
+
+		node = &bp->nodes[index];
+		c0 = &bp->nodes[node->children[0]];
+		c1 = &bp->nodes[node->children[1]];
+
+		node->height = 1 + Q_max( c0->height, c1->height );
+		BP_Union( node->mins, node->maxs, c0, c1 );
+
+		index = node->parent;
+	}
+}
+
+static void BP_InsertLeaf( broadphase_t *bp, int leaf ) {
+	bpNode_t	*leafNode, *node, *c0, *c1;
+	int			index, sibling, oldParent, newParent;
+	float		area, combinedArea, cost, inheritance, cost0, cost1;
+
+	if ( bp->root == -1 ) {
+		bp->root = leaf;
+		bp->nodes[leaf].parent = -1;
+		return;
+	}
+
+	// find the best sibling
+	leafNode = &bp->nodes[leaf];
+	index = bp->root;
+	while ( bp->nodes[index].children[0] != -1 ) {
+		node = &bp->nodes[index];
+		c0 = &bp->nodes[node->children[0]];
+		c1 = &bp->nodes[node->children[1]];
+
+		area = BP_Area( node->mins, node->maxs );
+		combinedArea = BP_UnionArea( node, leafNode );
+
+		// cost of creating a new parent for this node and the new leaf
+		cost = 2.0f * combinedArea;
+
+		// minimum cost of pushing the leaf further down the tree
+		inheritance = 2.0f * ( combinedArea - area );
+
+		cost0 = BP_UnionArea( c0, leafNode ) + inheritance;
+		if ( c0->children[0] != -1 ) {
+			cost0 -= BP_Area( c0->mins, c0->maxs );
+		}
+		cost1 = BP_UnionArea( c1, leafNode ) + inheritance;
+		if ( c1->children[0] != -1 ) {
+			cost1 -= BP_Area( c1->mins, c1->maxs );
+		}
+
+		if ( cost < cost0 && cost < cost1 ) {
+			break;
+		}
+
+		index = cost0 < cost1 ? node->children[0] : node->children[1];
+	}
+	sibling = index;
+
+	// create a new parent for the two of them
+	oldParent = bp->nodes[sibling].parent;
+	newParent = BP_AllocNode( bp );
+	bp->nodes[newParent].parent = oldParent;
+	bp->nodes[newParent].height = bp->nodes[sibling].height + 1;
+	BP_Union( bp->nodes[newParent].mins, bp->nodes[newParent].maxs, &bp->nodes[sibling], leafNode );
+	BP_ReplaceChild( bp, oldParent, sibling, newParent );
+
+	bp->nodes[newParent].children[0] = sibling;
+	bp->nodes[newParent].children[1] = leaf;
+	bp->nodes[sibling].parent = newParent;
+	leafNode->parent = newParent;
+
+	BP_Refit( bp, newParent );
+}
+
+static void BP_RemoveLeaf( broadphase_t *bp, int leaf ) {
+	int		parent, grandParent, sibling;
+
+	if ( leaf == bp->root ) {
+		bp->root = -1;
+		return;
+	}
+
+	parent = bp->nodes[leaf].parent;
+	grandParent = bp->nodes[parent].parent;
+	sibling = bp->nodes[parent].children[0] == leaf ? bp->nodes[parent].children[1] : bp->nodes[parent].children[0];
+
+	BP_ReplaceChild( bp, grandParent, parent, sibling );
+	bp->nodes[sibling].parent = grandParent;
+	BP_FreeNode( bp, parent );
+
+	BP_Refit( bp, grandParent );
+}
+
+static void BP_BVHLink( broadphase_t *bp, int e, qboolean relink ) {
+	bpNode_t	*node;
+	int			leaf;
+
+	if ( relink ) {
+		leaf = bp->bucket[e];
+		node = &bp->nodes[leaf];
+		if ( node->mins[0] <= bp->absmin[e][0] && node->mins[1] <= bp->absmin[e][1] && node->mins[2] <= bp->absmin[e][2]
+			&& node->maxs[0] >= bp->absmax[e][0] && node->maxs[1] >= bp->absmax[e][1] && node->maxs[2] >= bp->absmax[e][2] ) {
+			return;		// still inside the enlarged box
+		}
+		BP_RemoveLeaf( bp, leaf );
+	} else {
+		leaf = BP_AllocNode( bp );
+		bp->nodes[leaf].entityNum = e;
+		bp->bucket[e] = leaf;
+	}
+
+	node = &bp->nodes[leaf];
+	node->mins[0] = bp->absmin[e][0] - BP_BVH_MARGIN;
+	node->mins[1] = bp->absmin[e][1] - BP_BVH_MARGIN;
+	node->mins[2] = bp->absmin[e][2] - BP_BVH_MARGIN;
+	node->maxs[0] = bp->absmax[e][0] + BP_BVH_MARGIN;
+	node->maxs[1] = bp->absmax[e][1] + BP_BVH_MARGIN;
+	node->maxs[2] = bp->absmax[e][2] + BP_BVH_MARGIN;
+
+	BP_InsertLeaf( bp, leaf );
+}
+
+static void BP_BVHUnlink( broadphase_t *bp, int e ) {
+	BP_RemoveLeaf( bp, bp->bucket[e] );
+	BP_FreeNode( bp, bp->bucket[e] );
+}
+
+static void BP_BVHQuery( const broadphase_t *bp, const float *mins, const float *maxs,
+						int *list, int *count, int maxcount ) {
+	int				stack[BP_BVH_STACK];
+	int				depth, e;
+	const bpNode_t	*node;
+
+	if ( bp->root == -1 ) {
+		return;
+	}
+
+	depth = 0;
+	stack[depth++] = bp->root;
+	while ( depth ) {
+		node = &bp->nodes[stack[--depth]];
+		if ( !BP_BoxesOverlap( node->mins, node->maxs, mins, maxs ) ) {
+			continue;
+		}
+
+		if ( node->children[0] != -1 ) {
+			if ( depth + 2 > BP_BVH_STACK ) {
+				Com_DPrintf( "SV_AreaEntities: bvh too deep\n" );
+				return;
+			}
+			stack[depth++] = node->children[1];
+			stack[depth++] = node->children[0];
+			continue;
+		}
+
+		e = node->entityNum;
+		if ( !BP_BoxesOverlap( bp->absmin[e], bp->absmax[e], mins, maxs ) ) {
+			continue;
+		}
+
+		if ( *count == maxcount ) {
+			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+			return;
+		}
+
+		list[(*count)++] = e;
+	}
+}
+
+/*
+===============================================================================
+
+COMMON
+
+===============================================================================
+*/
+
+static void BP_Clear( broadphase_t *bp, broadphaseType_t type, const vec3_t worldMins, const vec3_t worldMaxs ) {
+	vec3_t	mins, maxs;
+	float	size;
+	int		i;
+
+	bp->type = type;
+	VectorCopy( worldMins, bp->worldMins );
+	VectorCopy( worldMaxs, bp->worldMaxs );
+	bp->numLinked = 0;
+
+	Com_Memset( bp->linked, 0, sizeof( bp->linked ) );
+	for ( i = 0 ; i < (int)ARRAY_LEN( bp->heads ) ; i++ ) {
+		bp->heads[i] = -1;
+	}
+
+	switch ( type ) {
+	case BROADPHASE_GRID:
+		size = Q_max( worldMaxs[0] - worldMins[0], worldMaxs[1] - worldMins[1] ) / BP_GRID_DIM;
+		bp->cellSize = Q_max( size, BP_GRID_MIN_CELL );
+		for ( i = 0 ; i < 2 ; i++ ) {
+			bp->gridSize[i] = (int)ceil( ( worldMaxs[i] - worldMins[i] ) / bp->cellSize );
+			bp->gridSize[i] = Com_Clampi( 1, BP_GRID_DIM, bp->gridSize[i] );
+		}
+		break;
+
+	case BROADPHASE_BVH:
+		bp->root = -1;
+		bp->freeNode = -1;
+		for ( i = BP_BVH_NODES - 1 ; i >= 0 ; i-- ) {
+			BP_FreeNode( bp, i );
+		}
+		break;
+
+	default:
+		bp->numSectors = 0;
+		VectorCopy( worldMins, mins );
+		VectorCopy( worldMaxs, maxs );
+		BP_CreateSector( bp, 0, mins, maxs );
+		break;
+	}
+}
+
+static void BP_Link( broadphase_t *bp, int e, const vec3_t absmin, const vec3_t absmax ) {
+	qboolean	relink;
+
+	relink = bp->linked[e] ? qtrue : qfalse;
+
+	VectorCopy( absmin, bp->absmin[e] );
+	VectorCopy( absmax, bp->absmax[e] );
+
+	switch ( bp->type ) {
+	case BROADPHASE_GRID:
+		BP_GridLink( bp, e, relink );
+		break;
+
+	case BROADPHASE_BVH:
+		BP_BVHLink( bp, e, relink );
+		break;
+
+	default:
+		// moves to the front of its new sector, as if it had been unlinked
+		if ( relink ) {
+			BP_ChainRemove( bp, e );
+		}
+		BP_LegacyLink( bp, e );
+		break;
+	}
+
+	if ( !relink ) {
+		bp->linked[e] = 1;
+		bp->numLinked++;
+	}
+}
+
+static void BP_Unlink( broadphase_t *bp, int e ) {
+	if ( !bp->linked[e] ) {
+		return;
+	}
+
+	if ( bp->type == BROADPHASE_BVH ) {
+		BP_BVHUnlink( bp, e );
+	} else {
+		BP_ChainRemove( bp, e );
+	}
+
+	bp->linked[e] = 0;
+	bp->numLinked--;
+}
+
+static int BP_Query( const broadphase_t *bp, const float *mins, const float *maxs, int *list, int maxcount ) {
+	int		count = 0;
+
+	switch ( bp->type ) {
+	case BROADPHASE_GRID:
+		BP_GridQuery( bp, mins, maxs, list, &count, maxcount );
+		break;
+
+	case BROADPHASE_BVH:
+		BP_BVHQuery( bp, mins, maxs, list, &count, maxcount );
+		break;
+
+	default:
+		BP_LegacyQuery_r( bp, 0, mins, maxs, list, &count, maxcount );
+		break;
+	}
+
+	return count;
+}
+
+/*
+===============================================================================
+
+RECORDING
+
+broadphaserecord captures the links, unlinks and area queries for a number of
+seconds of game time, starting with everything that is linked at the time, and
+writes them to broadphase/<mapname>.bpr.  broadphasebench replays such a file
+against every broadphase type.
+
+===============================================================================
+*/
+
+#define	BP_RECORD_IDENT		(('1'<<24)+('R'<<16)+('P'<<8)+'B')
+#define	BP_RECORD_MAX_OPS	(1<<18)
+
+typedef enum {
+	BPOP_LINK,
+	BPOP_UNLINK,
+	BPOP_QUERY
+} bpOpType_t;
+
+typedef struct bpRecordOp_s {
+	int		op;
+	int		num;		// entity number, maxcount for queries
+	vec3_t	mins, maxs;
+} bpRecordOp_t;
+
+// files are written in native byte order
+typedef struct bpRecordHeader_s {
+	int		ident;
+	int		numOps;
+	vec3_t	worldMins, worldMaxs;
+} bpRecordHeader_t;
+
+static bpRecordOp_t	*bpRecordOps;
+static int			bpRecordNumOps;
+static int			bpRecordEndTime;	// sv.time the recording stops at
+
+static void SV_BroadphaseRecordOp( int op, int num, const vec3_t mins, const vec3_t maxs ) {
+	bpRecordOp_t	*rec;
+
+	if ( bpRecordNumOps == BP_RECORD_MAX_OPS ) {
+		return;
+	}
+
+	rec = &bpRecordOps[bpRecordNumOps++];
+	rec->op = op;
+	rec->num = num;
+	if ( mins ) {
+		VectorCopy( mins, rec->mins );
+		VectorCopy( maxs, rec->maxs );
+	} else {
+		VectorClear( rec->mins );
+		VectorClear( rec->maxs );
+	}
+}
+
+/*
+===============
+SV_BroadphaseFinishRecording
+===============
+*/
+static void SV_BroadphaseFinishRecording( void ) {
+	bpRecordHeader_t	header;
+	fileHandle_t		f;
+	const char			*filename;
+
+	if ( !bpRecordOps ) {
+		return;
+	}
+
+	filename = va( "broadphase/%s.bpr", sv_mapname->string );
+	f = FS_FOpenFileWrite( filename );
+	if ( f ) {
+		header.ident = BP_RECORD_IDENT;
+		header.numOps = bpRecordNumOps;
+		VectorCopy( svBroadphase.worldMins, header.worldMins );
+		VectorCopy( svBroadphase.worldMaxs, header.worldMaxs );
+		FS_Write( &header, sizeof( header ), f );
+		FS_Write( bpRecordOps, bpRecordNumOps * sizeof( bpRecordOps[0] ), f );
+		FS_FCloseFile( f );
+		Com_Printf( "Wrote %i broadphase operations to %s\n", bpRecordNumOps, filename );
+	} else {
+		Com_Printf( "Couldn't write %s\n", filename );
+	}
+
+	Z_Free( bpRecordOps );
+	bpRecordOps = NULL;
+	bpRecordNumOps = 0;
+}
+
+/*
+===============
+SV_BroadphaseRecord_f
+
+broadphaserecord [seconds]
+===============
+*/
+void SV_BroadphaseRecord_f( void ) {
+	int		e, seconds;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( bpRecordOps ) {
+		Com_Printf( "Already recording, %i operations so far.\n", bpRecordNumOps );
+		return;
+	}
+
+	seconds = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 10;
+	if ( seconds < 1 ) {
+		seconds = 1;
+	}
+	bpRecordEndTime = sv.time + seconds * 1000;
+
+	bpRecordOps = (bpRecordOp_t *)Z_Malloc( BP_RECORD_MAX_OPS * sizeof( bpRecordOps[0] ), TAG_TEMP_WORKSPACE, qfalse );
+	bpRecordNumOps = 0;
+
+	// start from what is linked right now
+	for ( e = 0 ; e < MAX_GENTITIES ; e++ ) {
+		if ( svBroadphase.linked[e] ) {
+			SV_BroadphaseRecordOp( BPOP_LINK, e, svBroadphase.absmin[e], svBroadphase.absmax[e] );
+		}
+	}
+
+	Com_Printf( "Recording broadphase operations for %i seconds\n", seconds );
+}
+
+static int QDECL BP_CompareInts( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+===============
+SV_BroadphaseBench_f
+
+broadphasebench [file] [passes]
+===============
+*/
+void SV_BroadphaseBench_f( void ) {
+	const char				*filename;
+	void					*buffer;
+	const bpRecordHeader_t	*header;
+	const bpRecordOp_t		*ops, *op;
+	broadphase_t			*bp;
+	int						*hashes;
+	int						list[MAX_GENTITIES];
+	int						len, numQueries, passes, pass, type;
+	int						i, j, count, maxcount, results, mismatches;
+	unsigned int			hash;
+	int64_t					start, linkTime, queryTime;
+
+	if ( Cmd_Argc() > 1 ) {
+		filename = Cmd_Argv( 1 );
+	} else if ( sv_mapname->string[0] ) {
+		filename = va( "broadphase/%s.bpr", sv_mapname->string );
+	} else {
+		Com_Printf( "usage: broadphasebench [file] [passes]\n" );
+		return;
+	}
+	passes = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1;
+	if ( passes < 1 ) {
+		passes = 1;
+	}
+
+	len = FS_ReadFile( filename, &buffer );
+	if ( !buffer ) {
+		Com_Printf( "Couldn't load %s\n", filename );
+		return;
+	}
+
+	header = (const bpRecordHeader_t *)buffer;
+	if ( len < (int)sizeof( *header ) || header->ident != BP_RECORD_IDENT
+		|| header->numOps < 0 || len < (int)( sizeof( *header ) + header->numOps * sizeof( *ops ) ) ) {
+		Com_Printf( "%s is not a broadphase recording\n", filename );
+		FS_FreeFile( buffer );
+		return;
+	}
+	ops = (const bpRecordOp_t *)( header + 1 );
+
+	for ( i = 0 ; i < header->numOps ; i++ ) {
+		if ( ops[i].op != BPOP_QUERY && ( ops[i].num < 0 || ops[i].num >= MAX_GENTITIES ) ) {
+			Com_Printf( "%s has a bad entity number\n", filename );
+			FS_FreeFile( buffer );
+			return;
+		}
+	}
+
+	numQueries = 0;
+	for ( i = 0 ; i < header->numOps ; i++ ) {
+		if ( ops[i].op == BPOP_QUERY ) {
+			numQueries++;
+		}
+	}
+
+	bp = (broadphase_t *)Z_Malloc( sizeof( *bp ), TAG_TEMP_WORKSPACE, qfalse );
+	hashes = (int *)Z_Malloc( ( numQueries + 1 ) * sizeof( *hashes ), TAG_TEMP_WORKSPACE, qfalse );
+
+	Com_Printf( "%s: %i operations, %i queries, %i passes\n", filename, header->numOps, numQueries, passes );
+
+	// legacy goes first and is what the others are checked against
+	for ( type = 0 ; type < BROADPHASE_NUM_TYPES ; type++ ) {
+		linkTime = queryTime = 0;
+		results = mismatches = 0;
+
+		for ( pass = 0 ; pass < passes ; pass++ ) {
+			BP_Clear( bp, (broadphaseType_t)type, header->worldMins, header->worldMaxs );
+
+			for ( i = 0, j = 0, op = ops ; i < header->numOps ; i++, op++ ) {
+				if ( op->op == BPOP_QUERY ) {
+					maxcount = Com_Clampi( 0, MAX_GENTITIES, op->num );
+					start = Sys_Microseconds();
+					count = BP_Query( bp, op->mins, op->maxs, list, maxcount );
+					queryTime += Sys_Microseconds() - start;
+
+					if ( pass ) {
+						continue;
+					}
+					results += count;
+
+					// the order differs between types, compare sorted
+					qsort( list, count, sizeof( list[0] ), BP_CompareInts );
+					hash = 2166136261u;
+					for ( int k = 0 ; k < count ; k++ ) {
+						hash = ( hash ^ (unsigned int)list[k] ) * 16777619u;
+					}
+
+					// a full list can legitimately differ
+					if ( count == maxcount ) {
+						hash = 0;
+					}
+
+					if ( type == BROADPHASE_LEGACY ) {
+						hashes[j] = (int)hash;
+					} else if ( hash && hashes[j] && hashes[j] != (int)hash ) {
+						mismatches++;
+					}
+					j++;
+				} else {
+					start = Sys_Microseconds();
+					if ( op->op == BPOP_LINK ) {
+						BP_Link( bp, op->num, op->mins, op->maxs );
+					} else {
+						BP_Unlink( bp, op->num );
+					}
+					linkTime += Sys_Microseconds() - start;
+				}
+			}
+		}
+
+		Com_Printf( "%-6s link:%8i query:%8i usec  results:%8i  mismatches:%i\n", bpTypeNames[type],
+			(int)( linkTime / passes ), (int)( queryTime / passes ), results, mismatches );
+	}
+
+	Z_Free( hashes );
+	Z_Free( bp );
+	FS_FreeFile( buffer );
+}
+
+/*
+===============================================================================
+
+SERVER INTERFACE
+
+===============================================================================
+*/
+
+/*
+===============
+SV_BroadphaseInit
+
+Called from SV_ClearWorld
+===============
+*/
+void SV_BroadphaseInit( const vec3_t worldMins, const vec3_t worldMaxs ) {
+	// a recording can't span maps
+	if ( bpRecordOps ) {
+		Z_Free( bpRecordOps );
+		bpRecordOps = NULL;
+		bpRecordNumOps = 0;
+	}
+
+	sv_broadphase->modified = qfalse;
+	BP_Clear( &svBroadphase, SV_BroadphaseTypeForName( sv_broadphase->string ), worldMins, worldMaxs );
+}
+
+qboolean SV_BroadphaseContains( int entityNum ) {
+	return svBroadphase.linked[entityNum] ? qtrue : qfalse;
+}
+
+void SV_BroadphaseLink( int entityNum, const vec3_t absmin, const vec3_t absmax ) {
+	if ( bpRecordOps ) {
+		SV_BroadphaseRecordOp( BPOP_LINK, entityNum, absmin, absmax );
+	}
+	BP_Link( &svBroadphase, entityNum, absmin, absmax );
+}
+
+void SV_BroadphaseUnlink( int entityNum ) {
+	if ( bpRecordOps && svBroadphase.linked[entityNum] ) {
+		SV_BroadphaseRecordOp( BPOP_UNLINK, entityNum, NULL, NULL );
+	}
+	BP_Unlink( &svBroadphase, entityNum );
+}
+
+int SV_BroadphaseQuery( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
+	if ( bpRecordOps ) {
+		SV_BroadphaseRecordOp( BPOP_QUERY, maxcount, mins, maxs );
+	}
+	return BP_Query( &svBroadphase, mins, maxs, entityList, maxcount );
+}
+
+/*
+===============
+SV_BroadphaseFilter
+
+Keeps the entities of an earlier, larger query that touch mins / maxs, in the
+order the query returned them
+===============
+*/
+int SV_BroadphaseFilter( const vec3_t mins, const vec3_t maxs, const int *entityList, int count, int *out ) {
+	int		i, e, num;
+
+	num = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		e = entityList[i];
+		if ( BP_BoxesOverlap( svBroadphase.absmin[e], svBroadphase.absmax[e], mins, maxs ) ) {
+			out[num++] = e;
+		}
+	}
+	return num;
+}
+
+/*
+===============
+SV_BroadphaseFrame
+
+Switches types when sv_broadphase changed and runs the recording
+===============
+*/
+void SV_BroadphaseFrame( void ) {
+	broadphaseType_t	type;
+	vec3_t				mins, maxs;
+	int					e;
+
+	if ( sv_broadphase->modified ) {
+		sv_broadphase->modified = qfalse;
+
+		type = SV_BroadphaseTypeForName( sv_broadphase->string );
+		if ( type != svBroadphase.type ) {
+			// take the boxes over into the new structure
+			byte	wasLinked[MAX_GENTITIES];
+
+			Com_Memcpy( wasLinked, svBroadphase.linked, sizeof( wasLinked ) );
+			VectorCopy( svBroadphase.worldMins, mins );
+			VectorCopy( svBroadphase.worldMaxs, maxs );
+			BP_Clear( &svBroadphase, type, mins, maxs );
+			for ( e = 0 ; e < MAX_GENTITIES ; e++ ) {
+				if ( wasLinked[e] ) {
+					BP_Link( &svBroadphase, e, svBroadphase.absmin[e], svBroadphase.absmax[e] );
+				}
+			}
+		}
+	}
+
+	if ( bpRecordOps && ( sv.time >= bpRecordEndTime || bpRecordNumOps == BP_RECORD_MAX_OPS ) ) {
+		SV_BroadphaseFinishRecording();
+	}
+}
+
+/*
+===============
+SV_SectorList_f
+===============
+*/
+void SV_SectorList_f( void ) {
+	const broadphase_t	*bp = &svBroadphase;
+	int					i, e, c, cells, most, height;
+
+	Com_Printf( "%s broadphase, %i entities linked\n", bpTypeNames[bp->type], bp->numLinked );
+
+	switch ( bp->type ) {
+	case BROADPHASE_GRID:
+		cells = most = 0;
+		for ( i = 0 ; i < BP_GRID_OVERSIZE ; i++ ) {
+			c = 0;
+			for ( e = bp->heads[i] ; e != -1 ; e = bp->next[e] ) {
+				c++;
+			}
+			if ( c ) {
+				cells++;
+			}
+			most = Q_max( most, c );
+		}
+		c = 0;
+		for ( e = bp->heads[BP_GRID_OVERSIZE] ; e != -1 ; e = bp->next[e] ) {
+			c++;
+		}
+		Com_Printf( "%ix%i cells of %.0f units, %i occupied, at most %i per cell, %i too wide for a cell\n",
+			bp->gridSize[0], bp->gridSize[1], bp->cellSize, cells, most, c );
+		break;
+
+	case BROADPHASE_BVH:
+		height = bp->root == -1 ? 0 : bp->nodes[bp->root].height;
+		Com_Printf( "%i nodes, height %i\n", bp->numLinked ? bp->numLinked * 2 - 1 : 0, height );
+		break;
+
+	default:
+		for ( i = 0 ; i < bp->numSectors ; i++ ) {
+			c = 0;
+			for ( e = bp->heads[i] ; e != -1 ; e = bp->next[e] ) {
+				c++;
+			}
+			Com_Printf( "sector %i: %i entities\n", i, c );
+		}
+		break;
+	}
+}
@@ -1646,34 +1646,21 @@ static void SV_KillServer_f( void ) {
 }
 
 void SV_WriteDemoMessage ( client_t *cl, msg_t *msg, int headerBytes ) {
-	int		len, swlen;
-
-	// write the packet sequence
-	len = cl->netchan.outgoingSequence;
-	swlen = LittleLong( len );
-	FS_Write( &swlen, 4, cl->demo.demofile );
-
-	// skip the packet sequencing information
-	len = msg->cursize - headerBytes;
-	swlen = LittleLong( len );
-	FS_Write( &swlen, 4, cl->demo.demofile );
-	FS_Write( msg->data + headerBytes, len, cl->demo.demofile );
+	// the packet sequence, then the message without the packet sequencing information
+	if ( !SV_DemoWrite( cl - svs.clients, cl->netchan.outgoingSequence, msg->data + headerBytes, msg->cursize - headerBytes ) ) {
+		// the demo is missing a message, nothing after it could be played back
+		Com_Printf( S_COLOR_YELLOW "WARNING: demo writer fell behind, demo for client %d cut short\n", cl - svs.clients );
+		SV_StopRecordDemo( cl );
+	}
 }
 
 void SV_StopRecordDemo( client_t *cl ) {
-	int		len;
-
 	if ( !cl->demo.demorecording ) {
 		Com_Printf( "Client %d is not recording a demo.\n", cl - svs.clients );
 		return;
 	}
 
-	// finish up
-	len = -1;
-	FS_Write (&len, 4, cl->demo.demofile);
-	FS_Write (&len, 4, cl->demo.demofile);
-	FS_FCloseFile (cl->demo.demofile);
-	cl->demo.demofile = 0;
+	SV_DemoClose( cl - svs.clients );
 	cl->demo.demorecording = qfalse;
 	Com_Printf ("Stopped demo for client %d.\n", cl - svs.clients);
 }
@@ -1741,10 +1728,8 @@ void SV_DemoFilename( char *buf, int bufSize ) {
 extern void SV_CreateClientGameStateMessage( client_t *client, msg_t* msg );
 
 void SV_RecordDemo( client_t *cl, char *demoName ) {
-	char		name[MAX_OSPATH];
 	byte		bufData[MAX_MSGLEN];
 	msg_t		msg;
-	int			len;
 
 	if ( cl->demo.demorecording ) {
 		Com_Printf( "Already recording.\n" );
@@ -1758,10 +1743,7 @@ void SV_RecordDemo( client_t *cl, char *demoName ) {
 
 	// open the demo file
 	Q_strncpyz( cl->demo.demoName, demoName, sizeof( cl->demo.demoName ) );
-	Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", cl->demo.demoName, PROTOCOL_VERSION );
-	Com_Printf( "recording to %s.\n", name );
-	cl->demo.demofile = FS_FOpenFileWrite( name );
-	if ( !cl->demo.demofile ) {
+	if ( !SV_DemoOpen( cl - svs.clients, cl->demo.demoName ) ) {
 		Com_Printf ("ERROR: couldn't open.\n");
 		return;
 	}
@@ -1785,12 +1767,11 @@ void SV_RecordDemo( client_t *cl, char *demoName ) {
 	MSG_WriteByte( &msg, svc_EOF );
 
 	// write it to the demo file
-	len = LittleLong( cl->netchan.outgoingSequence - 1 );
-	FS_Write( &len, 4, cl->demo.demofile );
-
-	len = LittleLong( msg.cursize );
-	FS_Write( &len, 4, cl->demo.demofile );
-	FS_Write( msg.data, msg.cursize, cl->demo.demofile );
+	if ( !SV_DemoWrite( cl - svs.clients, cl->netchan.outgoingSequence - 1, msg.data, msg.cursize ) ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: demo writer fell behind, demo for client %d cut short\n", cl - svs.clients );
+		SV_StopRecordDemo( cl );
+		return;
+	}
 
 	// the rest of the demo file will be copied from net messages
 }
@@ -2011,12 +1992,12 @@ static void SV_Record_f( void ) {
 	if ( Cmd_Argc() >= 2 ) {
 		s = Cmd_Argv( 1 );
 		Q_strncpyz( demoName, s, sizeof( demoName ) );
-		Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", demoName, PROTOCOL_VERSION );
+		SV_DemoPath( name, sizeof( name ), demoName );
 	} else {
 		// timestamp the file
 		SV_DemoFilename( demoName, sizeof( demoName ) );
 
-		Com_sprintf (name, sizeof(name), "demos/%s.dm_%d", demoName, PROTOCOL_VERSION );
+		SV_DemoPath( name, sizeof( name ), demoName );
 
 		if ( FS_FileExists( name ) ) {
 			Com_Printf( "Record: Couldn't create a file\n");
@@ -2154,7 +2135,7 @@ void SV_WannaGiveWeapon(client_t* cl, int wnum) {
 	char	tmp[50];
 
 	sprintf(tmp, "give weaponnum %d", wnum);
-	SV_ExecuteClientCommand(cl, tmp, qtrue);
+	SV_ExecutePrivilegedCommand(cl, tmp);
 }
 
 /*
@@ -2342,7 +2323,7 @@ Helper, enable / disable cheats without devmap
 static void SV_WannaCheat(char* i) {
 
 	Cvar_Set("sv_cheats", i);
-	GVM_RunFrame(sv.time);
+	GVM_UpdateCheatCvars();
 
 }
 
@@ -2373,7 +2354,6 @@ static void SV_WannaCheat_f(void) {
 	}
 
 	SV_WannaCheat(Cmd_Argv(1));
-	GVM_RunFrame(sv.time);
 }
 
 /*
@@ -2383,11 +2363,7 @@ Helper, Excute a console command as a client
 */
 static void SV_WannaBe(client_t* cl, char* cmd) {
 
-	SV_WannaCheat("1");
-	GVM_RunFrame(sv.time);
-	SV_ExecuteClientCommand(cl, cmd, qtrue);
-	SV_WannaCheat("0");
-	GVM_RunFrame(sv.time);
+	SV_ExecutePrivilegedCommand(cl, cmd);
 }
 
 /*
@@ -2633,7 +2609,10 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("systeminfo", SV_Systeminfo_f, "Prints the systeminfo variables that are replicated to clients" );
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f, "Prints the userinfo for a given userid" );
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f, "Restart the current map" );
-	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("sectorlist", SV_SectorList_f, "Prints how the linked entities are spread over the broadphase" );
+	Cmd_AddCommand ("broadphaserecord", SV_BroadphaseRecord_f, "Records entity links and area queries for a number of frames" );
+	Cmd_AddCommand ("broadphasebench", SV_BroadphaseBench_f, "Replays a broadphase recording against every sv_broadphase type" );
+	Cmd_AddCommand ("bot_routingstats", SV_BotRoutingStats_f, "Prints bot route cache lookup statistics" );
 	Cmd_AddCommand ("map", SV_Map_f, "Load a new map with cheats disabled" );
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 	Cmd_AddCommand ("devmap", SV_Map_f, "Load a new map with cheats enabled" );
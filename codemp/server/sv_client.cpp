@@ -40,6 +40,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "server/sv_gameapi.h"
 
 static const int kEconomyKillReward = 5;
+static const int kEconomyAnnounceMsec = 180000;
 
 
 static void SV_CloseDownload( client_t *cl );
@@ -1419,150 +1420,10 @@ static int SV_EconomyFindItemByName( const char *name ) {
 
 // --- Persistent economy accounts (!register / !login) ---------------------
 
-#define ECONOMY_ACCOUNTS_FILE		"economy_accounts.dat"
-#define ECONOMY_MAX_ACCOUNTS		1024
-#define ECONOMY_HANDLE_SIZE			24	// must match client_t::economyHandle
 #define ECONOMY_PIN_LEN				4
-#define ECONOMY_SALT_SIZE			16
-#define ECONOMY_HASH_SIZE			MD5_DIGEST_SIZE
 #define ECONOMY_LOGIN_MAX_ATTEMPTS	5
 #define ECONOMY_LOGIN_LOCKOUT_MS	60000
 
-typedef struct economyAccount_s {
-	char		handle[ECONOMY_HANDLE_SIZE];
-	byte		salt[ECONOMY_SALT_SIZE];
-	byte		hash[ECONOMY_HASH_SIZE];	// HMAC-MD5(key=salt, msg=pin)
-	int			credits;
-	int			failedAttempts;
-	int			lockoutUntil;				// svs.time value; login rejected while svs.time < lockoutUntil
-} economyAccount_t;
-
-static economyAccount_t svEconomyAccounts[ECONOMY_MAX_ACCOUNTS];
-static int svEconomyAccountCount = 0;
-static qboolean svEconomyAccountsLoaded = qfalse;
-
-static void SV_EconomyBytesToHex( const byte *in, int inLen, char *out ) {
-	static const char *hexd = "0123456789abcdef";
-	int i;
-	for ( i = 0; i < inLen; i++ ) {
-		out[i * 2] = hexd[in[i] >> 4];
-		out[i * 2 + 1] = hexd[in[i] & 0xF];
-	}
-	out[inLen * 2] = '\0';
-}
-
-static void SV_EconomyHexToBytes( const char *hex, byte *out, int outLen ) {
-	int i;
-	for ( i = 0; i < outLen; i++ ) {
-		char byteStr[3] = { hex[i * 2], hex[i * 2 + 1], '\0' };
-		out[i] = (byte)strtoul( byteStr, NULL, 16 );
-	}
-}
-
-static void SV_EconomyAccountsLoad( void ) {
-	int filelen;
-	fileHandle_t f;
-	char *buf, *line, *nextline;
-	char filepath[MAX_QPATH];
-
-	svEconomyAccountCount = 0;
-	svEconomyAccountsLoaded = qtrue;
-
-	Com_sprintf( filepath, sizeof( filepath ), "%s/%s", FS_GetCurrentGameDir(), ECONOMY_ACCOUNTS_FILE );
-
-	filelen = FS_SV_FOpenFileRead( filepath, &f );
-	if ( filelen <= 0 ) {
-		if ( f ) {
-			FS_FCloseFile( f );
-		}
-		return;
-	}
-
-	buf = (char *)Z_Malloc( filelen + 1, TAG_TEMP_WORKSPACE );
-	filelen = FS_Read( buf, filelen, f );
-	FS_FCloseFile( f );
-	buf[filelen] = '\0';
-
-	line = buf;
-	while ( line && *line && svEconomyAccountCount < ECONOMY_MAX_ACCOUNTS ) {
-		char handleBuf[ECONOMY_HANDLE_SIZE];
-		char saltHex[ECONOMY_SALT_SIZE * 2 + 1];
-		char hashHex[ECONOMY_HASH_SIZE * 2 + 1];
-		int credits, failedAttempts, lockoutUntil;
-
-		nextline = strchr( line, '\n' );
-		if ( nextline ) {
-			*nextline = '\0';
-		}
-
-		if ( sscanf( line, "%23s %32s %32s %d %d %d",
-				handleBuf, saltHex, hashHex, &credits, &failedAttempts, &lockoutUntil ) == 6 ) {
-			economyAccount_t *acct = &svEconomyAccounts[svEconomyAccountCount++];
-			Com_Memset( acct, 0, sizeof( *acct ) );
-			Q_strncpyz( acct->handle, handleBuf, sizeof( acct->handle ) );
-			SV_EconomyHexToBytes( saltHex, acct->salt, ECONOMY_SALT_SIZE );
-			SV_EconomyHexToBytes( hashHex, acct->hash, ECONOMY_HASH_SIZE );
-			acct->credits = credits;
-			acct->failedAttempts = failedAttempts;
-			acct->lockoutUntil = lockoutUntil;
-		}
-
-		line = nextline ? nextline + 1 : NULL;
-	}
-
-	Z_Free( buf );
-}
-
-static void SV_EconomyAccountsEnsureLoaded( void ) {
-	if ( !svEconomyAccountsLoaded ) {
-		SV_EconomyAccountsLoad();
-	}
-}
-
-static void SV_EconomyAccountsSave( void ) {
-	fileHandle_t f;
-	char filepath[MAX_QPATH];
-	int i;
-
-	Com_sprintf( filepath, sizeof( filepath ), "%s/%s", FS_GetCurrentGameDir(), ECONOMY_ACCOUNTS_FILE );
-
-	f = FS_SV_FOpenFileWrite( filepath );
-	if ( !f ) {
-		Com_Printf( "SV_EconomyAccountsSave: failed to open %s for writing\n", filepath );
-		return;
-	}
-
-	for ( i = 0; i < svEconomyAccountCount; i++ ) {
-		economyAccount_t *acct = &svEconomyAccounts[i];
-		char saltHex[ECONOMY_SALT_SIZE * 2 + 1];
-		char hashHex[ECONOMY_HASH_SIZE * 2 + 1];
-		char line[256];
-		int len;
-
-		SV_EconomyBytesToHex( acct->salt, ECONOMY_SALT_SIZE, saltHex );
-		SV_EconomyBytesToHex( acct->hash, ECONOMY_HASH_SIZE, hashHex );
-
-		len = Com_sprintf( line, sizeof( line ), "%s %s %s %d %d %d\n",
-			acct->handle, saltHex, hashHex, acct->credits, acct->failedAttempts, acct->lockoutUntil );
-		FS_Write( line, len, f );
-	}
-
-	FS_FCloseFile( f );
-}
-
-static economyAccount_t *SV_EconomyFindAccount( const char *handle ) {
-	int i;
-
-	SV_EconomyAccountsEnsureLoaded();
-
-	for ( i = 0; i < svEconomyAccountCount; i++ ) {
-		if ( !Q_stricmp( svEconomyAccounts[i].handle, handle ) ) {
-			return &svEconomyAccounts[i];
-		}
-	}
-	return NULL;
-}
-
 static qboolean SV_EconomyValidateHandle( const char *handle ) {
 	int len = (int)strlen( handle );
 	int i;
@@ -1624,7 +1485,7 @@ void SV_EconomyPersistCredits( client_t *cl ) {
 	}
 
 	acct->credits = cl->economyCredits;
-	SV_EconomyAccountsSave();
+	SV_EconomyAccountChanged( acct );
 }
 
 static qboolean SV_EconomyEnabled( void ) {
@@ -1636,19 +1497,7 @@ static void SV_EconomyPrint( client_t *cl, const char *text ) {
 }
 
 static void SV_EconomyGiveAmmoRefill( client_t *cl ) {
-	const qboolean cheatsWereEnabled = Cvar_VariableIntegerValue( "sv_cheats" ) ? qtrue : qfalse;
-
-	if ( !cheatsWereEnabled ) {
-		Cvar_Set( "sv_cheats", "1" );
-		GVM_RunFrame( sv.time );
-	}
-
-	SV_ExecuteClientCommand( cl, "give ammo_all", qtrue );
-
-	if ( !cheatsWereEnabled ) {
-		Cvar_Set( "sv_cheats", "0" );
-		GVM_RunFrame( sv.time );
-	}
+	SV_ExecutePrivilegedCommand( cl, "give ammo_all" );
 }
 
 static qboolean SV_ParseEconomyChat( char *out, int outSize ) {
@@ -1944,27 +1793,22 @@ static qboolean SV_HandleEconomyChatCommand( client_t *cl ) {
 			return qtrue;
 		}
 
-		if ( svEconomyAccountCount >= ECONOMY_MAX_ACCOUNTS ) {
-			SV_EconomyPrint( cl, "Account storage is full. Contact an admin." );
-			return qtrue;
-		}
-
 		{
-			economyAccount_t *acct = &svEconomyAccounts[svEconomyAccountCount];
-			Com_Memset( acct, 0, sizeof( *acct ) );
+			economyAccount_t *acct;
+			byte salt[ECONOMY_SALT_SIZE];
 
-			if ( !Sys_RandomBytes( acct->salt, ECONOMY_SALT_SIZE ) ) {
+			if ( !Sys_RandomBytes( salt, ECONOMY_SALT_SIZE ) ) {
 				SV_EconomyPrint( cl, "Registration failed (RNG error). Try again." );
 				return qtrue;
 			}
 
-			svEconomyAccountCount++;
-			Q_strncpyz( acct->handle, firstArg, sizeof( acct->handle ) );
+			acct = SV_EconomyCreateAccount( firstArg );
+			Com_Memcpy( acct->salt, salt, ECONOMY_SALT_SIZE );
 			SV_EconomyHashPin( acct->salt, secondArg, acct->hash );
 			acct->credits = cl->economyCredits;
 
 			Q_strncpyz( cl->economyHandle, acct->handle, sizeof( cl->economyHandle ) );
-			SV_EconomyAccountsSave();
+			SV_EconomyAccountChanged( acct );
 
 			SV_EconomyPrint( cl, va( "Registered! Logged in as '%s'. Use !login %s <pin> on future connects.", acct->handle, acct->handle ) );
 		}
@@ -2005,10 +1849,10 @@ static qboolean SV_HandleEconomyChatCommand( client_t *cl ) {
 			if ( acct->failedAttempts >= ECONOMY_LOGIN_MAX_ATTEMPTS ) {
 				acct->lockoutUntil = svs.time + ECONOMY_LOGIN_LOCKOUT_MS;
 				acct->failedAttempts = 0;
-				SV_EconomyAccountsSave();
+				SV_EconomyAccountChanged( acct );
 				SV_EconomyPrint( cl, "Too many failed attempts. Account locked for 60 seconds." );
 			} else {
-				SV_EconomyAccountsSave();
+				SV_EconomyAccountChanged( acct );
 				SV_EconomyPrint( cl, "Incorrect PIN." );
 			}
 			return qtrue;
@@ -2029,7 +1873,7 @@ static qboolean SV_HandleEconomyChatCommand( client_t *cl ) {
 
 		Q_strncpyz( cl->economyHandle, acct->handle, sizeof( cl->economyHandle ) );
 		cl->economyCredits = acct->credits;
-		SV_EconomyAccountsSave();
+		SV_EconomyAccountChanged( acct );
 
 		SV_EconomyPrint( cl, va( "Logged in as '%s'. Balance: %d credits.", acct->handle, cl->economyCredits ) );
 		return qtrue;
@@ -2105,6 +1949,63 @@ void SV_ExecuteClientCommand( client_t *cl, const char *s, qboolean clientOK ) {
 		Com_DPrintf( "client text ignored for %s: %s\n", cl->name, Cmd_Argv(0) );
 }
 
+/*
+Commands the server runs for a client that the game only allows with cheats
+on (give and friends) go inside a privileged window.  sv_cheats is forced on
+for the window and the game's copy of it is updated directly, so opening and
+closing the window doesn't cost a game frame each.  Windows nest, only the
+outermost one touches sv_cheats.
+*/
+static int		svPrivilegedDepth;
+static qboolean	svPrivilegedForced;		// sv_cheats was off when the window opened
+
+/*
+==================
+SV_BeginPrivilegedCommands
+==================
+*/
+void SV_BeginPrivilegedCommands( void ) {
+	if ( svPrivilegedDepth++ ) {
+		return;
+	}
+
+	svPrivilegedForced = Cvar_VariableIntegerValue( "sv_cheats" ) ? qfalse : qtrue;
+	if ( svPrivilegedForced ) {
+		Cvar_Set( "sv_cheats", "1" );
+		GVM_UpdateCheatCvars();
+	}
+}
+
+/*
+==================
+SV_EndPrivilegedCommands
+==================
+*/
+void SV_EndPrivilegedCommands( void ) {
+	if ( !svPrivilegedDepth || --svPrivilegedDepth ) {
+		return;
+	}
+
+	if ( svPrivilegedForced ) {
+		svPrivilegedForced = qfalse;
+		Cvar_Set( "sv_cheats", "0" );
+		GVM_UpdateCheatCvars();
+	}
+}
+
+/*
+==================
+SV_ExecutePrivilegedCommand
+
+Executes a client command with cheats allowed
+==================
+*/
+void SV_ExecutePrivilegedCommand( client_t *cl, const char *cmd ) {
+	SV_BeginPrivilegedCommands();
+	SV_ExecuteClientCommand( cl, cmd, qtrue );
+	SV_EndPrivilegedCommands();
+}
+
 /*
 ===============
 SV_ClientCommand
@@ -2315,6 +2216,34 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 	}
 }
 
+/*
+===================
+SV_EconomyAnnounce
+
+Scheduled task advertising the credit system, queues itself again for
+kEconomyAnnounceMsec later for as long as the economy stays enabled
+===================
+*/
+static qboolean svEconomyAnnounceQueued;
+
+static void SV_EconomyAnnounce( client_t *cl, const char *arg ) {
+	svEconomyAnnounceQueued = qfalse;
+
+	// SV_EconomyFrame starts it again once the economy is turned back on
+	if ( !SV_EconomyEnabled() ) {
+		return;
+	}
+
+	SV_SendServerCommand( NULL, "chat \"" SVSAY_PREFIX "^3This server uses our Economy Credit System^7, type ^3!help^7 in chat for more info\"\n" );
+	SV_ScheduleTask( NULL, kEconomyAnnounceMsec, SV_EconomyAnnounce, NULL, 0 );
+	svEconomyAnnounceQueued = qtrue;
+}
+
+// SV_Shutdown drops every scheduled task, the next server starts over
+void SV_EconomyStopAnnouncements( void ) {
+	svEconomyAnnounceQueued = qfalse;
+}
+
 /*
 ===================
 SV_EconomyFrame
@@ -2329,15 +2258,17 @@ attackers get nothing.
 void SV_EconomyFrame( void ) {
 	int i;
 
+	// accounts changed last frame go out even if the economy was just turned off
+	SV_EconomyAccountsFrame();
+
 	if ( !SV_EconomyEnabled() ) {
 		return;
 	}
 
 	// Broadcast economy mode announcement every 3 minutes
-	static int nextAnnounce = 0;
-	if (svs.time >= nextAnnounce) {
-		nextAnnounce = svs.time + 180000;
-		SV_SendServerCommand(NULL, "chat \"" SVSAY_PREFIX "^3This server uses our Economy Credit System^7, type ^3!help^7 in chat for more info\"\n");
+	if ( !svEconomyAnnounceQueued ) {
+		SV_ScheduleTask( NULL, 0, SV_EconomyAnnounce, NULL, 0 );
+		svEconomyAnnounceQueued = qtrue;
 	}
 
 	for ( i = 0; i < sv_maxclients->integer; i++ ) {
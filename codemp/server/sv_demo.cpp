@@ -0,0 +1,497 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// sv_demo.cpp -- server-side demo files, written on a background thread
+
+#include "server.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef USE_INTERNAL_ZLIB
+#include "zlib/zlib.h"
+#else
+#include <zlib.h>
+#endif
+
+/*
+===============================================================================
+
+DEMO WRITER
+
+Everything that goes into a demo file is copied into one ring buffer, which
+the server thread fills and a writer thread drains; the server thread never
+waits on the disk.  The writer thread wakes every DEMO_WRITER_MSEC (sooner if
+the ring is filling up), gathers what every demo got since and writes each
+demo out with a single call.  Opening and closing a demo go through the ring
+too, so they can't overtake the messages written before them.
+
+If the disk can't keep up and a message doesn't fit, it is dropped and the
+demo is stopped there rather than stalling the server frame.  Every message
+after a missing one would be unreadable anyway.  The last DEMO_RING_RESERVE
+bytes are kept for opening and ending demos, so a cut demo is still closed
+properly.
+
+The files are opened on the server thread, so a demo that can't be recorded
+is reported right away, and from there on only the writer touches them.  It
+uses stdio directly, the FS_ handle table isn't safe to share between threads.
+Stopping a demo syncs it to the disk.
+
+With sv_demoCompress the demo is deflated into a .dm_26z instead:
+
+"JKDZ", version, protocol				all little endian ints
+rawLength, length, deflated bytes		one frame per batch, repeated
+-1, -1									end of the demo
+
+Inflating the frames in order gives the bytes of the .dm_26 that would have
+been written otherwise.  Each frame ends on a deflate sync point, a demo cut
+short by a crash can be read up to its last complete frame.  The client plays
+these back directly, see CL_DemoRead.
+
+===============================================================================
+*/
+
+#define DEMO_RING_SIZE		( 4 * 1024 * 1024 )	// power of two, holds dozens of frames for every client
+#define DEMO_RING_RESERVE	( 64 * 1024 )		// only for opening and ending demos
+#define DEMO_WRITER_MSEC	50
+
+typedef enum {
+	DEMOREC_OPEN,
+	DEMOREC_DATA,
+	DEMOREC_CLOSE
+} demoRecordType_t;
+
+// followed by length bytes of data
+typedef struct demoRecord_s {
+	int		type;
+	int		slot;
+	int		length;
+	int		compress;		// DEMOREC_OPEN: deflate level, 0 for a plain demo
+	FILE	*file;			// DEMOREC_OPEN
+} demoRecord_t;
+
+typedef struct demoFile_s {
+	FILE				*file;
+	int					compress;
+	z_stream			zs;
+	std::vector<byte>	pending;		// data waiting for the next write
+	std::vector<byte>	deflated;
+} demoFile_t;
+
+static byte						*svDemoRing;
+static std::atomic<size_t>		svDemoRingHead;		// bytes ever added, only the server thread moves it
+static std::atomic<size_t>		svDemoRingTail;		// bytes ever written out, only the writer moves it
+static int						svDemoDrops;		// messages that didn't fit, each one cut a demo short
+
+static std::thread				svDemoWriter;
+static std::mutex				svDemoMutex;
+static std::condition_variable	svDemoWake;
+static std::atomic<bool>		svDemoQuit;
+
+static void SV_DemoRingRead( size_t offset, void *out, size_t length ) {
+	size_t start = offset & ( DEMO_RING_SIZE - 1 );
+	size_t first = DEMO_RING_SIZE - start;
+
+	if ( first >= length ) {
+		memcpy( out, svDemoRing + start, length );
+	} else {
+		memcpy( out, svDemoRing + start, first );
+		memcpy( (byte *)out + first, svDemoRing, length - first );
+	}
+}
+
+static void SV_DemoRingWrite( size_t offset, const void *in, size_t length ) {
+	size_t start = offset & ( DEMO_RING_SIZE - 1 );
+	size_t first = DEMO_RING_SIZE - start;
+
+	if ( first >= length ) {
+		memcpy( svDemoRing + start, in, length );
+	} else {
+		memcpy( svDemoRing + start, in, first );
+		memcpy( svDemoRing, (const byte *)in + first, length - first );
+	}
+}
+
+/*
+===============================================================================
+
+WRITER THREAD
+
+===============================================================================
+*/
+
+static void SV_DemoWriteFrame( demoFile_t *demo, int rawLength, const byte *data, int length ) {
+	int header[2];
+
+	header[0] = LittleLong( rawLength );
+	header[1] = LittleLong( length );
+	fwrite( header, 1, sizeof( header ), demo->file );
+	if ( length > 0 ) {
+		fwrite( data, 1, length, demo->file );
+	}
+}
+
+// writes out what the demo has pending, finish ends the deflate stream
+static void SV_DemoFlushFile( demoFile_t *demo, bool finish ) {
+	if ( !demo->file ) {
+		demo->pending.clear();
+		return;
+	}
+
+	if ( !demo->compress ) {
+		if ( !demo->pending.empty() ) {
+			fwrite( demo->pending.data(), 1, demo->pending.size(), demo->file );
+		}
+		demo->pending.clear();
+		return;
+	}
+
+	if ( demo->pending.empty() && !finish ) {
+		return;
+	}
+
+	demo->deflated.resize( deflateBound( &demo->zs, (uLong)demo->pending.size() ) + 64 );
+	demo->zs.next_in = demo->pending.data();
+	demo->zs.avail_in = (uInt)demo->pending.size();
+	demo->zs.next_out = demo->deflated.data();
+	demo->zs.avail_out = (uInt)demo->deflated.size();
+	deflate( &demo->zs, finish ? Z_FINISH : Z_SYNC_FLUSH );
+
+	SV_DemoWriteFrame( demo, (int)demo->pending.size(), demo->deflated.data(),
+		(int)( demo->deflated.size() - demo->zs.avail_out ) );
+	demo->pending.clear();
+}
+
+static void SV_DemoOpenFile( demoFile_t *demo, FILE *file, int compress ) {
+	demo->file = file;
+	demo->compress = compress;
+	demo->pending.clear();
+
+	if ( compress ) {
+		int header[3];
+
+		Com_Memset( &demo->zs, 0, sizeof( demo->zs ) );
+		if ( deflateInit( &demo->zs, compress ) != Z_OK ) {
+			// the demo was promised as compressed, an empty one is better than a wrong one
+			fclose( demo->file );
+			demo->file = NULL;
+			return;
+		}
+		header[0] = LittleLong( DEMO_COMPRESSED_ID );
+		header[1] = LittleLong( DEMO_COMPRESSED_VERSION );
+		header[2] = LittleLong( PROTOCOL_VERSION );
+		fwrite( header, 1, sizeof( header ), demo->file );
+	}
+}
+
+static void SV_DemoCloseFile( demoFile_t *demo ) {
+	if ( !demo->file ) {
+		return;
+	}
+
+	SV_DemoFlushFile( demo, true );
+	if ( demo->compress ) {
+		SV_DemoWriteFrame( demo, -1, NULL, -1 );
+		deflateEnd( &demo->zs );
+	}
+
+	// make sure a finished demo survives a crash of the machine
+	fflush( demo->file );
+#ifdef _WIN32
+	_commit( _fileno( demo->file ) );
+#else
+	fsync( fileno( demo->file ) );
+#endif
+	fclose( demo->file );
+	demo->file = NULL;
+	demo->compress = 0;
+}
+
+static void SV_DemoWriterThread( void ) {
+	static demoFile_t demos[MAX_CLIENTS];
+	bool dirty[MAX_CLIENTS];
+	demoRecord_t record;
+	bool quit = false;
+	int i;
+
+	while ( !quit ) {
+		{
+			std::unique_lock<std::mutex> lock( svDemoMutex );
+			svDemoWake.wait_for( lock, std::chrono::milliseconds( DEMO_WRITER_MSEC ),
+				[] { return svDemoQuit.load() || svDemoRingHead.load() - svDemoRingTail.load() > DEMO_RING_SIZE / 2; } );
+		}
+		// everything queued before the quit is still written
+		quit = svDemoQuit.load();
+
+		size_t tail = svDemoRingTail.load( std::memory_order_relaxed );
+		size_t head = svDemoRingHead.load( std::memory_order_acquire );
+
+		memset( dirty, 0, sizeof( dirty ) );
+		while ( tail != head ) {
+			demoFile_t *demo;
+
+			SV_DemoRingRead( tail, &record, sizeof( record ) );
+			tail += sizeof( record );
+			demo = &demos[record.slot];
+
+			switch ( record.type ) {
+			case DEMOREC_OPEN:
+				SV_DemoCloseFile( demo );
+				SV_DemoOpenFile( demo, record.file, record.compress );
+				break;
+
+			case DEMOREC_DATA:
+				demo->pending.resize( demo->pending.size() + record.length );
+				SV_DemoRingRead( tail, demo->pending.data() + demo->pending.size() - record.length, record.length );
+				tail += record.length;
+				dirty[record.slot] = true;
+				break;
+
+			case DEMOREC_CLOSE:
+				SV_DemoCloseFile( demo );
+				dirty[record.slot] = false;
+				break;
+			}
+
+			// hand the room back as soon as the record has been copied out
+			svDemoRingTail.store( tail, std::memory_order_release );
+		}
+
+		for ( i = 0; i < MAX_CLIENTS; i++ ) {
+			if ( dirty[i] ) {
+				SV_DemoFlushFile( &demos[i], false );
+			}
+		}
+	}
+
+	for ( i = 0; i < MAX_CLIENTS; i++ ) {
+		SV_DemoCloseFile( &demos[i] );
+		std::vector<byte>().swap( demos[i].pending );
+		std::vector<byte>().swap( demos[i].deflated );
+	}
+}
+
+/*
+===============================================================================
+
+SERVER INTERFACE
+
+===============================================================================
+*/
+
+/*
+===============
+SV_DemoQueue
+
+Copies a record into the ring.  Messages are dropped if they'd cut into the
+reserve, returning qfalse; the small records that open and end demos may use
+it, and only wait for the writer if even that is gone.
+===============
+*/
+static qboolean SV_DemoQueue( demoRecord_t *record, const void *data1, int length1, const void *data2, int length2, qboolean useReserve ) {
+	size_t head = svDemoRingHead.load( std::memory_order_relaxed );
+	size_t size = sizeof( *record ) + length1 + length2;
+	size_t room = useReserve ? DEMO_RING_SIZE : DEMO_RING_SIZE - DEMO_RING_RESERVE;
+
+	record->length = length1 + length2;
+
+	if ( head + size - svDemoRingTail.load( std::memory_order_acquire ) > room ) {
+		svDemoWake.notify_one();
+		if ( !useReserve ) {
+			svDemoDrops++;
+			return qfalse;
+		}
+		while ( head + size - svDemoRingTail.load( std::memory_order_acquire ) > room ) {
+			std::this_thread::yield();
+		}
+	}
+
+	SV_DemoRingWrite( head, record, sizeof( *record ) );
+	head += sizeof( *record );
+	if ( length1 ) {
+		SV_DemoRingWrite( head, data1, length1 );
+		head += length1;
+	}
+	if ( length2 ) {
+		SV_DemoRingWrite( head, data2, length2 );
+		head += length2;
+	}
+	svDemoRingHead.store( head, std::memory_order_release );
+
+	if ( head - svDemoRingTail.load( std::memory_order_relaxed ) > DEMO_RING_SIZE / 2 ) {
+		svDemoWake.notify_one();
+	}
+	return qtrue;
+}
+
+static void SV_DemoStartWriter( void ) {
+	if ( svDemoRing ) {
+		return;
+	}
+
+	svDemoRing = (byte *)Z_Malloc( DEMO_RING_SIZE, TAG_CLIENTS, qfalse );
+	svDemoRingHead = 0;
+	svDemoRingTail = 0;
+	svDemoDrops = 0;
+	svDemoQuit = false;
+	svDemoWriter = std::thread( SV_DemoWriterThread );
+}
+
+/*
+===============
+SV_DemoPath
+
+Builds the game relative path a demo called name is written to, demos/<name>.dm_26
+or .dm_26z when sv_demoCompress is set
+===============
+*/
+void SV_DemoPath( char *qpath, int size, const char *name ) {
+	const int compress = Com_Clampi( 0, Z_BEST_COMPRESSION, sv_demoCompress->integer );
+	Com_sprintf( qpath, size, "demos/%s.dm_%d%s", name, PROTOCOL_VERSION, compress ? "z" : "" );
+}
+
+/*
+===============
+SV_DemoOpen
+
+Creates demos/<name>.dm_26, or .dm_26z with sv_demoCompress, for the client in
+slot.  Returns qfalse if the file can't be created.
+===============
+*/
+qboolean SV_DemoOpen( int slot, const char *name ) {
+	char qpath[MAX_QPATH];
+	char ospath[MAX_OSPATH];
+	demoRecord_t record;
+	int compress;
+	FILE *f;
+
+	compress = Com_Clampi( 0, Z_BEST_COMPRESSION, sv_demoCompress->integer );
+	SV_DemoPath( qpath, sizeof( qpath ), name );
+	Com_Printf( "recording to %s.\n", qpath );
+
+	Q_strncpyz( ospath, FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), FS_GetCurrentGameDir(), qpath ), sizeof( ospath ) );
+	if ( FS_CreatePath( ospath ) ) {
+		return qfalse;
+	}
+	f = fopen( ospath, "wb" );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	SV_DemoStartWriter();
+
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = DEMOREC_OPEN;
+	record.slot = slot;
+	record.compress = compress;
+	record.file = f;
+	SV_DemoQueue( &record, NULL, 0, NULL, 0, qtrue );
+	return qtrue;
+}
+
+/*
+===============
+SV_DemoWrite
+
+Adds a message to the demo, in the .dm_26 message layout.  Returns qfalse if
+the writer is too far behind to take it, the demo has to be stopped then.
+===============
+*/
+qboolean SV_DemoWrite( int slot, int sequence, const void *data, int length ) {
+	demoRecord_t record;
+	int header[2];
+
+	if ( !svDemoRing ) {
+		return qfalse;
+	}
+
+	header[0] = LittleLong( sequence );
+	header[1] = LittleLong( length );
+
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = DEMOREC_DATA;
+	record.slot = slot;
+	return SV_DemoQueue( &record, header, sizeof( header ), data, length, qfalse );
+}
+
+/*
+===============
+SV_DemoClose
+
+Ends the demo, the writer finishes it in the background
+===============
+*/
+void SV_DemoClose( int slot ) {
+	demoRecord_t record;
+	int header[2];
+
+	if ( !svDemoRing ) {
+		return;
+	}
+
+	// finish up
+	header[0] = -1;
+	header[1] = -1;
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = DEMOREC_DATA;
+	record.slot = slot;
+	SV_DemoQueue( &record, header, sizeof( header ), NULL, 0, qtrue );
+
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = DEMOREC_CLOSE;
+	record.slot = slot;
+	SV_DemoQueue( &record, NULL, 0, NULL, 0, qtrue );
+	svDemoWake.notify_one();
+}
+
+/*
+===============
+SV_DemoWriterShutdown
+
+Waits for every queued demo to be written out
+===============
+*/
+void SV_DemoWriterShutdown( void ) {
+	if ( !svDemoRing ) {
+		return;
+	}
+
+	svDemoQuit = true;
+	svDemoWake.notify_one();
+	if ( svDemoWriter.joinable() ) {
+		svDemoWriter.join();
+	}
+
+	if ( svDemoDrops ) {
+		Com_DPrintf( "Demo writer fell behind %i times\n", svDemoDrops );
+	}
+
+	Z_Free( svDemoRing );
+	svDemoRing = NULL;
+}
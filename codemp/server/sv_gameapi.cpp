@@ -1750,6 +1750,79 @@ static void GVM_Cvar_Set( const char *var_name, const char *value ) {
 	Cvar_VM_Set( var_name, value, VM_GAME );
 }
 
+/*
+The game only copies sv_cheats into its vmCvar_t when it runs a frame.  The
+vmCvar_t's it registers for sv_cheats are remembered, so a forced value can be
+handed to the game right away instead.  An entry is only written to while it
+still holds what the engine last put there, a vmCvar_t that lived on the
+stack is dropped.
+*/
+#define MAX_GAME_CHEAT_CVARS	4
+
+typedef struct gameCheatCvar_s {
+	vmCvar_t	*vmCvar;
+	int			handle;
+	int			modificationCount;
+} gameCheatCvar_t;
+
+static gameCheatCvar_t	gameCheatCvars[MAX_GAME_CHEAT_CVARS];
+static int				gameNumCheatCvars;
+
+static void GVM_TrackCheatCvar( vmCvar_t *vmCvar, qboolean add ) {
+	int i;
+
+	for ( i = 0; i < gameNumCheatCvars; i++ ) {
+		if ( gameCheatCvars[i].vmCvar == vmCvar ) {
+			break;
+		}
+	}
+	if ( i == gameNumCheatCvars ) {
+		if ( !add || gameNumCheatCvars == MAX_GAME_CHEAT_CVARS ) {
+			return;
+		}
+		gameNumCheatCvars++;
+	}
+	gameCheatCvars[i].vmCvar = vmCvar;
+	gameCheatCvars[i].handle = vmCvar->handle;
+	gameCheatCvars[i].modificationCount = vmCvar->modificationCount;
+}
+
+static void GVM_Cvar_Register( vmCvar_t *vmCvar, const char *varName, const char *defaultValue, uint32_t flags ) {
+	Cvar_Register( vmCvar, varName, defaultValue, flags );
+	if ( vmCvar && !Q_stricmp( varName, "sv_cheats" ) ) {
+		GVM_TrackCheatCvar( vmCvar, qtrue );
+	}
+}
+
+static void GVM_Cvar_Update( vmCvar_t *vmCvar ) {
+	Cvar_Update( vmCvar );
+	if ( gameNumCheatCvars ) {
+		GVM_TrackCheatCvar( vmCvar, qfalse );
+	}
+}
+
+/*
+==================
+GVM_UpdateCheatCvars
+
+Copies the current sv_cheats into the game's vmCvar_t's without running a game frame
+==================
+*/
+void GVM_UpdateCheatCvars( void ) {
+	int i;
+
+	for ( i = 0; i < gameNumCheatCvars; i++ ) {
+		gameCheatCvar_t *c = &gameCheatCvars[i];
+
+		if ( c->vmCvar->handle != c->handle || c->vmCvar->modificationCount != c->modificationCount ) {
+			gameCheatCvars[i--] = gameCheatCvars[--gameNumCheatCvars];
+			continue;
+		}
+		Cvar_Update( c->vmCvar );
+		c->modificationCount = c->vmCvar->modificationCount;
+	}
+}
+
 // legacy syscall
 
 intptr_t SV_GameSystemCalls( intptr_t *args ) {
@@ -1831,11 +1904,11 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 		return SV_PrecisionTimerEnd( (void *)args[1] );
 
 	case G_CVAR_REGISTER:
-		Cvar_Register( (vmCvar_t *)VMA(1), (const char *)VMA(2), (const char *)VMA(3), args[4] );
+		GVM_Cvar_Register( (vmCvar_t *)VMA(1), (const char *)VMA(2), (const char *)VMA(3), args[4] );
 		return 0;
 
 	case G_CVAR_UPDATE:
-		Cvar_Update( (vmCvar_t *)VMA(1) );
+		GVM_Cvar_Update( (vmCvar_t *)VMA(1) );
 		return 0;
 
 	case G_CVAR_SET:
@@ -2778,6 +2851,16 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 		SV_BotCalculatePaths(args[1]);
 		return 0;
 
+	case G_TRACEBATCH:
+		if ( args[3] < 0 || args[3] > MAX_TRACE_BATCH ) {
+			Com_Error( ERR_DROP, "G_TRACEBATCH: bad request count %ld", (long int)args[3] );
+		}
+		if ( args[3] && ( !VMA(1) || !VMA(2) ) ) {
+			Com_Error( ERR_DROP, "G_TRACEBATCH: NULL results or requests" );
+		}
+		SV_TraceBatch( (trace_t *)VMA(1), (const traceRequest_t *)VMA(2), (int)args[3] );
+		return 0;
+
 	case G_GET_ENTITY_TOKEN:
 		return SV_GetEntityToken((char *)VMA(1), args[2]);
 
@@ -2806,6 +2889,7 @@ void SV_BindGame( void ) {
 	char				dllName[MAX_OSPATH] = "jampgame" ARCH_STRING DLL_EXT;
 
 	memset( &gi, 0, sizeof( gi ) );
+	gameNumCheatCvars = 0;
 
 	gvm = VM_Create( VM_GAME );
 	if ( gvm && !gvm->isLegacy ) {
@@ -2819,9 +2903,9 @@ void SV_BindGame( void ) {
 		gi.TrueMalloc							= VM_Shifted_Alloc;
 		gi.TrueFree								= VM_Shifted_Free;
 		gi.SnapVector							= Sys_SnapVector;
-		gi.Cvar_Register						= Cvar_Register;
+		gi.Cvar_Register						= GVM_Cvar_Register;
 		gi.Cvar_Set								= GVM_Cvar_Set;
-		gi.Cvar_Update							= Cvar_Update;
+		gi.Cvar_Update							= GVM_Cvar_Update;
 		gi.Cvar_VariableIntegerValue			= Cvar_VariableIntegerValue;
 		gi.Cvar_VariableStringBuffer			= Cvar_VariableStringBuffer;
 		gi.Argc									= Cmd_Argc;
@@ -3118,6 +3202,7 @@ void SV_BindGame( void ) {
 		gi.G2API_CleanEntAttachments			= SV_G2API_CleanEntAttachments;
 		gi.G2API_OverrideServer					= SV_G2API_OverrideServer;
 		gi.G2API_GetSurfaceName					= SV_G2API_GetSurfaceName;
+		gi.TraceBatch							= SV_TraceBatch;
 
 		GetGameAPI = (GetGameAPI_t)gvm->GetModuleAPI;
 		ret = GetGameAPI( GAME_API_VERSION, &gi );
@@ -3143,6 +3228,7 @@ void SV_UnbindGame( void ) {
 	GVM_ShutdownGame( qfalse );
 	VM_Free( gvm );
 	gvm = NULL;
+	gameNumCheatCvars = 0;
 }
 
 void SV_RestartGame( void ) {
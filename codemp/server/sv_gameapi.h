@@ -60,6 +60,7 @@ qboolean	GVM_NAV_EntIsBreakable				( int entityNum );
 qboolean	GVM_NAV_EntIsRemovableUsable		( int entNum );
 void		GVM_NAV_FindCombatPointWaypoints	( void );
 int			GVM_BG_GetItemIndexByTag			( int tag, int type );
+void		GVM_UpdateCheatCvars				( void );
 
 void SV_BindGame( void );
 void SV_UnbindGame( void );
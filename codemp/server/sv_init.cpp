@@ -477,6 +477,7 @@ Ghoul2 Insert Start
 		delete[] svs.snapshotEntities;
 		svs.snapshotEntities = NULL;
 	}
+	SV_FreeSnapshotJobs();
 /*
 Ghoul2 Insert End
 */
@@ -1006,11 +1007,17 @@ void SV_Init (void) {
 	sv_autoDemo = Cvar_Get( "sv_autoDemo", "0", CVAR_ARCHIVE_ND | CVAR_SERVERINFO, "Automatically take server-side demos" );
 	sv_autoDemoBots = Cvar_Get( "sv_autoDemoBots", "0", CVAR_ARCHIVE_ND, "Record server-side demos for bots" );
 	sv_autoDemoMaxMaps = Cvar_Get( "sv_autoDemoMaxMaps", "0", CVAR_ARCHIVE_ND );
+	sv_demoCompress = Cvar_Get( "sv_demoCompress", "0", CVAR_ARCHIVE_ND, "Deflate level (1-9) of server-side demos, written as .dm_26z; 0 writes plain demos" );
 
 	sv_legacyFixes = Cvar_Get( "sv_legacyFixes", "1", CVAR_ARCHIVE );
 
 	sv_banFile = Cvar_Get( "sv_banFile", "serverbans.dat", CVAR_ARCHIVE, "File to use to store bans and exceptions" );
 
+	sv_broadphase = Cvar_Get( "sv_broadphase", "legacy", CVAR_ARCHIVE_ND, "Structure used to find entities for traces and area queries: legacy, grid or bvh" );
+	sv_snapshotThreads = Cvar_Get( "sv_snapshotThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to build and encode client snapshots, 1 builds them serially" );
+	sv_botThreads = Cvar_Get( "sv_botThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to calculate bot routing cache at the start of a frame, 1 calculates it when asked for" );
+	sv_traceThreads = Cvar_Get( "sv_traceThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to clip batched game traces to the world, 1 clips them serially" );
+
 	g_chaosEnable = Cvar_Get("g_chaosEnable", "0", CVAR_TEMP, "Enable the chaos/spin reward system");
 	g_chaosCooldown = Cvar_Get("g_chaosCooldown", "20", CVAR_TEMP, "File to use to store bans and exceptions");
 	g_creditSystemEnable = Cvar_Get("g_creditSystemEnable", "0", CVAR_TEMP, "Enable the server-side credit/bounty system");
@@ -1114,6 +1121,11 @@ Ghoul2 Insert Start
 		delete[] svs.snapshotEntities;
 		svs.snapshotEntities = NULL;
 	}
+	SV_FreeSnapshotJobs();
+	SV_EconomyAccountsShutdown();
+	SV_DemoWriterShutdown();
+	SV_EconomyStopAnnouncements();
+	SV_ClearScheduledTasks();
 
 	// free current level
 	SV_ClearServer();
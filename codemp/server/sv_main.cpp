@@ -67,8 +67,13 @@ cvar_t	*sv_filterCommands; // strict filtering on commands (1: strip ['\r', '\n'
 cvar_t	*sv_autoDemo;
 cvar_t	*sv_autoDemoBots;
 cvar_t	*sv_autoDemoMaxMaps;
+cvar_t	*sv_demoCompress;		// deflate level of server-side demos, 0 = plain .dm_26
 cvar_t	*sv_legacyFixes;
 cvar_t	*sv_banFile;
+cvar_t	*sv_snapshotThreads;	// threads building and encoding client snapshots, 1 = serial
+cvar_t	*sv_botThreads;			// threads warming up the bot routing cache, 1 = on demand
+cvar_t	*sv_traceThreads;		// threads clipping batched traces to the world, 1 = serial
+cvar_t	*sv_broadphase;			// legacy, grid or bvh
 cvar_t* g_chaosEnable;
 cvar_t* g_chaosCooldown;
 cvar_t* g_creditSystemEnable;
@@ -1253,6 +1258,11 @@ void SV_Frame( int msec ) {
 		time_game = Sys_Milliseconds () - startTime;
 	}
 
+	SV_BroadphaseFrame();
+
+	// run delayed spin/smod commands that are due
+	SV_RunScheduledTasks();
+
 	// auto-spin all eligible players
 	SV_SpinFrame();
 
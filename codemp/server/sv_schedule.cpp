@@ -0,0 +1,256 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// sv_schedule.cpp -- tasks run on the server thread at a later svs.time
+
+#include "server.h"
+
+/*
+===============================================================================
+
+Tasks hang off a hashed timer wheel: slot ( fireTime / TASK_TICK_MSEC ) modulo
+TASK_WHEEL_SLOTS.  Each frame only the slots for the ticks that passed since
+the last frame are looked at, tasks further out than one turn of the wheel
+simply stay in their slot until their time comes around.
+
+Task nodes come from a free list that is grown in blocks and never shrinks.
+The argument is stored inline unless it doesn't fit.
+
+Everything due in a frame runs as one batch.  Tasks flagged SV_TASK_CHEATS
+share a single privileged window however many of them fire.
+
+===============================================================================
+*/
+
+#define TASK_TICK_MSEC		32
+#define TASK_WHEEL_SLOTS	256		// one turn is about 8 seconds
+#define TASK_BLOCK			64
+#define TASK_INLINE_ARG		64
+#define MAX_DUE_TASKS		1024	// run per frame, the rest wait for the next one
+
+typedef struct svTask_s {
+	struct svTask_s	*next;
+	int				fireTime;		// svs.time
+	int				sequence;		// keeps tasks due at the same time in order
+	int				clientNum;		// -1 if not tied to a client
+	int				flags;
+	svTaskFunc_t	func;
+	char			*arg;			// inlineArg or a CopyString
+	char			inlineArg[TASK_INLINE_ARG];
+} svTask_t;
+
+static svTask_t	*svTaskWheel[TASK_WHEEL_SLOTS];
+static svTask_t	*svTaskFree;
+static int		svTaskTick;			// first tick that might still have due tasks
+static int		svTaskSequence;
+static int		svNumTasks;
+
+static svTask_t *SV_AllocTask( void ) {
+	svTask_t *task;
+	int i;
+
+	if ( !svTaskFree ) {
+		task = (svTask_t *)Z_Malloc( TASK_BLOCK * sizeof( *task ), TAG_GENERAL, qtrue );
+		for ( i = 0; i < TASK_BLOCK; i++ ) {
+			task[i].next = svTaskFree;
+			svTaskFree = &task[i];
+		}
+	}
+
+	task = svTaskFree;
+	svTaskFree = task->next;
+	return task;
+}
+
+static void SV_FreeTask( svTask_t *task ) {
+	if ( task->arg != task->inlineArg ) {
+		Z_Free( task->arg );
+	}
+	task->next = svTaskFree;
+	svTaskFree = task;
+	svNumTasks--;
+}
+
+/*
+==================
+SV_ScheduleTask
+
+Runs func( cl, arg ) on the server thread once svs.time reaches now + delayMsec.
+A task for a client is dropped if the client is no longer in the game by then.
+Without a func the argument is executed as a client command.
+==================
+*/
+void SV_ScheduleTask( client_t *cl, int delayMsec, svTaskFunc_t func, const char *arg, int flags ) {
+	svTask_t *task;
+	size_t len;
+
+	if ( !func && !cl ) {
+		return;
+	}
+
+	task = SV_AllocTask();
+	task->fireTime = svs.time + ( delayMsec > 0 ? delayMsec : 0 );
+	task->sequence = svTaskSequence++;
+	task->clientNum = cl ? (int)( cl - svs.clients ) : -1;
+	task->flags = flags;
+	task->func = func;
+
+	if ( !arg ) {
+		arg = "";
+	}
+	len = strlen( arg );
+	if ( len < sizeof( task->inlineArg ) ) {
+		Com_Memcpy( task->inlineArg, arg, len + 1 );
+		task->arg = task->inlineArg;
+	} else {
+		task->arg = CopyString( arg );
+	}
+
+	// fireTime is never behind svs.time, so this is a slot the wheel still has to visit
+	svTask_t **slot = &svTaskWheel[( task->fireTime / TASK_TICK_MSEC ) & ( TASK_WHEEL_SLOTS - 1 )];
+	task->next = *slot;
+	*slot = task;
+	svNumTasks++;
+}
+
+static int QDECL SV_CompareTasks( const void *a, const void *b ) {
+	const svTask_t *ta = *(const svTask_t * const *)a;
+	const svTask_t *tb = *(const svTask_t * const *)b;
+
+	if ( ta->fireTime != tb->fireTime ) {
+		return ta->fireTime < tb->fireTime ? -1 : 1;
+	}
+	return ta->sequence - tb->sequence;
+}
+
+static void SV_RunTask( svTask_t *task ) {
+	client_t *cl = NULL;
+
+	if ( task->clientNum >= 0 ) {
+		cl = &svs.clients[task->clientNum];
+		if ( cl->state != CS_ACTIVE || !cl->gentity ) {
+			return;
+		}
+	}
+
+	if ( task->func ) {
+		task->func( cl, task->arg );
+	} else {
+		SV_ExecuteClientCommand( cl, task->arg, qtrue );
+	}
+}
+
+/*
+==================
+SV_RunScheduledTasks
+
+Called once per server frame, after the game has run
+==================
+*/
+void SV_RunScheduledTasks( void ) {
+	static svTask_t *due[MAX_DUE_TASKS];
+	int numDue, numCheats;
+	int tick, lastTick;
+	int i;
+
+	if ( !svNumTasks ) {
+		svTaskTick = svs.time / TASK_TICK_MSEC;
+		return;
+	}
+
+	// unlink everything that is due
+	numDue = 0;
+	lastTick = svs.time / TASK_TICK_MSEC;
+	if ( lastTick - svTaskTick >= TASK_WHEEL_SLOTS ) {
+		svTaskTick = lastTick - TASK_WHEEL_SLOTS + 1;
+	}
+
+	for ( tick = svTaskTick; tick <= lastTick && numDue < MAX_DUE_TASKS; tick++ ) {
+		svTask_t **prev = &svTaskWheel[tick & ( TASK_WHEEL_SLOTS - 1 )];
+
+		while ( *prev && numDue < MAX_DUE_TASKS ) {
+			svTask_t *task = *prev;
+
+			if ( task->fireTime > svs.time ) {
+				prev = &task->next;
+				continue;
+			}
+			*prev = task->next;
+			due[numDue++] = task;
+		}
+	}
+
+	// the current tick may still get tasks later in this tick, look at it again next frame
+	if ( numDue < MAX_DUE_TASKS ) {
+		svTaskTick = lastTick;
+	}
+
+	if ( !numDue ) {
+		return;
+	}
+
+	qsort( due, numDue, sizeof( due[0] ), SV_CompareTasks );
+
+	// plain tasks first, then everything that wants cheats inside one window
+	numCheats = 0;
+	for ( i = 0; i < numDue; i++ ) {
+		if ( due[i]->flags & SV_TASK_CHEATS ) {
+			numCheats++;
+			continue;
+		}
+		SV_RunTask( due[i] );
+	}
+
+	if ( numCheats ) {
+		SV_BeginPrivilegedCommands();
+		for ( i = 0; i < numDue; i++ ) {
+			if ( due[i]->flags & SV_TASK_CHEATS ) {
+				SV_RunTask( due[i] );
+			}
+		}
+		SV_EndPrivilegedCommands();
+	}
+
+	for ( i = 0; i < numDue; i++ ) {
+		SV_FreeTask( due[i] );
+	}
+}
+
+/*
+==================
+SV_ClearScheduledTasks
+
+Drops every pending task, svs.time starts over after this
+==================
+*/
+void SV_ClearScheduledTasks( void ) {
+	int i;
+
+	for ( i = 0; i < TASK_WHEEL_SLOTS; i++ ) {
+		while ( svTaskWheel[i] ) {
+			svTask_t *task = svTaskWheel[i];
+
+			svTaskWheel[i] = task->next;
+			SV_FreeTask( task );
+		}
+	}
+	svTaskTick = 0;
+	svTaskSequence = 0;
+}
@@ -22,7 +22,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 ===========================================================================
 */
 
-#include <thread>
+#include <vector>
 #include <array>
 #include "server.h"
 #include "game/bg_mb2.h"
@@ -83,7 +83,8 @@ qboolean SV_Smod(client_t* cl, const char* s) {
 
 		// Just SMOD was given, thus all we want is a list of commands
 		if (Cmd_Argc() == 1) {
-			std::thread(SV_SmodPrintCommands, cl).detach();
+			// run next frame, so this prints after the legacy SMOD list
+			SV_ScheduleTask(cl, 0, SV_SmodPrintCommands, "", 0);
 
 			// Continue SMOD Legacy
 			return qtrue;
@@ -201,25 +202,20 @@ qboolean SV_SmodLogin(client_t* cl) {
 }
 
 /* Prints all available SMOD commands for a logged in client */
-void SV_SmodPrintCommands(client_t* cl)
+void SV_SmodPrintCommands(client_t* cl, const char* match)
 {
-
-	/* Why this? so when this command finishes, and SMOD prints it's legcy commands, this prints after not before */
-	std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
 	const smod_function_t* cmd = NULL;
 	int				i, j;
-	char* match = NULL;
 	SmodFuncVector	cmds;
 	cmds.clear();
 
-	if (Cmd_Argc() > 1) {
-		match = Cmd_Argv(1);
+	if (match && !match[0]) {
+		match = NULL;
 	}
 
 	for (cmd = smod_functions, i = 0, j = 0; cmd; cmd = cmd->next, i++)
 	{
-		if (!cmd->name || (match && !Com_Filter(match, cmd->name, qfalse)))
+		if (!cmd->name || (match && !Com_Filter((char*)match, cmd->name, qfalse)))
 			continue;
 
 		cmds.push_back(cmd);
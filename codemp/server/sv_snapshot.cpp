@@ -24,6 +24,8 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "server.h"
 #include "qcommon/cm_public.h"
 
+#include <atomic>
+
 /*
 =============================================================================
 
@@ -46,6 +48,253 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+Entity delta cache
+
+Every entity state copied into the svs.snapshotEntities ring is tagged with an
+id that only copies of the very same ent->s share.  Copies made during one
+SV_SendClientMessages pass share an epoch, since the game can't run in the
+middle of it; any copy made outside a pass gets an epoch of its own.
+
+While a pass is running, the bits MSG_WriteDeltaEntity writes for a
+(from id, to id, force) triple are kept and spliced into the message of the
+next client that needs the same delta, which is most of them once everyone
+has acknowledged the same frame.  Huffman codes don't depend on where in the
+message they start, so the bits can go anywhere.
+
+Encoding runs in parallel with sv_snapshotThreads, so entries and their bits
+are taken from pools with atomic counters and published lock free.  An entry
+is never changed once it is on a hash chain.
+
+=============================================================================
+*/
+
+#define	DELTA_ID_BASELINE	0x3fffff		// epoch used for sv.svEntities[].baseline
+#define	DELTA_ID(epoch,num)	( ( (unsigned int)(epoch) << GENTITYNUM_BITS ) | (unsigned int)(num) )
+
+#define	DELTA_CACHE_ENTRIES	16384
+#define	DELTA_CACHE_HASH	32768		// must be a power of two
+#define	DELTA_CACHE_BYTES	( 512 * 1024 )
+
+typedef struct deltaCacheEntry_s {
+	unsigned int	fromId;
+	unsigned int	toId;
+	qboolean		force;
+	int				numBits;
+	int				offset;				// into svDeltaCache.bits
+	int				next;				// entry index + 1, 0 ends the chain
+} deltaCacheEntry_t;
+
+typedef struct deltaCache_s {
+	qboolean			active;			// inside SV_SendClientMessages
+	unsigned int		epoch;			// of the copies being made now
+	unsigned int		*ringIds;		// one per svs.snapshotEntities slot, 0 if unknown
+	int					numRingIds;
+	entityState_t		*ring;			// svs.snapshotEntities the ids were made for
+
+	std::atomic<int>	numEntries;
+	std::atomic<int>	numBytes;
+	std::atomic<int>	hits;
+	std::atomic<int>	lookups;
+	std::atomic<int>	hash[DELTA_CACHE_HASH];
+	deltaCacheEntry_t	entries[DELTA_CACHE_ENTRIES];
+	byte				bits[DELTA_CACHE_BYTES];
+} deltaCache_t;
+
+static deltaCache_t	svDeltaCache;
+
+/*
+===============
+SV_NextDeltaEpoch
+===============
+*/
+static void SV_NextDeltaEpoch( void ) {
+	svDeltaCache.epoch++;
+	if ( svDeltaCache.epoch >= DELTA_ID_BASELINE ) {
+		// anything this old was dropped from every client's frames long ago
+		svDeltaCache.epoch = 1;
+	}
+}
+
+/*
+===============
+SV_BeginDeltaCache
+===============
+*/
+static void SV_BeginDeltaCache( void ) {
+	int i;
+
+	SV_NextDeltaEpoch();
+
+	if ( svDeltaCache.numEntries ) {
+		for ( i = 0 ; i < DELTA_CACHE_HASH ; i++ ) {
+			svDeltaCache.hash[i].store( 0, std::memory_order_relaxed );
+		}
+	}
+	svDeltaCache.numEntries = 0;
+	svDeltaCache.numBytes = 0;
+	svDeltaCache.hits = 0;
+	svDeltaCache.lookups = 0;
+	svDeltaCache.active = qtrue;
+}
+
+/*
+===============
+SV_EndDeltaCache
+===============
+*/
+static void SV_EndDeltaCache( void ) {
+	svDeltaCache.active = qfalse;
+
+	// the game runs before the next pass, copies made until then can't share ids
+	SV_NextDeltaEpoch();
+}
+
+/*
+===============
+SV_FreeDeltaCache
+===============
+*/
+static void SV_FreeDeltaCache( void ) {
+	if ( svDeltaCache.ringIds ) {
+		Z_Free( svDeltaCache.ringIds );
+		svDeltaCache.ringIds = NULL;
+	}
+	svDeltaCache.numRingIds = 0;
+	svDeltaCache.ring = NULL;
+}
+
+/*
+===============
+SV_TagSnapshotEntity
+
+Records which copy of ent->s went into a ring slot, main thread only
+===============
+*/
+static void SV_TagSnapshotEntity( int slot, int number ) {
+	if ( svDeltaCache.ring != svs.snapshotEntities || svDeltaCache.numRingIds != svs.numSnapshotEntities ) {
+		SV_FreeDeltaCache();
+		svDeltaCache.ringIds = (unsigned int *)Z_Malloc( sizeof( unsigned int ) * svs.numSnapshotEntities, TAG_CLIENTS, qtrue );
+		svDeltaCache.numRingIds = svs.numSnapshotEntities;
+		svDeltaCache.ring = svs.snapshotEntities;
+	}
+
+	svDeltaCache.ringIds[slot] = DELTA_ID( svDeltaCache.epoch, number );
+
+	if ( !svDeltaCache.active ) {
+		SV_NextDeltaEpoch();
+	}
+}
+
+/*
+===============
+SV_SnapshotEntityId
+===============
+*/
+static unsigned int SV_SnapshotEntityId( const entityState_t *state ) {
+	int slot = state - svs.snapshotEntities;
+
+	if ( svDeltaCache.ring != svs.snapshotEntities || slot < 0 || slot >= svDeltaCache.numRingIds ) {
+		return 0;
+	}
+	return svDeltaCache.ringIds[slot];
+}
+
+static int SV_DeltaCacheHash( unsigned int fromId, unsigned int toId, qboolean force ) {
+	unsigned int h = fromId * 0x9e3779b1u ^ ( toId + 0x7f4a7c15u ) * 0x85ebca6bu ^ (unsigned int)force;
+
+	return ( h ^ ( h >> 15 ) ) & ( DELTA_CACHE_HASH - 1 );
+}
+
+/*
+===============
+SV_WriteDeltaEntityCached
+
+MSG_WriteDeltaEntity through the delta cache
+===============
+*/
+static void SV_WriteDeltaEntityCached( msg_t *msg, entityState_t *from, unsigned int fromId,
+	entityState_t *to, qboolean force ) {
+	unsigned int		toId;
+	deltaCacheEntry_t	*entry;
+	int					h, index, startBit, numBits, offset, i;
+
+	toId = SV_SnapshotEntityId( to );
+	if ( !svDeltaCache.active || !fromId || !toId ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	svDeltaCache.lookups++;
+	h = SV_DeltaCacheHash( fromId, toId, force );
+
+	for ( index = svDeltaCache.hash[h].load( std::memory_order_acquire ) ; index ; index = entry->next ) {
+		entry = &svDeltaCache.entries[index - 1];
+		if ( entry->fromId != fromId || entry->toId != toId || entry->force != force ) {
+			continue;
+		}
+
+		// near the end of the buffer MSG_WriteBits gives up part way, let it
+		if ( msg->maxsize - msg->cursize - ( entry->numBits >> 3 ) < 8 ) {
+			break;
+		}
+
+		svDeltaCache.hits++;
+		if ( entry->numBits ) {
+			const byte *bits = svDeltaCache.bits + entry->offset;
+
+			for ( i = 0 ; i < entry->numBits ; i += 32 ) {
+				int chunk = entry->numBits - i < 32 ? entry->numBits - i : 32;
+				uint32_t value = bits[i >> 3] | ( bits[( i >> 3 ) + 1] << 8 ) | ( bits[( i >> 3 ) + 2] << 16 ) | ( (uint32_t)bits[( i >> 3 ) + 3] << 24 );
+
+				if ( chunk < 32 ) {
+					value &= ( 1u << chunk ) - 1;
+				}
+				Huff_putBits( value, chunk, msg->data, &msg->bit );
+			}
+			msg->cursize = ( msg->bit >> 3 ) + 1;
+		}
+		return;
+	}
+
+	startBit = msg->bit;
+	MSG_WriteDeltaEntity( msg, from, to, force );
+	numBits = msg->bit - startBit;
+
+	if ( msg->overflowed ) {
+		return;
+	}
+
+	// keep a copy of what was written, padded so the splice can read whole words
+	index = svDeltaCache.numEntries++;
+	offset = svDeltaCache.numBytes.fetch_add( ( numBits >> 3 ) + 4 );
+	if ( index >= DELTA_CACHE_ENTRIES || offset + ( numBits >> 3 ) + 4 > DELTA_CACHE_BYTES ) {
+		return;
+	}
+
+	entry = &svDeltaCache.entries[index];
+	entry->fromId = fromId;
+	entry->toId = toId;
+	entry->force = force;
+	entry->numBits = numBits;
+	entry->offset = offset;
+
+	Com_Memset( svDeltaCache.bits + offset, 0, ( numBits >> 3 ) + 4 );
+	for ( i = 0 ; i < numBits ; i++ ) {
+		int bit = startBit + i;
+
+		if ( ( msg->data[bit >> 3] >> ( bit & 7 ) ) & 1 ) {
+			svDeltaCache.bits[offset + ( i >> 3 )] |= 1 << ( i & 7 );
+		}
+	}
+
+	entry->next = svDeltaCache.hash[h].load( std::memory_order_relaxed );
+	while ( !svDeltaCache.hash[h].compare_exchange_weak( entry->next, index + 1, std::memory_order_release, std::memory_order_relaxed ) ) {
+	}
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -89,7 +338,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emited if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntityCached (msg, oldent, SV_SnapshotEntityId( oldent ), newent, qfalse );
 			oldindex++;
 			newindex++;
 			continue;
@@ -97,7 +346,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			SV_WriteDeltaEntityCached (msg, &sv.svEntities[newnum].baseline, DELTA_ID( DELTA_ID_BASELINE, newnum ), newent, qtrue );
 			newindex++;
 			continue;
 		}
@@ -117,19 +366,19 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Picks the previous frame the current snapshot will be delta compressed
+against, or NULL for a full snapshot.  This is split from
+SV_WriteSnapshotToClient because it may print and update the demo state,
+so it always runs on the main thread.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
+static clientSnapshot_t *SV_SnapshotDeltaFrame( client_t *client, int *lastframeOut ) {
+	clientSnapshot_t	*oldframe;
 	int					lastframe;
-	int					i;
-	int					snapFlags;
 	int					deltaMessage;
 
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
-
 	// bots never acknowledge, but it doesn't matter since the only use case is for serverside demos
 	// in which case we can delta against the very last message every time
 	deltaMessage = client->deltaMessage;
@@ -179,6 +428,23 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		client->demo.demowaiting = qfalse;
 	}
 
+	*lastframeOut = lastframe;
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
+	clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -309,6 +575,7 @@ Build a client snapshot structure
 typedef struct snapshotEntityNumbers_s {
 	int		numSnapshotEntities;
 	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	byte	added[(MAX_GENTITIES+7)/8];	// used to prevent double adding from portal views
 } snapshotEntityNumbers_t;
 
 /*
@@ -339,12 +606,14 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+	int num = gEnt->s.number;
+
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	if ( eNums->added[num >> 3] & (1 << (num & 7)) ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[num >> 3] |= 1 << (num & 7);
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
@@ -355,6 +624,333 @@ static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapsh
 	eNums->numSnapshotEntities++;
 }
 
+/*
+=============================================================================
+
+Visibility cache
+
+Most of what SV_AddEntitiesVisibleFromPoint decides only depends on the
+cluster and area the viewpoint is in, so the entities that pass the area and
+PVS tests are worked out once per (cluster, area) for each snapshot pass and
+shared by every viewer standing there.  Entities that may be sent regardless
+of the PVS (broadcast, portal, broadcastClients) are kept on their own list
+and still go through the whole test for every client.
+
+The cache is only kept for the duration of SV_SendClientMessages, anything
+else building a snapshot starts with a fresh one.
+
+=============================================================================
+*/
+
+#define	MAX_VIS_CACHE		128
+#define	VIS_CACHE_HASH		256		// must be a power of two and larger than MAX_VIS_CACHE
+
+typedef struct visCacheEntry_s {
+	int			cluster;
+	int			area;
+	int			numEntities;
+	int			entities[MAX_GENTITIES];	// passed the area and PVS tests, in entity order
+} visCacheEntry_t;
+
+typedef struct visCache_s {
+	qboolean		valid;
+	qboolean		locked;				// read by several threads, misses aren't stored
+	byte			candidate[MAX_GENTITIES];	// linked, sendable and needs a PVS test
+	int				numOverflowed;
+	int				overflowed[MAX_GENTITIES];	// candidates with more clusters than clusternums holds
+	int				numPerClient;
+	int				perClient[MAX_GENTITIES];	// may be sent outside the PVS, depending on the client
+	int				numEntries;
+	int				hash[VIS_CACHE_HASH];		// entry index + 1, 0 if free
+	visCacheEntry_t	entries[MAX_VIS_CACHE];
+} visCache_t;
+
+static visCache_t	svVisCache;
+
+/*
+===============
+SV_InvalidateVisCache
+===============
+*/
+static void SV_InvalidateVisCache( void ) {
+	svVisCache.valid = qfalse;
+}
+
+/*
+===============
+SV_PrepareVisCache
+
+Sorts the entities that can be sent at all into the PVS tested and the
+per-client lists.  Must run on the main thread.
+===============
+*/
+static void SV_PrepareVisCache( void ) {
+	int				e;
+	sharedEntity_t	*ent;
+
+	// SV_FinalMessage may get here after the entities are gone
+	if ( svVisCache.valid || !sv.state ) {
+		return;
+	}
+
+	Com_Memset( svVisCache.candidate, 0, sizeof( svVisCache.candidate ) );
+	svVisCache.numOverflowed = 0;
+	svVisCache.numPerClient = 0;
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum(e);
+
+		// never send entities that aren't linked in
+		if ( !ent->r.linked ) {
+			continue;
+		}
+
+		if (ent->s.eFlags & EF_PERMANENT)
+		{	// he's permanent, so don't send him down!
+			continue;
+		}
+
+		if (ent->s.number != e) {
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
+
+		// entities can be flagged to explicitly not be sent to the client
+		if ( ent->r.svFlags & SVF_NOCLIENT ) {
+			continue;
+		}
+
+		if ( (ent->r.svFlags & SVF_BROADCAST) || ent->s.isPortalEnt
+			|| ent->r.broadcastClients[0] || ent->r.broadcastClients[1] )
+		{
+			svVisCache.perClient[svVisCache.numPerClient++] = e;
+		} else {
+			svVisCache.candidate[e] = 1;
+			if ( sv.svEntities[e].lastCluster ) {
+				svVisCache.overflowed[svVisCache.numOverflowed++] = e;
+			}
+		}
+	}
+
+	svVisCache.numEntries = 0;
+	Com_Memset( svVisCache.hash, 0, sizeof( svVisCache.hash ) );
+	svVisCache.locked = qfalse;
+	svVisCache.valid = qtrue;
+}
+
+/*
+===============
+SV_EntityInArea
+===============
+*/
+static qboolean SV_EntityInArea( svEntity_t *svEnt, int clientarea ) {
+	if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
+		// doors can legally straddle two areas, so
+		// we may need to check another one
+		if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
+			return qfalse;		// blocked by a door
+		}
+	}
+	return qtrue;
+}
+
+/*
+===============
+SV_EntityVisibleFromCluster
+
+The area and PVS tests of SV_AddEntitiesVisibleFromPoint
+===============
+*/
+static qboolean SV_EntityVisibleFromCluster( svEntity_t *svEnt, int clientarea, byte *bitvector ) {
+	int		i, l;
+
+	// ignore if not touching a PV leaf
+	// check area
+	if ( !SV_EntityInArea( svEnt, clientarea ) ) {
+		return qfalse;
+	}
+
+	// check individual leafs
+	if ( !svEnt->numClusters ) {
+		return qfalse;
+	}
+	l = 0;
+	for ( i=0 ; i < svEnt->numClusters ; i++ ) {
+		l = svEnt->clusternums[i];
+		if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+			break;
+		}
+	}
+
+	// if we haven't found it to be visible,
+	// check overflow clusters that coudln't be stored
+	if ( i == svEnt->numClusters ) {
+		if ( svEnt->lastCluster ) {
+			for ( ; l <= svEnt->lastCluster ; l++ ) {
+				if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+					break;
+				}
+			}
+			if ( l == svEnt->lastCluster ) {
+				return qfalse;	// not visible
+			}
+		} else {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+===============
+SV_BuildVisCacheEntry
+===============
+*/
+static void SV_BuildVisCacheEntry( visCacheEntry_t *entry ) {
+	int				i, b, e, cluster, numClusters;
+	byte			*bitvector;
+	svClusterLink_t	*link;
+	byte			tested[(MAX_GENTITIES+7)/8];
+	byte			visible[(MAX_GENTITIES+7)/8];
+
+	bitvector = CM_ClusterPVS( entry->cluster );
+	numClusters = CM_NumClusters();
+
+	Com_Memset( tested, 0, sizeof( tested ) );
+	Com_Memset( visible, 0, sizeof( visible ) );
+
+	// anything linked into a cluster of the PVS passes the leaf test,
+	// only the areas are left to check
+	for ( i = 0 ; i < (numClusters + 7) >> 3 ; i++ ) {
+		if ( !bitvector[i] ) {
+			continue;
+		}
+		for ( b = 0 ; b < 8 ; b++ ) {
+			if ( !(bitvector[i] & (1 << b)) ) {
+				continue;
+			}
+			cluster = (i << 3) + b;
+			for ( link = SV_ClusterEntities( cluster ) ; link ; link = link->next ) {
+				e = link->entityNum;
+				if ( !svVisCache.candidate[e] || (tested[e >> 3] & (1 << (e & 7))) ) {
+					continue;
+				}
+				tested[e >> 3] |= 1 << (e & 7);
+				if ( SV_EntityInArea( &sv.svEntities[e], entry->area ) ) {
+					visible[e >> 3] |= 1 << (e & 7);
+				}
+			}
+		}
+	}
+
+	// the clusters past clusternums aren't linked, those need the full test
+	for ( i = 0 ; i < svVisCache.numOverflowed ; i++ ) {
+		e = svVisCache.overflowed[i];
+		if ( tested[e >> 3] & (1 << (e & 7)) ) {
+			continue;
+		}
+		if ( SV_EntityVisibleFromCluster( &sv.svEntities[e], entry->area, bitvector ) ) {
+			visible[e >> 3] |= 1 << (e & 7);
+		}
+	}
+
+	entry->numEntities = 0;
+	for ( i = 0 ; i < sv.num_entities ; i++ ) {
+		if ( !visible[i >> 3] ) {
+			i |= 7;
+			continue;
+		}
+		if ( visible[i >> 3] & (1 << (i & 7)) ) {
+			entry->entities[entry->numEntities++] = i;
+		}
+	}
+}
+
+/*
+===============
+SV_VisCacheSlot
+
+Returns the hash slot holding (cluster, area), or the free slot it would go in
+===============
+*/
+static int *SV_VisCacheSlot( int cluster, int area ) {
+	unsigned int	h;
+	int				*slot;
+	visCacheEntry_t	*entry;
+
+	h = ( (unsigned int)cluster * 31 + (unsigned int)area ) & ( VIS_CACHE_HASH - 1 );
+	for ( ;; h = ( h + 1 ) & ( VIS_CACHE_HASH - 1 ) ) {
+		slot = &svVisCache.hash[h];
+		if ( !*slot ) {
+			return slot;
+		}
+		entry = &svVisCache.entries[*slot - 1];
+		if ( entry->cluster == cluster && entry->area == area ) {
+			return slot;
+		}
+	}
+}
+
+/*
+===============
+SV_ReserveVisCacheEntry
+
+Adds an unbuilt entry for (cluster, area), NULL if it's already there or the cache is full
+===============
+*/
+static visCacheEntry_t *SV_ReserveVisCacheEntry( int cluster, int area ) {
+	int				*slot;
+	visCacheEntry_t	*entry;
+
+	if ( svVisCache.numEntries == MAX_VIS_CACHE ) {
+		return NULL;
+	}
+
+	slot = SV_VisCacheSlot( cluster, area );
+	if ( *slot ) {
+		return NULL;
+	}
+
+	entry = &svVisCache.entries[svVisCache.numEntries++];
+	entry->cluster = cluster;
+	entry->area = area;
+	entry->numEntities = 0;
+	*slot = svVisCache.numEntries;
+
+	return entry;
+}
+
+/*
+===============
+SV_FindVisCacheEntry
+
+Builds and stores a missing entry if allowed, else builds it into scratch
+===============
+*/
+static const visCacheEntry_t *SV_FindVisCacheEntry( int cluster, int area, visCacheEntry_t *scratch ) {
+	int				*slot;
+	visCacheEntry_t	*entry;
+
+	slot = SV_VisCacheSlot( cluster, area );
+	if ( *slot ) {
+		return &svVisCache.entries[*slot - 1];
+	}
+
+	entry = NULL;
+	if ( !svVisCache.locked ) {
+		entry = SV_ReserveVisCacheEntry( cluster, area );
+	}
+	if ( !entry ) {
+		entry = scratch;
+		entry->cluster = cluster;
+		entry->area = area;
+	}
+
+	SV_BuildVisCacheEntry( entry );
+	return entry;
+}
+
 /*
 ===============
 SV_AddEntitiesVisibleFromPoint
@@ -363,16 +959,17 @@ SV_AddEntitiesVisibleFromPoint
 float g_svCullDist = -1.0f;
 static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
 									snapshotEntityNumbers_t *eNums, qboolean portal ) {
-	int		e, i;
+	int		e, i, p;
 	sharedEntity_t *ent;
 	svEntity_t	*svEnt;
-	int		l;
 	int		clientarea, clientcluster;
 	int		leafnum;
 	byte	*clientpvs;
-	byte	*bitvector;
 	vec3_t	difference;
 	float	length, radius;
+	qboolean	pvsChecked;
+	const visCacheEntry_t	*vis;
+	visCacheEntry_t			scratch;
 
 	// during an error shutdown message we may need to transmit
 	// the shutdown message after the server has shutdown, so
@@ -390,28 +987,22 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 	clientpvs = CM_ClusterPVS (clientcluster);
 
-	for ( e = 0 ; e < sv.num_entities ; e++ ) {
-		ent = SV_GentityNum(e);
-
-		// never send entities that aren't linked in
-		if ( !ent->r.linked ) {
-			continue;
-		}
-
-		if (ent->s.eFlags & EF_PERMANENT)
-		{	// he's permanent, so don't send him down!
-			continue;
-		}
-
-		if (ent->s.number != e) {
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
+	vis = SV_FindVisCacheEntry( clientcluster, clientarea, &scratch );
 
-		// entities can be flagged to explicitly not be sent to the client
-		if ( ent->r.svFlags & SVF_NOCLIENT ) {
-			continue;
+	// walk the entities that passed the PVS already and the per-client ones
+	// together, so they are still considered in entity order
+	i = p = 0;
+	while ( i < vis->numEntities || p < svVisCache.numPerClient ) {
+		if ( p == svVisCache.numPerClient
+			|| ( i < vis->numEntities && vis->entities[i] < svVisCache.perClient[p] ) )
+		{
+			e = vis->entities[i++];
+			pvsChecked = qtrue;
+		} else {
+			e = svVisCache.perClient[p++];
+			pvsChecked = qfalse;
 		}
+		ent = SV_GentityNum(e);
 
 		// entities can be flagged to be sent to only one client
 		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
@@ -426,10 +1017,10 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			}
 		}
 
-		svEnt = SV_SvEntityForGentity( ent );
+		svEnt = &sv.svEntities[e];
 
 		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+		if ( eNums->added[e >> 3] & (1 << (e & 7)) ) {
 			continue;
 		}
 
@@ -439,57 +1030,23 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 		{
 			continue;
 		}
-		// broadcast entities are always sent, and so is the main player so we don't see noclip weirdness
-		if ( (ent->r.svFlags & SVF_BROADCAST) || e == frame->ps.clientNum
-			|| (ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
-		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
-		}
-
-		if (ent->s.isPortalEnt)
-		{ //rww - portal entities are always sent as well
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
-		}
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
-				continue;		// blocked by a door
+		if ( !pvsChecked ) {
+			// broadcast entities are always sent, and so is the main player so we don't see noclip weirdness
+			if ( (ent->r.svFlags & SVF_BROADCAST) || e == frame->ps.clientNum
+				|| (ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
+			{
+				SV_AddEntToSnapshot( ent, eNums );
+				continue;
 			}
-		}
-
-		bitvector = clientpvs;
 
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
-			continue;
-		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-				break;
+			if (ent->s.isPortalEnt)
+			{ //rww - portal entities are always sent as well
+				SV_AddEntToSnapshot( ent, eNums );
+				continue;
 			}
-		}
 
-		// if we haven't found it to be visible,
-		// check overflow clusters that coudln't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
-				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
-				}
-			} else {
+			if ( !SV_EntityVisibleFromCluster( svEnt, clientarea, clientpvs ) ) {
 				continue;
 			}
 		}
@@ -511,7 +1068,7 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 		}
 
 		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+		SV_AddEntToSnapshot( ent, eNums );
 
 		// if its a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL ) {
@@ -529,7 +1086,21 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 
 /*
 =============
-SV_BuildClientSnapshot
+SV_SnapshotViewOrigin
+
+Where the client's snapshot is seen from
+=============
+*/
+static void SV_SnapshotViewOrigin( client_t *client, vec3_t org ) {
+	playerState_t *ps = SV_GameClientNum( client - svs.clients );
+
+	VectorCopy( ps->origin, org );
+	org[2] += ps->viewheight;
+}
+
+/*
+=============
+SV_BuildClientSnapshotEntities
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstate and areabits.
@@ -538,34 +1109,32 @@ This properly handles multiple recursive portals, but the render
 currently doesn't.
 
 For viewing through other player's eyes, client can be something other than client->gentity
+
+Only the client's own frame and entityNumbers are written, so this can
+run for several clients at once.  Returns qfalse if there is nothing to
+view from, in which case the frame is left empty.
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static qboolean SV_BuildClientSnapshotEntities( client_t *client, snapshotEntityNumbers_t *entityNumbers ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
 	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
 	sharedEntity_t				*clent;
 	playerState_t				*ps;
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	entityNumbers->numSnapshotEntities = 0;
+	Com_Memset( entityNumbers->added, 0, sizeof( entityNumbers->added ) );
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
 	frame->num_entities = 0;
 
 	clent = client->gentity;
 	if ( !clent || client->state == CS_ZOMBIE ) {
-		return;
+		return qfalse;
 	}
 
 	// grab the current playerState_t
@@ -599,24 +1168,22 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
 		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
 	}
-	svEnt = &sv.svEntities[ clientNum ];
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	entityNumbers->added[clientNum >> 3] |= 1 << (clientNum & 7);
 
 
 	// find the client's viewpoint
-	VectorCopy( ps->origin, org );
-	org[2] += ps->viewheight;
+	SV_SnapshotViewOrigin( client, org );
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	SV_AddEntitiesVisibleFromPoint( org, frame, entityNumbers, qfalse );
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities,
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities,
+		sizeof( entityNumbers->snapshotEntities[0] ), SV_QsortEntityNumbers );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
@@ -624,13 +1191,31 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
 
+	return qtrue;
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Copies the entity states picked by SV_BuildClientSnapshotEntities out to
+the svs.snapshotEntities ring.  This must be done for one client at a time
+and in client order, so the ring never depends on how builds were scheduled.
+=============
+*/
+static void SV_StoreSnapshotEntities( clientSnapshot_t *frame, const snapshotEntityNumbers_t *entityNumbers ) {
+	int							i;
+	sharedEntity_t				*ent;
+	entityState_t				*state;
+
 	// copy the entity states out
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		ent = SV_GentityNum(entityNumbers->snapshotEntities[i]);
 		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*state = ent->s;
+		SV_TagSnapshotEntity( svs.nextSnapshotEntities % svs.numSnapshotEntities, state->number );
 		svs.nextSnapshotEntities++;
 		// this should never hit, map should always be restarted first in SV_Frame
 		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
@@ -640,6 +1225,21 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	}
 }
 
+/*
+=============
+SV_BuildClientSnapshot
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client ) {
+	snapshotEntityNumbers_t		entityNumbers;
+
+	SV_PrepareVisCache();
+
+	if ( SV_BuildClientSnapshotEntities( client, &entityNumbers ) ) {
+		SV_StoreSnapshotEntities( &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ], &entityNumbers );
+	}
+}
+
 
 /*
 ====================
@@ -762,62 +1362,64 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 /*
 =======================
-SV_SendClientSnapshot
-
-Also called by SV_FinalMessage
+SV_SendClientGamedir
 
+rww - if the client hasn't been sent the gamedir yet then make sure there
+is an svc_setgame sent before its next snapshot
 =======================
 */
-extern cvar_t	*fs_gamedirvar;
-void SV_SendClientSnapshot( client_t *client ) {
+static void SV_SendClientGamedir( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	int			i = 0;
 
-	if (!client->sentGamedir)
-	{ //rww - if this is the case then make sure there is an svc_setgame sent before this snap
-		int i = 0;
-
-		MSG_Init (&msg, msg_buf, sizeof(msg_buf));
+	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 
-		//have to include this for each message.
-		MSG_WriteLong( &msg, client->lastClientCommand );
+	//have to include this for each message.
+	MSG_WriteLong( &msg, client->lastClientCommand );
 
-		MSG_WriteByte (&msg, svc_setgame);
+	MSG_WriteByte (&msg, svc_setgame);
 
-		const char *gamedir = FS_GetCurrentGameDir(true);
+	const char *gamedir = FS_GetCurrentGameDir(true);
 
-		while (gamedir[i])
-		{
-			MSG_WriteByte(&msg, gamedir[i]);
-			i++;
-		}
-		MSG_WriteByte(&msg, 0);
+	while (gamedir[i])
+	{
+		MSG_WriteByte(&msg, gamedir[i]);
+		i++;
+	}
+	MSG_WriteByte(&msg, 0);
 
-		// MW - my attempt to fix illegible server message errors caused by
-		// packet fragmentation of initial snapshot.
-		//rww - reusing this code here
-		while(client->state&&client->netchan.unsentFragments)
-		{
-			// send additional message fragments if the last message
-			// was too large to send at once
-			Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
-			SV_Netchan_TransmitNextFragment(&client->netchan);
-		}
+	// MW - my attempt to fix illegible server message errors caused by
+	// packet fragmentation of initial snapshot.
+	//rww - reusing this code here
+	while(client->state&&client->netchan.unsentFragments)
+	{
+		// send additional message fragments if the last message
+		// was too large to send at once
+		Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
+		SV_Netchan_TransmitNextFragment(&client->netchan);
+	}
 
-		// record information about the message
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg.cursize;
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
+	// record information about the message
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg.cursize;
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
 
-		// send the datagram
-		SV_Netchan_Transmit( client, &msg );	//msg->cursize, msg->data );
+	// send the datagram
+	SV_Netchan_Transmit( client, &msg );	//msg->cursize, msg->data );
 
-		client->sentGamedir = qtrue;
-	}
+	client->sentGamedir = qtrue;
+}
 
-	// build the snapshot
-	SV_BuildClientSnapshot( client );
+/*
+=======================
+SV_SnapshotNeedsMessage
 
+Starts auto demos if needed and returns qfalse if the freshly built snapshot
+doesn't have to be encoded at all
+=======================
+*/
+static qboolean SV_SnapshotNeedsMessage( client_t *client ) {
 	if ( sv_autoDemo->integer && !client->demo.demorecording ) {
 		if ( client->netchan.remoteAddress.type != NA_BOT || sv_autoDemoBots->integer ) {
 			SV_BeginAutoRecordDemos();
@@ -827,35 +1429,269 @@ void SV_SendClientSnapshot( client_t *client ) {
 	// bots need to have their snapshots built, but
 	// they query them directly without needing to be sent
 	if ( client->netchan.remoteAddress.type == NA_BOT && !client->demo.demorecording ) {
-		return;
+		return qfalse;
 	}
 
-	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = qtrue;
+	return qtrue;
+}
+
+/*
+=======================
+SV_WriteClientMessage
 
+Everything but the download data, which reads files and stays on the main thread
+=======================
+*/
+static void SV_WriteClientMessage( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
 	// NOTE, MRE: all server->client messages now acknowledge
 	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	MSG_WriteLong( msg, client->lastClientCommand );
 
 	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_UpdateServerCommandsToClient( client, msg );
 
 	// send over all the relevant entityState_t
 	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	SV_WriteSnapshotToClient( client, oldframe, lastframe, msg );
+}
 
+/*
+=======================
+SV_FinishClientMessage
+=======================
+*/
+static void SV_FinishClientMessage( client_t *client, msg_t *msg ) {
 	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+	SV_WriteDownloadToClient( client, msg );
 
 	// check for overflow
-	if ( msg.overflowed ) {
+	if ( msg->overflowed ) {
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+		MSG_Clear (msg);
+	}
+
+	SV_SendMessageToClient( msg, client );
+}
+
+// com_speeds breakdown of SV_SendClientMessages
+typedef enum {
+	SNAPTIME_BUILD,
+	SNAPTIME_ENCODE,
+	SNAPTIME_SEND,
+	SNAPTIME_MAX
+} snapshotTime_t;
+
+static int64_t	svSnapshotTimes[SNAPTIME_MAX];
+static int64_t	svSnapshotMark;
+
+/*
+=======================
+SV_SnapshotTime
+
+Charges the time since the last mark to the given phase, or only sets the mark for SNAPTIME_MAX
+=======================
+*/
+static void SV_SnapshotTime( snapshotTime_t phase ) {
+	int64_t now;
+
+	if ( !com_speeds->integer ) {
+		return;
+	}
+
+	now = Sys_Microseconds();
+	if ( phase != SNAPTIME_MAX ) {
+		svSnapshotTimes[phase] += now - svSnapshotMark;
+	}
+	svSnapshotMark = now;
+}
+
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalMessage
+
+=======================
+*/
+extern cvar_t	*fs_gamedirvar;
+void SV_SendClientSnapshot( client_t *client ) {
+	byte				msg_buf[MAX_MSGLEN];
+	msg_t				msg;
+	clientSnapshot_t	*oldframe;
+	int					lastframe;
+
+	if (!client->sentGamedir)
+	{
+		SV_SendClientGamedir( client );
+	}
+
+	SV_SnapshotTime( SNAPTIME_MAX );
+
+	// build the snapshot
+	SV_BuildClientSnapshot( client );
+
+	if ( !SV_SnapshotNeedsMessage( client ) ) {
+		SV_SnapshotTime( SNAPTIME_BUILD );
+		return;
+	}
+
+	oldframe = SV_SnapshotDeltaFrame( client, &lastframe );
+	SV_SnapshotTime( SNAPTIME_BUILD );
+
+	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
+	msg.allowoverflow = qtrue;
+
+	SV_WriteClientMessage( client, oldframe, lastframe, &msg );
+	SV_SnapshotTime( SNAPTIME_ENCODE );
+
+	SV_FinishClientMessage( client, &msg );
+	SV_SnapshotTime( SNAPTIME_SEND );
+}
+
+/*
+=============================================================================
+
+Threaded snapshots
+
+With sv_snapshotThreads > 1 the clients that are due a snapshot this frame
+are collected first, then the entity culling and the delta encoding are each
+fanned out over the job pool.  Everything that touches shared state (the
+snapshot entity ring, demos, the network and the console) runs on the main
+thread in client order between the two parallel passes.  All the entity
+stores happen before any encode, so a lagging client may fall back to a
+full snapshot slightly sooner than on the serial path; otherwise the bytes
+that go out are the same.
+
+=============================================================================
+*/
+
+typedef struct snapshotJob_s {
+	client_t				*client;
+	qboolean				built;
+	qboolean				encode;
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
+	snapshotEntityNumbers_t	entityNumbers;
+	msg_t					msg;
+	byte					msgBuf[MAX_MSGLEN];	// kept per client, the ordered send needs them all at once
+} snapshotJob_t;
+
+static snapshotJob_t	*svSnapshotJobs;
+static int				svNumSnapshotJobSlots;
+
+/*
+=======================
+SV_FreeSnapshotJobs
+=======================
+*/
+void SV_FreeSnapshotJobs( void ) {
+	if ( svSnapshotJobs ) {
+		Z_Free( svSnapshotJobs );
+		svSnapshotJobs = NULL;
+	}
+	svNumSnapshotJobSlots = 0;
+
+	SV_FreeDeltaCache();
+}
+
+static void SV_BuildSnapshotJob( void *data, int index, int threadNum ) {
+	snapshotJob_t *job = (snapshotJob_t *)data + index;
+
+	job->built = SV_BuildClientSnapshotEntities( job->client, &job->entityNumbers );
+}
+
+static void SV_EncodeSnapshotJob( void *data, int index, int threadNum ) {
+	snapshotJob_t *job = (snapshotJob_t *)data + index;
+
+	if ( !job->encode ) {
+		return;
+	}
+
+	MSG_Init( &job->msg, job->msgBuf, sizeof( job->msgBuf ) );
+	job->msg.allowoverflow = qtrue;
+
+	SV_WriteClientMessage( job->client, job->oldframe, job->lastframe, &job->msg );
+}
+
+static void SV_BuildVisCacheJob( void *data, int index, int threadNum ) {
+	SV_BuildVisCacheEntry( (visCacheEntry_t *)data + index );
+}
+
+/*
+=======================
+SV_PrebuildVisCache
+
+Fills in the visibility cache for every viewpoint the jobs will need, so the
+parallel culling only ever reads it
+=======================
+*/
+static void SV_PrebuildVisCache( int numJobs, int numThreads ) {
+	snapshotJob_t	*job;
+	vec3_t			org;
+	int				i, leafnum, first;
+
+	SV_PrepareVisCache();
+
+	first = svVisCache.numEntries;
+	for ( i = 0, job = svSnapshotJobs ; i < numJobs ; i++, job++ ) {
+		if ( !job->client->gentity || job->client->state == CS_ZOMBIE ) {
+			continue;
+		}
+
+		SV_SnapshotViewOrigin( job->client, org );
+		leafnum = CM_PointLeafnum( org );
+		SV_ReserveVisCacheEntry( CM_LeafCluster( leafnum ), CM_LeafArea( leafnum ) );
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	Job_ParallelFor( svVisCache.numEntries - first, numThreads, SV_BuildVisCacheJob, &svVisCache.entries[first] );
 }
 
+/*
+=======================
+SV_SendSnapshotJobs
+=======================
+*/
+static void SV_SendSnapshotJobs( int numJobs, int numThreads ) {
+	snapshotJob_t	*job;
+	int				i;
+
+	SV_SnapshotTime( SNAPTIME_MAX );
+
+	SV_PrebuildVisCache( numJobs, numThreads );
+
+	// portal views still miss, those are culled without storing them
+	svVisCache.locked = qtrue;
+	Job_ParallelFor( numJobs, numThreads, SV_BuildSnapshotJob, svSnapshotJobs );
+	svVisCache.locked = qfalse;
+
+	// the ring and demo state are shared, walk the clients in order
+	for ( i = 0, job = svSnapshotJobs ; i < numJobs ; i++, job++ ) {
+		if ( job->built ) {
+			SV_StoreSnapshotEntities( &job->client->frames[ job->client->netchan.outgoingSequence & PACKET_MASK ], &job->entityNumbers );
+		}
+	}
+
+	// the encodes only run once every client has stored, so the delta bases
+	// have to be checked against the final ring position, not the one each
+	// client saw right after its own store
+	for ( i = 0, job = svSnapshotJobs ; i < numJobs ; i++, job++ ) {
+		job->encode = SV_SnapshotNeedsMessage( job->client );
+		if ( job->encode ) {
+			job->oldframe = SV_SnapshotDeltaFrame( job->client, &job->lastframe );
+		}
+	}
+	SV_SnapshotTime( SNAPTIME_BUILD );
+
+	Job_ParallelFor( numJobs, numThreads, SV_EncodeSnapshotJob, svSnapshotJobs );
+	SV_SnapshotTime( SNAPTIME_ENCODE );
+
+	for ( i = 0, job = svSnapshotJobs ; i < numJobs ; i++, job++ ) {
+		if ( job->encode ) {
+			SV_FinishClientMessage( job->client, &job->msg );
+		}
+	}
+	SV_SnapshotTime( SNAPTIME_SEND );
+}
 
 /*
 =======================
@@ -865,6 +1701,25 @@ SV_SendClientMessages
 void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
+	int			numThreads;
+	int			numJobs = 0;
+	int			numSnapshots = 0;
+
+	numThreads = Job_NumThreads( sv_snapshotThreads->integer );
+	if ( numThreads > 1 && svNumSnapshotJobSlots != sv_maxclients->integer ) {
+		SV_FreeSnapshotJobs();
+		svSnapshotJobs = (snapshotJob_t *)Z_Malloc( sizeof( snapshotJob_t ) * sv_maxclients->integer, TAG_CLIENTS, qfalse );
+		svNumSnapshotJobSlots = sv_maxclients->integer;
+	}
+
+	Com_Memset( svSnapshotTimes, 0, sizeof( svSnapshotTimes ) );
+
+	// the game has moved things since the last pass
+	SV_InvalidateVisCache();
+	SV_BeginDeltaCache();
+
+	// everything sent from here on goes out together
+	NET_BeginSendBatch();
 
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
@@ -885,8 +1740,35 @@ void SV_SendClientMessages( void ) {
 			continue;
 		}
 
+		numSnapshots++;
+
+		if ( numThreads > 1 ) {
+			// everything ahead of the snapshot itself still goes out right away
+			if ( !c->sentGamedir ) {
+				SV_SendClientGamedir( c );
+			}
+			svSnapshotJobs[numJobs++].client = c;
+			continue;
+		}
+
 		// generate and send a new message
 		SV_SendClientSnapshot( c );
 	}
-}
 
+	if ( numJobs ) {
+		SV_SendSnapshotJobs( numJobs, numThreads );
+	}
+
+	NET_FlushSendBatch();
+
+	// anything sent outside of this pass has to look at the entities again
+	SV_InvalidateVisCache();
+	SV_EndDeltaCache();
+
+	if ( com_speeds->integer && numSnapshots ) {
+		Com_Printf( "snapshots:%3i threads:%2i build:%6i encode:%6i send:%6i usec deltas:%5i/%5i cached\n",
+			numSnapshots, numThreads, (int)svSnapshotTimes[SNAPTIME_BUILD],
+			(int)svSnapshotTimes[SNAPTIME_ENCODE], (int)svSnapshotTimes[SNAPTIME_SEND],
+			svDeltaCache.hits.load(), svDeltaCache.lookups.load() );
+	}
+}
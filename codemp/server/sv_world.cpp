@@ -52,116 +52,102 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 
 
 
-/*
-===============================================================================
-
-ENTITY CHECKING
+// entities by PVS cluster, so snapshots only look at what can be seen
+svClusterLink_t	**sv_clusterEntities;
+int			sv_numClusters;
 
-To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+/*
+===============
+SV_ClearWorld
 
-===============================================================================
+===============
 */
+void SV_ClearWorld( void ) {
+	clipHandle_t	h;
+	vec3_t			mins, maxs;
 
-typedef struct worldSector_s {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct worldSector_s	*children[2];
-	svEntity_t	*entities;
-} worldSector_t;
-
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+	// lives as long as the collision map's PVS data
+	sv_numClusters = CM_NumClusters();
+	sv_clusterEntities = (svClusterLink_t **)Hunk_Alloc( sv_numClusters * sizeof( *sv_clusterEntities ), h_high );
 
-worldSector_t	sv_worldSectors[AREA_NODES];
-int			sv_numworldSectors;
+	// get world map bounds
+	h = CM_InlineModel( 0 );
+	CM_ModelBounds( h, mins, maxs );
+	SV_BroadphaseInit( mins, maxs );
+}
 
 
 /*
 ===============
-SV_SectorList_f
+SV_ClusterEntities
 ===============
 */
-void SV_SectorList_f( void ) {
-	int				i, c;
-	worldSector_t	*sec;
-	svEntity_t		*ent;
-
-	for ( i = 0 ; i < AREA_NODES ; i++ ) {
-		sec = &sv_worldSectors[i];
-
-		c = 0;
-		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
-			c++;
-		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+svClusterLink_t *SV_ClusterEntities( int cluster ) {
+	if ( cluster < 0 || cluster >= sv_numClusters ) {
+		return NULL;
 	}
+	return sv_clusterEntities[cluster];
 }
 
 /*
 ===============
-SV_CreateworldSector
+SV_LinkClusters
 
-Builds a uniformly subdivided tree for the given world size
+Chains the entity into the lists of its explicit clusters
 ===============
 */
-worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs ) {
-	worldSector_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
-
-	anode = &sv_worldSectors[sv_numworldSectors];
-	sv_numworldSectors++;
-
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
-	}
-
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1]) {
-		anode->axis = 0;
-	} else {
-		anode->axis = 1;
-	}
-
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
-
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+static void SV_LinkClusters( svEntity_t *ent ) {
+	svClusterLink_t	*link, **head;
+	int				i, j, cluster;
+
+	ent->numClusterLinks = 0;
+	for ( i = 0 ; i < ent->numClusters ; i++ ) {
+		cluster = ent->clusternums[i];
+		if ( cluster < 0 || cluster >= sv_numClusters ) {
+			continue;
+		}
 
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+		// several leafs can share a cluster
+		for ( j = 0 ; j < i ; j++ ) {
+			if ( ent->clusternums[j] == cluster ) {
+				break;
+			}
+		}
+		if ( j != i ) {
+			continue;
+		}
 
-	return anode;
+		head = &sv_clusterEntities[cluster];
+		link = &ent->clusterLinks[ent->numClusterLinks++];
+		link->entityNum = ent - sv.svEntities;
+		link->next = *head;
+		link->prevNext = head;
+		if ( *head ) {
+			(*head)->prevNext = &link->next;
+		}
+		*head = link;
+	}
 }
 
 /*
 ===============
-SV_ClearWorld
-
+SV_UnlinkClusters
 ===============
 */
-void SV_ClearWorld( void ) {
-	clipHandle_t	h;
-	vec3_t			mins, maxs;
-
-	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
-	sv_numworldSectors = 0;
-
-	// get world map bounds
-	h = CM_InlineModel( 0 );
-	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+static void SV_UnlinkClusters( svEntity_t *ent ) {
+	svClusterLink_t	*link;
+	int				i;
+
+	for ( i = 0 ; i < ent->numClusterLinks ; i++ ) {
+		link = &ent->clusterLinks[i];
+		*link->prevNext = link->next;
+		if ( link->next ) {
+			link->next->prevNext = link->prevNext;
+		}
+	}
+	ent->numClusterLinks = 0;
 }
 
-
 /*
 ===============
 SV_UnlinkEntity
@@ -170,35 +156,16 @@ SV_UnlinkEntity
 */
 void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
-	svEntity_t		*scan;
-	worldSector_t	*ws;
 
 	ent = SV_SvEntityForGentity( gEnt );
 
 	gEnt->r.linked = qfalse;
 
-	ws = ent->worldSector;
-	if ( !ws ) {
-		return;		// not linked in anywhere
-	}
-	ent->worldSector = NULL;
-
-	if ( ws->entities == ent ) {
-		ws->entities = ent->nextEntityInWorldSector;
-		return;
-	}
-
-	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
-		if ( scan->nextEntityInWorldSector == ent ) {
-			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
-			return;
-		}
-	}
+	SV_UnlinkClusters( ent );
 
-	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
+	SV_BroadphaseUnlink( ent - sv.svEntities );
 }
 
-
 /*
 ===============
 SV_LinkEntity
@@ -207,7 +174,6 @@ SV_LinkEntity
 */
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEntity( sharedEntity_t *gEnt ) {
-	worldSector_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
 	int			num_leafs;
@@ -219,8 +185,10 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
+	if ( SV_BroadphaseContains( ent - sv.svEntities ) ) {
+		// unlink from old position, the broadphase moves it below
+		gEnt->r.linked = qfalse;
+		SV_UnlinkClusters( ent );
 	}
 
 	// encode the size into the entityState_t for client prediction
@@ -302,6 +270,7 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// if none of the leafs were inside the map, the
 	// entity is outside the world and can be considered unlinked
 	if ( !num_leafs ) {
+		SV_BroadphaseUnlink( ent - sv.svEntities );
 		return;
 	}
 
@@ -343,109 +312,24 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linkcount++;
 
-	// find the first world sector node that the ent's box crosses
-	node = sv_worldSectors;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if ( gEnt->r.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if ( gEnt->r.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
+	SV_LinkClusters( ent );
 
 	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
+	SV_BroadphaseLink( ent - sv.svEntities, gEnt->r.absmin, gEnt->r.absmax );
 
 	gEnt->r.linked = qtrue;
 }
 
 /*
-============================================================================
-
-AREA QUERY
+================
+SV_AreaEntities
 
 Fills in a list of all entities who's absmin / absmax intersects the given
 bounds.  This does NOT mean that they actually touch in the case of bmodels.
-============================================================================
-*/
-
-typedef struct areaParms_s {
-	const float	*mins;
-	const float	*maxs;
-	int			*list;
-	int			count, maxcount;
-} areaParms_t;
-
-
-/*
-====================
-SV_AreaEntities_r
-
-====================
-*/
-void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
-	svEntity_t	*check, *next;
-	sharedEntity_t *gcheck;
-
-	for ( check = node->entities  ; check ; check = next ) {
-		next = check->nextEntityInWorldSector;
-
-		gcheck = SV_GEntityForSvEntity( check );
-
-		if ( gcheck->r.absmin[0] > ap->maxs[0]
-		|| gcheck->r.absmin[1] > ap->maxs[1]
-		|| gcheck->r.absmin[2] > ap->maxs[2]
-		|| gcheck->r.absmax[0] < ap->mins[0]
-		|| gcheck->r.absmax[1] < ap->mins[1]
-		|| gcheck->r.absmax[2] < ap->mins[2]) {
-			continue;
-		}
-
-		if ( ap->count == ap->maxcount ) {
-			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
-			return;
-		}
-
-		ap->list[ap->count] = check - sv.svEntities;
-		ap->count++;
-	}
-
-	if (node->axis == -1) {
-		return;		// terminal node
-	}
-
-	// recurse down both sides
-	if ( ap->maxs[node->axis] > node->dist ) {
-		SV_AreaEntities_r ( node->children[0], ap );
-	}
-	if ( ap->mins[node->axis] < node->dist ) {
-		SV_AreaEntities_r ( node->children[1], ap );
-	}
-}
-
-/*
-================
-SV_AreaEntities
 ================
 */
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
-	areaParms_t		ap;
-
-	ap.mins = mins;
-	ap.maxs = maxs;
-	ap.list = entityList;
-	ap.count = 0;
-	ap.maxcount = maxcount;
-
-	SV_AreaEntities_r( sv_worldSectors, &ap );
-
-	return ap.count;
+	return SV_BroadphaseQuery( mins, maxs, entityList, maxcount );
 }
 
 
@@ -535,9 +419,8 @@ static float VectorDistance(vec3_t p1, vec3_t p2)
 }
 #endif
 
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	static int	touchlist[MAX_GENTITIES];
-	int			i, num;
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace, oldTrace= {0};
@@ -545,8 +428,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 	float		*origin, *angles;
 	int			thisOwnerShared = 1;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -804,6 +685,72 @@ Ghoul2 Insert End
 	}
 }
 
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	static int	touchlist[MAX_GENTITIES];
+	int			num;
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
+/*
+==================
+SV_StartClipMove
+
+Clips the move to the world, unless world has that done already, and sets up
+the rest of the clip.  Returns qfalse if the world blocks it at the start.
+==================
+*/
+static qboolean SV_StartClipMove( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod, const trace_t *world = NULL ) {
+	int			i;
+
+	Com_Memset ( clip, 0, sizeof ( moveclip_t ) );
+
+	// clip to world
+	if ( world ) {
+		clip->trace = *world;
+	} else {
+		CM_BoxTrace( &clip->trace, start, end, mins, maxs, 0, contentmask, capsule );
+	}
+	clip->trace.entityNum = clip->trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	if ( clip->trace.fraction == 0 ) {
+		return qfalse;		// blocked immediately by the world
+	}
+
+	clip->contentmask = contentmask;
+/*
+Ghoul2 Insert Start
+*/
+	VectorCopy( start, clip->start );
+	clip->traceFlags = traceFlags;
+	clip->useLod = useLod;
+/*
+Ghoul2 Insert End
+*/
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	// create the bounding box of the entire move
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
+		} else {
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
+		}
+	}
+
+	return qtrue;
+}
+
 /*
 ==================
 SV_Trace
@@ -820,7 +767,6 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 Ghoul2 Insert End
 */
 	moveclip_t	clip;
-	int			i;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -829,51 +775,129 @@ Ghoul2 Insert End
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
-
-	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
-	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
-	if ( clip.trace.fraction == 0 ) {
-		*results = clip.trace;
-		return;		// blocked immediately by the world
+	if ( SV_StartClipMove( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule, traceFlags, useLod ) ) {
+		// clip to other solid entities
+		SV_ClipMoveToEntities ( &clip );
 	}
 
-	clip.contentmask = contentmask;
-/*
-Ghoul2 Insert Start
-*/
-	VectorCopy( start, clip.start );
-	clip.traceFlags = traceFlags;
-	clip.useLod = useLod;
+	*results = clip.trace;
+}
+
 /*
-Ghoul2 Insert End
+==================
+SV_TraceBatch
+
+Traces every request the same as SV_Trace would.  Consecutive requests whose
+move boxes overlap share one area query, and each of them only keeps the
+entities its own box touches.  The entities come out in the same order as
+their own query would give, so the results match tracing them one by one.
+
+The world part of the requests is clipped with CM_BoxTraceBatch, spread over
+sv_traceThreads threads.  Clipping against entities can reach Ghoul2
+collision, which isn't thread safe, so that stays on the calling thread.
+All scratch space lives on the stack, nothing is shared between calls.
+==================
 */
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+#define	TRACE_GROUP_SIZE	32
+#define	TRACE_GROUP_GROWTH	2.0f	// how much empty space a shared query may cover
+#define	TRACE_WORLD_CHUNK	64		// requests clipped to the world at a time
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
+static float SV_BoxVolume( const vec3_t mins, const vec3_t maxs ) {
+	return ( maxs[0] - mins[0] ) * ( maxs[1] - mins[1] ) * ( maxs[2] - mins[2] );
+}
+
+static void SV_ClipTraceGroup( moveclip_t *clips, trace_t **results, int numClips, const vec3_t mins, const vec3_t maxs ) {
+	int			grouplist[MAX_GENTITIES];
+	int			touchlist[MAX_GENTITIES];
+	int			i, numGroup, num;
+
+	if ( numClips == 1 ) {
+		num = SV_AreaEntities( clips[0].boxmins, clips[0].boxmaxs, touchlist, MAX_GENTITIES );
+		SV_ClipMoveToEntityList( &clips[0], touchlist, num );
+		*results[0] = clips[0].trace;
+		return;
+	}
+
+	numGroup = SV_AreaEntities( mins, maxs, grouplist, MAX_GENTITIES );
+
+	for ( i = 0 ; i < numClips ; i++ ) {
+		num = SV_BroadphaseFilter( clips[i].boxmins, clips[i].boxmaxs, grouplist, numGroup, touchlist );
+		SV_ClipMoveToEntityList( &clips[i], touchlist, num );
+		*results[i] = clips[i].trace;
+	}
+}
+
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests ) {
+	moveclip_t			clips[TRACE_GROUP_SIZE + 1];	// the spare one starts the next group
+	trace_t				*groupResults[TRACE_GROUP_SIZE];
+	cmBoxTrace_t		world[TRACE_WORLD_CHUNK];
+	moveclip_t			*clip;
+	const traceRequest_t	*req;
+	vec3_t				groupMins, groupMaxs, mins, maxs;
+	float				groupVolume;
+	int					i, j, numClips, numWorld;
+
+	if ( numRequests < 0 || numRequests > MAX_TRACE_BATCH ) {
+		Com_Error( ERR_DROP, "SV_TraceBatch: bad request count %i", numRequests );
+	}
+
+	numClips = 0;
+	groupVolume = 0;
+	for ( i = 0, req = requests ; i < numRequests ; i++, req++ ) {
+		if ( !( i % TRACE_WORLD_CHUNK ) ) {
+			numWorld = Q_min( numRequests - i, TRACE_WORLD_CHUNK );
+			for ( j = 0 ; j < numWorld ; j++ ) {
+				VectorCopy( req[j].start, world[j].start );
+				VectorCopy( req[j].end, world[j].end );
+				VectorCopy( req[j].mins, world[j].mins );
+				VectorCopy( req[j].maxs, world[j].maxs );
+				world[j].model = 0;
+				world[j].brushmask = req[j].contentmask;
+				world[j].capsule = req[j].capsule;
+			}
+			CM_BoxTraceBatch( world, numWorld, sv_traceThreads->integer );
+		}
+
+		clip = &clips[numClips];
+		if ( !SV_StartClipMove( clip, req->start, req->mins, req->maxs, req->end, req->passEntityNum,
+			req->contentmask, req->capsule, req->traceFlags, req->useLod, &world[i % TRACE_WORLD_CHUNK].trace ) ) {
+			results[i] = clip->trace;
+			continue;
+		}
+
+		if ( numClips ) {
+			for ( j = 0 ; j < 3 ; j++ ) {
+				mins[j] = Q_min( groupMins[j], clip->boxmins[j] );
+				maxs[j] = Q_max( groupMaxs[j], clip->boxmaxs[j] );
+			}
+
+			// start a new group if sharing the query would mostly look at empty space
+			if ( numClips == TRACE_GROUP_SIZE
+				|| SV_BoxVolume( mins, maxs ) > TRACE_GROUP_GROWTH * ( groupVolume + SV_BoxVolume( clip->boxmins, clip->boxmaxs ) ) ) {
+				moveclip_t	next = *clip;
+
+				SV_ClipTraceGroup( clips, groupResults, numClips, groupMins, groupMaxs );
+				numClips = 0;
+				clips[0] = next;
+				clip = &clips[0];
+			}
+		}
+
+		if ( !numClips ) {
+			VectorCopy( clip->boxmins, groupMins );
+			VectorCopy( clip->boxmaxs, groupMaxs );
+			groupVolume = SV_BoxVolume( groupMins, groupMaxs );
 		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+			VectorCopy( mins, groupMins );
+			VectorCopy( maxs, groupMaxs );
+			groupVolume = SV_BoxVolume( groupMins, groupMaxs );
 		}
+		groupResults[numClips++] = &results[i];
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
-
-	*results = clip.trace;
+	if ( numClips ) {
+		SV_ClipTraceGroup( clips, groupResults, numClips, groupMins, groupMaxs );
+	}
 }
 
 
@@ -113,6 +113,8 @@ void	Sys_Print( const char *msg );
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (bool baseTime = false);
 int		Sys_Milliseconds2(void);
+// monotonic, microsecond resolution; for profiling breakdowns only
+int64_t	Sys_Microseconds(void);
 void	Sys_Sleep( int msec );
 
 extern "C" void	Sys_SnapVector( float *v );